@@ -0,0 +1,115 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* A bump allocator for short-lived allocations that all end together,
+ * such as the state of one render. Allocating is a pointer increment in
+ * the common case, and freeing is a reset of the whole arena.
+ *
+ * Chunks are kept when the arena is reset (up to kArenaRetain bytes of
+ * them), so an arena that's reused settles down to making no heap
+ * allocations at all. */
+
+#include "common.h"
+#include "arena.h"
+
+#include <stdalign.h>
+
+struct sArenaChunk {
+    struct sArenaChunk * next;
+    size_t               size;    ///< of 'data'
+    size_t               used;
+    alignas( max_align_t ) byte data[];
+};
+
+// ------------------------------------------------------------------------------
+
+static inline size_t alignSize( size_t size )
+{
+    return ( size + alignof( max_align_t ) - 1 ) & ~( alignof( max_align_t ) - 1 );
+}
+
+static tArenaChunk * newChunk( size_t size )
+{
+    tArenaChunk * result = malloc( sizeof( tArenaChunk ) + size );
+
+    if ( result != NULL ) {
+        result->next = NULL;
+        result->size = size;
+        result->used = 0;
+    }
+    return result;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief allocate from an arena. Suitably aligned for any type
+ * @return the memory, or NULL if there isn't enough
+ */
+void * arenaAlloc( tArena * arena, size_t size )
+{
+    void *        result = NULL;
+    tArenaChunk * chunk  = arena->current;
+
+    size = alignSize( size );
+
+    /* move on through the chunks kept from before, until one has room */
+    while ( chunk != NULL && chunk->size - chunk->used < size ) {
+        chunk = chunk->next;
+    }
+
+    if ( chunk == NULL ) {
+        chunk = newChunk( ( size > kArenaChunkSize ) ? size : kArenaChunkSize );
+        if ( chunk != NULL ) {
+            /* append it, so the kept chunks stay in the order they're used */
+            tArenaChunk ** link = &arena->chunks;
+            while ( *link != NULL ) {
+                link = &(*link)->next;
+            }
+            *link = chunk;
+        }
+    }
+
+    if ( chunk != NULL ) {
+        result = &chunk->data[ chunk->used ];
+        chunk->used += size;
+        arena->current = chunk;
+    }
+    return result;
+}
+
+/**
+ * @brief release everything allocated from an arena, keeping some of its chunks for next time
+ */
+void resetArena( tArena * arena )
+{
+    size_t         kept = 0;
+    tArenaChunk ** link = &arena->chunks;
+
+    while ( *link != NULL ) {
+        tArenaChunk * chunk = *link;
+        if ( kept + chunk->size > kArenaRetain ) {
+            *link = chunk->next;
+            free( chunk );
+        } else {
+            kept += chunk->size;
+            chunk->used = 0;
+            link = &chunk->next;
+        }
+    }
+    arena->current = arena->chunks;
+}
+
+/**
+ * @brief release an arena's chunks
+ */
+void freeArena( tArena * arena )
+{
+    while ( arena->chunks != NULL ) {
+        tArenaChunk * chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        free( chunk );
+    }
+    arena->current = NULL;
+}
@@ -0,0 +1,27 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_ARENA_H
+#define TEMPLATEFS_ARENA_H
+
+#include <stddef.h>
+
+#define kArenaChunkSize  (16 * 1024)
+#define kArenaRetain     (256 * 1024)   // most kept for reuse when an arena is reset
+
+typedef struct sArenaChunk tArenaChunk;
+
+/**
+ * @brief a bump allocator. Everything allocated from it is released at once, by resetArena()
+ */
+typedef struct {
+    tArenaChunk *  chunks;     ///< every chunk, in the order they're used
+    tArenaChunk *  current;    ///< the chunk being allocated from
+} tArena;
+
+void * arenaAlloc( tArena * arena, size_t size );
+void   resetArena( tArena * arena );
+void   freeArena( tArena * arena );
+
+#endif //TEMPLATEFS_ARENA_H
@@ -0,0 +1,200 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* Stepping through an array in the KeySet means skipping over every
+ * descendant of each element to reach the next one, which is quadratic for
+ * nested arrays. Instead, each config view indexes its arrays once, when
+ * it's made: the cursors of every array's direct children are recorded in
+ * one contiguous vector, so each step to the next element is O(1).
+ *
+ * Arrays are found by the address of their key, with open addressing. */
+
+#include "common.h"
+#include "arrayIndex.h"
+#include "logStuff.h"
+
+#include <stdint.h>
+
+struct sArrayIndex {
+    tArrayElements *  arrays;       ///< one for each array
+    size_t            arrayCount;
+    elektraCursor *   elements;     ///< every array's elements, one array after another
+    size_t            elementCount;
+    tArrayElements ** slots;        ///< hash table of 'arrays', by key address
+    size_t            slotCount;    ///< always a power of two, at least twice 'arrayCount'
+};
+
+// ------------------------------------------------------------------------------
+
+static inline size_t hashArray( const Key * array, size_t slotCount )
+{
+    uint64_t hash = (uintptr_t)array;
+
+    /* the low bits of an address carry little information */
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdUL;
+    hash ^= hash >> 33;
+
+    return hash & ( slotCount - 1 );
+}
+
+static int appendElement( tArrayIndex * index, size_t * allocated, elektraCursor cursor )
+{
+    int result = 0;
+
+    if ( index->elementCount == *allocated ) {
+        size_t          newSize  = ( *allocated == 0 ) ? 256 : *allocated * 2;
+        elektraCursor * elements = realloc( index->elements, newSize * sizeof( elektraCursor ) );
+        if ( elements == NULL ) {
+            result = -ENOMEM;
+        } else {
+            index->elements = elements;
+            *allocated      = newSize;
+        }
+    }
+    if ( result == 0 ) {
+        index->elements[ index->elementCount++ ] = cursor;
+    }
+    return result;
+}
+
+static int appendArray( tArrayIndex * index, size_t * allocated, const Key * array )
+{
+    int result = 0;
+
+    if ( index->arrayCount == *allocated ) {
+        size_t           newSize = ( *allocated == 0 ) ? 16 : *allocated * 2;
+        tArrayElements * arrays  = realloc( index->arrays, newSize * sizeof( tArrayElements ) );
+        if ( arrays == NULL ) {
+            result = -ENOMEM;
+        } else {
+            index->arrays = arrays;
+            *allocated    = newSize;
+        }
+    }
+    if ( result == 0 ) {
+        tArrayElements * entry = &index->arrays[ index->arrayCount++ ];
+        entry->array    = array;
+        entry->elements = NULL;
+        /* for now, where its elements start in index->elements */
+        entry->count    = index->elementCount;
+    }
+    return result;
+}
+
+/**
+ * @brief hash the arrays, now that 'elements' won't move again
+ */
+static int hashArrays( tArrayIndex * index )
+{
+    int result = 0;
+
+    index->slotCount = 16;
+    while ( index->slotCount < index->arrayCount * 2 ) {
+        index->slotCount *= 2;
+    }
+    index->slots = calloc( index->slotCount, sizeof( tArrayElements * ) );
+    if ( index->slots == NULL ) {
+        result = -ENOMEM;
+    } else {
+        for ( size_t i = 0; i < index->arrayCount; ++i ) {
+            tArrayElements * entry = &index->arrays[ i ];
+            size_t           first = entry->count;
+            size_t           end   = ( i + 1 < index->arrayCount ) ? index->arrays[ i + 1 ].count
+                                                                   : index->elementCount;
+            entry->elements = &index->elements[ first ];
+            entry->count    = end - first;
+
+            size_t slot = hashArray( entry->array, index->slotCount );
+            while ( index->slots[ slot ] != NULL ) {
+                slot = ( slot + 1 ) & ( index->slotCount - 1 );
+            }
+            index->slots[ slot ] = entry;
+        }
+    }
+    return result;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief index the direct children of every key in a KeySet with 'array' metadata
+ * @return the index, or NULL if there isn't enough memory
+ */
+tArrayIndex * buildArrayIndex( KeySet * keySet )
+{
+    int           result            = 0;
+    size_t        arraysAllocated   = 0;
+    size_t        elementsAllocated = 0;
+    tArrayIndex * index             = calloc( 1, sizeof( tArrayIndex ) );
+
+    if ( index == NULL ) {
+        return NULL;
+    }
+
+    elektraCursor size = ksGetSize( keySet );
+    for ( elektraCursor i = 0; i < size && result == 0; ++i ) {
+        Key * array = ksAtCursor( keySet, i );
+
+        if ( keyGetMeta( array, "array" ) != NULL ) {
+            result = appendArray( index, &arraysAllocated, array );
+
+            /* the KeySet is sorted, so its descendants immediately follow it */
+            for ( elektraCursor j = i + 1; j < size && result == 0; ++j ) {
+                Key * key = ksAtCursor( keySet, j );
+                if ( keyIsBelow( array, key ) != 1 ) {
+                    break;
+                }
+                if ( keyIsDirectlyBelow( array, key ) == 1 ) {
+                    result = appendElement( index, &elementsAllocated, j );
+                }
+            }
+        }
+    }
+
+    if ( result == 0 ) {
+        result = hashArrays( index );
+    }
+    if ( result != 0 ) {
+        logError( "unable to index the arrays in the configuration (%d)", result );
+        freeArrayIndex( index );
+        index = NULL;
+    } else {
+        logDebug( "indexed %zu arrays, with %zu elements", index->arrayCount, index->elementCount );
+    }
+
+    return index;
+}
+
+void freeArrayIndex( tArrayIndex * index )
+{
+    if ( index != NULL ) {
+        free( index->slots );
+        free( index->elements );
+        free( index->arrays );
+        free( index );
+    }
+}
+
+/**
+ * @brief find the elements of an array
+ * @param index  may be NULL, in which case nothing is found
+ * @param array  a key in the indexed KeySet
+ * @return its elements, or NULL if it isn't an array (or nothing was indexed)
+ */
+const tArrayElements * findArrayElements( const tArrayIndex * index, const Key * array )
+{
+    const tArrayElements * result = NULL;
+
+    if ( index != NULL && array != NULL ) {
+        size_t slot = hashArray( array, index->slotCount );
+        while ( result == NULL && index->slots[ slot ] != NULL ) {
+            if ( index->slots[ slot ]->array == array ) {
+                result = index->slots[ slot ];
+            }
+            slot = ( slot + 1 ) & ( index->slotCount - 1 );
+        }
+    }
+    return result;
+}
@@ -0,0 +1,30 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_ARRAYINDEX_H
+#define TEMPLATEFS_ARRAYINDEX_H
+
+#include <stddef.h>
+
+#include <elektra.h>
+
+/**
+ * @brief the elements of one array, as cursors into the KeySet, in order
+ */
+typedef struct {
+    const Key *            array;      ///< the key with the 'array' metadata
+    const elektraCursor *  elements;   ///< cursor of each direct child
+    size_t                 count;
+} tArrayElements;
+
+/**
+ * @brief the elements of every array in a KeySet. Only valid for as long as the KeySet is unchanged
+ */
+typedef struct sArrayIndex tArrayIndex;
+
+tArrayIndex *          buildArrayIndex( KeySet * keySet );
+void                   freeArrayIndex( tArrayIndex * index );
+const tArrayElements * findArrayElements( const tArrayIndex * index, const Key * array );
+
+#endif //TEMPLATEFS_ARRAYINDEX_H
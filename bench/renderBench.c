@@ -0,0 +1,448 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* Micro-benchmark of processTemplate() on its own: no mount, and no Elektra database.
+ *
+ * Builds KeySets in memory, in one of a few shapes, snapshots them with
+ * newConfigSnapshot(), and renders a template that reads every key in them
+ * over and over. Reports the time, heap allocations and heap bytes each
+ * render takes, and how much it renders. Allocations are counted by
+ * replacing malloc() and friends in this executable, so they include
+ * libelektra's and mustach's as well as templatefs' own.
+ *
+ * Shapes:
+ *     flat     'keys' keys side by side, each read by a tag
+ *     deep     'depth' sections nested inside each other, with a value at each level
+ *     array    an array of 'elements' elements, each with 'fields' values
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <elektra.h>
+
+#include "common.h"
+#include "configStore.h"
+#include "dependencies.h"
+#include "logStuff.h"
+#include "processTemplate.h"
+
+#define kRenderRoot      "system:/config/render-bench"   // processTemplate() names are relative to system:/config
+#define kRenderRelative  "render-bench"
+
+typedef enum {
+    kShapeFlat,
+    kShapeDeep,
+    kShapeArray,
+    kMaxShape
+} eShape;
+
+static const char * shapeNames[ kMaxShape ] = { "flat", "deep", "array" };
+
+typedef struct {
+    unsigned int  keys;
+    unsigned int  depth;
+    unsigned int  elements;
+    unsigned int  fields;
+    unsigned long renders;
+    unsigned long warmup;
+    bool          dependencies;   ///< have each render record the keys it read, as the render cache does
+    bool          shapes[ kMaxShape ];
+} tRenderOptions;
+
+// ------------------------------------------------------------------------------
+
+/* glibc's own allocator, underneath the counting versions below */
+extern void * __libc_malloc( size_t size );
+extern void * __libc_calloc( size_t count, size_t size );
+extern void * __libc_realloc( void * ptr, size_t size );
+extern void * __libc_memalign( size_t alignment, size_t size );
+extern void   __libc_free( void * ptr );
+
+/* only counted while a render is being timed, and only on the thread doing it */
+static __thread bool          counting;
+static __thread unsigned long allocations;
+static __thread unsigned long allocatedBytes;
+
+static inline void countAllocation( size_t size )
+{
+    if ( counting ) {
+        ++allocations;
+        allocatedBytes += size;
+    }
+}
+
+void * malloc( size_t size )
+{
+    countAllocation( size );
+    return __libc_malloc( size );
+}
+
+void * calloc( size_t count, size_t size )
+{
+    countAllocation( count * size );
+    return __libc_calloc( count, size );
+}
+
+void * realloc( void * ptr, size_t size )
+{
+    countAllocation( size );
+    return __libc_realloc( ptr, size );
+}
+
+void * memalign( size_t alignment, size_t size )
+{
+    countAllocation( size );
+    return __libc_memalign( alignment, size );
+}
+
+void * aligned_alloc( size_t alignment, size_t size )
+{
+    countAllocation( size );
+    return __libc_memalign( alignment, size );
+}
+
+int posix_memalign( void ** ptr, size_t alignment, size_t size )
+{
+    countAllocation( size );
+    *ptr = __libc_memalign( alignment, size );
+    return ( *ptr != NULL ) ? 0 : ENOMEM;
+}
+
+void free( void * ptr )
+{
+    __libc_free( ptr );
+}
+
+// ------------------------------------------------------------------------------
+
+static uint64_t nowNS( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief the base name of an array element, as libelektra writes them: '#0' to '#9', '#_10' to '#_99', ...
+ */
+static void arrayElementName( char * name, size_t size, unsigned int index )
+{
+    char   digits[16];
+    int    length = snprintf( digits, sizeof( digits ), "%u", index );
+    size_t used   = 0;
+
+    name[ used++ ] = '#';
+    for ( int i = 1; i < length && used < size - 1; ++i ) {
+        name[ used++ ] = '_';
+    }
+    snprintf( &name[ used ], size - used, "%s", digits );
+}
+
+static void addKey( KeySet * ks, const char * name, const char * value )
+{
+    ksAppendKey( ks, keyNew( name, KEY_VALUE, value, KEY_END ) );
+}
+
+/**
+ * @brief the configuration for a shape, and a template that reads all of it
+ * @param template  receives the template's text, to be freed by the caller
+ * @return the KeySet, or NULL if out of memory
+ */
+static KeySet * buildShape( const tRenderOptions * options, eShape shape, char ** template, size_t * length )
+{
+    KeySet * ks  = ksNew( 0, KS_END );
+    FILE *   out = open_memstream( template, length );
+    char     name[ 4096 ];
+    char     value[ 64 ];
+
+    if ( ks == NULL || out == NULL ) {
+        if ( out != NULL ) {
+            fclose( out );
+            free( *template );
+        }
+        ksDel( ks );
+        return NULL;
+    }
+
+    addKey( ks, kRenderRoot, "" );
+    snprintf( name, sizeof( name ), "%s/%s", kRenderRoot, shapeNames[ shape ] );
+    addKey( ks, name, "" );
+
+    /* names in tags are one level each, so it's sections that descend */
+    fprintf( out, "{{#%s}}{{#%s}}\n", kRenderRelative, shapeNames[ shape ] );
+
+    switch ( shape ) {
+    case kShapeFlat:
+        for ( unsigned int i = 0; i < options->keys; ++i ) {
+            snprintf( name, sizeof( name ), "%s/flat/k%u", kRenderRoot, i );
+            snprintf( value, sizeof( value ), "value %u", i );
+            addKey( ks, name, value );
+            fprintf( out, "k%u = {{k%u}}\n", i, i );
+        }
+        break;
+
+    case kShapeDeep:
+        {
+            size_t used = snprintf( name, sizeof( name ), "%s/deep", kRenderRoot );
+            for ( unsigned int level = 0; level < options->depth && used < sizeof( name ) - 64; ++level ) {
+                used += snprintf( &name[ used ], sizeof( name ) - used, "/l%u", level );
+                addKey( ks, name, "" );
+
+                char leaf[ sizeof( name ) + 16 ];
+                snprintf( leaf, sizeof( leaf ), "%s/value", name );
+                snprintf( value, sizeof( value ), "level %u", level );
+                addKey( ks, leaf, value );
+
+                fprintf( out, "{{#l%u}}%*s{{value}}\n", level, (int)level, "" );
+            }
+            for ( unsigned int level = options->depth; level-- > 0; ) {
+                fprintf( out, "{{/l%u}}", level );
+            }
+            fputc( '\n', out );
+        }
+        break;
+
+    case kShapeArray:
+        {
+            char last[ 32 ] = "";
+            if ( options->elements > 0 ) {
+                arrayElementName( last, sizeof( last ), options->elements - 1 );
+            }
+            snprintf( name, sizeof( name ), "%s/array/list", kRenderRoot );
+            ksAppendKey( ks, keyNew( name, KEY_META, "array", last, KEY_END ) );
+
+            for ( unsigned int element = 0; element < options->elements; ++element ) {
+                char base[ 32 ];
+                arrayElementName( base, sizeof( base ), element );
+                snprintf( name, sizeof( name ), "%s/array/list/%s", kRenderRoot, base );
+                addKey( ks, name, "" );
+                for ( unsigned int field = 0; field < options->fields; ++field ) {
+                    snprintf( name, sizeof( name ), "%s/array/list/%s/f%u", kRenderRoot, base, field );
+                    snprintf( value, sizeof( value ), "%u.%u", element, field );
+                    addKey( ks, name, value );
+                }
+            }
+
+            fprintf( out, "{{#list}}\n-" );
+            for ( unsigned int field = 0; field < options->fields; ++field ) {
+                fprintf( out, " {{f%u}}", field );
+            }
+            fprintf( out, "\n{{/list}}\n" );
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    fprintf( out, "{{/%s}}{{/%s}}\n", shapeNames[ shape ], kRenderRelative );
+    fclose( out );
+
+    return ks;
+}
+
+/**
+ * @brief processTemplate() only renders from a file, so put the template in an unlinked one
+ * @return the descriptor, or -1 if it couldn't be made
+ */
+static int templateFile( const char * template, size_t length )
+{
+    char path[] = "/tmp/render-bench.XXXXXX";
+    int  result = mkstemp( path );
+
+    if ( result != -1 ) {
+        unlink( path );
+        if ( write( result, template, length ) != (ssize_t)length ) {
+            close( result );
+            result = -1;
+        }
+    }
+    return result;
+}
+
+/**
+ * @return zero if successful, otherwise the render's error
+ */
+static int render( int fd, tConfigSnapshot * snapshot, bool recordDependencies, size_t * size )
+{
+    byte *          buffer       = NULL;
+    tDependencies * dependencies = NULL;
+    int             result       = processTemplate( fd, snapshot, &buffer, size,
+                                                    recordDependencies ? &dependencies : NULL );
+    freeDependencies( dependencies );
+    free( buffer );
+    return result;
+}
+
+static int benchShape( const tRenderOptions * options, eShape shape )
+{
+    int      result   = 0;
+    char *   template = NULL;
+    size_t   length   = 0;
+    KeySet * ks       = buildShape( options, shape, &template, &length );
+
+    if ( ks == NULL ) {
+        fprintf( stderr, "not enough memory for the %s configuration\n", shapeNames[ shape ] );
+        return -ENOMEM;
+    }
+
+    size_t            keys     = ksGetSize( ks );
+    int               fd       = templateFile( template, length );
+    tConfigSnapshot * snapshot = newConfigSnapshot( ks );
+    size_t            rendered = 0;
+
+    if ( fd == -1 || snapshot == NULL ) {
+        fprintf( stderr, "unable to set up the %s render (%s)\n", shapeNames[ shape ], strerror( errno ) );
+        result = -EIO;
+    }
+
+    /* the first few compile the template, make the view, and fill the key memo and the arena */
+    for ( unsigned long i = 0; result == 0 && i < options->warmup; ++i ) {
+        result = render( fd, snapshot, options->dependencies, &rendered );
+    }
+
+    if ( result == 0 ) {
+        allocations    = 0;
+        allocatedBytes = 0;
+
+        uint64_t start = nowNS();
+        counting = true;
+        for ( unsigned long i = 0; result == 0 && i < options->renders; ++i ) {
+            result = render( fd, snapshot, options->dependencies, &rendered );
+        }
+        counting = false;
+        uint64_t elapsed = nowNS() - start;
+
+        if ( result != 0 ) {
+            fprintf( stderr, "rendering the %s template failed (%d)\n", shapeNames[ shape ], result );
+        } else if ( options->renders > 0 ) {
+            double renders = (double)options->renders;
+            printf( "%-8s %10zu %10lu %14.0f %14.2f %14.1f %14zu\n",
+                    shapeNames[ shape ], keys, options->renders,
+                    (double)elapsed / renders,
+                    (double)allocations / renders,
+                    (double)allocatedBytes / renders,
+                    rendered );
+        }
+    }
+
+    releaseConfigSnapshot( snapshot );
+    if ( fd != -1 ) {
+        close( fd );
+    }
+    ksDel( ks );
+    free( template );
+
+    return result;
+}
+
+static void usage( const char * name )
+{
+    printf( "usage: %s [options]\n\n"
+            "    --shapes LIST         any of flat,deep,array (default: all of them)\n"
+            "    --keys N              keys in the flat shape (default: 1000)\n"
+            "    --depth N             levels in the deep shape (default: 32)\n"
+            "    --elements N          elements in the array shape (default: 1000)\n"
+            "    --fields N            values in each element (default: 4)\n"
+            "    --renders N           renders to time (default: 10000)\n"
+            "    --warmup N            renders beforehand, not timed (default: 100)\n"
+            "    --dependencies        record the keys each render reads, as the render cache does\n",
+            name );
+}
+
+static int parseShapes( tRenderOptions * options, const char * list )
+{
+    int    result = 0;
+    char * copy   = strdup( list );
+    char * save   = NULL;
+
+    memset( options->shapes, 0, sizeof( options->shapes ) );
+    for ( char * name = strtok_r( copy, ",", &save ); name != NULL && result == 0; name = strtok_r( NULL, ",", &save ) ) {
+        result = -EINVAL;
+        for ( unsigned int shape = 0; shape < kMaxShape; ++shape ) {
+            if ( strcmp( name, shapeNames[ shape ] ) == 0 ) {
+                options->shapes[ shape ] = true;
+                result = 0;
+            }
+        }
+    }
+    free( copy );
+    return result;
+}
+
+int main( int argc, char * argv[] )
+{
+    int            result  = 0;
+    tRenderOptions options = {
+        .keys     = 1000,
+        .depth    = 32,
+        .elements = 1000,
+        .fields   = 4,
+        .renders  = 10000,
+        .warmup   = 100,
+        .shapes   = { true, true, true }
+    };
+
+    static const struct option longOptions[] = {
+        { "shapes",       required_argument, NULL, 's' },
+        { "keys",         required_argument, NULL, 'k' },
+        { "depth",        required_argument, NULL, 'd' },
+        { "elements",     required_argument, NULL, 'e' },
+        { "fields",       required_argument, NULL, 'f' },
+        { "renders",      required_argument, NULL, 'n' },
+        { "warmup",       required_argument, NULL, 'w' },
+        { "dependencies", no_argument,       NULL, 'r' },
+        { "help",         no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int option;
+    while ( result == 0 && ( option = getopt_long( argc, argv, "s:k:d:e:f:n:w:rh", longOptions, NULL ) ) != -1 ) {
+        switch ( option ) {
+        case 's':
+            if ( parseShapes( &options, optarg ) != 0 ) {
+                fprintf( stderr, "unknown shape in \'%s\'\n", optarg );
+                result = 2;
+            }
+            break;
+        case 'k': options.keys         = strtoul( optarg, NULL, 0 ); break;
+        case 'd': options.depth        = strtoul( optarg, NULL, 0 ); break;
+        case 'e': options.elements     = strtoul( optarg, NULL, 0 ); break;
+        case 'f': options.fields       = strtoul( optarg, NULL, 0 ); break;
+        case 'n': options.renders      = strtoul( optarg, NULL, 0 ); break;
+        case 'w': options.warmup       = strtoul( optarg, NULL, 0 ); break;
+        case 'r': options.dependencies = true; break;
+        case 'h': usage( argv[0] ); return 0;
+        default:  usage( argv[0] ); return 2;
+        }
+    }
+    if ( result != 0 ) {
+        return result;
+    }
+
+    /* only problems are worth hearing about */
+    setLogStuffDestination( kLogFunctions, kLogToTheVoid, kLogNothing );
+    setLogStuffDestination( kLogWarning, kLogToStderr, kLogNormal );
+
+    printf( "%-8s %10s %10s %14s %14s %14s %14s\n",
+            "shape", "keys", "renders", "ns/render", "allocs/render", "bytes/render", "output bytes" );
+    for ( unsigned int shape = 0; shape < kMaxShape; ++shape ) {
+        if ( options.shapes[ shape ] && benchShape( &options, shape ) != 0 ) {
+            result = 1;
+        }
+    }
+
+    return result;
+}
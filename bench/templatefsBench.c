@@ -0,0 +1,740 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* End-to-end benchmark of a mounted templatefs.
+ *
+ * Builds a synthetic tree: plain files underneath the mount (which are
+ * passed through), mustache templates with a given number of tags and of
+ * array sections, and executable templates. Seeds the configuration they
+ * read under kBenchRoot, mounts templatefs over the tree, and then has
+ * several threads stat, open, read and list it for a while. Reports the
+ * throughput and latency percentiles of each kind of operation on each
+ * kind of file.
+ *
+ * Run it once for each variant to be compared, e.g.
+ *
+ *     templatefs-bench --single                  # single-threaded fuse_loop()
+ *     templatefs-bench                           # fuse_loop_mt()
+ *     templatefs-bench --options cachesize=0     # without the render cache
+ *     templatefs-bench --options kernelcache
+ *     templatefs-bench --options lowlevel
+ *
+ * Mounting needs fuse, and seeding the configuration needs write access
+ * to Elektra's system namespace, so it's normally run as root. */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <elektra.h>
+
+extern char ** environ;
+
+#define kBenchRoot        "system:/config/templatefs-bench"
+#define kBenchRelative    "templatefs-bench"    // kBenchRoot, as templates name it
+#define kLatencyBuckets   1024                  // see bucketFor()
+#define kReadChunk        65536
+#define kMountWaitMS      10000
+
+typedef enum {
+    kOpGetattr,
+    kOpOpen,
+    kOpRead,
+    kOpReaddir,
+    kMaxOp
+} eBenchOp;
+
+typedef enum {
+    kKindFile,          ///< passed through to the file underneath the mount
+    kKindTemplate,      ///< rendered from the configuration
+    kKindExecutable,    ///< run
+    kKindDirectory,     ///< the root of the mount, for readdir
+    kMaxKind
+} eFileKind;
+
+static const char * opNames[ kMaxOp ]     = { "getattr", "open", "read", "readdir" };
+static const char * kindNames[ kMaxKind ] = { "file", "template", "executable", "directory" };
+
+typedef struct {
+    const char *  binary;       ///< the templatefs executable
+    char *        dir;          ///< where the tree is built
+    const char *  options;      ///< extra mount options, or NULL
+    bool          single;       ///< pass -s, for the single-threaded loop
+    bool          keep;         ///< leave the tree and the configuration afterwards
+    unsigned int  files;
+    size_t        fileSize;
+    unsigned int  templates;
+    unsigned int  tags;         ///< per template
+    unsigned int  arrays;       ///< array sections per template
+    unsigned int  elements;     ///< per array
+    unsigned int  executables;
+    unsigned int  threads;
+    double        seconds;
+    bool          ops[ kMaxOp ];
+} tBenchOptions;
+
+/**
+ * @brief latencies, bucketed log-linearly: 16 buckets per power of two, so
+ * within about 6%
+ */
+typedef struct {
+    uint64_t  count;
+    uint64_t  errors;
+    uint64_t  buckets[ kLatencyBuckets ];
+} tLatencies;
+
+typedef struct {
+    const tBenchOptions * options;
+    char *                mount;
+    uint64_t              deadline;     ///< CLOCK_MONOTONIC, in ns
+    unsigned int          seed;
+    tLatencies            latencies[ kMaxOp ][ kMaxKind ];
+} tWorker;
+
+// ------------------------------------------------------------------------------
+
+static uint64_t nowNS( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static unsigned int bucketFor( uint64_t ns )
+{
+    unsigned int result = ns;
+
+    if ( ns >= 16 ) {
+        unsigned int exponent = 63 - __builtin_clzll( ns );     // at least 4
+        result = ( exponent - 3 ) * 16 + ( ( ns >> ( exponent - 4 ) ) & 15 );
+    }
+    return ( result < kLatencyBuckets ) ? result : kLatencyBuckets - 1;
+}
+
+/**
+ * @return the middle of a bucket, in ns
+ */
+static double bucketValue( unsigned int bucket )
+{
+    double result = bucket;
+
+    if ( bucket >= 16 ) {
+        unsigned int exponent = bucket / 16 + 3;
+        double       width    = (double)( 1ULL << ( exponent - 4 ) );
+        result = ( 16 + bucket % 16 ) * width + width / 2;
+    }
+    return result;
+}
+
+static double percentile( const tLatencies * latencies, double fraction )
+{
+    double   result = 0;
+    uint64_t rank   = (uint64_t)( fraction * (double)latencies->count );
+    uint64_t seen   = 0;
+
+    for ( unsigned int i = 0; i < kLatencyBuckets; ++i ) {
+        seen += latencies->buckets[ i ];
+        if ( seen > rank ) {
+            result = bucketValue( i );
+            break;
+        }
+    }
+    return result;
+}
+
+static int writeFile( const char * path, const char * text, size_t length, mode_t mode )
+{
+    int result = 0;
+    int fd     = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode );
+
+    if ( fd == -1 || write( fd, text, length ) != (ssize_t)length ) {
+        result = -errno;
+    }
+    if ( fd != -1 ) {
+        close( fd );
+    }
+    return result;
+}
+
+/**
+ * @brief the base name of an array element, as libelektra writes them: '#0' to '#9', '#_10' to '#_99', ...
+ */
+static void arrayElementName( char * name, size_t size, unsigned int index )
+{
+    char   digits[16];
+    int    length = snprintf( digits, sizeof( digits ), "%u", index );
+    size_t used   = 0;
+
+    name[ used++ ] = '#';
+    for ( int i = 1; i < length && used < size - 1; ++i ) {
+        name[ used++ ] = '_';
+    }
+    snprintf( &name[ used ], size - used, "%s", digits );
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief the plain files, templates and executables
+ * @return zero if successful, negative errno if not
+ */
+static int buildTree( const tBenchOptions * options )
+{
+    int    result = 0;
+    char   path[ PATH_MAX ];
+    char * contents = malloc( options->fileSize > 0 ? options->fileSize : 1 );
+
+    if ( contents == NULL ) {
+        return -ENOMEM;
+    }
+    for ( size_t i = 0; i < options->fileSize; ++i ) {
+        contents[ i ] = 'a' + i % 26;
+    }
+
+    snprintf( path, sizeof( path ), "%s/mnt", options->dir );
+    if ( mkdir( path, 0755 ) != 0 && errno != EEXIST ) {
+        result = -errno;
+    }
+    snprintf( path, sizeof( path ), "%s/templates", options->dir );
+    if ( result == 0 && mkdir( path, 0755 ) != 0 && errno != EEXIST ) {
+        result = -errno;
+    }
+
+    for ( unsigned int i = 0; result == 0 && i < options->files; ++i ) {
+        snprintf( path, sizeof( path ), "%s/mnt/file-%u", options->dir, i );
+        result = writeFile( path, contents, options->fileSize, 0644 );
+    }
+
+    for ( unsigned int i = 0; result == 0 && i < options->templates; ++i ) {
+        char * text   = NULL;
+        size_t length = 0;
+        FILE * out    = open_memstream( &text, &length );
+
+        if ( out == NULL ) {
+            result = -errno;
+            break;
+        }
+        /* names in tags are one level each, so it's sections that descend */
+        fprintf( out, "# template %u\n{{#%s}}{{#t%u}}\n", i, kBenchRelative, i );
+        for ( unsigned int tag = 0; tag < options->tags; ++tag ) {
+            fprintf( out, "key%u = {{k%u}}\n", tag, tag );
+        }
+        for ( unsigned int array = 0; array < options->arrays; ++array ) {
+            fprintf( out, "{{#list%u}}\n- {{name}}\n{{/list%u}}\n", array, array );
+        }
+        fprintf( out, "{{/t%u}}{{/%s}}\n", i, kBenchRelative );
+        fclose( out );
+
+        snprintf( path, sizeof( path ), "%s/templates/template-%u.conf", options->dir, i );
+        result = writeFile( path, text, length, 0644 );
+        free( text );
+    }
+
+    static const char script[] = "#!/bin/sh\nprintf 'generated for %s\\n' \"$2\"\n";
+    for ( unsigned int i = 0; result == 0 && i < options->executables; ++i ) {
+        snprintf( path, sizeof( path ), "%s/templates/executable-%u", options->dir, i );
+        result = writeFile( path, script, sizeof( script ) - 1, 0755 );
+    }
+
+    free( contents );
+    return result;
+}
+
+/**
+ * @brief remove what buildTree() made, and nothing else: anything else
+ * already in 'dir' is the user's. So mnt/ and templates/ are only removed
+ * if that leaves them empty, and 'dir' only if this run made it
+ */
+static void removeTree( const tBenchOptions * options, bool madeDir )
+{
+    char path[ PATH_MAX ];
+
+    for ( unsigned int i = 0; i < options->files; ++i ) {
+        snprintf( path, sizeof( path ), "%s/mnt/file-%u", options->dir, i );
+        unlink( path );
+    }
+    for ( unsigned int i = 0; i < options->templates; ++i ) {
+        snprintf( path, sizeof( path ), "%s/templates/template-%u.conf", options->dir, i );
+        unlink( path );
+    }
+    for ( unsigned int i = 0; i < options->executables; ++i ) {
+        snprintf( path, sizeof( path ), "%s/templates/executable-%u", options->dir, i );
+        unlink( path );
+    }
+
+    snprintf( path, sizeof( path ), "%s/mnt", options->dir );
+    rmdir( path );
+    snprintf( path, sizeof( path ), "%s/templates", options->dir );
+    rmdir( path );
+    if ( madeDir ) {
+        rmdir( options->dir );
+    }
+}
+
+/**
+ * @brief replace everything below kBenchRoot with what the templates read, or with nothing
+ * @return zero if successful, negative if not
+ */
+static int seedConfig( const tBenchOptions * options, bool populate )
+{
+    int      result = 0;
+    Key *    parent = keyNew( kBenchRoot, KEY_END );
+    KDB *    kdb    = kdbOpen( NULL, parent );
+    KeySet * ks     = ksNew( 0, KS_END );
+
+    if ( kdb == NULL || kdbGet( kdb, ks, parent ) < 0 ) {
+        result = -1;
+    } else {
+        ksDel( ksCut( ks, parent ) );
+        if ( populate ) {
+            ksAppendKey( ks, keyNew( kBenchRoot, KEY_END ) );
+        }
+
+        for ( unsigned int i = 0; populate && i < options->templates; ++i ) {
+            char name[ 256 ];
+            char value[ 64 ];
+
+            snprintf( name, sizeof( name ), "%s/t%u", kBenchRoot, i );
+            ksAppendKey( ks, keyNew( name, KEY_END ) );
+
+            for ( unsigned int tag = 0; tag < options->tags; ++tag ) {
+                snprintf( name, sizeof( name ), "%s/t%u/k%u", kBenchRoot, i, tag );
+                snprintf( value, sizeof( value ), "value %u.%u", i, tag );
+                ksAppendKey( ks, keyNew( name, KEY_VALUE, value, KEY_END ) );
+            }
+            for ( unsigned int array = 0; array < options->arrays; ++array ) {
+                char last[ 32 ] = "";
+                if ( options->elements > 0 ) {
+                    arrayElementName( last, sizeof( last ), options->elements - 1 );
+                }
+                snprintf( name, sizeof( name ), "%s/t%u/list%u", kBenchRoot, i, array );
+                ksAppendKey( ks, keyNew( name, KEY_META, "array", last, KEY_END ) );
+
+                for ( unsigned int element = 0; element < options->elements; ++element ) {
+                    char base[ 32 ];
+                    arrayElementName( base, sizeof( base ), element );
+                    snprintf( name, sizeof( name ), "%s/t%u/list%u/%s", kBenchRoot, i, array, base );
+                    ksAppendKey( ks, keyNew( name, KEY_END ) );
+                    snprintf( name, sizeof( name ), "%s/t%u/list%u/%s/name", kBenchRoot, i, array, base );
+                    snprintf( value, sizeof( value ), "item %u", element );
+                    ksAppendKey( ks, keyNew( name, KEY_VALUE, value, KEY_END ) );
+                }
+            }
+        }
+
+        if ( kdbSet( kdb, ks, parent ) < 0 ) {
+            result = -1;
+        }
+    }
+
+    ksDel( ks );
+    if ( kdb != NULL ) {
+        kdbClose( kdb, parent );
+    }
+    keyDel( parent );
+
+    return result;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief start templatefs in the foreground, and wait for the mount to appear
+ * @return its pid, or -1 if it couldn't be mounted
+ */
+static pid_t mountTree( const tBenchOptions * options, const char * mount )
+{
+    pid_t       result = -1;
+    char        mountOptions[ PATH_MAX + 1024 ];
+    const char * argv[ 8 ];
+    int         argc = 0;
+    struct stat under;
+
+    snprintf( mountOptions, sizeof( mountOptions ), "templates=%s/templates%s%s",
+              options->dir, options->options != NULL ? "," : "", options->options != NULL ? options->options : "" );
+
+    argv[ argc++ ] = options->binary;
+    argv[ argc++ ] = "-f";
+    if ( options->single ) {
+        argv[ argc++ ] = "-s";
+    }
+    argv[ argc++ ] = "-o";
+    argv[ argc++ ] = mountOptions;
+    argv[ argc++ ] = mount;
+    argv[ argc ]   = NULL;
+
+    if ( stat( mount, &under ) != 0
+      || posix_spawn( &result, options->binary, NULL, NULL, (char * const *)argv, environ ) != 0 ) {
+        fprintf( stderr, "unable to start %s (%s)\n", options->binary, strerror( errno ) );
+        return -1;
+    }
+
+    /* it's mounted once the directory is on a different device */
+    for ( unsigned int waited = 0; waited < kMountWaitMS; waited += 10 ) {
+        struct stat st;
+        int         status;
+
+        if ( waitpid( result, &status, WNOHANG ) == result ) {
+            fprintf( stderr, "%s exited before mounting\n", options->binary );
+            return -1;
+        }
+        if ( stat( mount, &st ) == 0 && st.st_dev != under.st_dev ) {
+            return result;
+        }
+        usleep( 10000 );
+    }
+
+    fprintf( stderr, "%s didn't mount within %u ms\n", options->binary, kMountWaitMS );
+    kill( result, SIGTERM );
+    waitpid( result, NULL, 0 );
+    return -1;
+}
+
+static void unmountTree( const char * mount, pid_t pid )
+{
+    const char * argv[] = { "fusermount3", "-u", mount, NULL };
+    pid_t        helper;
+    int          status = -1;
+
+    if ( posix_spawnp( &helper, argv[0], NULL, NULL, (char * const *)argv, environ ) == 0 ) {
+        waitpid( helper, &status, 0 );
+    }
+    if ( status != 0 && umount2( mount, MNT_DETACH ) != 0 ) {
+        kill( pid, SIGTERM );
+    }
+    waitpid( pid, NULL, 0 );
+}
+
+// ------------------------------------------------------------------------------
+
+static void doOperation( tWorker * worker, eBenchOp op, eFileKind kind, const char * path, char * buffer )
+{
+    bool     failed = false;
+    uint64_t start  = nowNS();
+
+    switch ( op ) {
+    case kOpGetattr:
+        {
+            struct stat st;
+            failed = ( stat( path, &st ) != 0 );
+        }
+        break;
+
+    case kOpOpen:
+    case kOpRead:
+        {
+            int fd = open( path, O_RDONLY | O_CLOEXEC );
+            failed = ( fd == -1 );
+            if ( !failed && op == kOpRead ) {
+                ssize_t got;
+                while ( ( got = read( fd, buffer, kReadChunk ) ) > 0 ) {
+                    /* just the time it takes */
+                }
+                failed = ( got < 0 );
+            }
+            if ( fd != -1 ) {
+                close( fd );
+            }
+        }
+        break;
+
+    case kOpReaddir:
+        {
+            DIR * dir = opendir( path );
+            failed = ( dir == NULL );
+            if ( !failed ) {
+                while ( readdir( dir ) != NULL ) {
+                    /* just the time it takes */
+                }
+                closedir( dir );
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    tLatencies * latencies = &worker->latencies[ op ][ kind ];
+    ++latencies->count;
+    ++latencies->buckets[ bucketFor( nowNS() - start ) ];
+    if ( failed ) {
+        ++latencies->errors;
+    }
+}
+
+static void * runWorker( void * context )
+{
+    tWorker *             worker  = context;
+    const tBenchOptions * options = worker->options;
+    char                  path[ PATH_MAX ];
+    char *                buffer  = malloc( kReadChunk );
+    unsigned int          total   = options->files + options->templates + options->executables;
+    unsigned int          next    = 0;
+
+    if ( buffer == NULL ) {
+        return NULL;
+    }
+
+    while ( nowNS() < worker->deadline ) {
+        eBenchOp op = (eBenchOp)( next++ % kMaxOp );
+        if ( !options->ops[ op ] ) {
+            continue;
+        }
+
+        if ( op == kOpReaddir ) {
+            doOperation( worker, op, kKindDirectory, worker->mount, buffer );
+        } else if ( total > 0 ) {
+            /* each kind of file in proportion to how many there are */
+            unsigned int pick = rand_r( &worker->seed ) % total;
+            if ( pick < options->files ) {
+                snprintf( path, sizeof( path ), "%s/file-%u", worker->mount, pick );
+                doOperation( worker, op, kKindFile, path, buffer );
+            } else if ( ( pick -= options->files ) < options->templates ) {
+                snprintf( path, sizeof( path ), "%s/template-%u.conf", worker->mount, pick );
+                doOperation( worker, op, kKindTemplate, path, buffer );
+            } else {
+                pick -= options->templates;
+                snprintf( path, sizeof( path ), "%s/executable-%u", worker->mount, pick );
+                doOperation( worker, op, kKindExecutable, path, buffer );
+            }
+        }
+    }
+
+    free( buffer );
+    return NULL;
+}
+
+static void report( const tBenchOptions * options, tWorker * workers, double elapsed )
+{
+    printf( "%u threads for %.1fs, %s fuse loop%s%s\n",
+            options->threads, elapsed, options->single ? "single-threaded" : "multi-threaded",
+            options->options != NULL ? ", -o " : "", options->options != NULL ? options->options : "" );
+    printf( "%-20s %10s %12s %10s %10s %10s %8s\n", "operation", "count", "ops/s", "p50 us", "p99 us", "p999 us", "errors" );
+
+    for ( unsigned int op = 0; op < kMaxOp; ++op ) {
+        for ( unsigned int kind = 0; kind < kMaxKind; ++kind ) {
+            tLatencies merged;
+            memset( &merged, 0, sizeof( merged ) );
+
+            for ( unsigned int t = 0; t < options->threads; ++t ) {
+                const tLatencies * latencies = &workers[ t ].latencies[ op ][ kind ];
+                merged.count  += latencies->count;
+                merged.errors += latencies->errors;
+                for ( unsigned int i = 0; i < kLatencyBuckets; ++i ) {
+                    merged.buckets[ i ] += latencies->buckets[ i ];
+                }
+            }
+
+            if ( merged.count > 0 ) {
+                char name[ 32 ];
+                snprintf( name, sizeof( name ), "%s/%s", opNames[ op ], kindNames[ kind ] );
+                printf( "%-20s %10lu %12.0f %10.1f %10.1f %10.1f %8lu\n",
+                        name, merged.count, (double)merged.count / elapsed,
+                        percentile( &merged, 0.50 ) / 1000,
+                        percentile( &merged, 0.99 ) / 1000,
+                        percentile( &merged, 0.999 ) / 1000,
+                        merged.errors );
+            }
+        }
+    }
+}
+
+static void usage( const char * name )
+{
+    printf( "usage: %s [options]\n\n"
+            "    --templatefs PATH     the templatefs executable (default: ./templatefs)\n"
+            "    --dir DIR             where to build the tree (default: a new directory in /tmp)\n"
+            "    --options OPTS        extra mount options, e.g. 'kernelcache,renderthreads=8'\n"
+            "    --single              use the single-threaded fuse loop\n"
+            "    --files N             plain files, passed through (default: 100)\n"
+            "    --size BYTES          length of each plain file (default: 4096)\n"
+            "    --templates N         mustache templates (default: 100)\n"
+            "    --tags N              tags in each template (default: 20)\n"
+            "    --arrays N            array sections in each template (default: 2)\n"
+            "    --elements N          elements in each array (default: 10)\n"
+            "    --executables N       executable templates (default: 10)\n"
+            "    --threads N           threads making requests (default: 4)\n"
+            "    --seconds S           how long to make them for (default: 5)\n"
+            "    --ops LIST            any of getattr,open,read,readdir (default: all of them)\n"
+            "    --keep                leave the tree and the configuration afterwards\n",
+            name );
+}
+
+static int parseOps( tBenchOptions * options, const char * list )
+{
+    int    result = 0;
+    char * copy   = strdup( list );
+    char * save   = NULL;
+
+    memset( options->ops, 0, sizeof( options->ops ) );
+    for ( char * name = strtok_r( copy, ",", &save ); name != NULL && result == 0; name = strtok_r( NULL, ",", &save ) ) {
+        result = -EINVAL;
+        for ( unsigned int op = 0; op < kMaxOp; ++op ) {
+            if ( strcmp( name, opNames[ op ] ) == 0 ) {
+                options->ops[ op ] = true;
+                result = 0;
+            }
+        }
+    }
+    free( copy );
+    return result;
+}
+
+int main( int argc, char * argv[] )
+{
+    int           result   = 0;
+    char          tmpDir[] = "/tmp/templatefs-bench.XXXXXX";
+    char          mount[ PATH_MAX ];
+    tBenchOptions options  = {
+        .binary      = "./templatefs",
+        .files       = 100,
+        .fileSize    = 4096,
+        .templates   = 100,
+        .tags        = 20,
+        .arrays      = 2,
+        .elements    = 10,
+        .executables = 10,
+        .threads     = 4,
+        .seconds     = 5,
+        .ops         = { true, true, true, true }
+    };
+
+    static const struct option longOptions[] = {
+        { "templatefs",  required_argument, NULL, 'b' },
+        { "dir",         required_argument, NULL, 'd' },
+        { "options",     required_argument, NULL, 'o' },
+        { "single",      no_argument,       NULL, '1' },
+        { "files",       required_argument, NULL, 'f' },
+        { "size",        required_argument, NULL, 'z' },
+        { "templates",   required_argument, NULL, 't' },
+        { "tags",        required_argument, NULL, 'g' },
+        { "arrays",      required_argument, NULL, 'a' },
+        { "elements",    required_argument, NULL, 'e' },
+        { "executables", required_argument, NULL, 'x' },
+        { "threads",     required_argument, NULL, 'j' },
+        { "seconds",     required_argument, NULL, 's' },
+        { "ops",         required_argument, NULL, 'm' },
+        { "keep",        no_argument,       NULL, 'k' },
+        { "help",        no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int option;
+    while ( result == 0 && ( option = getopt_long( argc, argv, "b:d:o:1f:z:t:g:a:e:x:j:s:m:kh", longOptions, NULL ) ) != -1 ) {
+        switch ( option ) {
+        case 'b': options.binary      = optarg; break;
+        case 'd': options.dir         = optarg; break;
+        case 'o': options.options     = optarg; break;
+        case '1': options.single      = true; break;
+        case 'f': options.files       = strtoul( optarg, NULL, 0 ); break;
+        case 'z': options.fileSize    = strtoul( optarg, NULL, 0 ); break;
+        case 't': options.templates   = strtoul( optarg, NULL, 0 ); break;
+        case 'g': options.tags        = strtoul( optarg, NULL, 0 ); break;
+        case 'a': options.arrays      = strtoul( optarg, NULL, 0 ); break;
+        case 'e': options.elements    = strtoul( optarg, NULL, 0 ); break;
+        case 'x': options.executables = strtoul( optarg, NULL, 0 ); break;
+        case 'j': options.threads     = strtoul( optarg, NULL, 0 ); break;
+        case 's': options.seconds     = strtod( optarg, NULL ); break;
+        case 'm':
+            if ( parseOps( &options, optarg ) != 0 ) {
+                fprintf( stderr, "unknown operation in \'%s\'\n", optarg );
+                result = 2;
+            }
+            break;
+        case 'k': options.keep = true; break;
+        case 'h': usage( argv[0] ); return 0;
+        default:  usage( argv[0] ); return 2;
+        }
+    }
+    if ( result != 0 ) {
+        return result;
+    }
+    if ( options.threads == 0 ) {
+        options.threads = 1;
+    }
+
+    bool madeDir = ( options.dir == NULL );
+    if ( madeDir ) {
+        options.dir = mkdtemp( tmpDir );
+        if ( options.dir == NULL ) {
+            fprintf( stderr, "unable to make a directory for the tree (%s)\n", strerror( errno ) );
+            return 1;
+        }
+    }
+    snprintf( mount, sizeof( mount ), "%s/mnt", options.dir );
+
+    int err = buildTree( &options );
+    if ( err != 0 ) {
+        fprintf( stderr, "unable to build the tree in \'%s\' (%s)\n", options.dir, strerror( -err ) );
+        if ( !options.keep ) {
+            removeTree( &options, madeDir );
+        }
+        return 1;
+    }
+    if ( seedConfig( &options, true ) != 0 ) {
+        fprintf( stderr, "unable to write the configuration below %s, so templates will render empty\n", kBenchRoot );
+    }
+
+    pid_t pid = mountTree( &options, mount );
+    if ( pid == -1 ) {
+        result = 1;
+    } else {
+        tWorker *   workers = calloc( options.threads, sizeof( tWorker ) );
+        pthread_t * threads = calloc( options.threads, sizeof( pthread_t ) );
+
+        if ( workers == NULL || threads == NULL ) {
+            fprintf( stderr, "not enough memory for %u threads\n", options.threads );
+            result = 1;
+        } else {
+            uint64_t start    = nowNS();
+            uint64_t deadline = start + (uint64_t)( options.seconds * 1e9 );
+            unsigned int started = 0;
+
+            for ( ; started < options.threads; ++started ) {
+                workers[ started ].options  = &options;
+                workers[ started ].mount    = mount;
+                workers[ started ].deadline = deadline;
+                workers[ started ].seed     = started + 1;
+                if ( pthread_create( &threads[ started ], NULL, runWorker, &workers[ started ] ) != 0 ) {
+                    break;
+                }
+            }
+            for ( unsigned int t = 0; t < started; ++t ) {
+                pthread_join( threads[ t ], NULL );
+            }
+            options.threads = started;
+
+            report( &options, workers, (double)( nowNS() - start ) / 1e9 );
+        }
+        free( workers );
+        free( threads );
+
+        unmountTree( mount, pid );
+    }
+
+    if ( !options.keep ) {
+        seedConfig( &options, false );
+        removeTree( &options, madeDir );
+    }
+
+    return result;
+}
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <unistd.h>
 
 #include <dirent.h>
@@ -23,4 +24,57 @@
 
 typedef char byte;
 
+/**
+ * @brief receives output as it's produced, rather than once it's complete
+ * (see streamExecutable() and streamTemplate())
+ * @return zero to carry on, or negative errno to stop producing it
+ */
+typedef int (* tOutputSink)( void * context, const byte * data, size_t length );
+
+/* FNV-1a, for the hash tables (and content hashes) throughout. Never
+ * instrumented, as they're called far too often to be worth tracing */
+#define kFNVOffsetBasis  14695981039346656037ULL
+#define kFNVPrime        1099511628211ULL
+
+__attribute__((no_instrument_function))
+static inline uint64_t fnvMix( uint64_t hash, uint64_t value )
+{
+    return ( hash ^ value ) * kFNVPrime;
+}
+
+__attribute__((no_instrument_function))
+static inline uint64_t fnvAddBytes( uint64_t hash, const void * data, size_t length )
+{
+    const unsigned char * c = data;
+
+    for ( size_t i = 0; i < length; ++i ) {
+        hash = fnvMix( hash, c[ i ] );
+    }
+    return hash;
+}
+
+__attribute__((no_instrument_function))
+static inline uint64_t fnvAddString( uint64_t hash, const char * str )
+{
+    for ( const char * c = str; *c != '\0'; ++c ) {
+        hash = fnvMix( hash, (unsigned char)*c );
+    }
+    return hash;
+}
+
+__attribute__((no_instrument_function))
+static inline uint64_t hashString( const char * str )
+{
+    return fnvAddString( kFNVOffsetBasis, str );
+}
+
+/**
+ * @brief the hash of a name that's only unique together with what it's relative to
+ */
+__attribute__((no_instrument_function))
+static inline uint64_t hashStringSeeded( const void * seed, const char * str )
+{
+    return fnvAddString( fnvMix( kFNVOffsetBasis, (uintptr_t)seed ), str );
+}
+
 #endif //TEMPLATEFS_COMMON_H
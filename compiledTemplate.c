@@ -0,0 +1,807 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* Templates rarely change, so rather than have mustach re-tokenize the
+ * template text on every render, parse it once into a flat array of literal
+ * spans and tag ops, with section nesting already resolved, and cache that
+ * per template inode and mtime (the least recently used beyond a fixed count
+ * are discarded, as rename-saves leave a new inode each time). Rendering is then a linear walk over the ops,
+ * making the same calls into the mustach_wrap_itf callbacks, in the same
+ * order, as mustach_wrap_mem() would.
+ *
+ * Only the subset of mustache (and its extensions) that can be reproduced
+ * exactly is compiled. Anything else (partials, dotted names, comparisons,
+ * object iteration...) marks the template as 'not compiled', and the caller
+ * falls back to mustach_wrap_mem().
+ *
+ * The output either accumulates in one buffer, or is handed to a write
+ * callback as it's produced, as mustach_wrap_write() would (see
+ * renderStream.c). */
+
+#include "common.h"
+#include "templatefs.h"
+#include "compiledTemplate.h"
+#include "logStuff.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+
+#define kMaxDelimiterLength     8
+#define kMaxCompiledTemplates   1024    // beyond this, the least recently used are discarded
+
+typedef struct {
+    tTemplateOp * ops;
+    size_t        opCount;
+    size_t        opAlloc;
+    char *        strings;
+    size_t        used;
+    size_t        alloc;
+} tBuilder;
+
+typedef struct {
+    char *               data;
+    size_t               length;
+    size_t               alloc;
+    mustach_write_cb_t * write;         ///< if set, receives the output instead of 'data'
+    void *               writeClosure;
+} tOutput;
+
+typedef struct {
+    pthread_mutex_t      lock;
+    tCompiledTemplate ** buckets;
+    size_t               bucketCount;    ///< always a power of two
+    size_t               entryCount;
+    tCompiledTemplate *  lruHead;        ///< most recently used
+    tCompiledTemplate *  lruTail;        ///< least recently used
+} tCompiledCache;
+
+static tCompiledCache compiledCache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+// ------------------------------------------------------------------------------
+
+static bool addString( tBuilder * builder, const char * str, size_t length, uint32_t * offset )
+{
+    /* always leave room to NUL-terminate */
+    if ( builder->used + length + 1 > builder->alloc ) {
+        size_t newAlloc = ( builder->alloc + length + 1 ) * 2;
+        char * strings  = realloc( builder->strings, newAlloc );
+        if ( strings == NULL ) {
+            return false;
+        }
+        builder->strings = strings;
+        builder->alloc   = newAlloc;
+    }
+    *offset = builder->used;
+    memcpy( &builder->strings[ builder->used ], str, length );
+    builder->used += length;
+    builder->strings[ builder->used++ ] = '\0';
+
+    return true;
+}
+
+static bool addOp( tBuilder * builder, eTemplateOp op, const char * str, size_t length )
+{
+    if ( builder->opCount >= builder->opAlloc ) {
+        size_t        newAlloc = ( builder->opAlloc == 0 ) ? 32 : builder->opAlloc * 2;
+        tTemplateOp * ops      = realloc( builder->ops, newAlloc * sizeof( tTemplateOp ) );
+        if ( ops == NULL ) {
+            return false;
+        }
+        builder->ops     = ops;
+        builder->opAlloc = newAlloc;
+    }
+
+    tTemplateOp * templateOp = &builder->ops[ builder->opCount ];
+    templateOp->op     = op;
+    templateOp->length = length;
+    templateOp->match  = 0;
+    if ( !addString( builder, str, length, &templateOp->offset ) ) {
+        return false;
+    }
+    ++builder->opCount;
+
+    return true;
+}
+
+static inline bool isBlank( char c )
+{
+    return ( c == ' ' || c == '\t' );
+}
+
+/**
+ * @brief whether a tag name can be handed to the 'sel' callback as-is.
+ *
+ * mustach-wrap splits dotted names and JSON pointers into 'sel' and 'subsel'
+ * calls, and interprets comparisons, escapes and '*' itself, so leave all of
+ * those to mustach.
+ */
+static bool isPlainName( const char * name, size_t length )
+{
+    if ( length == 0 ) {
+        return false;
+    }
+    if ( length == 1 && name[0] == '.' ) {
+        return true;
+    }
+    if ( name[0] == '/' || name[0] == ':' || name[0] == '*' ) {
+        return false;
+    }
+    for ( size_t i = 0; i < length; ++i ) {
+        switch ( name[i] )
+        {
+        case '.': case '=': case '<': case '>': case '\\': case '*':
+            return false;
+
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief parse the template text into ops
+ * @return true if the whole template was compiled, false if mustach should be used
+ */
+static bool compileTemplate( tBuilder * builder, const char * text, size_t length )
+{
+    const char * end       = text + length;
+    const char * p         = text;
+    const char * textStart = text;
+
+    char   open[ kMaxDelimiterLength + 1 ]  = "{{";
+    char   close[ kMaxDelimiterLength + 2 ] = "}}";
+    size_t openLen  = 2;
+    size_t closeLen = 2;
+
+    uint32_t stack[ MUSTACH_MAX_DEPTH ];
+    int      depth = 0;
+
+    while ( true ) {
+        const char * tag = memmem( p, end - p, open, openLen );
+        if ( tag == NULL ) {
+            break;
+        }
+
+        const char * inner = tag + openLen;
+        char         kind  = ( inner < end ) ? *inner : '\0';
+        const char * name;
+        const char * nameEnd;
+        const char * after;
+        eTemplateOp  op;
+
+        if ( kind == '{' ) {
+            /* triple mustache, closed by '}' followed by the closing delimiter */
+            char   tripleClose[ kMaxDelimiterLength + 2 ] = "}";
+            strcpy( &tripleClose[1], close );
+            nameEnd = memmem( inner, end - inner, tripleClose, closeLen + 1 );
+            if ( nameEnd == NULL ) {
+                return false;
+            }
+            name  = inner + 1;
+            after = nameEnd + closeLen + 1;
+            op    = kOpValueRaw;
+        } else {
+            nameEnd = memmem( inner, end - inner, close, closeLen );
+            if ( nameEnd == NULL ) {
+                return false;
+            }
+            after = nameEnd + closeLen;
+            name  = inner + 1;
+            switch ( kind )
+            {
+            case '#': op = kOpSection;  break;
+            case '^': op = kOpInverted; break;
+            case '/': op = kOpEnd;      break;
+            case '&': op = kOpValueRaw; break;
+            case '!': op = kOpText;     break; /* a comment, emits nothing */
+            case '=': op = kOpText;     break; /* a change of delimiters */
+            case '>':                          /* partials aren't supported */
+                return false;
+            default:
+                op   = kOpValue;
+                name = inner;
+                break;
+            }
+        }
+
+        /* trim whitespace around the name */
+        while ( name < nameEnd && isspace( (unsigned char) *name ) ) {
+            ++name;
+        }
+        while ( nameEnd > name && isspace( (unsigned char) nameEnd[ -1 ] ) ) {
+            --nameEnd;
+        }
+
+        /* Section, comment and delimiter tags on a line of their own
+         * take the whole line with them, including the newline */
+        const char * textEnd = tag;
+        if ( kind == '#' || kind == '^' || kind == '/' || kind == '!' || kind == '=' ) {
+            const char * lineStart = tag;
+            while ( lineStart > text && isBlank( lineStart[ -1 ] ) ) {
+                --lineStart;
+            }
+            const char * lineEnd = after;
+            while ( lineEnd < end && isBlank( *lineEnd ) ) {
+                ++lineEnd;
+            }
+            if ( ( lineStart == text || lineStart[ -1 ] == '\n' ) ) {
+                if ( lineEnd == end ) {
+                    textEnd = lineStart;
+                    after   = lineEnd;
+                } else if ( *lineEnd == '\n' ) {
+                    textEnd = lineStart;
+                    after   = lineEnd + 1;
+                } else if ( *lineEnd == '\r' && lineEnd + 1 < end && lineEnd[1] == '\n' ) {
+                    textEnd = lineStart;
+                    after   = lineEnd + 2;
+                }
+            }
+        }
+
+        if ( textEnd < textStart ) {
+            textEnd = textStart;
+        }
+        if ( textEnd > textStart && !addOp( builder, kOpText, textStart, textEnd - textStart ) ) {
+            return false;
+        }
+
+        switch ( kind )
+        {
+        case '!':
+            break;
+
+        case '=':
+            {
+                /* {{=<% %>=}} - the new delimiters are separated by whitespace */
+                if ( nameEnd <= name || nameEnd[ -1 ] != '=' ) {
+                    return false;
+                }
+                const char * newOpen    = name;
+                const char * newOpenEnd = newOpen;
+                while ( newOpenEnd < nameEnd - 1 && !isspace( (unsigned char) *newOpenEnd ) ) {
+                    ++newOpenEnd;
+                }
+                const char * newClose = newOpenEnd;
+                while ( newClose < nameEnd - 1 && isspace( (unsigned char) *newClose ) ) {
+                    ++newClose;
+                }
+                const char * newCloseEnd = nameEnd - 1;
+                while ( newCloseEnd > newClose && isspace( (unsigned char) newCloseEnd[ -1 ] ) ) {
+                    --newCloseEnd;
+                }
+                openLen  = newOpenEnd - newOpen;
+                closeLen = newCloseEnd - newClose;
+                if ( openLen == 0 || closeLen == 0
+                  || openLen > kMaxDelimiterLength || closeLen > kMaxDelimiterLength
+                  || memchr( newClose, ' ', closeLen ) != NULL ) {
+                    return false;
+                }
+                memcpy( open,  newOpen,  openLen );   open[ openLen ]   = '\0';
+                memcpy( close, newClose, closeLen );  close[ closeLen ] = '\0';
+            }
+            break;
+
+        default:
+            if ( !isPlainName( name, nameEnd - name ) ) {
+                return false;
+            }
+            if ( op == kOpEnd ) {
+                if ( depth == 0 ) {
+                    return false;
+                }
+                tTemplateOp * section = &builder->ops[ stack[ --depth ] ];
+                if ( section->length != (size_t)( nameEnd - name )
+                  || memcmp( &builder->strings[ section->offset ], name, section->length ) != 0 ) {
+                    return false;
+                }
+            }
+            /* note where the section starts, before addOp() can realloc */
+            uint32_t index = builder->opCount;
+            if ( !addOp( builder, op, name, nameEnd - name ) ) {
+                return false;
+            }
+            if ( op == kOpSection || op == kOpInverted ) {
+                if ( depth >= MUSTACH_MAX_DEPTH ) {
+                    return false;
+                }
+                stack[ depth++ ] = index;
+            } else if ( op == kOpEnd ) {
+                /* resolve the nesting now, so rendering never has to search for it */
+                builder->ops[ index ].match = stack[ depth ];
+                builder->ops[ stack[ depth ] ].match = index;
+            }
+            break;
+        }
+
+        p = textStart = after;
+    }
+
+    if ( depth != 0 ) {
+        return false;
+    }
+
+    return ( end <= textStart || addOp( builder, kOpText, textStart, end - textStart ) );
+}
+
+// ------------------------------------------------------------------------------
+
+static bool emit( tOutput * output, const char * data, size_t length )
+{
+    if ( output->write != NULL ) {
+        return ( length == 0 || output->write( output->writeClosure, data, length ) >= 0 );
+    }
+    if ( output->length + length + 1 > output->alloc ) {
+        size_t newAlloc = ( output->alloc + length + 1 ) * 2;
+        char * newData  = realloc( output->data, newAlloc );
+        if ( newData == NULL ) {
+            return false;
+        }
+        output->data  = newData;
+        output->alloc = newAlloc;
+    }
+    memcpy( &output->data[ output->length ], data, length );
+    output->length += length;
+    output->data[ output->length ] = '\0';
+
+    return true;
+}
+
+/* the same escaping mustach applies to {{name}} */
+static bool emitEscaped( tOutput * output, const char * data, size_t length )
+{
+    bool   result = true;
+    size_t start  = 0;
+
+    for ( size_t i = 0; result && i < length; ++i ) {
+        const char * entity;
+
+        switch ( data[i] )
+        {
+        case '<': entity = "&lt;";   break;
+        case '>': entity = "&gt;";   break;
+        case '&': entity = "&amp;";  break;
+        case '"': entity = "&quot;"; break;
+        default:  entity = NULL;     break;
+        }
+        if ( entity != NULL ) {
+            result = emit( output, &data[ start ], i - start )
+                  && emit( output, entity, strlen( entity ) );
+            start = i + 1;
+        }
+    }
+    return result && emit( output, &data[ start ], length - start );
+}
+
+static inline int selectName( const struct mustach_wrap_itf * itf, void * closure, const char * name )
+{
+    /* a lone '.' means the current item */
+    return itf->sel( closure, ( name[0] == '.' && name[1] == '\0' ) ? NULL : name );
+}
+
+static int renderValue( const struct mustach_wrap_itf * itf,
+                        void * closure,
+                        const char * name,
+                        bool escape,
+                        tOutput * output )
+{
+    int result = selectName( itf, closure, name );
+    if ( result > 0 ) {
+        struct mustach_sbuf sbuf;
+        memset( &sbuf, 0, sizeof( sbuf ) );
+
+        result = itf->get( closure, &sbuf, 0 );
+        if ( result > 0 && sbuf.value != NULL ) {
+            size_t length = ( sbuf.length != 0 ) ? sbuf.length : strlen( sbuf.value );
+            bool   ok     = escape ? emitEscaped( output, sbuf.value, length )
+                                   : emit( output, sbuf.value, length );
+            if ( !ok ) {
+                result = MUSTACH_ERROR_SYSTEM;
+            }
+        }
+        if ( sbuf.freecb != NULL ) {
+            if ( sbuf.closure != NULL ) {
+                sbuf.releasecb( sbuf.value, sbuf.closure );
+            } else {
+                sbuf.freecb( (void *) sbuf.value );
+            }
+        }
+    }
+    return ( result < 0 ) ? result : MUSTACH_OK;
+}
+
+/**
+ * @brief walk the ops of a compiled template, calling the callbacks the
+ *        same way mustach_wrap_mem() would
+ * @return MUSTACH_OK if successful, else a negative mustach error code
+ */
+static int renderOps( const tCompiledTemplate * compiled,
+                      const struct mustach_wrap_itf * itf,
+                      void * closure,
+                      tOutput * output )
+{
+    int    result = MUSTACH_OK;
+    size_t i      = 0;
+
+    /* for each open section, whether 'enter' succeeded (so 'leave' is owed) */
+    bool   entered[ MUSTACH_MAX_DEPTH ];
+    int    depth = 0;
+
+    while ( result >= 0 && i < compiled->opCount ) {
+        const tTemplateOp * op   = &compiled->ops[ i ];
+        const char *        name = &compiled->strings[ op->offset ];
+
+        switch ( op->op )
+        {
+        case kOpText:
+            if ( !emit( output, name, op->length ) ) {
+                result = MUSTACH_ERROR_SYSTEM;
+            }
+            ++i;
+            break;
+
+        case kOpValue:
+        case kOpValueRaw:
+            result = renderValue( itf, closure, name, op->op == kOpValue, output );
+            ++i;
+            break;
+
+        case kOpSection:
+        case kOpInverted:
+            result = selectName( itf, closure, name );
+            if ( result > 0 ) {
+                result = itf->enter( closure, 0 );
+            }
+            if ( result < 0 ) {
+                break;
+            }
+            if ( op->op == kOpInverted ) {
+                if ( result > 0 ) {
+                    /* nothing inside an inverted section that was entered is rendered,
+                     * but mustach still steps through every item before leaving it */
+                    do {
+                        result = itf->next( closure );
+                    } while ( result > 0 );
+                    if ( result == 0 ) {
+                        result = itf->leave( closure );
+                    }
+                    i = op->match + 1;
+                } else {
+                    entered[ depth++ ] = false;
+                    ++i;
+                }
+            } else {
+                if ( result > 0 ) {
+                    entered[ depth++ ] = true;
+                    ++i;
+                } else {
+                    /* skip straight past the end of an empty section */
+                    i = op->match + 1;
+                }
+            }
+            break;
+
+        case kOpEnd:
+            if ( entered[ depth - 1 ] ) {
+                result = itf->next( closure );
+                if ( result > 0 ) {
+                    /* go around again, for the next item */
+                    i = compiled->ops[ i ].match + 1;
+                    break;
+                }
+                if ( result == 0 ) {
+                    result = itf->leave( closure );
+                }
+            }
+            --depth;
+            ++i;
+            break;
+        }
+    }
+
+    /* unwind any sections left open by an error */
+    while ( depth > 0 ) {
+        if ( entered[ --depth ] ) {
+            itf->leave( closure );
+        }
+    }
+
+    return ( result < 0 ) ? result : MUSTACH_OK;
+}
+
+/**
+ * @brief start and stop the interface around a walk of the ops, as mustach does
+ * @return MUSTACH_OK if successful, else a negative mustach error code
+ */
+static int renderOutput( const tCompiledTemplate * compiled,
+                         const struct mustach_wrap_itf * itf,
+                         void * closure,
+                         tOutput * output )
+{
+    int status = MUSTACH_OK;
+
+    if ( itf->start != NULL ) {
+        status = itf->start( closure );
+    }
+    if ( status >= 0 ) {
+        /* make sure there's always a buffer to return, even if empty */
+        if ( !emit( output, "", 0 ) ) {
+            status = MUSTACH_ERROR_SYSTEM;
+        } else {
+            status = renderOps( compiled, itf, closure, output );
+        }
+    }
+    if ( itf->stop != NULL ) {
+        itf->stop( closure, status );
+    }
+    return status;
+}
+
+/**
+ * @brief render a compiled template into a memory buffer
+ *
+ * @param compiled  the compiled template
+ * @param itf       the mustach-wrap interface to fetch values through
+ * @param closure   passed to the interface's callbacks
+ * @param result    receives the rendered output (allocated with malloc) when 0 is returned
+ * @param size      receives the length of the rendered output
+ * @return MUSTACH_OK if successful, else a negative mustach error code
+ */
+int renderCompiledTemplate( const tCompiledTemplate * compiled,
+                            const struct mustach_wrap_itf * itf,
+                            void * closure,
+                            byte ** result,
+                            size_t * size )
+{
+    tOutput output = { NULL, 0, 0, NULL, NULL };
+    int     status = renderOutput( compiled, itf, closure, &output );
+
+    if ( status == MUSTACH_OK ) {
+        *result = output.data;
+        *size   = output.length;
+    } else {
+        free( output.data );
+    }
+    return status;
+}
+
+/**
+ * @brief render a compiled template, handing the output to 'write' as it's
+ * produced, as mustach_wrap_write() would
+ *
+ * @param write         receives each piece of the output, in order
+ * @param writeClosure  passed to 'write'
+ * @return MUSTACH_OK if successful, else a negative mustach error code.
+ * MUSTACH_ERROR_SYSTEM if 'write' failed
+ */
+int writeCompiledTemplate( const tCompiledTemplate * compiled,
+                           const struct mustach_wrap_itf * itf,
+                           void * closure,
+                           mustach_write_cb_t * write,
+                           void * writeClosure )
+{
+    tOutput output = { NULL, 0, 0, write, writeClosure };
+
+    return renderOutput( compiled, itf, closure, &output );
+}
+
+// ------------------------------------------------------------------------------
+
+static inline size_t hashInode( dev_t dev, ino_t ino )
+{
+    return (size_t)( ino * 2654435761UL ) ^ (size_t) dev;
+}
+
+static inline bool isCurrent( const tCompiledTemplate * compiled, const struct stat * st )
+{
+    return ( compiled->mtime.tv_sec  == st->st_mtim.tv_sec
+          && compiled->mtime.tv_nsec == st->st_mtim.tv_nsec
+          && compiled->size == st->st_size );
+}
+
+static tCompiledTemplate * newCompiledTemplate( int fd, const struct stat * st )
+{
+    tCompiledTemplate * compiled = calloc( 1, sizeof( tCompiledTemplate ) );
+    if ( compiled == NULL ) {
+        return NULL;
+    }
+
+    atomic_init( &compiled->refCount, 1 );
+    compiled->dev   = st->st_dev;
+    compiled->ino   = st->st_ino;
+    compiled->mtime = st->st_mtim;
+    compiled->size  = st->st_size;
+
+    if ( st->st_size > 0 ) {
+        void * text = mmap( NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( text != MAP_FAILED ) {
+            tBuilder builder;
+            memset( &builder, 0, sizeof( builder ) );
+
+            compiled->compiled = compileTemplate( &builder, text, st->st_size );
+            if ( compiled->compiled ) {
+                compiled->ops     = builder.ops;
+                compiled->opCount = builder.opCount;
+                compiled->strings = builder.strings;
+            } else {
+                logDebug( "template uses features that aren't compiled, will use mustach" );
+                free( builder.ops );
+                free( builder.strings );
+            }
+            munmap( text, st->st_size );
+        }
+    } else {
+        /* an empty template renders as nothing */
+        compiled->compiled = true;
+    }
+
+    return compiled;
+}
+
+static void lruUnlink( tCompiledTemplate * compiled )
+{
+    if ( compiled->lruPrev != NULL ) {
+        compiled->lruPrev->lruNext = compiled->lruNext;
+    } else {
+        compiledCache.lruHead = compiled->lruNext;
+    }
+    if ( compiled->lruNext != NULL ) {
+        compiled->lruNext->lruPrev = compiled->lruPrev;
+    } else {
+        compiledCache.lruTail = compiled->lruPrev;
+    }
+    compiled->lruPrev = NULL;
+    compiled->lruNext = NULL;
+}
+
+static void lruPushHead( tCompiledTemplate * compiled )
+{
+    compiled->lruPrev = NULL;
+    compiled->lruNext = compiledCache.lruHead;
+    if ( compiledCache.lruHead != NULL ) {
+        compiledCache.lruHead->lruPrev = compiled;
+    } else {
+        compiledCache.lruTail = compiled;
+    }
+    compiledCache.lruHead = compiled;
+}
+
+/**
+ * @brief take an entry out of the cache, dropping the cache's reference. Caller must hold the lock
+ * @param link  the link to it in its hash bucket
+ */
+static void removeEntry( tCompiledTemplate ** link )
+{
+    tCompiledTemplate * compiled = *link;
+
+    *link = compiled->next;
+    lruUnlink( compiled );
+    --compiledCache.entryCount;
+    releaseCompiledTemplate( compiled );
+}
+
+/**
+ * @brief discard the least recently used entries, until there are few enough.
+ * Saving a template by renaming a new file over it leaves a new inode each
+ * time, so the entries for the old ones would otherwise accumulate forever.
+ * Caller must hold the lock
+ */
+static void evictEntries( void )
+{
+    while ( compiledCache.entryCount > kMaxCompiledTemplates && compiledCache.lruTail != NULL ) {
+        tCompiledTemplate *  victim = compiledCache.lruTail;
+        tCompiledTemplate ** link   = &compiledCache.buckets[ hashInode( victim->dev, victim->ino )
+                                                              & ( compiledCache.bucketCount - 1 ) ];
+        while ( *link != victim ) {
+            link = &(*link)->next;
+        }
+        removeEntry( link );
+    }
+}
+
+static void growBuckets( void )
+{
+    size_t newCount = ( compiledCache.bucketCount == 0 ) ? 64 : compiledCache.bucketCount * 2;
+    tCompiledTemplate ** newBuckets = calloc( newCount, sizeof( tCompiledTemplate * ) );
+
+    if ( newBuckets != NULL ) {
+        for ( size_t i = 0; i < compiledCache.bucketCount; ++i ) {
+            tCompiledTemplate * compiled = compiledCache.buckets[ i ];
+            while ( compiled != NULL ) {
+                tCompiledTemplate * next = compiled->next;
+                size_t idx = hashInode( compiled->dev, compiled->ino ) & ( newCount - 1 );
+
+                compiled->next    = newBuckets[ idx ];
+                newBuckets[ idx ] = compiled;
+                compiled = next;
+            }
+        }
+        free( compiledCache.buckets );
+        compiledCache.buckets     = newBuckets;
+        compiledCache.bucketCount = newCount;
+    }
+}
+
+/**
+ * @brief get the compiled form of the template open on fd, compiling it if necessary
+ * @param fd  file descriptor of the template
+ * @param st  the current status of the template
+ * @return a reference to the compiled template (release with releaseCompiledTemplate),
+ *         or NULL if out of memory
+ */
+tCompiledTemplate * acquireCompiledTemplate( int fd, const struct stat * st )
+{
+    tCompiledTemplate * result = NULL;
+
+    pthread_mutex_lock( &compiledCache.lock );
+
+    if ( compiledCache.bucketCount > 0 ) {
+        tCompiledTemplate ** link = &compiledCache.buckets[ hashInode( st->st_dev, st->st_ino )
+                                                            & ( compiledCache.bucketCount - 1 ) ];
+        while ( *link != NULL ) {
+            tCompiledTemplate * compiled = *link;
+            if ( compiled->dev == st->st_dev && compiled->ino == st->st_ino ) {
+                if ( isCurrent( compiled, st ) ) {
+                    result = compiled;
+                    atomic_fetch_add( &result->refCount, 1 );
+                    lruUnlink( result );
+                    lruPushHead( result );
+                } else {
+                    /* the template has changed since it was compiled */
+                    removeEntry( link );
+                }
+                break;
+            }
+            link = &compiled->next;
+        }
+    }
+
+    pthread_mutex_unlock( &compiledCache.lock );
+
+    if ( result == NULL ) {
+        /* compile outside the lock. If another thread races us, the last one wins */
+        result = newCompiledTemplate( fd, st );
+        if ( result != NULL ) {
+            pthread_mutex_lock( &compiledCache.lock );
+
+            if ( compiledCache.entryCount >= compiledCache.bucketCount ) {
+                growBuckets();
+            }
+            if ( compiledCache.bucketCount > 0 ) {
+                size_t idx = hashInode( st->st_dev, st->st_ino ) & ( compiledCache.bucketCount - 1 );
+                tCompiledTemplate ** link = &compiledCache.buckets[ idx ];
+                while ( *link != NULL ) {
+                    if ( (*link)->dev == st->st_dev && (*link)->ino == st->st_ino ) {
+                        removeEntry( link );
+                        break;
+                    }
+                    link = &(*link)->next;
+                }
+                atomic_fetch_add( &result->refCount, 1 );
+                result->next = compiledCache.buckets[ idx ];
+                compiledCache.buckets[ idx ] = result;
+                lruPushHead( result );
+                ++compiledCache.entryCount;
+                evictEntries();
+            }
+
+            pthread_mutex_unlock( &compiledCache.lock );
+        }
+    }
+
+    return result;
+}
+
+void releaseCompiledTemplate( tCompiledTemplate * compiled )
+{
+    if ( compiled != NULL && atomic_fetch_sub( &compiled->refCount, 1 ) == 1 ) {
+        free( compiled->ops );
+        free( compiled->strings );
+        free( compiled );
+    }
+}
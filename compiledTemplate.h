@@ -0,0 +1,64 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_COMPILEDTEMPLATE_H
+#define TEMPLATEFS_COMPILEDTEMPLATE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <mustach/mustach-wrap.h>
+
+typedef enum {
+    kOpText = 0,    ///< literal text, emitted as-is
+    kOpValue,       ///< {{name}}, emitted with HTML escaping
+    kOpValueRaw,    ///< {{{name}}} or {{&name}}, emitted as-is
+    kOpSection,     ///< {{#name}}
+    kOpInverted,    ///< {{^name}}
+    kOpEnd          ///< {{/name}}
+} eTemplateOp;
+
+typedef struct {
+    eTemplateOp  op;
+    uint32_t     offset;   ///< start of the literal text or tag name in 'strings'
+    uint32_t     length;   ///< length of the literal text or tag name
+    uint32_t     match;    ///< section ops: index of the matching end op, and vice versa
+} tTemplateOp;
+
+/**
+ * @brief a template parsed once into a flat array of literal spans and tag ops
+ */
+typedef struct sCompiledTemplate {
+    atomic_uint                 refCount;
+    struct sCompiledTemplate *  next;        ///< next entry in the same hash bucket
+    struct sCompiledTemplate *  lruPrev;     ///< more recently used
+    struct sCompiledTemplate *  lruNext;     ///< less recently used
+
+    dev_t                       dev;         ///< identity of the template file it was compiled from
+    ino_t                       ino;
+    struct timespec             mtime;
+    off_t                       size;
+
+    bool                        compiled;    ///< false if mustach must be used instead
+    char *                      strings;     ///< literal text and (NUL-terminated) tag names
+    tTemplateOp *               ops;
+    size_t                      opCount;
+} tCompiledTemplate;
+
+tCompiledTemplate * acquireCompiledTemplate( int fd, const struct stat * st );
+void                releaseCompiledTemplate( tCompiledTemplate * compiled );
+
+int renderCompiledTemplate( const tCompiledTemplate * compiled,
+                            const struct mustach_wrap_itf * itf,
+                            void * closure,
+                            byte ** result,
+                            size_t * size );
+int writeCompiledTemplate( const tCompiledTemplate * compiled,
+                           const struct mustach_wrap_itf * itf,
+                           void * closure,
+                           mustach_write_cb_t * write,
+                           void * writeClosure );
+
+#endif //TEMPLATEFS_COMPILEDTEMPLATE_H
@@ -0,0 +1,655 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* Keeps one libelektra handle and KeySet open for the life of the mount,
+ * rather than paying for kdbOpen()/kdbGet()/kdbClose() on every render.
+ *
+ * The KeySet is refreshed in place by kdbGet(), which is cheap when
+ * nothing has changed. Only when the backend reports a change do we take
+ * a new (deep) copy of it and publish that as the current snapshot. Renders
+ * hold a reference to a snapshot for as long as they need it, so a refresh
+ * never changes the configuration underneath a render in progress.
+ *
+ * Nothing is loaded until it's first needed. A template may declare the
+ * only parts of the configuration it uses (its 'roots' setting), in which
+ * case it's rendered against a store of its own that loads just those, so
+ * neither loading nor refreshing it scales with the size of the whole
+ * configuration. Scoped stores are kept for as long as the store they were
+ * made from, with a libelektra handle each.
+ *
+ * When a store's configuration changes, its onChange callback is given
+ * both the new snapshot and the one it replaces, so what changed can be
+ * found with diffConfigSnapshots(). */
+
+#include "common.h"
+#include "templatefs.h"
+#include "configStore.h"
+#include "arrayIndex.h"
+#include "dependencies.h"
+#include "keyMemo.h"
+#include "metrics.h"
+#include "logStuff.h"
+
+/* shared by every snapshot, so a generation number uniquely identifies its content */
+static atomic_ulong nextGeneration = 1;
+
+/* bumped (e.g. by SIGUSR1) to force each store's next acquire to call kdbGet() */
+static atomic_ulong refreshEpoch = 0;
+
+#define kInitialChanges  16
+
+/* when configurations an earlier run saw last changed, by their content (see rememberConfigChange()) */
+static struct {
+    pthread_mutex_t  lock;
+    size_t           count;
+    struct {
+        uint64_t         contentHash;
+        struct timespec  changedAt;
+    }                entries[ kRememberedConfigChanges ];
+} remembered = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+// ------------------------------------------------------------------------------
+
+static unsigned long msSince( const struct timespec * then )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return (unsigned long)( now.tv_sec - then->tv_sec ) * 1000
+         + ( now.tv_nsec - then->tv_nsec ) / 1000000;
+}
+
+/**
+ * @brief a snapshot of a KeySet that's already loaded, whether by a store or
+ * built in memory. The snapshot has its own copy, so 'keySet' stays the caller's
+ * @return the snapshot (release with releaseConfigSnapshot()), or NULL if out of memory
+ */
+tConfigSnapshot * newConfigSnapshot( KeySet * keySet )
+{
+    tConfigSnapshot * snapshot = calloc( 1, sizeof( tConfigSnapshot ) );
+    if ( snapshot != NULL ) {
+        atomic_init( &snapshot->refCount, 1 );
+        snapshot->generation = atomic_fetch_add( &nextGeneration, 1 );
+        clock_gettime( CLOCK_REALTIME, &snapshot->loadedAt );
+        snapshot->changedAt = snapshot->loadedAt;
+        pthread_mutex_init( &snapshot->lock, NULL );
+        snapshot->keySet = ksDeepDup( keySet );
+        if ( snapshot->keySet == NULL ) {
+            pthread_mutex_destroy( &snapshot->lock );
+            free( snapshot );
+            snapshot = NULL;
+        }
+    }
+    return snapshot;
+}
+
+/**
+ * @brief if a new snapshot has the same content as the one it replaces, or as
+ * one an earlier run remembered, then the configuration hasn't really changed since
+ * @param previous  the snapshot it replaces, or NULL if it's the store's first
+ */
+static void carryConfigChange( tConfigSnapshot * snapshot, tConfigSnapshot * previous )
+{
+    if ( previous != NULL ) {
+        if ( hashConfigContent( snapshot ) == hashConfigContent( previous ) ) {
+            snapshot->changedAt = previous->changedAt;
+        }
+    } else {
+        pthread_mutex_lock( &remembered.lock );
+        if ( remembered.count > 0 ) {
+            uint64_t hash = hashConfigContent( snapshot );
+            for ( size_t i = 0; i < remembered.count; ++i ) {
+                if ( remembered.entries[ i ].contentHash == hash ) {
+                    snapshot->changedAt = remembered.entries[ i ].changedAt;
+                    break;
+                }
+            }
+        }
+        pthread_mutex_unlock( &remembered.lock );
+    }
+}
+
+/**
+ * @brief ask libelektra whether anything changed, and if it did, publish a new snapshot.
+ *
+ * Only one thread refreshes at a time. Threads that find a refresh already
+ * in progress carry on with the current snapshot rather than waiting.
+ */
+static void refreshConfigStore( tConfigStore * store )
+{
+    unsigned long epoch  = atomic_load( &refreshEpoch );
+    bool          forced = ( epoch != store->refreshEpoch || store->current == NULL );
+
+    if ( !forced && msSince( &store->lastCheck ) < store->checkInterval ) {
+        return;
+    }
+
+    if ( pthread_mutex_trylock( &store->refreshLock ) != 0 ) {
+        return;
+    }
+
+    store->refreshEpoch = epoch;
+    clock_gettime( CLOCK_MONOTONIC, &store->lastCheck );
+
+    int      changed = 0;
+    uint64_t start   = metricsClock();
+    for ( Key ** parent = store->parents; *parent != NULL && changed >= 0; ++parent ) {
+        int got = kdbGet( store->kdb, store->keySet, *parent );
+        if ( got < 0 ) {
+            logError( "kdbGet of \'%s\' failed", keyName( *parent ) );
+            changed = got;
+        } else if ( got > 0 ) {
+            changed = 1;
+        }
+    }
+    noteTimer( kTimerConfigLoad, start );
+
+    if ( changed > 0 || ( changed == 0 && store->current == NULL ) ) {
+        tConfigSnapshot * snapshot = newConfigSnapshot( store->keySet );
+        if ( snapshot == NULL ) {
+            logError( "unable to snapshot the configuration" );
+        } else {
+            /* only this thread replaces 'current', and it holds the refresh lock */
+            carryConfigChange( snapshot, store->current );
+
+            logInfo( "configuration under \'%s\' changed, now generation %lu",
+                     keyName( store->parents[0] ), snapshot->generation );
+
+            pthread_mutex_lock( &store->lock );
+            tConfigSnapshot * previous = store->current;
+            store->current = snapshot;
+            pthread_mutex_unlock( &store->lock );
+
+            if ( previous != NULL && store->onChange != NULL ) {
+                store->onChange( snapshot, previous );
+            }
+            releaseConfigSnapshot( previous );
+        }
+    }
+
+    pthread_mutex_unlock( &store->refreshLock );
+}
+
+static bool sameRoots( const tConfigStore * store, char * const roots[] )
+{
+    size_t i = 0;
+
+    while ( store->parents[ i ] != NULL && roots[ i ] != NULL
+         && strcmp( keyName( store->parents[ i ] ), roots[ i ] ) == 0 ) {
+        ++i;
+    }
+    return ( store->parents[ i ] == NULL && roots[ i ] == NULL );
+}
+
+/**
+ * @brief open libelektra for the given roots. Nothing is loaded until the first acquire
+ * @return zero if successful, negative errno if not
+ */
+static int openConfigStore( tConfigStore * store, char * const roots[], unsigned long checkInterval )
+{
+    int    result = 0;
+    size_t count  = 0;
+
+    memset( store, 0, sizeof( tConfigStore ) );
+    pthread_mutex_init( &store->refreshLock, NULL );
+    pthread_mutex_init( &store->lock, NULL );
+    store->checkInterval = checkInterval;
+    store->refreshEpoch  = atomic_load( &refreshEpoch );
+
+    while ( roots[ count ] != NULL ) {
+        ++count;
+    }
+    store->parents = calloc( count + 1, sizeof( Key * ) );
+    if ( store->parents == NULL ) {
+        return -ENOMEM;
+    }
+    for ( size_t i = 0; i < count && result == 0; ++i ) {
+        store->parents[ i ] = keyNew( roots[ i ], KEY_END );
+        if ( store->parents[ i ] == NULL ) {
+            logError( "invalid configuration root \'%s\'", roots[ i ] );
+            result = -EINVAL;
+        }
+    }
+
+    if ( result == 0 ) {
+        store->kdb = kdbOpen( NULL, store->parents[0] );
+        logDebug( "kdb = %p for \'%s\'", store->kdb, roots[0] );
+
+        if ( store->kdb == NULL ) {
+            logError( "unable to open libelektra" );
+            result = -EFAULT;
+        } else {
+            store->keySet = ksNew( 0, KS_END );
+            if ( store->keySet == NULL ) {
+                logError( "failed to create a KeySet" );
+                result = -EADDRNOTAVAIL;
+            }
+        }
+    }
+
+    if ( result < 0 ) {
+        releaseConfigStore( store );
+    }
+
+    return result;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief open libelektra. The configuration is loaded when it's first acquired
+ * @param store          the store to initialize
+ * @param rootName       name of the root key to load, e.g. 'system:/config'
+ * @param checkInterval  minimum time between checks for changes, in ms
+ * @return zero if successful, negative errno if not
+ */
+int initConfigStore( tConfigStore * store, const char * rootName, unsigned long checkInterval )
+{
+    char * roots[] = { (char *)rootName, NULL };
+
+    return openConfigStore( store, roots, checkInterval );
+}
+
+void releaseConfigStore( tConfigStore * store )
+{
+    while ( store->scoped != NULL ) {
+        tConfigStore * scoped = store->scoped;
+        store->scoped = scoped->next;
+        releaseConfigStore( scoped );
+        free( scoped );
+    }
+
+    releaseConfigSnapshot( store->current );
+    store->current = NULL;
+
+    if ( store->keySet != NULL ) {
+        ksDel( store->keySet );
+        store->keySet = NULL;
+    }
+    if ( store->kdb != NULL ) {
+        kdbClose( store->kdb, store->parents[0] );
+        store->kdb = NULL;
+    }
+    if ( store->parents != NULL ) {
+        for ( Key ** parent = store->parents; *parent != NULL; ++parent ) {
+            keyDel( *parent );
+        }
+        free( store->parents );
+        store->parents = NULL;
+    }
+}
+
+/**
+ * @brief get a store that loads only the given parts of the configuration.
+ *
+ * Made the first time it's asked for, and kept for as long as 'store' is.
+ * Relative names in templates are still resolved from 'system:/config', so
+ * roots are normally below that.
+ *
+ * @param store  the store for the whole configuration
+ * @param roots  NULL-terminated list of the root keys to load
+ * @return the scoped store, or 'store' itself if 'roots' is empty or a
+ * scoped store couldn't be made
+ */
+tConfigStore * scopedConfigStore( tConfigStore * store, char * const roots[] )
+{
+    tConfigStore * result = store;
+
+    if ( store != NULL && store->kdb != NULL && roots != NULL && roots[0] != NULL ) {
+        pthread_mutex_lock( &store->lock );
+
+        result = store->scoped;
+        while ( result != NULL && !sameRoots( result, roots ) ) {
+            result = result->next;
+        }
+        if ( result == NULL ) {
+            result = calloc( 1, sizeof( tConfigStore ) );
+            if ( result == NULL || openConfigStore( result, roots, store->checkInterval ) != 0 ) {
+                logWarning( "unable to load just \'%s\', using all of the configuration", roots[0] );
+                free( result );
+                result = store;
+            } else {
+                result->onChange = store->onChange;
+                result->next     = store->scoped;
+                store->scoped    = result;
+            }
+        }
+
+        pthread_mutex_unlock( &store->lock );
+    }
+
+    return result;
+}
+
+/**
+ * @brief force the next acquireConfigSnapshot() of each store to check for changes.
+ * Note: async-signal-safe, so may be called from a signal handler.
+ */
+void requestConfigRefresh( void )
+{
+    atomic_fetch_add( &refreshEpoch, 1 );
+}
+
+/**
+ * @brief tell stores that a configuration with this content was last changed
+ * at 'changedAt', e.g. as saved by an earlier run. A store whose first snapshot
+ * has the same content reports that, rather than when it was loaded
+ */
+void rememberConfigChange( uint64_t contentHash, const struct timespec * changedAt )
+{
+    pthread_mutex_lock( &remembered.lock );
+
+    size_t i = 0;
+    while ( i < remembered.count && remembered.entries[ i ].contentHash != contentHash ) {
+        ++i;
+    }
+    if ( i == remembered.count && i < kRememberedConfigChanges ) {
+        remembered.entries[ i ].contentHash = contentHash;
+        remembered.entries[ i ].changedAt   = *changedAt;
+        ++remembered.count;
+    }
+
+    pthread_mutex_unlock( &remembered.lock );
+}
+
+/**
+ * @brief get the latest snapshot of the configuration, checking for changes if due.
+ * @param store the configuration store
+ * @return a reference to the snapshot (release with releaseConfigSnapshot()),
+ *         or NULL if there is no configuration available
+ */
+tConfigSnapshot * acquireConfigSnapshot( tConfigStore * store )
+{
+    tConfigSnapshot * result = NULL;
+
+    if ( store != NULL && store->kdb != NULL ) {
+        refreshConfigStore( store );
+
+        pthread_mutex_lock( &store->lock );
+        result = retainConfigSnapshot( store->current );
+        pthread_mutex_unlock( &store->lock );
+    }
+
+    return result;
+}
+
+/**
+ * @brief get the latest snapshot that's been published, without checking for changes.
+ * For callers too frequent, or too latency-sensitive, to pay for a kdbGet()
+ * @param store the configuration store
+ * @return a reference to the snapshot (release with releaseConfigSnapshot()),
+ *         or NULL if nothing has been loaded yet
+ */
+tConfigSnapshot * peekConfigSnapshot( tConfigStore * store )
+{
+    tConfigSnapshot * result = NULL;
+
+    if ( store != NULL && store->kdb != NULL ) {
+        pthread_mutex_lock( &store->lock );
+        result = retainConfigSnapshot( store->current );
+        pthread_mutex_unlock( &store->lock );
+    }
+
+    return result;
+}
+
+tConfigSnapshot * retainConfigSnapshot( tConfigSnapshot * snapshot )
+{
+    if ( snapshot != NULL ) {
+        atomic_fetch_add( &snapshot->refCount, 1 );
+    }
+    return snapshot;
+}
+
+void releaseConfigSnapshot( tConfigSnapshot * snapshot )
+{
+    if ( snapshot != NULL && atomic_fetch_sub( &snapshot->refCount, 1 ) == 1 ) {
+        tConfigView * view = snapshot->idle;
+        while ( view != NULL ) {
+            tConfigView * next = view->next;
+            freeKeyMemo( view->memo );
+            freeArrayIndex( view->arrays );
+            ksDel( view->keySet );
+            free( view );
+            view = next;
+        }
+        ksDel( snapshot->keySet );
+        pthread_mutex_destroy( &snapshot->lock );
+        free( snapshot );
+    }
+}
+
+/**
+ * @brief borrow a private copy of the snapshot's KeySet.
+ *
+ * Copies are made on demand, and reused once they have been checked in,
+ * so there are only ever as many copies as there were concurrent renders.
+ *
+ * @param snapshot the snapshot to borrow from
+ * @return a view for the caller's exclusive use, or NULL if out of memory
+ */
+tConfigView * checkoutConfigView( tConfigSnapshot * snapshot )
+{
+    tConfigView * view = NULL;
+
+    if ( snapshot != NULL ) {
+        pthread_mutex_lock( &snapshot->lock );
+
+        view = snapshot->idle;
+        if ( view != NULL ) {
+            snapshot->idle = view->next;
+        } else {
+            view = calloc( 1, sizeof( tConfigView ) );
+            if ( view != NULL ) {
+                view->keySet = ksDeepDup( snapshot->keySet );
+                if ( view->keySet == NULL ) {
+                    free( view );
+                    view = NULL;
+                } else {
+                    /* without these, tags are just resolved (and arrays
+                     * stepped through) the long way */
+                    view->memo   = newKeyMemo();
+                    view->arrays = buildArrayIndex( view->keySet );
+                }
+            }
+        }
+
+        pthread_mutex_unlock( &snapshot->lock );
+    }
+
+    return view;
+}
+
+void checkinConfigView( tConfigSnapshot * snapshot, tConfigView * view )
+{
+    if ( snapshot != NULL && view != NULL ) {
+        pthread_mutex_lock( &snapshot->lock );
+        view->next     = snapshot->idle;
+        snapshot->idle = view;
+        pthread_mutex_unlock( &snapshot->lock );
+    }
+}
+
+/**
+ * @brief a hash of the current values of some keys, to tell whether any have changed
+ * @param snapshot  the snapshot to look the keys up in
+ * @param names     NULL-terminated list of key names
+ * @return the hash. Missing keys contribute to it too, differently from empty ones
+ */
+uint64_t hashConfigValues( tConfigSnapshot * snapshot, char * const names[] )
+{
+    uint64_t      hash = kFNVOffsetBasis;
+    tConfigView * view = checkoutConfigView( snapshot );
+
+    if ( view != NULL ) {
+        for ( int i = 0; names[ i ] != NULL; ++i ) {
+            Key *        key   = ksLookupByName( view->keySet, names[ i ], 0 );
+            const char * value = ( key != NULL ) ? keyString( key ) : NULL;
+
+            hash = fnvMix( hash, ( value != NULL ) ? 1 : 0 );
+            hash = fnvAddString( hash, ( value != NULL ) ? value : "" );
+            /* separate the values, so 'ab','c' differs from 'a','bc' */
+            hash = fnvMix( hash, 0xff );
+        }
+        checkinConfigView( snapshot, view );
+    }
+
+    return hash;
+}
+
+/**
+ * @brief a hash of everything in a snapshot, which (unlike its generation)
+ * means the same thing from one run of templatefs to the next
+ * @return the hash, never zero
+ */
+uint64_t hashConfigContent( tConfigSnapshot * snapshot )
+{
+    uint64_t result;
+
+    pthread_mutex_lock( &snapshot->lock );
+
+    if ( snapshot->contentHash == 0 ) {
+        /* of every name, value and 'array' marker */
+        uint64_t hash  = kFNVOffsetBasis;
+        ssize_t  count = ksGetSize( snapshot->keySet );
+
+        for ( elektraCursor i = 0; i < count; ++i ) {
+            const Key *  key   = ksAtCursor( snapshot->keySet, i );
+            const byte * value = keyValue( key );
+            ssize_t      size  = keyGetValueSize( key );
+
+            hash = fnvAddString( hash, keyName( key ) );
+            hash = fnvMix( hash, 0xff );
+            /* the size first, so where one value ends is never ambiguous */
+            hash = fnvMix( hash, (uint64_t)size );
+            if ( value != NULL && size > 0 ) {
+                hash = fnvAddBytes( hash, value, size );
+            }
+            hash = fnvMix( hash, ( keyGetMeta( key, "array" ) != NULL ) ? 0xfe : 0xfd );
+        }
+        snapshot->contentHash = ( hash != 0 ) ? hash : 1;
+    }
+    result = snapshot->contentHash;
+
+    pthread_mutex_unlock( &snapshot->lock );
+
+    return result;
+}
+
+/**
+ * @brief do two keys, with the same name, differ in anything a render could see?
+ */
+static bool isKeyChanged( const Key * a, const Key * b )
+{
+    ssize_t size = keyGetValueSize( a );
+
+    return ( size != keyGetValueSize( b )
+          || ( size > 0 && memcmp( keyValue( a ), keyValue( b ), size ) != 0 )
+          || ( keyGetMeta( a, "array" ) == NULL ) != ( keyGetMeta( b, "array" ) == NULL ) );
+}
+
+static int compareNames( const void * a, const void * b )
+{
+    return strcmp( *(char * const *)a, *(char * const *)b );
+}
+
+/**
+ * @brief add a name to the list of changes
+ * @return false if there isn't enough memory
+ */
+static bool addChange( tConfigChanges * changes, size_t * capacity, const Key * key )
+{
+    bool result = true;
+
+    if ( changes->count == *capacity ) {
+        size_t  grown = ( *capacity == 0 ) ? kInitialChanges : *capacity * 2;
+        char ** names = realloc( changes->names, grown * sizeof( char * ) );
+        if ( names == NULL ) {
+            result = false;
+        } else {
+            changes->names = names;
+            *capacity      = grown;
+        }
+    }
+    if ( result ) {
+        changes->names[ changes->count ] = strdup( keyName( key ) );
+        if ( changes->names[ changes->count ] == NULL ) {
+            result = false;
+        } else {
+            ++changes->count;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief list the keys that were added, removed or changed between two snapshots
+ *
+ * Both KeySets are sorted, so they're walked side by side. The master
+ * copies are read directly, under their locks, rather than paying for a
+ * view of each. Nothing else ever holds both locks, so the order's moot.
+ *
+ * @return the names that differ, sorted with strcmp(), to be freed with
+ * freeConfigChanges(). NULL if they couldn't be listed
+ */
+tConfigChanges * diffConfigSnapshots( tConfigSnapshot * before, tConfigSnapshot * after )
+{
+    tConfigChanges * result = NULL;
+
+    if ( before == NULL || after == NULL || before == after ) {
+        return NULL;
+    }
+
+    result = calloc( 1, sizeof( tConfigChanges ) );
+    if ( result != NULL ) {
+        pthread_mutex_lock( &before->lock );
+        pthread_mutex_lock( &after->lock );
+
+        size_t        capacity = 0;
+        bool          ok       = true;
+        elektraCursor i        = 0;
+        elektraCursor j        = 0;
+        ssize_t       iCount   = ksGetSize( before->keySet );
+        ssize_t       jCount   = ksGetSize( after->keySet );
+
+        while ( ok && ( i < iCount || j < jCount ) ) {
+            Key * a = ( i < iCount ) ? ksAtCursor( before->keySet, i ) : NULL;
+            Key * b = ( j < jCount ) ? ksAtCursor( after->keySet, j ) : NULL;
+            int   order = ( a == NULL ) ? 1 : ( b == NULL ) ? -1 : keyCmp( a, b );
+
+            if ( order < 0 ) {
+                /* removed */
+                ok = addChange( result, &capacity, a );
+                ++i;
+            } else if ( order > 0 ) {
+                /* added */
+                ok = addChange( result, &capacity, b );
+                ++j;
+            } else {
+                if ( isKeyChanged( a, b ) ) {
+                    ok = addChange( result, &capacity, a );
+                }
+                ++i;
+                ++j;
+            }
+        }
+
+        pthread_mutex_unlock( &after->lock );
+        pthread_mutex_unlock( &before->lock );
+
+        if ( !ok ) {
+            freeConfigChanges( result );
+            result = NULL;
+        } else {
+            /* the KeySets' order isn't quite strcmp()'s */
+            qsort( result->names, result->count, sizeof( char * ), compareNames );
+            logDebug( "%lu keys changed between generations %lu and %lu",
+                      result->count, before->generation, after->generation );
+        }
+    }
+
+    return result;
+}
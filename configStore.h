@@ -0,0 +1,88 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_CONFIGSTORE_H
+#define TEMPLATEFS_CONFIGSTORE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <elektra.h>
+
+/**
+ * @brief a private copy of a snapshot's KeySet, for use by one render at a time.
+ *
+ * libelektra's KeySets and Keys aren't thread-safe (even reads touch
+ * reference counts), so concurrent renders never share a KeySet.
+ */
+typedef struct sConfigView {
+    struct sConfigView * next;      ///< next idle view of the same snapshot
+    KeySet *             keySet;
+    struct sKeyMemo *    memo;      ///< tags already resolved against 'keySet', see keyMemo.c. May be NULL
+    struct sArrayIndex * arrays;    ///< the elements of each array in 'keySet', see arrayIndex.c. May be NULL
+} tConfigView;
+
+/**
+ * @brief an immutable copy of the configuration, as of one generation
+ */
+typedef struct sConfigSnapshot {
+    atomic_uint          refCount;
+    unsigned long        generation; ///< unique to this content, increases with each change
+    struct timespec      loadedAt;   ///< when this content was loaded (CLOCK_REALTIME)
+    struct timespec      changedAt;  ///< when the configuration last changed to this content (CLOCK_REALTIME).
+                                     ///< Carried over from earlier snapshots, and runs, with the same content
+
+    pthread_mutex_t      lock;       ///< protects the fields below
+    KeySet *             keySet;     ///< master copy, only used to make views
+    tConfigView *        idle;       ///< views not currently checked out
+    uint64_t             contentHash; ///< see hashConfigContent(). Zero until it's first needed
+} tConfigSnapshot;
+
+/**
+ * @brief a long-lived connection to libelektra, and the latest snapshot
+ * of the part of the configuration it loads
+ */
+typedef struct sConfigStore {
+    pthread_mutex_t      refreshLock; ///< held while kdbGet() is running
+    pthread_mutex_t      lock;        ///< protects 'current' and 'scoped'
+    KDB *                kdb;
+    Key **               parents;     ///< NULL-terminated list of the root keys it loads
+    KeySet *             keySet;      ///< refreshed in place by kdbGet()
+    tConfigSnapshot *    current;     ///< NULL until it's first needed
+    struct timespec      lastCheck;   ///< when kdbGet() was last called (CLOCK_MONOTONIC)
+    unsigned long        checkInterval; ///< minimum ms between calls to kdbGet()
+    unsigned long        refreshEpoch;  ///< the last forced refresh it has seen
+
+    struct sConfigStore * scoped;     ///< stores for just part of this one's configuration
+    struct sConfigStore * next;       ///< the next of its parent's scoped stores
+
+    /** optional, called (by the refreshing thread) after a changed configuration is published */
+    void              (* onChange)( tConfigSnapshot * snapshot, tConfigSnapshot * previous );
+} tConfigStore;
+
+#define kDefaultConfigCheckInterval  1000
+#define kRememberedConfigChanges     64      // most change times carried over from an earlier run
+
+int               initConfigStore( tConfigStore * store, const char * rootName, unsigned long checkInterval );
+void              releaseConfigStore( tConfigStore * store );
+tConfigStore *    scopedConfigStore( tConfigStore * store, char * const roots[] );
+void              requestConfigRefresh( void );
+void              rememberConfigChange( uint64_t contentHash, const struct timespec * changedAt );
+
+tConfigSnapshot * newConfigSnapshot( KeySet * keySet );
+tConfigSnapshot * acquireConfigSnapshot( tConfigStore * store );
+tConfigSnapshot * peekConfigSnapshot( tConfigStore * store );
+tConfigSnapshot * retainConfigSnapshot( tConfigSnapshot * snapshot );
+void              releaseConfigSnapshot( tConfigSnapshot * snapshot );
+
+tConfigView *     checkoutConfigView( tConfigSnapshot * snapshot );
+void              checkinConfigView( tConfigSnapshot * snapshot, tConfigView * view );
+
+uint64_t          hashConfigValues( tConfigSnapshot * snapshot, char * const names[] );
+uint64_t          hashConfigContent( tConfigSnapshot * snapshot );
+struct sConfigChanges * diffConfigSnapshots( tConfigSnapshot * before, tConfigSnapshot * after );
+
+#endif //TEMPLATEFS_CONFIGSTORE_H
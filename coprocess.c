@@ -0,0 +1,498 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* Executable templates that set 'worker = yes' in their settings file are
+ * run as long-lived workers rather than once per open, so they only pay
+ * for exec, dynamic linking and interpreter start-up once. Each template
+ * has a small pool of them (up to 'workers', default kDefaultWorkers).
+ *
+ * A worker is started with the same arguments as a one-shot template,
+ * plus TEMPLATEFS_WORKER=1 in its environment. Its stdin and stdout are
+ * both connected to one end of a socketpair, and stderr is inherited.
+ * It loops reading requests from stdin and writing responses to stdout,
+ * and should exit when it reads EOF.
+ *
+ * A request is a few lines, ending with an empty one:
+ *
+ *     TEMPLATE <absolute path of the template>
+ *     MOUNT <absolute path the output will appear at>
+ *     ENV <name>=<value>              (zero or more)
+ *
+ * The ENV lines are changes relative to the environment the worker was
+ * started with. Nothing that identifies who's opening the template is sent:
+ * its output is shared by everyone who opens it (see outputCache.c), so it
+ * mustn't depend on that, any more than a one-shot run's may.
+ *
+ * The response is either 'OK <length>' followed by a newline and exactly
+ * <length> bytes of output, or 'ERROR <message>' and a newline. Any other
+ * response, or the worker exiting, retires that worker. So does a response
+ * that takes longer than the template's timeout, or is longer than its
+ * maxoutput (see execEngine.h). Without either, a worker is still retired
+ * if it stalls for kWorkerStallTimeout, or announces more than kMaxWorkerFrame. */
+
+#include "common.h"
+#include "templatefs.h"
+#include "coprocess.h"
+#include "logStuff.h"
+
+#include <ctype.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define kMaxWorkerFrame     (1024UL * 1024 * 1024)  // longest response accepted, even with no maxoutput
+#define kWorkerStallTimeout 60000                   // ms without any data before a worker with no timeout is given up on
+
+/**
+ * @brief one long-lived worker process
+ */
+typedef struct sWorker {
+    struct sWorker *  next;        ///< next idle worker in the same pool
+    pid_t             pid;
+    int               fd;          ///< our end of the socketpair
+    unsigned long     generation;  ///< of its pool, when it was started
+} tWorker;
+
+/**
+ * @brief the workers for one template
+ */
+typedef struct sWorkerPool {
+    struct sWorkerPool * next;
+    char *               path;          ///< path of the template, relative to the mount
+    pthread_cond_t       available;     ///< signalled when a worker becomes idle, or a slot frees up
+    tWorker *            idle;
+    unsigned int         count;         ///< number of workers, idle or busy
+    unsigned long        generation;    ///< bumped to retire the current workers
+} tWorkerPool;
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static tWorkerPool *   pools    = NULL;
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief find the pool for 'path', creating it if necessary. Caller must hold the lock.
+ */
+static tWorkerPool * findPool( const char * path, bool create )
+{
+    tWorkerPool * pool = pools;
+
+    while ( pool != NULL && strcmp( pool->path, path ) != 0 ) {
+        pool = pool->next;
+    }
+
+    if ( pool == NULL && create ) {
+        pool = calloc( 1, sizeof( tWorkerPool ) );
+        if ( pool != NULL ) {
+            pool->path = strdup( path );
+            if ( pool->path == NULL ) {
+                free( pool );
+                pool = NULL;
+            } else {
+                pthread_cond_init( &pool->available, NULL );
+                pool->next = pools;
+                pools      = pool;
+            }
+        }
+    }
+
+    return pool;
+}
+
+/**
+ * @brief start a new worker for a template
+ * @return the worker, or NULL if it couldn't be started
+ */
+static tWorker * startWorker( const char * templatePath, const char * mountPath )
+{
+    tWorker * worker = calloc( 1, sizeof( tWorker ) );
+    int       sv[2];
+
+    if ( worker == NULL ) {
+        return NULL;
+    }
+
+    if ( socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv ) != 0 ) {
+        logError( "unable to create a socketpair for a worker" );
+        free( worker );
+        return NULL;
+    }
+
+    /* the worker's environment is ours, plus TEMPLATEFS_WORKER */
+    size_t envCount = 0;
+    while ( globals.envp[ envCount ] != NULL ) {
+        ++envCount;
+    }
+    char ** envp = calloc( envCount + 2, sizeof( char * ) );
+    char *  argv[3] = { (char *)templatePath, (char *)mountPath, NULL };
+    int     err     = ENOMEM;
+
+    if ( envp != NULL ) {
+        memcpy( envp, globals.envp, envCount * sizeof( char * ) );
+        envp[ envCount ] = "TEMPLATEFS_WORKER=1";
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init( &actions );
+        posix_spawn_file_actions_adddup2( &actions, sv[1], STDIN_FILENO );
+        posix_spawn_file_actions_adddup2( &actions, sv[1], STDOUT_FILENO );
+
+        /* as spawnChild() in execEngine.c: its own process group, so stopping
+         * it stops everything it started, and none of the signal state of the
+         * fuse or pool thread that happened to start it */
+        posix_spawnattr_t attr;
+        sigset_t          mask;
+        posix_spawnattr_init( &attr );
+        posix_spawnattr_setpgroup( &attr, 0 );
+        sigemptyset( &mask );
+        posix_spawnattr_setsigmask( &attr, &mask );
+        sigaddset( &mask, SIGPIPE );
+        posix_spawnattr_setsigdefault( &attr, &mask );
+        posix_spawnattr_setflags( &attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF );
+
+        err = posix_spawn( &worker->pid, templatePath, &actions, &attr, argv, envp );
+        posix_spawnattr_destroy( &attr );
+        posix_spawn_file_actions_destroy( &actions );
+        free( envp );
+    }
+    close( sv[1] );
+
+    if ( err != 0 ) {
+        logError( "unable to start a worker for \'%s\' (%d)", templatePath, err );
+        close( sv[0] );
+        free( worker );
+        worker = NULL;
+    } else {
+        logDebug( "started worker %d for \'%s\'", worker->pid, templatePath );
+        worker->fd = sv[0];
+    }
+
+    return worker;
+}
+
+/**
+ * @brief make a worker exit, giving it a moment to do so cleanly.
+ * Anything it started in its process group goes with it
+ */
+static void terminateWorker( tWorker * worker )
+{
+    /* EOF on its stdin should be enough */
+    close( worker->fd );
+
+    int status;
+    for ( int i = 0; i < 10 && waitpid( worker->pid, &status, WNOHANG ) == 0; ++i ) {
+        if ( i == 0 ) {
+            kill( -worker->pid, SIGTERM );
+        }
+        nanosleep( &(struct timespec){ 0, 10 * 1000 * 1000 }, NULL );
+    }
+    if ( waitpid( worker->pid, &status, WNOHANG ) == 0 ) {
+        kill( -worker->pid, SIGKILL );
+        waitpid( worker->pid, &status, 0 );
+    } else {
+        /* it's gone, but whatever it left behind in its group may not be */
+        kill( -worker->pid, SIGKILL );
+    }
+    errno = 0;
+
+    logDebug( "worker %d stopped", worker->pid );
+    free( worker );
+}
+
+static int sendAll( int fd, const char * data, size_t length )
+{
+    while ( length > 0 ) {
+        ssize_t sent = send( fd, data, length, MSG_NOSIGNAL );
+        if ( sent < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return -errno;
+        }
+        data   += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+static int sendRequest( tWorker * worker,
+                        const char * templatePath,
+                        const char * mountPath,
+                        char * const envDelta[] )
+{
+    int    result;
+    char * request = NULL;
+    size_t length  = 0;
+    FILE * fp      = open_memstream( &request, &length );
+
+    if ( fp == NULL ) {
+        return -ENOMEM;
+    }
+
+    fprintf( fp, "TEMPLATE %s\nMOUNT %s\n", templatePath, mountPath );
+    for ( int i = 0; envDelta != NULL && envDelta[ i ] != NULL; ++i ) {
+        fprintf( fp, "ENV %s\n", envDelta[ i ] );
+    }
+    fputc( '\n', fp );
+    fclose( fp );
+
+    result = sendAll( worker->fd, request, length );
+    free( request );
+
+    return result;
+}
+
+/**
+ * @brief recv() that gives up at a deadline. Without one, it still gives up
+ * if nothing at all arrives for kWorkerStallTimeout, so a stalled worker
+ * can't hold the render thread forever
+ * @return as recv(), or -1 with errno set to ETIMEDOUT
+ */
+static ssize_t recvBefore( int fd, void * data, size_t length, const tExecLimits * limits, const struct timespec * deadline )
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int           ready;
+
+    do {
+        long wait = ( limits->timeout != 0 ) ? remainingTime( deadline ) : kWorkerStallTimeout;
+        ready = poll( &pfd, 1, (int)wait );
+    } while ( ready < 0 && errno == EINTR );
+
+    if ( ready == 0 ) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return recv( fd, data, length, 0 );
+}
+
+/**
+ * @brief read one framed response
+ * @return zero if successful, negative errno if not
+ */
+static int readResponse( tWorker * worker, const tExecLimits * limits, byte ** buffer, size_t * size )
+{
+    struct timespec deadline;
+    setDeadline( &deadline, limits->timeout );
+
+    char    header[ 256 ];
+    size_t  used = 0;
+    char *  eol  = NULL;
+
+    /* read until we have the whole header line. May read some of the body too */
+    while ( eol == NULL ) {
+        if ( used >= sizeof( header ) - 1 ) {
+            return -EPROTO;
+        }
+        ssize_t got = recvBefore( worker->fd, &header[ used ], sizeof( header ) - 1 - used, limits, &deadline );
+        if ( got < 0 && errno == EINTR ) {
+            continue;
+        }
+        if ( got <= 0 ) {
+            return ( got == 0 ) ? -EPIPE : -errno;
+        }
+        used += got;
+        header[ used ] = '\0';
+        eol = memchr( header, '\n', used );
+    }
+    *eol = '\0';
+
+    if ( strncmp( header, "ERROR", 5 ) == 0 ) {
+        logError( "worker %d: %s", worker->pid, header );
+        return -EIO;
+    }
+
+    char *             end;
+    unsigned long long length;
+    errno = 0;
+    if ( strncmp( header, "OK ", 3 ) != 0 || !isdigit( (unsigned char)header[3] )
+      || ( length = strtoull( &header[3], &end, 10 ), *end != '\0' || errno == ERANGE ) ) {
+        logError( "worker %d sent an invalid response", worker->pid );
+        return -EPROTO;
+    }
+    /* 'length + 1' is allocated, so this also keeps that from wrapping */
+    size_t maxFrame = ( limits->maxOutput != 0 && limits->maxOutput < kMaxWorkerFrame ) ? limits->maxOutput
+                                                                                        : kMaxWorkerFrame;
+    if ( length > maxFrame ) {
+        logError( "worker %d sent %llu bytes, more than the %zu allowed", worker->pid, length, maxFrame );
+        return -EFBIG;
+    }
+
+    byte * data = malloc( length + 1 );
+    if ( data == NULL ) {
+        return -ENOMEM;
+    }
+
+    /* whatever followed the header is the start of the body */
+    size_t have = used - ( eol + 1 - header );
+    if ( have > length ) {
+        free( data );
+        return -EPROTO;
+    }
+    memcpy( data, eol + 1, have );
+
+    while ( have < length ) {
+        ssize_t got = recvBefore( worker->fd, &data[ have ], length - have, limits, &deadline );
+        if ( got < 0 && errno == EINTR ) {
+            continue;
+        }
+        if ( got <= 0 ) {
+            free( data );
+            return ( got == 0 ) ? -EPIPE : -errno;
+        }
+        have += got;
+    }
+    data[ length ] = '\0';
+
+    *buffer = data;
+    *size   = length;
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief have one of a template's workers produce its output, starting one if necessary
+ * @param path          path of the template, relative to the mount
+ * @param templatePath  absolute path of the template
+ * @param mountPath     absolute path the output will appear at
+ * @param maxWorkers    maximum number of workers for this template
+ * @param envDelta      NULL-terminated 'name=value' changes to the environment, or NULL
+ * @param limits        how long to wait for the output, and how much to accept
+ * @param buffer        receives the output (allocated with malloc)
+ * @param size          receives the length of the output
+ * @return zero if successful, negative errno if not
+ */
+int runWorker( const char * path,
+               const char * templatePath,
+               const char * mountPath,
+               unsigned int maxWorkers,
+               char * const envDelta[],
+               const tExecLimits * limits,
+               byte ** buffer,
+               size_t * size )
+{
+    int       result = 0;
+    tWorker * worker = NULL;
+
+    pthread_mutex_lock( &poolLock );
+
+    tWorkerPool * pool = findPool( path, true );
+    if ( pool == NULL ) {
+        result = -ENOMEM;
+    }
+    while ( result == 0 && worker == NULL ) {
+        if ( pool->idle != NULL ) {
+            worker     = pool->idle;
+            pool->idle = worker->next;
+        } else if ( pool->count < maxWorkers ) {
+            unsigned long generation = pool->generation;
+            ++pool->count;
+
+            pthread_mutex_unlock( &poolLock );
+            worker = startWorker( templatePath, mountPath );
+            pthread_mutex_lock( &poolLock );
+
+            if ( worker == NULL ) {
+                --pool->count;
+                pthread_cond_signal( &pool->available );
+                result = -ECHILD;
+            } else {
+                worker->generation = generation;
+            }
+        } else {
+            pthread_cond_wait( &pool->available, &poolLock );
+        }
+    }
+
+    pthread_mutex_unlock( &poolLock );
+
+    if ( worker != NULL ) {
+        result = sendRequest( worker, templatePath, mountPath, envDelta );
+        if ( result == 0 ) {
+            result = readResponse( worker, limits, buffer, size );
+            if ( result == -ETIMEDOUT ) {
+                logError( "worker %d for \'%s\' didn't respond within %lu ms", worker->pid, path,
+                          ( limits->timeout != 0 ) ? limits->timeout : (unsigned long)kWorkerStallTimeout );
+            }
+        }
+
+        pthread_mutex_lock( &poolLock );
+        bool keep = ( result == 0 && worker->generation == pool->generation );
+        if ( keep ) {
+            worker->next = pool->idle;
+            pool->idle   = worker;
+        } else {
+            --pool->count;
+        }
+        pthread_cond_signal( &pool->available );
+        pthread_mutex_unlock( &poolLock );
+
+        if ( !keep ) {
+            terminateWorker( worker );
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief stop a template's workers, e.g. because it changed.
+ * Idle workers are stopped now, busy ones when they finish.
+ */
+void retireWorkers( const char * path )
+{
+    tWorker * retired = NULL;
+
+    pthread_mutex_lock( &poolLock );
+
+    tWorkerPool * pool = findPool( path, false );
+    if ( pool != NULL ) {
+        ++pool->generation;
+        retired     = pool->idle;
+        pool->idle  = NULL;
+        for ( tWorker * worker = retired; worker != NULL; worker = worker->next ) {
+            --pool->count;
+        }
+        pthread_cond_broadcast( &pool->available );
+    }
+
+    pthread_mutex_unlock( &poolLock );
+
+    while ( retired != NULL ) {
+        tWorker * next = retired->next;
+        terminateWorker( retired );
+        retired = next;
+    }
+}
+
+/**
+ * @brief stop every worker, and discard the pools. Nothing may be using them.
+ */
+void stopAllWorkers( void )
+{
+    pthread_mutex_lock( &poolLock );
+    tWorkerPool * pool = pools;
+    pools = NULL;
+    pthread_mutex_unlock( &poolLock );
+
+    while ( pool != NULL ) {
+        tWorkerPool * next = pool->next;
+
+        while ( pool->idle != NULL ) {
+            tWorker * worker = pool->idle;
+            pool->idle = worker->next;
+            terminateWorker( worker );
+        }
+        pthread_cond_destroy( &pool->available );
+        free( pool->path );
+        free( pool );
+
+        pool = next;
+    }
+}
@@ -0,0 +1,21 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_COPROCESS_H
+#define TEMPLATEFS_COPROCESS_H
+
+#include "execEngine.h"
+
+int  runWorker( const char * path,
+                const char * templatePath,
+                const char * mountPath,
+                unsigned int maxWorkers,
+                char * const envDelta[],
+                const tExecLimits * limits,
+                byte ** buffer,
+                size_t * size );
+void retireWorkers( const char * path );
+void stopAllWorkers( void );
+
+#endif //TEMPLATEFS_COPROCESS_H
@@ -0,0 +1,269 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* Which keys a rendered template was made from, so a change to the
+ * configuration only invalidates the renderings that read something that
+ * changed, rather than every one of them.
+ *
+ * While rendering, each key name a tag resolves to (or would have, had it
+ * existed) is recorded, along with the base key of each array a section
+ * walks through. An array is recorded as a prefix, so adding, removing or
+ * changing any of its elements counts as a change to it.
+ *
+ * The recorder's set lives in the render's arena. Once the render is done
+ * it's copied out into a single sorted block, which the render cache keeps
+ * with the rendering. If anything goes wrong while recording, there is no
+ * block, and the rendering is treated as depending on everything. */
+
+#include "common.h"
+#include "dependencies.h"
+
+#include <stdint.h>
+
+typedef struct {
+    const char *  name;     ///< NULL if the slot is empty
+    uint64_t      hash;
+    bool          prefix;   ///< everything below 'name' too
+} tRecorded;
+
+struct sDependencyRecorder {
+    tArena *     arena;
+    tRecorded *  slots;
+    size_t       slotCount;     ///< always a power of two
+    size_t       count;
+    size_t       nameBytes;     ///< total length of the names, including their terminators
+    bool         overflowed;    ///< lost track, so it depends on everything
+};
+
+typedef struct {
+    const char *  name;
+    bool          prefix;
+} tDependency;
+
+struct sDependencies {
+    size_t        count;
+    size_t        size;         ///< of the whole block, in bytes
+    tDependency   list[];       ///< sorted by name. The names follow the list, in the same block
+};
+
+#define kInitialRecorderSlots  64
+
+// ------------------------------------------------------------------------------
+
+static tRecorded * findSlot( tRecorded * slots, size_t slotCount, const char * name, uint64_t hash )
+{
+    size_t slot = hash & ( slotCount - 1 );
+
+    while ( slots[ slot ].name != NULL
+         && ( slots[ slot ].hash != hash || strcmp( slots[ slot ].name, name ) != 0 ) ) {
+        slot = ( slot + 1 ) & ( slotCount - 1 );
+    }
+    return &slots[ slot ];
+}
+
+/**
+ * @brief double the number of slots, to keep the probes short. The old
+ * slots stay in the arena until it's reset
+ */
+static bool growRecorder( tDependencyRecorder * recorder )
+{
+    bool        result    = false;
+    size_t      slotCount = ( recorder->slotCount == 0 ) ? kInitialRecorderSlots : recorder->slotCount * 2;
+    tRecorded * slots     = arenaAlloc( recorder->arena, slotCount * sizeof( tRecorded ) );
+
+    if ( slots != NULL ) {
+        memset( slots, 0, slotCount * sizeof( tRecorded ) );
+        for ( size_t i = 0; i < recorder->slotCount; ++i ) {
+            if ( recorder->slots[ i ].name != NULL ) {
+                *findSlot( slots, slotCount, recorder->slots[ i ].name, recorder->slots[ i ].hash ) = recorder->slots[ i ];
+            }
+        }
+        recorder->slots     = slots;
+        recorder->slotCount = slotCount;
+        result = true;
+    }
+    return result;
+}
+
+static int compareDependencies( const void * a, const void * b )
+{
+    return strcmp( ((const tDependency *)a)->name, ((const tDependency *)b)->name );
+}
+
+/**
+ * @brief does 'name' start with 'prefix', as a key name, i.e. is it the prefix itself or below it?
+ */
+static inline bool isBelow( const char * name, const char * prefix, size_t length )
+{
+    return ( strncmp( name, prefix, length ) == 0 && ( name[ length ] == '\0' || name[ length ] == '/' ) );
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @param arena  where the recorder and what it records are allocated
+ * @return a new, empty recorder, or NULL if there isn't enough memory
+ */
+tDependencyRecorder * newDependencyRecorder( tArena * arena )
+{
+    tDependencyRecorder * result = arenaAlloc( arena, sizeof( tDependencyRecorder ) );
+
+    if ( result != NULL ) {
+        memset( result, 0, sizeof( tDependencyRecorder ) );
+        result->arena = arena;
+        if ( !growRecorder( result ) ) {
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief note that the render read the key 'name', or tried to
+ * @param recorder  may be NULL, in which case nothing is recorded
+ * @param name      the full name of the key. Copied, if it's new
+ * @param prefix    true if everything below 'name' matters too
+ */
+void recordDependency( tDependencyRecorder * recorder, const char * name, bool prefix )
+{
+    if ( recorder == NULL || recorder->overflowed || name == NULL ) {
+        return;
+    }
+
+    uint64_t    hash = hashString( name );
+    tRecorded * slot = findSlot( recorder->slots, recorder->slotCount, name, hash );
+
+    if ( slot->name != NULL ) {
+        /* already recorded. A prefix covers the key itself, too */
+        slot->prefix = slot->prefix || prefix;
+    } else if ( recorder->count >= kMaxDependencies ) {
+        recorder->overflowed = true;
+    } else {
+        size_t length = strlen( name ) + 1;
+        char * copy   = arenaAlloc( recorder->arena, length );
+
+        if ( copy == NULL ) {
+            recorder->overflowed = true;
+        } else {
+            memcpy( copy, name, length );
+            slot->name   = copy;
+            slot->hash   = hash;
+            slot->prefix = prefix;
+            recorder->nameBytes += length;
+
+            /* keep it no more than half full */
+            if ( ++recorder->count * 2 > recorder->slotCount && !growRecorder( recorder ) ) {
+                recorder->overflowed = true;
+            }
+        }
+    }
+}
+
+/**
+ * @brief copy what was recorded out of the arena, before it's reset
+ * @return the sorted dependencies, to be freed with freeDependencies(), or
+ * NULL if they aren't known (and the render must be assumed to depend on everything)
+ */
+tDependencies * finishDependencies( tDependencyRecorder * recorder )
+{
+    tDependencies * result = NULL;
+
+    if ( recorder != NULL && !recorder->overflowed ) {
+        size_t size = sizeof( tDependencies ) + recorder->count * sizeof( tDependency ) + recorder->nameBytes;
+
+        result = malloc( size );
+        if ( result != NULL ) {
+            char * names = (char *) &result->list[ recorder->count ];
+
+            result->count = 0;
+            result->size  = size;
+            for ( size_t i = 0; i < recorder->slotCount; ++i ) {
+                const tRecorded * slot = &recorder->slots[ i ];
+                if ( slot->name != NULL ) {
+                    size_t length = strlen( slot->name ) + 1;
+                    memcpy( names, slot->name, length );
+
+                    result->list[ result->count ].name   = names;
+                    result->list[ result->count ].prefix = slot->prefix;
+                    ++result->count;
+                    names += length;
+                }
+            }
+            qsort( result->list, result->count, sizeof( tDependency ), compareDependencies );
+        }
+    }
+    return result;
+}
+
+void freeDependencies( tDependencies * dependencies )
+{
+    free( dependencies );
+}
+
+/**
+ * @return the memory used by 'dependencies', in bytes
+ */
+size_t dependenciesSize( const tDependencies * dependencies )
+{
+    return ( dependencies != NULL ) ? dependencies->size : 0;
+}
+
+/**
+ * @brief did any key a render read change?
+ * @param dependencies  what the render read, or NULL if that isn't known
+ * @param changes       what changed, or NULL if that isn't known
+ * @return true if any of 'changes' is one of 'dependencies', or below one of its prefixes
+ */
+bool dependsOnChanges( const tDependencies * dependencies, const tConfigChanges * changes )
+{
+    bool result = false;
+
+    if ( dependencies == NULL || changes == NULL ) {
+        return true;
+    }
+
+    for ( size_t i = 0; i < dependencies->count && !result; ++i ) {
+        const tDependency * dependency = &dependencies->list[ i ];
+
+        /* the first changed name that isn't before it */
+        size_t low  = 0;
+        size_t high = changes->count;
+        while ( low < high ) {
+            size_t middle = low + ( high - low ) / 2;
+            if ( strcmp( changes->names[ middle ], dependency->name ) < 0 ) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+
+        if ( !dependency->prefix ) {
+            result = ( low < changes->count && strcmp( changes->names[ low ], dependency->name ) == 0 );
+        } else {
+            /* names below the prefix follow it, though maybe not
+             * immediately (e.g. 'a/b-c' sorts between 'a/b' and 'a/b/c') */
+            size_t length = strlen( dependency->name );
+            for ( size_t j = low;
+                  j < changes->count && !result && strncmp( changes->names[ j ], dependency->name, length ) == 0;
+                  ++j ) {
+                result = isBelow( changes->names[ j ], dependency->name, length );
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief free the result of diffConfigSnapshots(). 'changes' may be NULL
+ */
+void freeConfigChanges( tConfigChanges * changes )
+{
+    if ( changes != NULL ) {
+        for ( size_t i = 0; i < changes->count; ++i ) {
+            free( changes->names[ i ] );
+        }
+        free( changes->names );
+        free( changes );
+    }
+}
@@ -0,0 +1,43 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_DEPENDENCIES_H
+#define TEMPLATEFS_DEPENDENCIES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+#define kMaxDependencies  16384     // past this many, a render is treated as depending on everything
+
+/**
+ * @brief the names of the keys one render read, sorted. Immutable once finished
+ */
+typedef struct sDependencies tDependencies;
+
+/**
+ * @brief collects the names of keys read during one render, in its arena
+ */
+typedef struct sDependencyRecorder tDependencyRecorder;
+
+/**
+ * @brief the names of the keys that differ between two snapshots, see diffConfigSnapshots()
+ */
+typedef struct sConfigChanges {
+    size_t   count;
+    char **  names;     ///< sorted with strcmp()
+} tConfigChanges;
+
+tDependencyRecorder * newDependencyRecorder( tArena * arena );
+void                  recordDependency( tDependencyRecorder * recorder, const char * name, bool prefix );
+tDependencies *       finishDependencies( tDependencyRecorder * recorder );
+
+void                  freeDependencies( tDependencies * dependencies );
+size_t                dependenciesSize( const tDependencies * dependencies );
+bool                  dependsOnChanges( const tDependencies * dependencies, const tConfigChanges * changes );
+
+void                  freeConfigChanges( tConfigChanges * changes );
+
+#endif //TEMPLATEFS_DEPENDENCIES_H
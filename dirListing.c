@@ -0,0 +1,342 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* What a directory of the mount lists: the names in the directory
+ * underneath the mount, merged with those in the same directory of the
+ * template hierarchy, so templates without a file underneath the mount
+ * are visible too. Settings files never are.
+ *
+ * Listings are built once and cached, keyed on the directory's path and
+ * only valid while both directories' inode and mtime match those recorded
+ * when it was built. Adding, removing or renaming a name in either one
+ * changes its mtime, so that's all it takes to know a listing is stale.
+ * Only the names and types are kept, not their attributes, as a file can
+ * change without its directory's mtime changing. The least recently used
+ * listings are evicted once there are more than kDirCacheEntries. */
+
+#include "common.h"
+#include "templatefs.h"
+#include "dirListing.h"
+#include "templateSettings.h"
+#include "logStuff.h"
+
+#include <pthread.h>
+
+#define kDirListingBuckets  512     // always a power of two
+
+typedef struct {
+    pthread_mutex_t  lock;
+    tDirListing *    buckets[ kDirListingBuckets ];
+    size_t           count;
+    tDirListing *    lruHead;       ///< most recently used
+    tDirListing *    lruTail;       ///< least recently used
+} tDirCache;
+
+static tDirCache dirCache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+typedef struct sDirStamp tDirStamp;
+
+// ------------------------------------------------------------------------------
+
+static void stampDir( int fd, tDirStamp * stamp )
+{
+    struct stat st;
+
+    memset( stamp, 0, sizeof( tDirStamp ) );
+    if ( fd == -1 ) {
+        stamp->err = ENOENT;
+    } else if ( fstat( fd, &st ) == -1 ) {
+        stamp->err = errno;
+        errno = 0;
+    } else {
+        stamp->dev   = st.st_dev;
+        stamp->ino   = st.st_ino;
+        stamp->mtime = st.st_mtim;
+    }
+}
+
+static bool sameStamp( const tDirStamp * a, const tDirStamp * b )
+{
+    return ( a->err == b->err
+          && a->dev == b->dev
+          && a->ino == b->ino
+          && a->mtime.tv_sec == b->mtime.tv_sec
+          && a->mtime.tv_nsec == b->mtime.tv_nsec );
+}
+
+static void freeDirListing( tDirListing * listing )
+{
+    for ( size_t i = 0; i < listing->count; ++i ) {
+        free( (char *)listing->entries[ i ].name );
+    }
+    free( listing->entries );
+    free( listing->path );
+    free( listing );
+}
+
+static int compareEntries( const void * a, const void * b )
+{
+    return strcmp( ((const tDirEntry *)a)->name, ((const tDirEntry *)b)->name );
+}
+
+/**
+ * @brief add the names in one directory to a listing being built
+ * @param fd           the directory. Any kind of fd will do, even O_PATH. May be -1
+ * @param inTemplates  true if it's the directory in the template hierarchy
+ * @param capacity     how many entries the listing has room for
+ * @return zero if successful, negative errno if not
+ */
+static int readTree( tDirListing * listing, size_t * capacity, int fd, bool inTemplates )
+{
+    int result = 0;
+
+    if ( fd == -1 ) {
+        return 0;
+    }
+
+    int dirFD = openat( fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    DIR * dir = ( dirFD == -1 ) ? NULL : fdopendir( dirFD );
+    if ( dir == NULL ) {
+        result = -errno;
+        if ( dirFD != -1 ) {
+            close( dirFD );
+        }
+        errno = 0;
+        return result;
+    }
+
+    struct dirent * entry;
+    while ( result == 0 && ( entry = readdir( dir ) ) != NULL ) {
+        if ( inTemplates && isSettingsPath( entry->d_name ) ) {
+            /* they're ours */
+            continue;
+        }
+
+        if ( listing->count == *capacity ) {
+            size_t      grown   = ( *capacity == 0 ) ? 32 : *capacity * 2;
+            tDirEntry * entries = realloc( listing->entries, grown * sizeof( tDirEntry ) );
+            if ( entries == NULL ) {
+                result = -ENOMEM;
+                break;
+            }
+            listing->entries = entries;
+            *capacity        = grown;
+        }
+
+        tDirEntry * added = &listing->entries[ listing->count ];
+        memset( added, 0, sizeof( tDirEntry ) );
+        added->name = strdup( entry->d_name );
+        if ( added->name == NULL ) {
+            result = -ENOMEM;
+        } else {
+            if ( inTemplates ) {
+                added->inTemplates  = true;
+                added->templateIno  = entry->d_ino;
+                added->templateType = entry->d_type;
+            } else {
+                added->inMount   = true;
+                added->mountIno  = entry->d_ino;
+                added->mountType = entry->d_type;
+            }
+            ++listing->count;
+        }
+    }
+    closedir( dir );
+
+    return result;
+}
+
+/**
+ * @brief list both directories, merging names that are in both
+ * @return the new listing with one reference, or NULL if it couldn't be built
+ */
+static tDirListing * buildDirListing( const char * path, int mountFD, int templateFD )
+{
+    tDirListing * result   = calloc( 1, sizeof( tDirListing ) );
+    size_t        capacity = 0;
+    int           err      = -ENOMEM;
+
+    if ( result != NULL ) {
+        atomic_init( &result->refCount, 1 );
+        result->path = strdup( path );
+        /* stamp them first, so a change while they're being read makes it stale */
+        stampDir( mountFD, &result->mountStamp );
+        stampDir( templateFD, &result->templateStamp );
+
+        if ( result->path != NULL ) {
+            err = readTree( result, &capacity, mountFD, false );
+        }
+        if ( err == 0 ) {
+            err = readTree( result, &capacity, templateFD, true );
+        }
+    }
+
+    if ( err != 0 ) {
+        logDebug( "unable to list \'%s\' (%d: %s)", path, -err, strerror( -err ) );
+        if ( result != NULL ) {
+            freeDirListing( result );
+        }
+        result = NULL;
+    } else {
+        qsort( result->entries, result->count, sizeof( tDirEntry ), compareEntries );
+
+        /* a name is in each directory at most once, so duplicates are adjacent pairs */
+        size_t kept = 0;
+        for ( size_t i = 0; i < result->count; ++i ) {
+            tDirEntry * entry = &result->entries[ i ];
+            if ( kept > 0 && strcmp( result->entries[ kept - 1 ].name, entry->name ) == 0 ) {
+                tDirEntry * merged = &result->entries[ kept - 1 ];
+                if ( entry->inTemplates ) {
+                    merged->inTemplates  = true;
+                    merged->templateIno  = entry->templateIno;
+                    merged->templateType = entry->templateType;
+                } else {
+                    merged->inMount   = true;
+                    merged->mountIno  = entry->mountIno;
+                    merged->mountType = entry->mountType;
+                }
+                free( (char *)entry->name );
+            } else {
+                result->entries[ kept++ ] = *entry;
+            }
+        }
+        result->count = kept;
+
+        logDebug( "listed \'%s\', %lu entries", path, result->count );
+    }
+    return result;
+}
+
+static void lruUnlink( tDirListing * listing )
+{
+    if ( listing->lruPrev != NULL ) {
+        listing->lruPrev->lruNext = listing->lruNext;
+    } else {
+        dirCache.lruHead = listing->lruNext;
+    }
+    if ( listing->lruNext != NULL ) {
+        listing->lruNext->lruPrev = listing->lruPrev;
+    } else {
+        dirCache.lruTail = listing->lruPrev;
+    }
+    listing->lruPrev = NULL;
+    listing->lruNext = NULL;
+}
+
+static void lruPushHead( tDirListing * listing )
+{
+    listing->lruPrev = NULL;
+    listing->lruNext = dirCache.lruHead;
+    if ( dirCache.lruHead != NULL ) {
+        dirCache.lruHead->lruPrev = listing;
+    } else {
+        dirCache.lruTail = listing;
+    }
+    dirCache.lruHead = listing;
+}
+
+/**
+ * @brief unlink a listing from the cache and drop the cache's reference to it.
+ * Caller must hold the lock
+ */
+static void removeListing( tDirListing * listing )
+{
+    tDirListing ** link = &dirCache.buckets[ hashString( listing->path ) & ( kDirListingBuckets - 1 ) ];
+    while ( *link != NULL && *link != listing ) {
+        link = &(*link)->hashNext;
+    }
+    if ( *link == listing ) {
+        *link = listing->hashNext;
+        listing->hashNext = NULL;
+    }
+    lruUnlink( listing );
+    --dirCache.count;
+
+    releaseDirListing( listing );
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief the merged listing of a directory, from the cache if it's still valid
+ * @param path        of the directory, relative to the mount
+ * @param mountFD     the directory underneath the mount, -1 if there isn't one. May be O_PATH
+ * @param templateFD  the directory in the template hierarchy, -1 if there isn't one. May be O_PATH
+ * @return a new reference to the listing, or NULL if it couldn't be listed
+ */
+tDirListing * acquireDirListing( const char * path, int mountFD, int templateFD )
+{
+    tDirListing * result = NULL;
+    tDirStamp     mountStamp;
+    tDirStamp     templateStamp;
+
+    stampDir( mountFD, &mountStamp );
+    stampDir( templateFD, &templateStamp );
+
+    pthread_mutex_lock( &dirCache.lock );
+
+    tDirListing * listing = dirCache.buckets[ hashString( path ) & ( kDirListingBuckets - 1 ) ];
+    while ( listing != NULL && strcmp( listing->path, path ) != 0 ) {
+        listing = listing->hashNext;
+    }
+    if ( listing != NULL ) {
+        if ( sameStamp( &listing->mountStamp, &mountStamp )
+          && sameStamp( &listing->templateStamp, &templateStamp ) ) {
+            lruUnlink( listing );
+            lruPushHead( listing );
+            result = retainDirListing( listing );
+        } else {
+            logDebug( "discarding stale listing of \'%s\'", path );
+            removeListing( listing );
+        }
+    }
+
+    pthread_mutex_unlock( &dirCache.lock );
+
+    if ( result == NULL ) {
+        result = buildDirListing( path, mountFD, templateFD );
+        if ( result != NULL ) {
+            pthread_mutex_lock( &dirCache.lock );
+
+            /* another thread may have listed it in the meantime */
+            tDirListing ** link = &dirCache.buckets[ hashString( path ) & ( kDirListingBuckets - 1 ) ];
+            while ( *link != NULL && strcmp( (*link)->path, path ) != 0 ) {
+                link = &(*link)->hashNext;
+            }
+            if ( *link != NULL ) {
+                removeListing( *link );
+            }
+            while ( dirCache.count >= kDirCacheEntries && dirCache.lruTail != NULL ) {
+                removeListing( dirCache.lruTail );
+            }
+
+            size_t bucket = hashString( path ) & ( kDirListingBuckets - 1 );
+            result->hashNext = dirCache.buckets[ bucket ];
+            dirCache.buckets[ bucket ] = retainDirListing( result );
+            lruPushHead( result );
+            ++dirCache.count;
+
+            pthread_mutex_unlock( &dirCache.lock );
+        }
+    }
+
+    return result;
+}
+
+tDirListing * retainDirListing( tDirListing * listing )
+{
+    if ( listing != NULL ) {
+        atomic_fetch_add( &listing->refCount, 1 );
+    }
+    return listing;
+}
+
+void releaseDirListing( tDirListing * listing )
+{
+    if ( listing != NULL && atomic_fetch_sub( &listing->refCount, 1 ) == 1 ) {
+        freeDirListing( listing );
+    }
+}
@@ -0,0 +1,58 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_DIRLISTING_H
+#define TEMPLATEFS_DIRLISTING_H
+
+#include <dirent.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define kDirCacheEntries  256   // most directory listings kept
+
+/**
+ * @brief one name in a merged directory listing, and what it is in each tree
+ */
+typedef struct {
+    const char *   name;
+    ino_t          mountIno;       ///< underneath the mount, if 'inMount'
+    ino_t          templateIno;    ///< in the template hierarchy, if 'inTemplates'
+    unsigned char  mountType;      ///< DT_* underneath the mount
+    unsigned char  templateType;   ///< DT_* in the template hierarchy
+    bool           inMount;
+    bool           inTemplates;
+} tDirEntry;
+
+/**
+ * @brief the merged entries of a directory underneath the mount and the
+ * same directory in the template hierarchy, sorted by name.
+ *
+ * Immutable once built, and shared between every open handle on the
+ * directory (and the cache). Use retainDirListing() and releaseDirListing()
+ * to manage its lifetime.
+ */
+typedef struct sDirListing {
+    size_t                count;
+    tDirEntry *           entries;
+
+    /* everything below is owned by the listing cache */
+    atomic_uint           refCount;
+    char *                path;        ///< of the directory, relative to the mount
+    struct sDirStamp {
+        int               err;         ///< errno from stat'ing it, zero if it exists
+        dev_t             dev;
+        ino_t             ino;
+        struct timespec   mtime;
+    }                     mountStamp, templateStamp;
+
+    struct sDirListing *  hashNext;
+    struct sDirListing *  lruPrev;
+    struct sDirListing *  lruNext;
+} tDirListing;
+
+tDirListing * acquireDirListing( const char * path, int mountFD, int templateFD );
+tDirListing * retainDirListing( tDirListing * listing );
+void          releaseDirListing( tDirListing * listing );
+
+#endif //TEMPLATEFS_DIRLISTING_H
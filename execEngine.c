@@ -0,0 +1,624 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* Runs an executable template once, capturing its stdout, within bounds:
+ *
+ *  - a wall-clock deadline, after which it (and anything it started) is killed
+ *  - a maximum amount of output, past which it's killed
+ *  - optionally, cgroup v2 CPU and memory limits
+ *
+ * so a hung or noisy script can't tie up the thread that opened it.
+ *
+ * Both pipes are non-blocking and drained as data arrives, so a child
+ * that fills one pipe while we're waiting on the other can't deadlock.
+ * The child is started in its own process group, so a timeout also kills
+ * whatever it forked. Where the kernel provides pidfds, its exit is
+ * watched alongside the pipes.
+ *
+ * Output is either collected into one buffer, or passed to a sink as it
+ * arrives, so it can be served before the child has finished.
+ *
+ * For cgroup limits, '-o execcgroup=DIR' names a cgroup v2 directory
+ * delegated to us. Each run gets a child cgroup of its own, which is
+ * removed when it finishes. */
+
+#include "common.h"
+#include "execEngine.h"
+#include "logStuff.h"
+
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/* how often to check for the child exiting, if pidfds aren't available */
+#define kExitPollInterval  10
+
+static struct {
+    tExecLimits   defaults;
+    int           cgroupFD;     ///< the delegated cgroup, or -1 if limits aren't in use
+    unsigned int  cpuPercent;   ///< of one CPU. Zero for no limit
+    size_t        memoryMax;    ///< bytes. Zero for no limit
+    atomic_ulong  sequence;     ///< to name each run's cgroup
+} execEngine = {
+    .defaults = { kDefaultExecTimeout, kDefaultExecMaxOutput },
+    .cgroupFD = -1
+};
+
+/**
+ * @brief a buffer that expands as it fills, up to a limit
+ */
+typedef struct {
+    char *   data;       ///< pointer to the data, caution: may move when realloc'd
+    size_t   available;  ///< amount of data currently in the buffer
+    size_t   allocated;  ///< size of 'data'
+    size_t   limit;      ///< most it may hold. Zero for no limit
+    tOutputSink  sink;         ///< if set, the data is passed on as it arrives, and not kept
+    void *       sinkContext;
+    size_t       total;        ///< amount passed to the sink so far
+    int          sinkResult;   ///< non-zero once the sink has failed
+} tElasticBuffer;
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief make sure there's at least 'headroom' bytes of space after the data
+ * @return zero if successful, -ENOMEM if not
+ */
+static int makeRoom( tElasticBuffer * buf, size_t headroom )
+{
+    int result = 0;
+
+    if ( buf->allocated - buf->available < headroom ) {
+        size_t newSize = ( buf->allocated == 0 ) ? 16384 : buf->allocated * 2;
+        while ( newSize - buf->available < headroom ) {
+            newSize *= 2;
+        }
+        char * data = realloc( buf->data, newSize );
+        if ( data == NULL ) {
+            result = -ENOMEM;
+        } else {
+            buf->data      = data;
+            buf->allocated = newSize;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief read everything currently available from a non-blocking descriptor
+ * @param fd        the descriptor to read from
+ * @param buf       where to append it, or NULL to discard it
+ * @param overflow  set true if 'buf' would have exceeded its limit
+ * @return true if the descriptor is at EOF (or failed), false if more may come
+ */
+static bool drain( int fd, tElasticBuffer * buf, bool * overflow )
+{
+    char scratch[ 4096 ];
+
+    for (;;) {
+        char * space = scratch;
+        size_t room  = sizeof( scratch );
+
+        if ( buf != NULL && !*overflow ) {
+            if ( makeRoom( buf, sizeof( scratch ) ) != 0 ) {
+                *overflow = true;
+            } else {
+                space = &buf->data[ buf->available ];
+                room  = buf->allocated - buf->available;
+            }
+        }
+
+        ssize_t got = read( fd, space, room );
+        if ( got < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            bool eof = ( errno != EAGAIN && errno != EWOULDBLOCK );
+            errno = 0;
+            return eof;
+        }
+        if ( got == 0 ) {
+            return true;
+        }
+
+        if ( space != scratch ) {
+            buf->available += got;
+            if ( buf->sink != NULL ) {
+                buf->total += got;
+                if ( buf->limit != 0 && buf->total > buf->limit ) {
+                    *overflow = true;
+                } else {
+                    buf->sinkResult = buf->sink( buf->sinkContext, (byte *)buf->data, buf->available );
+                    if ( buf->sinkResult != 0 ) {
+                        *overflow = true;
+                    }
+                }
+                buf->available = 0;
+            } else if ( buf->limit != 0 && buf->available > buf->limit ) {
+                buf->available = buf->limit;
+                *overflow = true;
+            }
+        }
+    }
+}
+
+static int openPidFD( pid_t pid )
+{
+#ifdef SYS_pidfd_open
+    int fd = syscall( SYS_pidfd_open, pid, 0 );
+    if ( fd < 0 ) {
+        errno = 0;
+    }
+    return fd;
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+/**
+ * @brief write a value to a cgroup interface file
+ */
+static int writeCgroupFile( int dirFD, const char * file, const char * value )
+{
+    int result = 0;
+    int fd     = openat( dirFD, file, O_WRONLY | O_CLOEXEC );
+
+    if ( fd < 0 ) {
+        result = -errno;
+    } else {
+        if ( write( fd, value, strlen( value ) ) < 0 ) {
+            result = -errno;
+        }
+        close( fd );
+    }
+    if ( result != 0 ) {
+        errno = 0;
+    }
+    return result;
+}
+
+/**
+ * @brief make a cgroup for one run, with the configured limits
+ * @param name  receives the name of the cgroup, relative to execEngine.cgroupFD
+ * @return a descriptor for the new cgroup, or -1 if limits aren't in use or it failed
+ */
+static int createRunCgroup( char * name, size_t nameSize )
+{
+    int  result = -1;
+    char value[ 64 ];
+
+    if ( execEngine.cgroupFD < 0 ) {
+        return -1;
+    }
+
+    snprintf( name, nameSize, "run-%d-%lu", getpid(), atomic_fetch_add( &execEngine.sequence, 1 ) );
+    if ( mkdirat( execEngine.cgroupFD, name, 0755 ) != 0 ) {
+        logError( "unable to create cgroup \'%s\' (%d)", name, errno );
+        errno = 0;
+    } else {
+        result = openat( execEngine.cgroupFD, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+        if ( result >= 0 && execEngine.cpuPercent != 0 ) {
+            /* quota and period in microseconds */
+            snprintf( value, sizeof( value ), "%u 100000", execEngine.cpuPercent * 1000 );
+            if ( writeCgroupFile( result, "cpu.max", value ) != 0 ) {
+                logWarning( "unable to set cpu.max of cgroup \'%s\'", name );
+            }
+        }
+        if ( result >= 0 && execEngine.memoryMax != 0 ) {
+            snprintf( value, sizeof( value ), "%zu", execEngine.memoryMax );
+            if ( writeCgroupFile( result, "memory.max", value ) != 0 ) {
+                logWarning( "unable to set memory.max of cgroup \'%s\'", name );
+            }
+            /* don't let it escape the limit by swapping */
+            writeCgroupFile( result, "memory.swap.max", "0" );
+        }
+        if ( result < 0 ) {
+            unlinkat( execEngine.cgroupFD, name, AT_REMOVEDIR );
+            errno = 0;
+        }
+    }
+    return result;
+}
+
+static void removeRunCgroup( int fd, const char * name )
+{
+    if ( fd >= 0 ) {
+        close( fd );
+        /* can only be removed once it's empty, which it is once the child is reaped */
+        if ( unlinkat( execEngine.cgroupFD, name, AT_REMOVEDIR ) != 0 ) {
+            logWarning( "unable to remove cgroup \'%s\' (%d)", name, errno );
+            errno = 0;
+        }
+    }
+}
+
+/**
+ * @brief kill the child and anything it started
+ */
+static void killRun( pid_t pid, int cgroupFD )
+{
+    /* cgroup.kill (Linux 5.14) also catches anything that left the process group */
+    if ( cgroupFD >= 0 ) {
+        writeCgroupFile( cgroupFD, "cgroup.kill", "1" );
+    }
+    kill( -pid, SIGKILL );
+    errno = 0;
+}
+
+/**
+ * @brief start the child with its stdout and stderr on the given pipes
+ * @return zero if successful, negative errno if not
+ */
+static int spawnChild( pid_t * pid,
+                       char * const argv[],
+                       char * const envp[],
+                       int stdoutFD,
+                       int stderrFD,
+                       int cgroupFD )
+{
+    int                        result;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t          attr;
+    sigset_t                   mask;
+    short                      flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+
+    /* dup2() clears close-on-exec on the copies, and the originals are closed by exec */
+    posix_spawn_file_actions_init( &actions );
+    posix_spawn_file_actions_adddup2( &actions, stdoutFD, STDOUT_FILENO );
+    posix_spawn_file_actions_adddup2( &actions, stderrFD, STDERR_FILENO );
+
+    posix_spawnattr_init( &attr );
+    /* its own process group, so a timeout can kill everything it started */
+    posix_spawnattr_setpgroup( &attr, 0 );
+    /* the fuse threads block some signals, and libfuse ignores SIGPIPE,
+     * both of which the child would otherwise inherit */
+    sigemptyset( &mask );
+    posix_spawnattr_setsigmask( &attr, &mask );
+    sigaddset( &mask, SIGPIPE );
+    posix_spawnattr_setsigdefault( &attr, &mask );
+#ifdef POSIX_SPAWN_SETCGROUP
+    /* glibc 2.39+: start it in the cgroup, rather than moving it there after */
+    if ( cgroupFD >= 0 ) {
+        flags |= POSIX_SPAWN_SETCGROUP;
+        posix_spawnattr_setcgroup_np( &attr, cgroupFD );
+    }
+#endif
+    posix_spawnattr_setflags( &attr, flags );
+
+    result = -posix_spawn( pid, argv[ 0 ], &actions, &attr, argv, envp );
+
+    posix_spawnattr_destroy( &attr );
+    posix_spawn_file_actions_destroy( &actions );
+
+#ifndef POSIX_SPAWN_SETCGROUP
+    if ( result == 0 && cgroupFD >= 0 ) {
+        char pidStr[ 32 ];
+        snprintf( pidStr, sizeof( pidStr ), "%d", *pid );
+        if ( writeCgroupFile( cgroupFD, "cgroup.procs", pidStr ) != 0 ) {
+            logWarning( "unable to move %s into its cgroup", argv[ 0 ] );
+        }
+    }
+#endif
+
+    return result;
+}
+
+/**
+ * @brief run an executable, passing its stdout to 'sink' if given, otherwise collecting it into 'buffer'
+ * @return as runExecutable()
+ */
+static int runChild( char * const argv[],
+                     char * const envp[],
+                     const tExecLimits * limits,
+                     tOutputSink sink,
+                     void * context,
+                     byte ** buffer,
+                     size_t * size )
+{
+    int       result = 0;
+    int       stdoutPipe[2];
+    int       stderrPipe[2];
+    const int kPipeReadIdx  = 0;
+    const int kPipeWriteIdx = 1;
+
+    /* close-on-exec, so other children spawned concurrently don't inherit them.
+     * Only our ends are non-blocking */
+    if ( pipe2( stdoutPipe, O_CLOEXEC ) == -1 ) {
+        logError( "unable to create pipe for stdout" );
+        return -errno;
+    }
+    if ( pipe2( stderrPipe, O_CLOEXEC ) == -1 ) {
+        logError( "unable to create pipe for stderr" );
+        result = -errno;
+        close( stdoutPipe[ kPipeReadIdx ] );
+        close( stdoutPipe[ kPipeWriteIdx ] );
+        return result;
+    }
+    fcntl( stdoutPipe[ kPipeReadIdx ], F_SETFL, O_NONBLOCK );
+    fcntl( stderrPipe[ kPipeReadIdx ], F_SETFL, O_NONBLOCK );
+
+    char  cgroupName[ 64 ];
+    int   cgroupFD = createRunCgroup( cgroupName, sizeof( cgroupName ) );
+    pid_t pid;
+
+    logDebug( "spawn( %s, %s )", argv[ 0 ], argv[ 1 ] );
+    result = spawnChild( &pid, argv, envp,
+                         stdoutPipe[ kPipeWriteIdx ], stderrPipe[ kPipeWriteIdx ], cgroupFD );
+    close( stdoutPipe[ kPipeWriteIdx ] );
+    close( stderrPipe[ kPipeWriteIdx ] );
+
+    if ( result != 0 ) {
+        logError( "failed to execute \'%s\' (%d)", argv[ 0 ], result );
+    } else {
+        tElasticBuffer  stdoutBuf = { .limit = limits->maxOutput, .sink = sink, .sinkContext = context };
+        tElasticBuffer  stderrBuf = { .limit = kExecMaxStderr };
+        bool            stdoutOverflow = false;
+        bool            stderrOverflow = false;
+        bool            timedOut = false;
+        bool            exited   = false;
+        int             openPipes = 2;
+        int             status   = 0;
+        struct timespec deadline;
+        struct epoll_event event;
+
+        setDeadline( &deadline, limits->timeout );
+
+        int epfd  = epoll_create1( EPOLL_CLOEXEC );
+        int pidfd = openPidFD( pid );
+
+        event.events  = EPOLLIN;
+        event.data.fd = stdoutPipe[ kPipeReadIdx ];
+        epoll_ctl( epfd, EPOLL_CTL_ADD, event.data.fd, &event );
+        event.data.fd = stderrPipe[ kPipeReadIdx ];
+        epoll_ctl( epfd, EPOLL_CTL_ADD, event.data.fd, &event );
+        if ( pidfd >= 0 ) {
+            /* readable once the child has exited */
+            event.data.fd = pidfd;
+            epoll_ctl( epfd, EPOLL_CTL_ADD, pidfd, &event );
+        }
+
+        /* wait for EOF on both pipes, and for the child to exit */
+        while ( ( openPipes > 0 || !exited ) && !stdoutOverflow ) {
+            int wait = -1;
+            if ( limits->timeout != 0 ) {
+                wait = remainingTime( &deadline );
+                if ( wait == 0 ) {
+                    timedOut = true;
+                    break;
+                }
+            }
+            if ( pidfd < 0 && openPipes == 0 && ( wait < 0 || wait > kExitPollInterval ) ) {
+                wait = kExitPollInterval;
+            }
+
+            struct epoll_event events[3];
+            int eventCount = epoll_wait( epfd, events, 3, wait );
+            if ( eventCount < 0 && errno == EINTR ) {
+                errno = 0;
+                continue;
+            }
+
+            for ( int i = 0; i < eventCount; i++ ) {
+                int eventFD = events[ i ].data.fd;
+                if ( eventFD == pidfd ) {
+                    exited = true;
+                    epoll_ctl( epfd, EPOLL_CTL_DEL, pidfd, NULL );
+                } else {
+                    bool eof;
+                    if ( eventFD == stdoutPipe[ kPipeReadIdx ] ) {
+                        eof = drain( eventFD, &stdoutBuf, &stdoutOverflow );
+                    } else {
+                        /* keep reading past the limit, just stop keeping it */
+                        eof = drain( eventFD, &stderrBuf, &stderrOverflow );
+                    }
+                    if ( eof ) {
+                        epoll_ctl( epfd, EPOLL_CTL_DEL, eventFD, NULL );
+                        --openPipes;
+                    }
+                }
+            }
+
+            if ( pidfd < 0 && openPipes == 0 && !exited ) {
+                pid_t reaped = waitpid( pid, &status, WNOHANG );
+                if ( reaped == pid || reaped < 0 ) {
+                    exited = true;
+                }
+            }
+        }
+
+        if ( timedOut || stdoutOverflow ) {
+            killRun( pid, cgroupFD );
+        }
+        /* if it was reaped above, this fails with ECHILD and 'status' is kept */
+        if ( waitpid( pid, &status, 0 ) == -1 && errno != ECHILD ) {
+            logError( "unable to wait for \'%s\' (%d)", argv[ 0 ], errno );
+        }
+        errno = 0;
+
+        if ( timedOut ) {
+            logError( "\'%s\' killed after %lu ms", argv[ 0 ], limits->timeout );
+            result = -ETIMEDOUT;
+        } else if ( stdoutBuf.sinkResult != 0 ) {
+            logError( "\'%s\' killed, as its output couldn't be kept (%d)", argv[ 0 ], stdoutBuf.sinkResult );
+            result = stdoutBuf.sinkResult;
+        } else if ( stdoutOverflow ) {
+            logError( "\'%s\' killed for exceeding %zu bytes of output", argv[ 0 ], limits->maxOutput );
+            result = -EFBIG;
+        } else if ( WIFSIGNALED( status ) ) {
+            logError( "\'%s\' killed by signal %d", argv[ 0 ], WTERMSIG( status ) );
+            result = -EIO;
+        } else if ( WIFEXITED( status ) && WEXITSTATUS( status ) != 0 ) {
+            logError( "\'%s\' exit code: %d", argv[ 0 ], WEXITSTATUS( status ) );
+            result = -EIO;
+        }
+
+        if ( result == 0 && buffer != NULL ) {
+            *buffer = stdoutBuf.data;
+            *size   = stdoutBuf.available;
+        } else {
+            free( stdoutBuf.data );
+        }
+
+        if ( stderrBuf.available > 0 ) {
+            logWarning( "stderr output from %s%s", argv[ 0 ], stderrOverflow ? " (truncated)" : "" );
+            logTextBlock( kLogWarning, stderrBuf.data, stderrBuf.available );
+        }
+        free( stderrBuf.data );
+
+        if ( pidfd >= 0 ) {
+            close( pidfd );
+        }
+        close( epfd );
+    }
+    close( stdoutPipe[ kPipeReadIdx ] );
+    close( stderrPipe[ kPipeReadIdx ] );
+    removeRunCgroup( cgroupFD, cgroupName );
+
+    return result;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief set a deadline 'timeout' ms from now, on CLOCK_MONOTONIC
+ */
+void setDeadline( struct timespec * deadline, unsigned long timeout )
+{
+    clock_gettime( CLOCK_MONOTONIC, deadline );
+    deadline->tv_sec  += timeout / 1000;
+    deadline->tv_nsec += ( timeout % 1000 ) * 1000000L;
+    if ( deadline->tv_nsec >= 1000000000L ) {
+        deadline->tv_sec  += 1;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * @brief ms left until a deadline, rounded up
+ * @return the time remaining, or zero if it has passed
+ */
+long remainingTime( const struct timespec * deadline )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    long result = ( deadline->tv_sec - now.tv_sec ) * 1000L
+                + ( deadline->tv_nsec - now.tv_nsec + 999999L ) / 1000000L;
+
+    return ( result > 0 ) ? result : 0;
+}
+
+/**
+ * @brief set the limits used for executable templates
+ * @param timeout     default ms before a run is killed. Zero waits indefinitely
+ * @param maxOutput   default most output accepted. Zero for no limit
+ * @param cgroup      delegated cgroup v2 directory to run them in, or NULL
+ * @param cpuPercent  CPU limit for each run, as a percentage of one CPU. Zero for no limit
+ * @param memoryMax   memory limit for each run, in bytes. Zero for no limit
+ * @return zero if successful, negative errno if not
+ */
+int configureExecEngine( unsigned long timeout,
+                         size_t maxOutput,
+                         const char * cgroup,
+                         unsigned int cpuPercent,
+                         size_t memoryMax )
+{
+    int result = 0;
+
+    execEngine.defaults.timeout   = timeout;
+    execEngine.defaults.maxOutput = maxOutput;
+    execEngine.cpuPercent         = cpuPercent;
+    execEngine.memoryMax          = memoryMax;
+
+    if ( cgroup == NULL ) {
+        if ( cpuPercent != 0 || memoryMax != 0 ) {
+            logCritical( "fatal: execcpu and execmemory need execcgroup" );
+            result = -EINVAL;
+        }
+    } else {
+        execEngine.cgroupFD = open( cgroup, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+        if ( execEngine.cgroupFD < 0 ) {
+            result = -errno;
+            logCritical( "fatal: unable to open cgroup \'%s\' (%d)", cgroup, result );
+        } else {
+            /* let each run's cgroup have its own limits. Fails if the
+             * cgroup already has processes in it, in which case it may
+             * have been done already */
+            char controllers[ 32 ] = "";
+            if ( cpuPercent != 0 ) {
+                strcat( controllers, "+cpu " );
+            }
+            if ( memoryMax != 0 ) {
+                strcat( controllers, "+memory" );
+            }
+            if ( controllers[0] != '\0'
+              && writeCgroupFile( execEngine.cgroupFD, "cgroup.subtree_control", controllers ) != 0 ) {
+                logWarning( "unable to enable \'%s\' in \'%s\'", controllers, cgroup );
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief the limits set by the mount options
+ */
+void defaultExecLimits( tExecLimits * limits )
+{
+    *limits = execEngine.defaults;
+}
+
+/**
+ * @brief run an executable, capturing what it writes to stdout
+ *
+ * The child is started with posix_spawn() (which glibc implements with
+ * CLONE_VM|CLONE_VFORK) rather than fork(), so the cost doesn't grow with
+ * the size of the daemon, and nothing that isn't async-signal-safe runs
+ * in the child.
+ *
+ * @param argv    NULL-terminated arguments. argv[0] is the executable
+ * @param envp    its environment
+ * @param limits  the bounds to run it within
+ * @param buffer  receives the output (allocated with malloc)
+ * @param size    receives the length of the output
+ * @return zero if it succeeded, -ETIMEDOUT if it ran out of time, -EFBIG if it
+ * produced too much output, -EIO if it failed, or another negative errno
+ */
+int runExecutable( char * const argv[],
+                   char * const envp[],
+                   const tExecLimits * limits,
+                   byte ** buffer,
+                   size_t * size )
+{
+    return runChild( argv, envp, limits, NULL, NULL, buffer, size );
+}
+
+/**
+ * @brief run an executable, passing what it writes to stdout to 'sink' as it arrives
+ *
+ * The limits apply as they do for runExecutable(), with 'maxOutput' counting
+ * everything passed to the sink. The sink is called on this thread, and the
+ * run is killed if it fails.
+ *
+ * @param argv     NULL-terminated arguments. argv[0] is the executable
+ * @param envp     its environment
+ * @param limits   the bounds to run it within
+ * @param sink     receives each piece of output
+ * @param context  passed to 'sink'
+ * @return as runExecutable(), or the error the sink failed with
+ */
+int streamExecutable( char * const argv[],
+                      char * const envp[],
+                      const tExecLimits * limits,
+                      tOutputSink sink,
+                      void * context )
+{
+    return runChild( argv, envp, limits, sink, context, NULL, NULL );
+}
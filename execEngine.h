@@ -0,0 +1,41 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_EXECENGINE_H
+#define TEMPLATEFS_EXECENGINE_H
+
+#include <time.h>
+
+#define kDefaultExecTimeout    10000                // ms an executable template may run for
+#define kDefaultExecMaxOutput  (16 * 1024 * 1024)   // most output accepted from one
+#define kExecMaxStderr         (64 * 1024)          // most of its stderr that's logged
+
+/**
+ * @brief the bounds placed on one run of an executable template
+ */
+typedef struct {
+    unsigned long  timeout;     ///< ms before it's killed. Zero waits indefinitely
+    size_t         maxOutput;   ///< most output accepted. Zero for no limit
+} tExecLimits;
+
+int  configureExecEngine( unsigned long timeout,
+                          size_t maxOutput,
+                          const char * cgroup,
+                          unsigned int cpuPercent,
+                          size_t memoryMax );
+void defaultExecLimits( tExecLimits * limits );
+long remainingTime( const struct timespec * deadline );
+void setDeadline( struct timespec * deadline, unsigned long timeout );
+int  runExecutable( char * const argv[],
+                    char * const envp[],
+                    const tExecLimits * limits,
+                    byte ** buffer,
+                    size_t * size );
+int  streamExecutable( char * const argv[],
+                       char * const envp[],
+                       const tExecLimits * limits,
+                       tOutputSink sink,
+                       void * context );
+
+#endif //TEMPLATEFS_EXECENGINE_H
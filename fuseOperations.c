@@ -6,6 +6,8 @@
 #include "templatefs.h"
 #include "logStuff.h"
 
+#include <limits.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <sys/file.h>   /* flock(2) */
 #include <sys/epoll.h>
@@ -18,164 +20,28 @@
 #include <fuse3/fuse.h>
 
 #include "fuseOperations.h"
+#include "configStore.h"
+#include "dependencies.h"
+#include "execEngine.h"
+#include "coprocess.h"
 #include "processTemplate.h"
-
-typedef struct {
-    char * path;
-    DIR  * dir;
-    int    fd;
-} tFSTree;
-
-typedef struct {
-    tFSTree  mountpoint;    ///< absolute path to the mount point
-    tFSTree  templates;     ///< absolute path to the top of the template hierarchy
-} tPrivateData;
-
-typedef struct {
-    const char *  path;          ///< absolute path to the file
-    int           fd;            ///< file descriptor. -1 if fd not open/valid */
-    bool          isTemplate;    ///< true if there's a template file to process, else pass request through
-    bool          isExecutable;  ///< true if the templatee file is _executable_
-
-    byte *        contents;      ///< the cached result of processing the template file
-    size_t        length;        ///< length of the cached file contents
-} tFHFile;
-
-typedef struct {
-    DIR *            dp;
-    struct dirent *  entry;
-    off_t            offset;
-} tFHDir;
-
-typedef struct {
-    /* * * UNION MUST BE FIRST * * */
-    /* tFHHandle. tFHFile, and tFHDir are cast back and
-     * forth, based on the value of the type field */
-    union {
-        tFHFile file;
-        tFHDir  directory;
-    };
-
-    /* how the union should be accessed */
-    enum {
-        notInitialized = 0,  ///< hasn't been set yet
-        isFile,              ///< use the 'file' field of the union
-        isDirectory          ///< use the 'directory' field of the union
-    } type;                  ///< indicates which field of the union to use
-
-} tFileHandle;
-
-/**
- * @brief a buffer that expands as it fills
- * @see newElasticBuffer()
- * @see releaseElasticBuffer()
- * @see makeRoom()
- * @see getSpacePtr()
- * @see increaseAvailable()
- */
-typedef struct {
-    char *   data;       ///< pointer to the data, caution: may move when realloc'd
-    ssize_t  available;  ///< amount of data currently in the buffer
-    ssize_t  remaining;  ///< amount of unused space lwft
-    ssize_t  headroom;   ///< the amount of 'space' that's added
-} tElasticBuffer;
-
-// ------------------------------------------------------------------------------
-
-/**
- * @brief allocate a new, empty buffer
- * @param size      initial size of buffer
- * @param headroom  amount to ensure we have ready to fill
- * @return the buffer structure, or NULL if failed.
- */
-tElasticBuffer * newElasticBuffer( size_t size, size_t headroom )
-{
-    tElasticBuffer * result = calloc(1, sizeof(tElasticBuffer));
-    if ( result != NULL ) {
-        result->data      = calloc( 1, size);
-        result->available = 0;
-        if ( result->data != NULL ) {
-            result->remaining = size;
-        }
-        result->headroom = headroom;
-    }
-    return result;
-}
-
-/**
- * @brief release the resources in use by the elastic buffer
- * @param buf the elastic buffer
- */
-void releaseElasticBuffer( tElasticBuffer * buf )
-{
-    free( buf->data );
-    free( buf );
-}
-
-/**
- * @brief ensure that there's at least 'headroom' bytes available in the buffer
- *
- * Caution: calling realloc() may move the data buffer.
- *
- * @param buf  the elastic buffer to check/expand
- * @return the number of bytes now available
- */
-static size_t makeRoom( tElasticBuffer * buf )
-{
-    if ( buf->remaining < buf->headroom ) {
-        buf->remaining += buf->headroom * 2;
-        buf->data       = realloc( buf->data, buf->available + buf->remaining );
-    }
-    return buf->remaining;
-}
-
-/**
- * @brief
- * @param buf
- * @return
- */
-char * getSpacePtr( tElasticBuffer * buf )
-{
-    /* Caution: if makeRoom causes a realloc, make sure it
-     * happens *before* doing any pointer arithmetic */
-    makeRoom( buf );
-    return buf->data + buf->available;
-}
-
-/**
- * @brief increase
- * @param buf
- * @param additional
- */
-void increaseAvailable( tElasticBuffer * buf, size_t additional )
+#include "renderCache.h"
+#include "renderMeta.h"
+#include "renderPool.h"
+#include "renderSnapshot.h"
+#include "renderStream.h"
+#include "kernelCache.h"
+#include "metrics.h"
+#include "outputCache.h"
+#include "templateIndex.h"
+#include "templateSettings.h"
+#include "traceStuff.h"
+#include "warmup.h"
+#include "watcher.h"
+
+static inline bool isLaterThan( const struct timespec * a, const struct timespec * b )
 {
-    buf->available += additional;
-    buf->remaining -= additional;
-    makeRoom(buf);
-}
-
-/**
- * @brief substitute -errno if result == -1
- *
- * In a nutshell, most linux filesystem functions invariably return -1 on error,
- * and return the actual error that occurred as a positive integer in 'errno'.
- * libfuse adopts the (much saner) convention of returning -errno rather than -1
- * when an error is being reported.
- *
- * This convention crops up throughout operation functions. So define it
- * as a common inline function.
- *
- * @param result the result of a 'standard' filesystem function.
- * @return if result == -1, then return -errno, otherwise just pass back result unmodified.
- */
-
-static inline int fixupResult( int result )
-{
-    if ( result == -1 )
-    {
-        result = -errno;
-    }
-    return result;
+    return ( a->tv_sec > b->tv_sec || ( a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec ) );
 }
 
 // ------------------------------------------------------------------------------
@@ -232,6 +98,9 @@ void releaseHandle( struct fuse_file_info * fi )
 }
 
 // ------------------------------------------------------------------------------
+/* set when mounted through the low-level API, which has no fuse context */
+static tPrivateData * sessionPrivateData = NULL;
+
 /**
  * @brief retrieve the tPrivateData structure we stashed in the fuse context earlier.
  * See also initPrivateData()
@@ -239,16 +108,26 @@ void releaseHandle( struct fuse_file_info * fi )
  */
 tPrivateData * getPrivateData( void )
 {
-    tPrivateData * result = NULL;
+    tPrivateData * result = sessionPrivateData;
 
-    struct fuse_context * fc = fuse_get_context();
-    if ( fc != NULL ) {
-        result = fc->private_data;
+    if ( result == NULL ) {
+        struct fuse_context * fc = fuse_get_context();
+        if ( fc != NULL ) {
+            result = fc->private_data;
+        }
     }
 
     return result;
 }
 
+/**
+ * @brief make the private data available without a fuse context (see lowlevelOperations.c)
+ */
+void setPrivateData( tPrivateData * privateData )
+{
+    sessionPrivateData = privateData;
+}
+
 int getMountpointFD( void )
 {
     int result = -1;
@@ -275,23 +154,36 @@ int getTemplateFD( void )
     return result;
 }
 
-static inline bool hasTemplate( const char * path )
+bool hasTemplate( const char * path )
 {
-    bool result = ( faccessat( getTemplateFD(),
-                               &path[1],
-                               R_OK,
-                               AT_SYMLINK_NOFOLLOW ) == 0 );
-    errno = 0;
+    bool result;
+
+    if ( isTemplateIndexReady() ) {
+        result = ( lookupTemplateIndex( path ) & kTemplatePresent ) != 0;
+    } else {
+        result = ( !isSettingsPath( path )
+                && faccessat( getTemplateFD(),
+                              &path[1],
+                              R_OK,
+                              AT_SYMLINK_NOFOLLOW ) == 0 );
+        errno = 0;
+    }
     return ( result );
 }
 
-static inline bool isExecutable( const char * path )
+bool isExecutable( const char * path )
 {
-    bool result = ( faccessat( getTemplateFD(),
-                               &path[1],
-                               X_OK,
-                               AT_SYMLINK_NOFOLLOW ) == 0 );
-    errno = 0;
+    bool result;
+
+    if ( isTemplateIndexReady() ) {
+        result = ( lookupTemplateIndex( path ) & kTemplateExecutable ) != 0;
+    } else {
+        result = ( faccessat( getTemplateFD(),
+                              &path[1],
+                              X_OK,
+                              AT_SYMLINK_NOFOLLOW ) == 0 );
+        errno = 0;
+    }
     return ( result );
 }
 
@@ -317,6 +209,121 @@ int setupFSTree( tFSTree * tree, const char * path )
     return result;
 }
 
+/**
+ * @brief get the settings for a template, avoiding the filesystem if the index says it has none
+ */
+static const tTemplateSettings * loadTemplateSettings( const char * path )
+{
+    const tTemplateSettings * result;
+
+    if ( isTemplateIndexReady() && ( lookupTemplateIndex( path ) & kTemplateHasSettings ) == 0 ) {
+        result = defaultTemplateSettings();
+    } else {
+        result = acquireTemplateSettings( getTemplateFD(), path );
+    }
+    return result;
+}
+
+/**
+ * @return true if a template's settings say to serve its output as it's produced
+ */
+static bool isStreamed( const char * path )
+{
+    const tTemplateSettings * settings = loadTemplateSettings( path );
+    bool                      result   = settings->stream;
+
+    releaseTemplateSettings( settings );
+    return result;
+}
+
+/**
+ * @brief the configuration to render a template against: just the parts
+ * of it the template's settings say it uses, if they do (see configStore.c)
+ * @param refresh  check for changes first, if due. If not, it's whatever was last loaded
+ * @return a reference to the snapshot, or NULL if there is no configuration available
+ */
+static tConfigSnapshot * acquireTemplateConfig( tPrivateData * privateData, const char * path, bool refresh )
+{
+    tConfigSnapshot * result = NULL;
+
+    if ( privateData != NULL ) {
+        const tTemplateSettings * settings = loadTemplateSettings( path );
+        tConfigStore *            store    = scopedConfigStore( &privateData->config, settings->roots );
+
+        result = refresh ? acquireConfigSnapshot( store ) : peekConfigSnapshot( store );
+        releaseTemplateSettings( settings );
+    }
+    return result;
+}
+
+static void warmTemplate( const char * path, void * context );
+
+/**
+ * @brief the configuration changed, so any renders that read a key that
+ * changed are stale, along with whatever the kernel is caching of them
+ */
+static void configChanged( tConfigSnapshot * snapshot, tConfigSnapshot * previous )
+{
+    tConfigChanges * changes = diffConfigSnapshots( previous, snapshot );
+
+    logDebug( "revising rendered templates for generation %lu", snapshot->generation );
+    reviseRendered( previous->generation,
+                    snapshot->generation,
+                    changes,
+                    isKernelCacheEnabled() ? invalidateKernelCache : NULL );
+    freeConfigChanges( changes );
+
+    requestWarmup();
+}
+
+/**
+ * @brief something changed in the template hierarchy or underneath the mount
+ */
+static void treeChanged( const tWatchEvent * events, size_t count, void * context )
+{
+    (void)context;
+
+    bool templatesChanged = false;
+
+    for ( size_t i = 0; i < count; ++i ) {
+        const tWatchEvent * event = &events[ i ];
+
+        if ( event->tree == kTreeTemplates ) {
+            templatesChanged = true;
+            if ( isSettingsPath( event->path ) ) {
+                /* workers were started with the old settings */
+                char   path[ PATH_MAX ];
+                size_t len = strlen( event->path ) - ( sizeof( kSettingsSuffix ) - 1 );
+
+                snprintf( path, sizeof( path ), "%.*s", (int)len, event->path );
+                retireWorkers( path );
+                forgetTemplateSettings( path );
+                forgetOutput( path );
+            } else {
+                /* workers are running the old version */
+                retireWorkers( event->path );
+                forgetOutput( event->path );
+                if ( event->kinds & kChangeDeleted ) {
+                    forgetRenderedMeta( event->path );
+                    forgetLastGood( event->path );
+                }
+            }
+        }
+
+        if ( isKernelCacheEnabled() ) {
+            if ( event->kinds & kChangeOverflow ) {
+                /* we don't know what changed, so drop everything we've rendered */
+                forEachRenderedPath( invalidateKernelCache );
+            } else {
+                invalidateKernelCache( event->path );
+            }
+        }
+    }
+
+    if ( templatesChanged ) {
+        requestWarmup();
+    }
+}
 
 void * initPrivateData( const char * mountPath, const char * templatePath )
 {
@@ -326,11 +333,98 @@ void * initPrivateData( const char * mountPath, const char * templatePath )
     if ( result != NULL ) {
         setupFSTree( &result->mountpoint, mountPath );
         setupFSTree( &result->templates, templatePath );
+        /* not fatal: templates will fail to render, but passthrough still works */
+        initConfigStore( &result->config, "system:/config", globals.template.configCheck );
+        result->config.onChange = configChanged;
     }
 
     return (void *) result;
 }
 
+/**
+ * @brief start the threads that run alongside the fuse loop.
+ *
+ * Called from the init operation rather than earlier, as that runs after
+ * fuse_daemonize() has forked. None of it is fatal if it fails: renders
+ * run on the fuse threads without the pool, and without the watcher we
+ * just won't notice changes as quickly.
+ */
+void startBackground( tPrivateData * privateData )
+{
+    if ( privateData != NULL ) {
+        if ( globals.template.logAsync ) {
+            /* after the fork, or the thread would be left behind */
+            startAsyncLogging();
+        }
+        if ( globals.template.trace != NULL ) {
+            startTracing( globals.template.trace );
+        }
+        startRenderPool( globals.template.renderThreads );
+
+        if ( globals.template.snapshot != NULL ) {
+            /* before warming up, so the warm-up can claim what's still good */
+            loadRenderSnapshot( globals.template.snapshot, renderCacheBudget() );
+        }
+
+        addWatchConsumer( updateTemplateIndex, privateData );
+        addWatchConsumer( treeChanged, privateData );
+        if ( startWatcher( privateData->templates.fd, privateData->mountpoint.fd ) == 0 ) {
+            /* only worth having if it can be kept up to date */
+            if ( buildTemplateIndex( privateData->templates.fd ) == 0 && globals.template.warmup ) {
+                startWarmup( warmTemplate, privateData );
+            }
+        }
+    }
+}
+
+/**
+ * @brief stop everything startBackground() started, and release the private data's resources
+ */
+void stopBackground( tPrivateData * privateData )
+{
+    stopWarmup();
+    stopWatcher();
+    stopRenderPool();
+    stopAllWorkers();
+    releaseTemplateIndex();
+
+    if ( globals.template.snapshot != NULL ) {
+        /* nothing's rendering any more */
+        saveRenderSnapshot( globals.template.snapshot );
+        discardRestored();
+    }
+
+    if ( privateData != NULL ) {
+        releaseConfigStore( &privateData->config );
+    }
+
+    stopTracing();
+    /* last, so it sends on what everything above had to say */
+    stopAsyncLogging();
+}
+
+/**
+ * @brief ask for data to be spliced between the kernel and the files
+ * underneath the mount, rather than copied through our buffers
+ */
+void wantSplice( struct fuse_conn_info * conn )
+{
+    conn->want |= conn->capable & ( FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE );
+}
+
+/**
+ * @brief ask for readdirplus on every readdir, not just when the kernel guesses
+ * it's worthwhile, as the attributes come with the (cached) listing for
+ * little more than the cost of a stat each (see readDirOp())
+ */
+void wantReadDirPlus( struct fuse_conn_info * conn )
+{
+    if ( conn->capable & FUSE_CAP_READDIRPLUS ) {
+        conn->want |= FUSE_CAP_READDIRPLUS;
+        conn->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+    }
+}
+
 // ------------------------------------------------------------------------------
 /**
  * Initialize filesystem
@@ -340,25 +434,164 @@ void * initPrivateData( const char * mountPath, const char * templatePath )
  * parameter to the destroy() method. It overrides the initial
  * value provided to fuse_main() / fuse_new().
  */
-void * initFsOp( struct fuse_conn_info * UNUSED( conn ), struct fuse_config * cfg )
+void * initFsOp( struct fuse_conn_info * conn, struct fuse_config * cfg )
 {
     logEntry( "%p,%p", conn, cfg );
 
     cfg->use_ino     = 1;
     cfg->nullpath_ok = 1;
 
-    /* Pick up changes from lower filesystem right away. This is also necessary
-     * for better hardlink support. When the kernel calls the unlink() handler,
-     * it does not know the inode of the to-be-removed entry and therefore can
-     * not invalidate the cache of the associated inode - resulting in an
-     * incorrect st_nlink value being reported for any remaining hardlinks to
-     * this inode. */
-    cfg->entry_timeout    = 0;
-    cfg->attr_timeout     = 0;
-    cfg->negative_timeout = 0;
+    wantSplice( conn );
+    wantReadDirPlus( conn );
+
+    if ( isKernelCacheEnabled() ) {
+        /* Let the kernel cache, and push changes out to it explicitly (see
+         * kernelCache.c). The kernel will also drop cached contents when it
+         * sees a file's size or mtime change (FUSE_CAP_AUTO_INVAL_DATA). */
+        cfg->entry_timeout    = globals.template.cacheTimeout;
+        cfg->attr_timeout     = globals.template.cacheTimeout;
+        cfg->negative_timeout = globals.template.cacheTimeout;
+    } else {
+        /* Pick up changes from lower filesystem right away. This is also necessary
+         * for better hardlink support. When the kernel calls the unlink() handler,
+         * it does not know the inode of the to-be-removed entry and therefore can
+         * not invalidate the cache of the associated inode - resulting in an
+         * incorrect st_nlink value being reported for any remaining hardlinks to
+         * this inode. */
+        cfg->entry_timeout    = 0;
+        cfg->attr_timeout     = 0;
+        cfg->negative_timeout = 0;
+    }
+
+    tPrivateData * privateData = getPrivateData();
+    startBackground( privateData );
 
     /* Note: we've already set up private data, so pass that back, or it'll be lost */
-    return (void *)getPrivateData();
+    return (void *)privateData;
+}
+
+/**
+ * Clean up filesystem
+ *
+ * Called on filesystem exit.
+ */
+void destroyFsOp( void * private_data )
+{
+    logEntry( "%p", private_data );
+
+    stopBackground( private_data );
+}
+
+/**
+ * @brief adjust the attributes of a template file to describe what it renders to
+ * @param path   path of the template, relative to the mount
+ * @param fh     its open handle, or NULL if it isn't open
+ * @param stbuf  the attributes of the template file itself
+ */
+void templateAttributes( const char * path, const tFHFile * fh, struct stat * stbuf )
+{
+    /* if it's a template, report it as read-only/not executable */
+    mode_t mask = S_IWUSR | S_IWGRP | S_IWOTH;
+    if ( !S_ISDIR( stbuf->st_mode ) ) {
+        /* if it's not a directory, clear the exec bits too */
+        mask = mask | S_IXUSR | S_IXGRP | S_IXOTH;
+    }
+    stbuf->st_mode = stbuf->st_mode & ~mask;
+
+    if ( !S_ISDIR( stbuf->st_mode ) ) {
+        tPrivateData *    privateData = getPrivateData();
+        tConfigSnapshot * config      = NULL;
+        size_t            length;
+
+        /* getattr is far too frequent to call kdbGet() for; opens check for changes */
+        if ( privateData != NULL ) {
+            config = acquireTemplateConfig( privateData, path, false );
+        }
+
+        /* report the length of the rendered output, if we know it. If the
+         * template hasn't been rendered against the current configuration,
+         * the best we can do without rendering it is the template's length */
+        if ( fh != NULL && fh->contents != NULL ) {
+            stbuf->st_size = fh->contents->length;
+        } else if ( fh != NULL && fh->stream != NULL ) {
+            /* as much as has been produced so far */
+            stbuf->st_size = renderStreamLength( fh->stream );
+        } else if ( fh == NULL
+                 && config != NULL
+                 && !isExecutable( path )
+                 && lookupRenderedMeta( path, stbuf, config->generation, &length ) ) {
+            stbuf->st_size = length;
+        }
+
+        /* the output changes whenever the template or the configuration does. Not
+         * when the configuration was merely (re)loaded, or every restart would look
+         * like a change to everything */
+        if ( config != NULL ) {
+            if ( isLaterThan( &config->changedAt, &stbuf->st_mtim ) ) {
+                stbuf->st_mtim = config->changedAt;
+            }
+            if ( isLaterThan( &config->changedAt, &stbuf->st_ctim ) ) {
+                stbuf->st_ctim = config->changedAt;
+            }
+            releaseConfigSnapshot( config );
+        }
+    }
+}
+
+/**
+ * @brief the attributes of the stats directory, or the file in it.
+ * Also used by lowlevelOperations.c
+ */
+int statsAttributes( const char * path, struct stat * stbuf )
+{
+    memset( stbuf, 0, sizeof( struct stat ) );
+    if ( isStatsDir( path ) ) {
+        stbuf->st_mode  = S_IFDIR | 0555;
+        stbuf->st_nlink = 2;
+    } else {
+        /* its length isn't known until it's opened, so it's opened with direct_io */
+        stbuf->st_mode  = S_IFREG | 0444;
+        stbuf->st_nlink = 1;
+    }
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+    clock_gettime( CLOCK_REALTIME, &stbuf->st_mtim );
+    stbuf->st_atim = stbuf->st_mtim;
+    stbuf->st_ctim = stbuf->st_mtim;
+
+    return 0;
+}
+
+/**
+ * @brief open the stats file, capturing everything counted so far (see metrics.c).
+ * Also used by lowlevelOperations.c
+ */
+int openStats( tFHFile * fh, struct fuse_file_info * fi )
+{
+    int    result;
+    char * text   = NULL;
+    size_t length = 0;
+
+    if ( ( fi->flags & O_ACCMODE ) != O_RDONLY ) {
+        result = -EACCES;
+    } else {
+        result = formatMetrics( &text, &length );
+    }
+
+    if ( result == 0 ) {
+        /* served like a rendered template, just not cached */
+        fh->fd         = -1;
+        fh->isTemplate = true;
+        fh->contents   = newRendered( (byte *) text, length );
+        if ( fh->contents == NULL ) {
+            free( text );
+            result = -ENOMEM;
+        }
+        fi->direct_io  = 1;
+        fi->keep_cache = 0;
+    }
+
+    return result;
 }
 
 /** Get file attributes.
@@ -377,12 +610,14 @@ int getFileAttrOp( const char * path, struct stat * stbuf, struct fuse_file_info
     int result;
     logEntry( "\'%s\', %p, %p", path, stbuf, fi );
 
+    if ( isStatsDir( path ) || isStatsFile( path ) ) {
+        return statsAttributes( path, stbuf );
+    }
+
     tFHFile * fh = getFileHandle( fi );
 
     bool isTemplate;
 
-    /* ToDo: handle templates better - particularly timestamps */
-
     if ( fh == NULL ) {
         isTemplate = hasTemplate( path );
     } else {
@@ -402,24 +637,21 @@ int getFileAttrOp( const char * path, struct stat * stbuf, struct fuse_file_info
                                              &path[ 1 ],
                                              stbuf,
                                              AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW ) );
+        if ( result == -ENOENT && recheckTemplateIndex( path ) ) {
+            /* the watcher hasn't caught up with a template being added or removed yet */
+            isTemplate = hasTemplate( path );
+            rootFD     = isTemplate ? getTemplateFD() : getMountpointFD();
+            result     = fixupResult( fstatat( rootFD,
+                                               &path[ 1 ],
+                                               stbuf,
+                                               AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW ) );
+        }
     } else {
         result = fixupResult( fstat( fh->fd, stbuf ) );
     }
 
-    if ( isTemplate ) {
-
-        /* if it's a template, report it as read-only/not executable */
-        mode_t mask = S_IWUSR | S_IWGRP | S_IWOTH;
-        if ( !S_ISDIR( stbuf->st_mode ) ) {
-            /* if it's not a directory, clear the exec bits too */
-            mask = mask | S_IXUSR | S_IXGRP | S_IXOTH;
-        }
-        stbuf->st_mode = stbuf->st_mode & ~mask;
-
-        /* return the length of the cached contents */
-        if ( fh != NULL && fh->contents != NULL ) {
-            stbuf->st_size = fh->length;
-        }
+    if ( isTemplate && result == 0 ) {
+        templateAttributes( path, fh, stbuf );
     }
 
     return result;
@@ -438,6 +670,10 @@ int fileAccessOp( const char * path, int mask )
 {
     logEntry( "\'%s\', %d", path, mask );
 
+    if ( isStatsDir( path ) || isStatsFile( path ) ) {
+        return ( mask & W_OK ) ? -EACCES : 0;
+    }
+
     return fixupResult( faccessat( getMountpointFD(),
                                          &path[ 1 ],
                                          mask,
@@ -470,6 +706,62 @@ int readSymlinkOp( const char * path, char * buf, size_t size )
     return result;
 }
 
+/**
+ * @brief the path of an entry in a directory, relative to the mount
+ * @return zero if successful, -ENAMETOOLONG if it doesn't fit
+ */
+static int entryPath( const char * dirPath, const char * name, char * path, size_t size )
+{
+    int written = snprintf( path, size, "%s%s%s",
+                            dirPath,
+                            ( strcmp( dirPath, "/" ) == 0 ) ? "" : "/",
+                            name );
+
+    return ( written < 0 || (size_t)written >= size ) ? -ENAMETOOLONG : 0;
+}
+
+/**
+ * @brief is an entry in a merged listing served from the template hierarchy,
+ * rather than from underneath the mount?
+ * @param dirPath  the directory it's in, relative to the mount
+ */
+bool isServedFromTemplates( const char * dirPath, const tDirEntry * entry )
+{
+    bool result = false;
+    char path[ PATH_MAX ];
+
+    if ( entry->inTemplates && entryPath( dirPath, entry->name, path, sizeof( path ) ) == 0 ) {
+        result = hasTemplate( path );
+    }
+    return result;
+}
+
+/**
+ * @brief the attributes of an entry in a directory, as getattr would report them
+ * @return zero if successful, negative errno if not
+ */
+static int entryAttributes( const tFHDir * dh, const tDirEntry * entry, struct stat * st )
+{
+    int  result;
+    char path[ PATH_MAX ];
+
+    result = entryPath( dh->path, entry->name, path, sizeof( path ) );
+    if ( result == 0 ) {
+        bool isTemplate = ( entry->inTemplates && hasTemplate( path ) );
+        int  dirFD      = isTemplate ? dh->templateFD : dh->mountFD;
+
+        if ( dirFD == -1 ) {
+            result = -ENOENT;
+        } else {
+            result = fixupResult( fstatat( dirFD, entry->name, st, AT_SYMLINK_NOFOLLOW ) );
+        }
+        if ( result == 0 && isTemplate ) {
+            templateAttributes( path, NULL, st );
+        }
+    }
+    return result;
+}
+
 /** Open directory
  *
  * Unless the 'default_permissions' mount option is given,
@@ -477,47 +769,58 @@ int readSymlinkOp( const char * path, char * buf, size_t size )
  * directory. Optionally opendir may also return an arbitrary
  * filehandle in the fuse_file_info structure, which will be
  * passed to readdir, releasedir and fsyncdir.
+ *
+ * The directory is listed (or its listing found in the cache)
+ * right away, merging the directory underneath the mount with
+ * the same one in the template hierarchy (see dirListing.c).
  */
 int openDirOp( const char * path, struct fuse_file_info * fi )
 {
-    int fd;
+    int result = 0;
 
     logEntry( "\'%s\',%p", path, fi );
 
-    tFHDir * dh = (tFHDir *) malloc( sizeof( tFileHandle ) );
-
+    tFHDir * dh = (tFHDir *) calloc( 1, sizeof( tFileHandle ) );
     if ( dh == NULL ) {
         return -ENOMEM;
     }
 
-    if ( strcmp( path, "/" ) == 0 ) {
-        fd = dup( getMountpointFD() );
-        if ( lseek( fd, 0, SEEK_SET ) == -1 ) {
-            fuse_log( FUSE_LOG_ERR, "error: lseek failed (%d: %s)", errno, strerror( errno ) );
-            return -errno;
+    /* either may be missing, but not both. The stats directory lists as empty */
+    const char * relative = ( strcmp( path, "/" ) == 0 ) ? "." : &path[ 1 ];
+    dh->mountFD    = openat( getMountpointFD(), relative, O_PATH | O_DIRECTORY | O_CLOEXEC );
+    dh->templateFD = openat( getTemplateFD(), relative, O_PATH | O_DIRECTORY | O_CLOEXEC );
+    if ( dh->mountFD == -1 && dh->templateFD == -1 && !isStatsDir( path ) ) {
+        result = -errno;
+    }
+    errno = 0;
+
+    if ( result == 0 ) {
+        dh->path = strdup( path );
+        if ( dh->path == NULL ) {
+            result = -ENOMEM;
+        } else {
+            dh->listing = acquireDirListing( path, dh->mountFD, dh->templateFD );
+            if ( dh->listing == NULL ) {
+                logError( "failed to list directory \'%s\'", path );
+                result = -EIO;
+            }
         }
-    } else {
-        fd = openat( getMountpointFD(), &path[ 1 ], O_RDONLY );
     }
 
-    if ( fd == -1 ) {
-        fuse_log( FUSE_LOG_ERR, "file descriptor is invalid (%d: %s)", errno,
-                  strerror( errno ) );
-        return -errno;
+    if ( result == 0 ) {
+        setDirHandle( fi, dh );
     } else {
-        dh->dp = fdopendir( fd );
-        if ( dh->dp == NULL ) {
-            fuse_log( FUSE_LOG_ERR, "failed to open directory \'%s\'", path );
-            free( dh );
-            return -errno;;
+        if ( dh->mountFD != -1 ) {
+            close( dh->mountFD );
         }
-        dh->offset = 0;
-        dh->entry  = NULL;
-
-        setDirHandle( fi, dh );
+        if ( dh->templateFD != -1 ) {
+            close( dh->templateFD );
+        }
+        free( dh->path );
+        free( dh );
     }
 
-    return 0;
+    return result;
 }
 
 /** Read directory
@@ -530,6 +833,10 @@ int openDirOp( const char * path, struct fuse_file_info * fi )
  * offset to the filler function.  When the data is full (or an error
  * happens) the filler function will return '1'.
  *
+ * The offset of an entry is one more than its index in the listing. For
+ * readdirplus, each entry's attributes are included, as getattr would
+ * report them, so listing a directory with them takes no more requests.
+ *
  * @param path
  * @param buf
  * @param filler
@@ -545,11 +852,6 @@ int readDirOp( const char * UNUSED( path ),
                struct fuse_file_info * fi,
                enum fuse_readdir_flags flags )
 {
-    (void)flags;
-
-    /* ToDo: merge entries from the mount point and corresponding template directory
-     * Otherwise a template file that does not have a corresponding file under the
-     * mountpoint will never be visible */
     logEntry( "\'%s\',%p", path, fi );
 
     tFHDir * dh = getDirHandle( fi );
@@ -558,65 +860,39 @@ int readDirOp( const char * UNUSED( path ),
         return -ENOTDIR;
     }
 
-    if ( offset != dh->offset ) {
-#ifndef __FreeBSD__
-        seekdir( dh->dp, offset );
-#else
-        /* Subtract the one that we add when calling telldir() below */
-        seekdir( dh->dp, offset - 1 );
-#endif
-        dh->entry  = NULL;
-        dh->offset = offset;
+    if ( offset == 0 ) {
+        /* (re)starting, so pick up any change since it was opened */
+        tDirListing * listing = acquireDirListing( dh->path, dh->mountFD, dh->templateFD );
+        if ( listing != NULL ) {
+            releaseDirListing( dh->listing );
+            dh->listing = listing;
+        }
     }
-    do {
-        struct stat              st;
-        off_t                    nextoff;
+
+    for ( size_t i = offset; i < dh->listing->count; ++i ) {
+        const tDirEntry *        entry      = &dh->listing->entries[ i ];
         enum fuse_fill_dir_flags fill_flags = 0;
+        struct stat              st;
 
-        if ( !dh->entry ) {
-            dh->entry = readdir( dh->dp );
-            if ( !dh->entry ) {
-                break;
-            }
-        }
-#ifdef HAVE_FSTATAT
-        if (flags & FUSE_READDIR_PLUS) {
-            int result;
-
-            result = fstatat( dirfd(d->dp),
-                              d->entry->d_name,
-                              &st,
-                              AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW);
-            if (result != -1)
-            {
-                fill_flags |= FUSE_FILL_DIR_PLUS;
-            }
-        }
-#endif
-        if ( !( fill_flags & FUSE_FILL_DIR_PLUS ) ) {
+        if ( ( flags & FUSE_READDIR_PLUS ) && entryAttributes( dh, entry, &st ) == 0 ) {
+            fill_flags |= FUSE_FILL_DIR_PLUS;
+        } else if ( isServedFromTemplates( dh->path, entry ) ) {
+            memset( &st, 0, sizeof( st ) );
+            st.st_ino  = entry->templateIno;
+            st.st_mode = entry->templateType << 12;
+        } else if ( entry->inMount ) {
             memset( &st, 0, sizeof( st ) );
-            st.st_ino  = dh->entry->d_ino;
-            st.st_mode = dh->entry->d_type << 12;
+            st.st_ino  = entry->mountIno;
+            st.st_mode = entry->mountType << 12;
+        } else {
+            /* only in the template hierarchy, but not a template (e.g. unreadable) */
+            continue;
         }
-        nextoff = telldir( dh->dp );
-#ifdef __FreeBSD__
-        /* Under FreeBSD, telldir() may return 0 the first time it is called.
-         * But for libfuse, an offset of zero means that offsets are not
-         * supported, so we shift everything by one. */
-        nextoff++;
-#endif
-        if ( filler( buf,
-                     dh->entry->d_name,
-                     &st,
-                     nextoff,
-                     fill_flags ) ) {
+
+        if ( filler( buf, entry->name, &st, i + 1, fill_flags ) ) {
             break;
         }
-
-        dh->entry  = NULL;
-        dh->offset = nextoff;
-
-    } while ( 1 );
+    }
 
     return 0;
 }
@@ -632,9 +908,15 @@ int releaseDirOp( const char * UNUSED( path ), struct fuse_file_info * fi )
     logEntry( "\'%s\',%p", path, fi );
 
     tFHDir * dh = getDirHandle( fi );
-    if ( dh != NULL && dh->dp != NULL ) {
-        closedir( dh->dp );
-        dh->dp = NULL;
+    if ( dh != NULL ) {
+        releaseDirListing( dh->listing );
+        if ( dh->mountFD != -1 ) {
+            close( dh->mountFD );
+        }
+        if ( dh->templateFD != -1 ) {
+            close( dh->templateFD );
+        }
+        free( dh->path );
     }
     releaseHandle( fi );
 
@@ -904,150 +1186,627 @@ int createFileOp( const char * path, mode_t mode, struct fuse_file_info * fi )
 }
 
 /**
- * @brief
- * @param fd
- * @param buffer
- * @param size
- * @return
+ * @brief the bounds to run an executable template within: the mount options,
+ * unless its settings override them
  */
-int executeTemplate( tFHFile *fh, byte ** buffer, size_t * size )
+static void templateExecLimits( const tTemplateSettings * settings, tExecLimits * limits )
 {
-    int result = 0;
-    tPrivateData * privateData;
-    char * argv[3];
+    defaultExecLimits( limits );
+    if ( settings->timeout != 0 ) {
+        limits->timeout = settings->timeout;
+    }
+    if ( settings->maxOutput != 0 ) {
+        limits->maxOutput = settings->maxOutput;
+    }
+}
 
-    int       stdoutPipe[2];
-    int       stderrPipe[2];
-    const int kPipeReadIdx  = 0;
-    const int kPipeWriteIdx = 1;
+/**
+ * @brief a render of a (non-executable) template, handed to the render pool
+ */
+typedef struct {
+    const char *      path;     ///< path of the template, relative to the mount
+    int               fd;       ///< open descriptor of the template file
+    tConfigSnapshot * config;   ///< the configuration to render it against
+    tRenderStream *   stream;   ///< if set, receives the output as it's produced
+    byte *            buffer;   ///< otherwise, receives the output (allocated with malloc)
+    size_t            size;     ///< receives the length of the output
+    tDependencies *   dependencies; ///< receives the keys it read, NULL if they aren't known
+} tTemplateJob;
 
-    if ( pipe( stdoutPipe ) == -1 ) {
-        logError("unable to create pipe for stdout");
-        result = -errno;
-    } else if ( pipe( stderrPipe ) == -1 ) {
-        logError("unable to create pipe for stderr");
-        result = -errno;
+/**
+ * @brief a streamed render of a template. It may outlive the open that started it
+ */
+typedef struct {
+    tTemplateJob    render;     ///< must be first
+    char *          path;       ///< our own copy, as the handle's may go first
+    struct stat     st;         ///< of the template, when it was opened
+    uint64_t        configHash; ///< see renderFromConfig()
+} tStreamRenderJob;
+
+/**
+ * @brief a run of an executable template, handed to the render pool.
+ * There's no fuse context on a pool thread, so anything it's needed for
+ * is captured beforehand.
+ */
+typedef struct {
+    tPrivateData *            privateData;
+    const char *              path;     ///< path of the template, relative to the mount
+    const tTemplateSettings * settings;
+    tExecLimits               limits;
+    tRenderStream *           stream;   ///< if set, receives the output as it's produced
+    byte *                    buffer;   ///< otherwise, receives the output (allocated with malloc)
+    size_t                    size;     ///< receives the length of the output
+} tExecJob;
+
+/**
+ * @brief a streamed run of an executable template. It may outlive the open that started it
+ */
+typedef struct {
+    tExecJob        exec;     ///< must be first
+    char *          path;     ///< our own copy, as the handle's may go first
+    tOutputEntry *  entry;    ///< from prepareOutput(), or NULL
+} tStreamJob;
+
+/**
+ * @brief run an executable template once, capturing what it writes to stdout (see execEngine.c)
+ * @return zero if successful, negative errno if not
+ */
+static int executeTemplate( tExecJob * job )
+{
+    int            result      = 0;
+    tPrivateData * privateData = job->privateData;
+    const char *   path        = job->path;
+    char *         argv[3]     = { NULL, NULL, NULL };
+
+    if ( privateData == NULL ) {
+        result = -EFAULT;
+    } else if ( asprintf( &argv[ 0 ], "%s%s", privateData->templates.path, path ) < 0 ) {
+        argv[ 0 ] = NULL;   /* undefined after a failed asprintf() */
+        result = -ENOMEM;
+    } else if ( asprintf( &argv[ 1 ], "%s%s", privateData->mountpoint.path, path ) < 0 ) {
+        argv[ 1 ] = NULL;   /* argv[ 0 ] is still ours, and freed below */
+        result = -ENOMEM;
+    } else if ( job->stream != NULL ) {
+        result = streamExecutable( argv, globals.envp, &job->limits, appendRenderStream, job->stream );
     } else {
-        privateData = getPrivateData();
+        result = runExecutable( argv, globals.envp, &job->limits, &job->buffer, &job->size );
+    }
+    free( argv[ 0 ] );
+    free( argv[ 1 ] );
 
-        pid_t pid = fork();
-        switch (pid)
-        {
-        case -1: /* the fork() failed */
-            logError( "failed to execute template");
-            result = -errno;
-            break;
+    logDebug( "%s result: %d", path, result );
+
+    return result;
+}
+
+/**
+ * @brief run an executable template as a long-lived worker (see coprocess.c)
+ * @return zero if successful, negative errno if not
+ */
+static int executeWorker( tExecJob * job )
+{
+    int            result       = 0;
+    tPrivateData * privateData  = job->privateData;
+    const char *   path         = job->path;
+    char *         templatePath = NULL;
+    char *         mountPath    = NULL;
+
+    if ( privateData == NULL ) {
+        result = -EFAULT;
+    } else if ( asprintf( &templatePath, "%s%s", privateData->templates.path, path ) < 0 ) {
+        templatePath = NULL;
+        result = -ENOMEM;
+    } else if ( asprintf( &mountPath, "%s%s", privateData->mountpoint.path, path ) < 0 ) {
+        mountPath = NULL;
+        result = -ENOMEM;
+    } else {
+        /* no environment delta: its output is shared by everyone who opens it, as a
+         * one-shot run's is, so it mustn't depend on who asked (see executeTemplate()) */
+        result = runWorker( path, templatePath, mountPath, job->settings->workers, NULL,
+                            &job->limits, &job->buffer, &job->size );
+    }
+    free( templatePath );
+    free( mountPath );
+
+    return result;
+}
+
+/**
+ * @brief render a template, on a render pool thread
+ */
+static int runTemplateJob( void * context )
+{
+    tTemplateJob * job   = context;
+    uint64_t       start = metricsClock();
+
+    int result;
+
+    if ( job->stream != NULL ) {
+        result    = streamTemplate( job->fd, job->config, appendRenderStream, job->stream, &job->dependencies );
+        job->size = renderStreamLength( job->stream );
+    } else {
+        result = processTemplate( job->fd, job->config, &job->buffer, &job->size, &job->dependencies );
+    }
+
+    noteTimer( kTimerRender, start );
+    noteTemplateRender( job->path, start, job->size, result );
+    if ( result == 0 ) {
+        countMetric( kCountRenderedBytes, job->size );
+    }
+    return result;
+}
+
+/**
+ * @brief run an executable template, on a render pool thread
+ */
+static int runExecJob( void * context )
+{
+    tExecJob * job    = context;
+    int        result = -ENOSYS;
+    uint64_t   start  = metricsClock();
+
+    if ( job->settings->worker ) {
+        result = executeWorker( job );
+        if ( result == -ETIMEDOUT || result == -EFBIG ) {
+            /* running it again would only take as long, or be as big */
+        } else if ( result != 0 ) {
+            logWarning( "worker for \'%s\' failed (%d), running it once instead", job->path, result );
+            free( job->buffer );
+            job->buffer = NULL;
+            result = executeTemplate( job );
+        }
+    } else {
+        result = executeTemplate( job );
+    }
+
+    size_t produced = ( job->stream != NULL ) ? renderStreamLength( job->stream ) : job->size;
+    noteTimer( kTimerExecute, start );
+    noteTemplateRender( job->path, start, produced, result );
+    countMetric( kCountExecutedBytes, produced );
+    if ( result == -ETIMEDOUT ) {
+        countMetric( kCountExecTimeouts, 1 );
+    }
+    return result;
+}
+
+/**
+ * @brief a streamed run has finished, on a render pool thread
+ */
+static void streamDone( int result, void * context )
+{
+    tStreamJob * job = context;
+    tRendered *  output;
+
+    finishRenderStream( job->exec.stream, result );
+
+    output = renderStreamOutput( job->exec.stream );
+    storeOutput( job->entry, output );
+    if ( output != NULL ) {
+        if ( globals.template.serveStale ) {
+            storeLastGood( job->path, output );
+        }
+        if ( job->entry != NULL ) {
+            /* the kernel may still hold pages from the previous output */
+            invalidateKernelCache( job->path );
+        }
+    }
+    releaseRendered( output );
+
+    releaseRenderStream( job->exec.stream );
+    releaseTemplateSettings( job->exec.settings );
+    free( job->path );
+    free( job );
+}
 
-        case 0: /* we are the child */
-            if ( privateData != NULL ) {
-                /* set up the argv array */
-                asprintf( &argv[ 0 ], "%s%s", privateData->templates.path, fh->path );
-                asprintf( &argv[ 1 ], "%s%s", privateData->mountpoint.path, fh->path );
-                argv[ 2 ] = NULL;
-
-                dup2( stdoutPipe[ kPipeWriteIdx ], STDOUT_FILENO);
-                close( stdoutPipe[ kPipeReadIdx ] );
-                fprintf( stdout, "child wrote to stdout\n" );
-
-                dup2( stderrPipe[ kPipeWriteIdx ], STDERR_FILENO);
-                close( stderrPipe[ kPipeReadIdx ] );
-                fprintf( stderr, "child wrote to stderr\n" );
-
-                logDebug( "child: execve( %s, %s )", argv[ 0 ], argv[ 1 ] );
-                execve( argv[ 0 ], argv, globals.envp );
-                /* !!! not expected to return !!! */
-                result = -EXIT_FAILURE;
+/**
+ * @brief start streaming the output of an executable template, or join a stream already in progress
+ *
+ * The open doesn't wait for it to be run. Reads wait for as much as they
+ * ask for instead (see renderStream.c). Once a streamed run has finished,
+ * its output is cached like that of any other run.
+ *
+ * @return zero if successful, negative errno if not
+ */
+static int streamFromExecutable( tFHFile * fh,
+                                 tPrivateData * privateData,
+                                 const tTemplateSettings * settings,
+                                 const struct stat * st,
+                                 tConfigSnapshot * config,
+                                 const tInputRoot * root )
+{
+    int  result = 0;
+    bool leader;
+
+    fh->stream = joinRenderStream( fh->path, &leader );
+    if ( fh->stream == NULL ) {
+        result = -ENOMEM;
+    } else if ( leader ) {
+        tStreamJob * job = calloc( 1, sizeof( tStreamJob ) );
+
+        if ( job == NULL || ( job->path = strdup( fh->path ) ) == NULL ) {
+            free( job );
+            result = -ENOMEM;
+        } else {
+            if ( settings->ttl > 0 ) {
+                job->entry = prepareOutput( job->path, st, settings, config, root );
             }
-            break;
+            job->exec.privateData = privateData;
+            job->exec.path        = job->path;
+            job->exec.settings    = retainTemplateSettings( settings );
+            job->exec.stream      = fh->stream;     /* takes the producer's reference */
+            templateExecLimits( settings, &job->exec.limits );
+
+            result = submitRender( kLaneExecutable, runExecJob, &job->exec, streamDone, job );
+            if ( result != 0 ) {
+                releaseTemplateSettings( job->exec.settings );
+                storeOutput( job->entry, NULL );
+                free( job->path );
+                free( job );
+            }
+        }
+        if ( result != 0 ) {
+            /* let anyone who joined it in the meantime know, then drop
+             * both the producer's reference and ours */
+            finishRenderStream( fh->stream, result );
+            releaseRenderStream( fh->stream );
+            releaseRenderStream( fh->stream );
+            fh->stream = NULL;
+        }
+    }
 
-        default:
-            close( stdoutPipe[ kPipeWriteIdx ] );
-            close( stderrPipe[ kPipeWriteIdx ] );
-
-            static struct epoll_event events[2];
-            int epfd = epoll_create(4);
-
-            events[0].events  = EPOLLIN;
-            events[0].data.fd = stdoutPipe[ kPipeReadIdx ];
-            epoll_ctl( epfd, EPOLL_CTL_ADD, events[0].data.fd, &events[0] );
-
-            events[1].events  = EPOLLIN;
-            events[1].data.fd = stderrPipe[ kPipeReadIdx ];
-            epoll_ctl( epfd, EPOLL_CTL_ADD, events[1].data.fd, &events[1] );
-
-            tElasticBuffer * stdoutBuf = newElasticBuffer( 16384, 2048 );
-            tElasticBuffer * stderrBuf = newElasticBuffer( 16384, 2048 );
-            /* event loop to drain the pipes. Also watches for
-             * EPOLLHUP, which implies the child exited */
-            bool streamEOF = false;
-            do {
-                int eventCount = epoll_wait( epfd, events, 2, 10000 );
-
-                for ( int i = 0; i < eventCount; i++ ) {
-                    int eventFD = events[ i ].data.fd;
-                    if ( events[ i ].events & EPOLLIN ) {
-                        tElasticBuffer * buff = NULL;
-                        if ( eventFD == stdoutPipe[ kPipeReadIdx ] ) {
-                            buff = stdoutBuf;
-                        } else if ( eventFD == stderrPipe[ kPipeReadIdx ] ) {
-                            buff = stderrBuf;
-                        } else {
-                            logError( "epoll shows data available on"
-                                      " unknown file descriptor %d", eventFD );
-                            /* throw away the data, or we'll continue to get the same event */
-                            lseek( eventFD, 0, SEEK_END );
-                        }
-                        if ( buff != NULL ) {
-                            size_t readSize = read( eventFD,
-                                                    getSpacePtr( stderrBuf ),
-                                                    makeRoom( stderrBuf ) );
-                            increaseAvailable( stderrBuf, readSize );
-                        }
-                    }
-                    if ( events[ i ].events & ( EPOLLHUP | EPOLLERR ) ) {
-                        /* either no more data (child probably exited) or an error
-                         * either way, exit from the epoll loop */
-                        streamEOF = true;
-                    }
+    return result;
+}
+
+/**
+ * @brief a streamed render has finished, on a render pool thread
+ */
+static void streamRenderDone( int result, void * context )
+{
+    tStreamRenderJob * job    = context;
+    tConfigSnapshot *  config = job->render.config;
+    tRendered *        output;
+
+    finishRenderStream( job->render.stream, result );
+
+    output = renderStreamOutput( job->render.stream );
+    if ( output != NULL ) {
+        /* cached just as renderFromConfig() would have, so later opens needn't render it again */
+        output->dependencies    = job->render.dependencies;
+        output->configHash      = job->configHash;
+        output->configChangedAt = config->changedAt;
+        job->render.dependencies = NULL;
+        insertRendered( job->path, &job->st, config->generation, output );
+        recordRenderedMeta( job->path, &job->st, config->generation, output->length );
+        invalidateKernelCache( job->path );
+    }
+    releaseRendered( output );
+
+    freeDependencies( job->render.dependencies );
+    releaseRenderStream( job->render.stream );
+    releaseConfigSnapshot( config );
+    close( job->render.fd );
+    free( job->path );
+    free( job );
+}
+
+/**
+ * @brief start streaming the render of a template, or join a stream already in progress
+ *
+ * Like streamFromExecutable(), the open doesn't wait for the render, and
+ * reads wait for as much as they ask for instead (see renderStream.c).
+ * Once it's finished, the output goes into the render cache like that of
+ * any other render.
+ *
+ * @param stream  receives a reference to the stream
+ * @return zero if successful, negative errno if not
+ */
+static int streamFromConfig( const char * path,
+                             int fd,
+                             const struct stat * st,
+                             tConfigSnapshot * config,
+                             uint64_t configHash,
+                             tRenderStream ** stream )
+{
+    int  result = 0;
+    bool leader;
+
+    *stream = joinRenderStream( path, &leader );
+    if ( *stream == NULL ) {
+        result = -ENOMEM;
+    } else if ( leader ) {
+        tStreamRenderJob * job = calloc( 1, sizeof( tStreamRenderJob ) );
+
+        if ( job == NULL || ( job->path = strdup( path ) ) == NULL ) {
+            free( job );
+            result = -ENOMEM;
+        } else {
+            /* the render may well outlast the open, and its fd */
+            job->render.fd = fixupResult( dup( fd ) );
+            if ( job->render.fd < 0 ) {
+                result = job->render.fd;
+            } else {
+                job->st            = *st;
+                job->configHash    = configHash;
+                job->render.path   = job->path;
+                job->render.config = retainConfigSnapshot( config );
+                job->render.stream = *stream;     /* takes the producer's reference */
+
+                result = submitRender( kLaneTemplate, runTemplateJob, &job->render, streamRenderDone, job );
+                if ( result != 0 ) {
+                    releaseConfigSnapshot( job->render.config );
+                    close( job->render.fd );
                 }
-            } while ( !streamEOF );
+            }
+            if ( result != 0 ) {
+                free( job->path );
+                free( job );
+            }
+        }
+        if ( result != 0 ) {
+            /* let anyone who joined it in the meantime know, then drop
+             * both the producer's reference and ours */
+            finishRenderStream( *stream, result );
+            releaseRenderStream( *stream );
+            releaseRenderStream( *stream );
+            *stream = NULL;
+        }
+    }
 
-            if ( waitpid( pid, &result, 0 ) == -1 ) {
-                result = -errno;
+    return result;
+}
+
+/**
+ * @brief get the rendered output of a (non-executable) template
+ *
+ * The render cache is checked first, and it's only rendered on a miss.
+ * Concurrent requests for the same template wait for and share a single render.
+ * If its settings say to stream it, and the caller can take a stream, a miss
+ * doesn't wait for the render at all (see streamFromConfig()).
+ *
+ * @param privateData  the filesystem's private data
+ * @param path         path of the template, relative to the mount
+ * @param fd           open descriptor of the template file
+ * @param contents     receives a reference to the rendered output
+ * @param stream       if not NULL, may receive a reference to a stream instead
+ * @param warming      true for the warm-up, which skips a template that's already
+ *                     being rendered rather than waiting for it
+ * @param cacheHit     set true if the contents are the same as previously rendered
+ * @return zero if successful, -EINPROGRESS if the warm-up skipped it, negative errno if not
+ */
+static int renderFromConfig( tPrivateData * privateData,
+                             const char * path,
+                             int fd,
+                             tRendered ** contents,
+                             tRenderStream ** stream,
+                             bool warming,
+                             bool * cacheHit )
+{
+    int               result;
+    struct stat       st;
+    tConfigSnapshot * config = NULL;
+    tInFlight *       flight;
+
+    *cacheHit = false;
+
+    config = acquireTemplateConfig( privateData, path, true );
+
+    result = fixupResult( fstat( fd, &st ) );
+    if ( result == 0 && config == NULL ) {
+        logError( "no configuration available to render \'%s\'", path );
+        result = -EFAULT;
+    } else if ( result == 0 ) {
+        /* the snapshot can't change underneath us, so its generation is exactly
+         * the configuration this was rendered against */
+        unsigned long generation = config->generation;
+        /* only needed to tell whether a rendering saved by an earlier run is still good */
+        uint64_t      configHash = ( globals.template.snapshot != NULL ) ? hashConfigContent( config ) : 0;
+
+        *contents = lookupRendered( path, &st, generation );
+        countMetric( ( *contents != NULL ) ? kCountRenderCacheHits : kCountRenderCacheMisses, 1 );
+        if ( *contents != NULL ) {
+            logDebug( "render cache hit for \'%s\'", path );
+            *cacheHit = true;
+        } else if ( stream != NULL && isStreamed( path ) ) {
+            result = streamFromConfig( path, fd, &st, config, configHash, stream );
+        } else if ( warming && !tryJoinRender( path, generation, &flight ) ) {
+            /* the warm-up runs on a pool thread, and the leader's render may be
+             * queued behind it, so waiting could leave the pool waiting on itself */
+            result = -EINPROGRESS;
+        } else if ( warming || joinRender( path, generation, &flight, contents, &result ) ) {
+            /* a previous leader may have finished between our miss and joining */
+            *contents = lookupRendered( path, &st, generation );
+            if ( *contents == NULL && configHash != 0 ) {
+                *contents = claimRestored( path, &st, configHash );
+                if ( *contents != NULL ) {
+                    logDebug( "restored \'%s\' from the snapshot", path );
+                    insertRendered( path, &st, generation, *contents );
+                    recordRenderedMeta( path, &st, generation, (*contents)->length );
+                }
             }
-            *buffer = stdoutBuf->data;
-            *size   = stdoutBuf->available;
-            free( stdoutBuf ); /* but don't free stdoutBuf->data! */
-
-            if ( stderrBuf->available > 0 ) {
-                logWarning( "stderr output from %s%s",
-                            privateData->templates.path,
-                            fh->path );
-                logTextBlock( kLogWarning,
-                              stderrBuf->data,
-                              stderrBuf->available );
+            if ( *contents == NULL ) {
+                tTemplateJob job = { .path = path, .fd = fd, .config = config };
+
+                result = runRender( kLaneTemplate, runTemplateJob, &job );
+                if ( result == 0 ) {
+                    *contents = newRendered( job.buffer, job.size );
+                    if ( *contents == NULL ) {
+                        free( job.buffer );
+                        freeDependencies( job.dependencies );
+                        result = -ENOMEM;
+                    } else {
+                        /* so a change to the configuration need only discard it if it read what changed */
+                        (*contents)->dependencies = job.dependencies;
+                        (*contents)->configHash      = configHash;
+                        (*contents)->configChangedAt = config->changedAt;
+                        insertRendered( path, &st, generation, *contents );
+                        recordRenderedMeta( path, &st, generation, job.size );
+                        /* the kernel may still hold attributes from a previous render */
+                        invalidateKernelCache( path );
+                    }
+                }
             }
-            releaseElasticBuffer( stderrBuf );
+            finishRender( flight, *contents, result );
+        }
+    }
+    releaseConfigSnapshot( config );
 
-            close( epfd );
-            break;
+    return result;
+}
+
+/**
+ * @brief get the output of an executable template
+ *
+ * It's run every time, unless its settings give it a ttl, in which case
+ * its output is reused until the ttl runs out or one of its declared
+ * dependencies changes (see outputCache.c). Concurrent opens of the same
+ * template wait for and share a single run. A run that exceeds its limits
+ * fails, unless '-o servestale' lets a timed-out run fall back to the
+ * last good output. If its settings say to stream it, the open doesn't
+ * wait for the run to finish at all (see streamFromExecutable()).
+ *
+ * @param fh        handle of the template file being opened
+ * @param cacheHit  set true if the contents are the same as a previous run
+ * @return zero if successful, negative errno if not
+ */
+static int renderFromExecutable( tFHFile * fh, bool * cacheHit )
+{
+    int                       result      = 0;
+    tPrivateData *            privateData = getPrivateData();
+    const tTemplateSettings * settings    = loadTemplateSettings( fh->path );
+    tConfigSnapshot *         config      = NULL;
+    tInputRoot                root;
+    struct stat               st;
+    tInFlight *               flight;
+
+    *cacheHit = false;
+
+    if ( settings->ttl > 0 ) {
+        result = fixupResult( fstat( fh->fd, &st ) );
+        if ( privateData != NULL ) {
+            config         = acquireConfigSnapshot( &privateData->config );
+            root.mountPath = privateData->mountpoint.path;
+            root.mountFD   = privateData->mountpoint.fd;
+        } else {
+            root.mountPath = "";
+            root.mountFD   = -1;
+        }
+        if ( result == 0 ) {
+            fh->contents = lookupOutput( fh->path, &st, settings, config, &root );
+            countMetric( ( fh->contents != NULL ) ? kCountOutputCacheHits : kCountOutputCacheMisses, 1 );
         }
-        close( stdoutPipe[kPipeReadIdx] );
-        close( stderrPipe[kPipeReadIdx] );
     }
 
+    if ( fh->contents != NULL ) {
+        logDebug( "output cache hit for '%s'", fh->path );
+        *cacheHit = true;
+    } else if ( result == 0 && settings->stream && !settings->worker ) {
+        result = streamFromExecutable( fh, privateData, settings, &st, config, &root );
+    } else if ( result == 0 && joinRender( fh->path,
+                                           ( config != NULL ) ? config->generation : 0,
+                                           &flight, &fh->contents, &result ) ) {
+        tOutputEntry * entry = NULL;
+
+        if ( settings->ttl > 0 ) {
+            /* a previous leader may have finished between our miss and joining */
+            fh->contents = lookupOutput( fh->path, &st, settings, config, &root );
+            if ( fh->contents == NULL ) {
+                entry = prepareOutput( fh->path, &st, settings, config, &root );
+            }
+        }
 
-#ifdef DEBUG
-    logDebug( "%s exit code: %d", fh->path, result );
-#else
-    if ( result != 0 ) {
-        logError( "%s exit code: %d", fh->path, result );
+        if ( fh->contents == NULL ) {
+            tExecJob job = {
+                .privateData = privateData,
+                .path        = fh->path,
+                .settings    = settings
+            };
+            templateExecLimits( settings, &job.limits );
+
+            result = runRender( kLaneExecutable, runExecJob, &job );
+            if ( result == 0 ) {
+                fh->contents = newRendered( job.buffer, job.size );
+                if ( fh->contents == NULL ) {
+                    free( job.buffer );
+                    result = -ENOMEM;
+                }
+            } else {
+                free( job.buffer );
+            }
+            storeOutput( entry, fh->contents );
+
+            if ( globals.template.serveStale ) {
+                if ( result == 0 ) {
+                    storeLastGood( fh->path, fh->contents );
+                } else if ( result == -ETIMEDOUT ) {
+                    fh->contents = lookupLastGood( fh->path );
+                    if ( fh->contents != NULL ) {
+                        logWarning( "serving the last good output of '%s'", fh->path );
+                        result = 0;
+                    }
+                }
+            }
+            if ( entry != NULL && result == 0 ) {
+                /* the kernel may still hold pages from the previous output */
+                invalidateKernelCache( fh->path );
+            }
+        }
+        finishRender( flight, fh->contents, result );
+    }
+
+    releaseConfigSnapshot( config );
+    releaseTemplateSettings( settings );
+
+    return result;
+}
+
+/**
+ * @brief populate fh->contents from the template that fh->fd refers to
+ *
+ * Executable templates are run, unless their output can be reused. Other
+ * templates are looked up in the render cache first, and only rendered on
+ * a miss. Either way, concurrent opens of the same template wait for and
+ * share a single render, which is done on the render pool (see renderPool.c).
+ *
+ * @param fh        handle of the template file being opened
+ * @param cacheHit  set true if the contents are the same as previously rendered
+ * @return zero if successful, negative errno if not
+ */
+int renderTemplate( tFHFile * fh, bool * cacheHit )
+{
+    int result;
+
+    if ( fh->isExecutable ) {
+        result = renderFromExecutable( fh, cacheHit );
+    } else {
+        result = renderFromConfig( getPrivateData(), fh->path, fh->fd, &fh->contents, &fh->stream, false, cacheHit );
     }
-#endif
 
     return result;
 }
 
+/**
+ * @brief render one template in the background, to fill the caches (see warmup.c)
+ * @param path     path of the template, relative to the mount
+ * @param context  the filesystem's private data
+ */
+static void warmTemplate( const char * path, void * context )
+{
+    tPrivateData * privateData = context;
+    tRendered *    contents    = NULL;
+    bool           cacheHit;
+
+    int fd = openat( privateData->templates.fd, &path[1], O_RDONLY | O_NOFOLLOW );
+    if ( fd < 0 ) {
+        logDebug( "unable to warm \'%s\'", path );
+    } else {
+        if ( renderFromConfig( privateData, path, fd, &contents, NULL, true, &cacheHit ) == 0 && !cacheHit ) {
+            logDebug( "warmed \'%s\'", path );
+        }
+        releaseRendered( contents );
+        close( fd );
+    }
+}
+
 /** Open a file
  *
  * Open flags are available in fi->flags. The following rules apply:
@@ -1110,7 +1869,10 @@ int openFileOp( const char * path, struct fuse_file_info * fi )
                 setFileHandle( fi, fh );
             }
         }
-        if ( fh != NULL ) {
+        if ( fh != NULL && isStatsFile( path ) ) {
+            fh->path = strdup( path );
+            result   = openStats( fh, fi );
+        } else if ( fh != NULL ) {
             fh->path         = strdup( path );
             fh->isTemplate   = hasTemplate( path );
             fh->isExecutable = isExecutable( path );
@@ -1125,17 +1887,28 @@ int openFileOp( const char * path, struct fuse_file_info * fi )
             }
 
             fd = fixupResult( openat( rootfd, &path[ 1 ], fi->flags ) );
+            if ( fd == -ENOENT && recheckTemplateIndex( path ) ) {
+                /* the watcher hasn't caught up with a template being added or removed yet */
+                fh->isTemplate   = hasTemplate( path );
+                fh->isExecutable = isExecutable( path );
+                rootfd = fh->isTemplate ? getTemplateFD() : getMountpointFD();
+                fd     = fixupResult( openat( rootfd, &path[ 1 ], fi->flags ) );
+            }
             if ( fd < 0 ) {
                 result = fd;
             } else {
-                fh->path = strdup( path );
                 fh->fd = fd;
                 if ( fh->isTemplate ) {
-                    if ( fh->isExecutable ) {
-                        result = executeTemplate( fh, &fh->contents, &fh->length );
-                    } else {
-                        result = processTemplate( fh->fd, &fh->contents, &fh->length );
-                    }
+                    bool cacheHit;
+
+                    result = renderTemplate( fh, &cacheHit );
+                    /* the kernel's copy is only still good if the template,
+                     * and the configuration it was rendered with, are unchanged */
+                    fi->keep_cache = isKernelCacheEnabled() && cacheHit;
+                    /* the length of a stream isn't known until it's finished */
+                    fi->direct_io  = ( fh->stream != NULL );
+                } else {
+                    fi->keep_cache = isKernelCacheEnabled();
                 }
             }
         }
@@ -1166,15 +1939,19 @@ int readFileOp( const char * UNUSED( path ),
     if ( fh == NULL ) {
         result = -ENFILE;
     } else {
-        if ( fh->isTemplate ) {
-            if (fh->contents == NULL || (size_t)offset >= fh->length ) {
+        if ( fh->stream != NULL ) {
+            /* waits for the output to reach offset + size, or end */
+            result = readRenderStream( fh->stream, buf, size, offset );
+        } else if ( fh->isTemplate ) {
+            tRendered * contents = fh->contents;
+            if (contents == NULL || (size_t)offset >= contents->length ) {
                 result = -EOF;
             } else {
                 /* if trying to read more data than we have, trim the size */
-                if ( offset + size > fh->length ) {
-                    size = fh->length - offset;
+                if ( offset + size > contents->length ) {
+                    size = contents->length - offset;
                 }
-                memcpy( buf, &fh->contents[offset], size );
+                memcpy( buf, &contents->data[offset], size );
                 result = size;
             }
         } else {
@@ -1205,30 +1982,72 @@ int readFileBufOp( const char * UNUSED( path ),
                    off_t offset,
                    struct fuse_file_info * fi )
 {
-    int result = 0;;
+    int result = 0;
     tFHFile * fh = NULL;
     logEntry( "\'%s\', %p", path, fi );
 
-    if ( fi == NULL ) {
+    fh = getFileHandle( fi );
+    if ( fh == NULL ) {
         result = -ENFILE;
     } else {
-        fh = getFileHandle( fi );
-        if ( fh == NULL ) {
-            result = -ENFILE;
-        } else {
-            struct fuse_bufvec * src;
-            src = (struct fuse_bufvec *) calloc( 1, sizeof( struct fuse_bufvec ) );
-            if ( src == NULL ) {
+        struct fuse_bufvec * src;
+        src = (struct fuse_bufvec *) calloc( 1, sizeof( struct fuse_bufvec ) );
+        if ( src == NULL ) {
+            result = -ENOMEM;
+        } else if ( fh->stream != NULL ) {
+            *src = FUSE_BUFVEC_INIT( size );
+            src->buf[ 0 ].mem = malloc( size );
+            if ( src->buf[ 0 ].mem == NULL ) {
                 result = -ENOMEM;
             } else {
-                *src = FUSE_BUFVEC_INIT( size );
-
+                ssize_t got = readRenderStream( fh->stream, src->buf[ 0 ].mem, size, offset );
+                if ( got < 0 ) {
+                    free( src->buf[ 0 ].mem );
+                    result = got;
+                } else {
+                    src->buf[ 0 ].size = got;
+                }
+            }
+        } else if ( fh->isTemplate ) {
+            tRendered * contents = fh->contents;
+            size_t      length   = 0;
+
+            if ( contents != NULL && (size_t)offset < contents->length ) {
+                length = contents->length - offset;
+                if ( length > size ) {
+                    length = size;
+                }
+            }
+            *src = FUSE_BUFVEC_INIT( length );
+            if ( length > 0 && contents->fd != -1 ) {
+                /* served straight from the sealed memfd */
                 src->buf[ 0 ].flags = ( FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK );
-                src->buf[ 0 ].fd    = fh->fd;
+                src->buf[ 0 ].fd    = contents->fd;
                 src->buf[ 0 ].pos   = offset;
-
-                *bufp = src;
+            } else if ( length > 0 ) {
+                /* libfuse frees the memory of a memory bufvec, so it can't be
+                 * handed the shared rendered contents. Copy just what was asked for */
+                src->buf[ 0 ].mem = malloc( length );
+                if ( src->buf[ 0 ].mem == NULL ) {
+                    result = -ENOMEM;
+                } else {
+                    memcpy( src->buf[ 0 ].mem, &contents->data[ offset ], length );
+                }
             }
+        } else {
+            /* just describe where the data is, so libfuse can splice it
+             * straight from the file into the kernel */
+            *src = FUSE_BUFVEC_INIT( size );
+
+            src->buf[ 0 ].flags = ( FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK );
+            src->buf[ 0 ].fd    = fh->fd;
+            src->buf[ 0 ].pos   = offset;
+        }
+
+        if ( result == 0 ) {
+            *bufp = src;
+        } else {
+            free( src );
         }
     }
 
@@ -1287,6 +2106,10 @@ int writeFileBufOp( const char * UNUSED( path ), struct fuse_bufvec * buf, off_t
     if ( fh == NULL ) {
         return -ENFILE;
     }
+    if ( fh->isTemplate ) {
+        /* fail if attempting to write to a template file - they are read-only */
+        return -EPERM;
+    }
 
     dst.buf[ 0 ].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
     dst.buf[ 0 ].fd    = fh->fd;
@@ -1380,12 +2203,12 @@ int releaseFileOp( const char * UNUSED( path ), struct fuse_file_info * fi )
     if ( fh != NULL ) {
         result = fixupResult( close( fh->fd ) );
 
-        /* we have cached contents, discard them */
-        if ( fh->contents != NULL ) {
-            free( fh->contents );
-            fh->contents = NULL;
-        }
-        fh->length = 0;
+        /* drop our reference to the rendered contents. They may
+         * live on in the render cache, or in other open handles */
+        releaseRendered( fh->contents );
+        fh->contents = NULL;
+        releaseRenderStream( fh->stream );
+        fh->stream = NULL;
 
         releaseHandle( fi );
     }
@@ -1579,7 +2402,8 @@ ssize_t fileCopyRangeOp( const char * UNUSED( path_in),
                          struct fuse_file_info *fi_out, off_t off_out,
                          size_t len, int flags)
 {
-    ssize_t result;
+    logEntry( "\'%s\',%p,%ld,\'%s\',%p,%ld,%lu,%d", path_in, fi_in, off_in, path_out, fi_out, off_out, len, flags );
+
     tFHFile * fh_in = getFileHandle( fi_in );
     if ( fh_in == NULL)
     {
@@ -1590,17 +2414,49 @@ ssize_t fileCopyRangeOp( const char * UNUSED( path_in),
     {
         return -ENFILE;
     }
+    if ( fh_out->isTemplate )
+    {
+        return -EPERM;
+    }
+    if ( fh_in->isTemplate )
+    {
+        /* the fd is the template itself, not what it renders to. This
+         * makes the kernel fall back to an ordinary read and write */
+        return -EOPNOTSUPP;
+    }
 
-
-    return fixupResult( copy_file_range(fh_in->fd,
-                                        &off_in,
-                                        fh_out->fd,
-                                        &off_out,
-                                        len,
-                                        flags) );
+    /* not fixupResult(), as the count may not fit in an int */
+    ssize_t result = copy_file_range( fh_in->fd, &off_in, fh_out->fd, &off_out, len, flags );
+    if ( result == -1 )
+    {
+        result = -errno;
+    }
+    return result;
 }
 #endif
 
+/**
+ * @brief SEEK_DATA or SEEK_HOLE within rendered output, which never has any holes
+ * @return the offset, or negative errno
+ */
+off_t seekRendered( const tRendered * contents, off_t off, int whence )
+{
+    off_t result;
+    off_t length = ( contents != NULL ) ? (off_t)contents->length : 0;
+
+    if ( off < 0 ) {
+        result = -EINVAL;
+    } else if ( whence != SEEK_DATA && whence != SEEK_HOLE ) {
+        result = -EINVAL;
+    } else if ( off >= length ) {
+        result = -ENXIO;
+    } else {
+        /* all data up to the end, where the implicit hole starts */
+        result = ( whence == SEEK_DATA ) ? off : length;
+    }
+    return result;
+}
+
 /** Find next data or hole after the specified offset */
 off_t lseekFileOp( const char * UNUSED( path ),
                    off_t off,
@@ -1612,60 +2468,138 @@ off_t lseekFileOp( const char * UNUSED( path ),
 
     tFHFile * fh = getFileHandle( fi );
     if ( fh != NULL ) {
-        if ( !fh->isTemplate ) {
-            result = fixupResult( lseek( fh->fd, off, whence ) );
+        if ( fh->isTemplate ) {
+            result = seekRendered( fh->contents, off, whence );
+        } else {
+            result = lseek( fh->fd, off, whence );
+            if ( result == -1 ) {
+                result = -errno;
+            }
         }
     }
 
     return result;
 }
 
+/* each operation, timed for the stats (see metrics.c) */
+METERED( kOpGetattr, int, getFileAttrOp,
+         ( const char * path, struct stat * stbuf, struct fuse_file_info * fi ), ( path, stbuf, fi ) )
+METERED( kOpAccess, int, fileAccessOp, ( const char * path, int mask ), ( path, mask ) )
+METERED( kOpReadlink, int, readSymlinkOp, ( const char * path, char * buf, size_t size ), ( path, buf, size ) )
+METERED( kOpOpendir, int, openDirOp, ( const char * path, struct fuse_file_info * fi ), ( path, fi ) )
+METERED( kOpReaddir, int, readDirOp,
+         ( const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
+           struct fuse_file_info * fi, enum fuse_readdir_flags flags ),
+         ( path, buf, filler, offset, fi, flags ) )
+METERED( kOpReleasedir, int, releaseDirOp, ( const char * path, struct fuse_file_info * fi ), ( path, fi ) )
+METERED( kOpMknod, int, mkNodOp, ( const char * path, mode_t mode, dev_t rdev ), ( path, mode, rdev ) )
+METERED( kOpMkdir, int, createDirOp, ( const char * path, mode_t mode ), ( path, mode ) )
+METERED( kOpSymlink, int, createSymlinkOp, ( const char * from, const char * to ), ( from, to ) )
+METERED( kOpUnlink, int, fileUnlinkOp, ( const char * path ), ( path ) )
+METERED( kOpRmdir, int, removeDirOp, ( const char * path ), ( path ) )
+METERED( kOpRename, int, renameFsObjOp, ( const char * from, const char * to, unsigned int flags ), ( from, to, flags ) )
+METERED( kOpLink, int, linkFileOp, ( const char * from, const char * to ), ( from, to ) )
+METERED( kOpChmod, int, chmodFileOp, ( const char * path, mode_t mode, struct fuse_file_info * fi ), ( path, mode, fi ) )
+METERED( kOpChown, int, chownFileOp,
+         ( const char * path, uid_t uid, gid_t gid, struct fuse_file_info * fi ), ( path, uid, gid, fi ) )
+METERED( kOpTruncate, int, truncateFileOp, ( const char * path, off_t size, struct fuse_file_info * fi ), ( path, size, fi ) )
+#ifdef HAVE_UTIMENSAT
+METERED( kOpUtimens, int, utimensOp,
+         ( const char * path, const struct timespec ts[2], struct fuse_file_info * fi ), ( path, ts, fi ) )
+#endif
+METERED( kOpCreate, int, createFileOp, ( const char * path, mode_t mode, struct fuse_file_info * fi ), ( path, mode, fi ) )
+METERED( kOpOpen, int, openFileOp, ( const char * path, struct fuse_file_info * fi ), ( path, fi ) )
+METERED( kOpRead, int, readFileOp,
+         ( const char * path, char * buf, size_t size, off_t offset, struct fuse_file_info * fi ),
+         ( path, buf, size, offset, fi ) )
+METERED( kOpReadBuf, int, readFileBufOp,
+         ( const char * path, struct fuse_bufvec ** bufp, size_t size, off_t offset, struct fuse_file_info * fi ),
+         ( path, bufp, size, offset, fi ) )
+METERED( kOpWrite, int, writeFileOp,
+         ( const char * path, const char * buf, size_t size, off_t offset, struct fuse_file_info * fi ),
+         ( path, buf, size, offset, fi ) )
+METERED( kOpWriteBuf, int, writeFileBufOp,
+         ( const char * path, struct fuse_bufvec * buf, off_t offset, struct fuse_file_info * fi ),
+         ( path, buf, offset, fi ) )
+METERED( kOpStatfs, int, getFsStatsOp, ( const char * path, struct statvfs * stbuf ), ( path, stbuf ) )
+METERED( kOpFlush, int, flushFileOp, ( const char * path, struct fuse_file_info * fi ), ( path, fi ) )
+METERED( kOpRelease, int, releaseFileOp, ( const char * path, struct fuse_file_info * fi ), ( path, fi ) )
+METERED( kOpFsync, int, fsyncFileOp, ( const char * path, int isdatasync, struct fuse_file_info * fi ), ( path, isdatasync, fi ) )
+#ifdef HAVE_POSIX_FALLOCATE
+METERED( kOpFallocate, int, fallocateOp,
+         ( const char * path, int mode, off_t offset, off_t length, struct fuse_file_info * fi ),
+         ( path, mode, offset, length, fi ) )
+#endif
+#ifdef HAVE_SETXATTR
+METERED( kOpSetxattr, int, setXAttrOp,
+         ( const char * path, const char * name, const char * value, size_t size, int flags ),
+         ( path, name, value, size, flags ) )
+METERED( kOpGetxattr, int, getXAttrOp,
+         ( const char * path, const char * name, char * value, size_t size ), ( path, name, value, size ) )
+METERED( kOpListxattr, int, listXAttrOp, ( const char * path, char * list, size_t size ), ( path, list, size ) )
+METERED( kOpRemovexattr, int, removeXAttrOp, ( const char * path, const char * name ), ( path, name ) )
+#endif
+#ifdef HAVE_LIBULOCKMGR
+METERED( kOpLock, int, lockFileOp,
+         ( const char * path, struct fuse_file_info * fi, int cmd, struct flock * lock ), ( path, fi, cmd, lock ) )
+#endif
+METERED( kOpFlock, int, flockFileOp, ( const char * path, struct fuse_file_info * fi, int op ), ( path, fi, op ) )
+#ifdef HAVE_COPY_FILE_RANGE
+METERED( kOpCopyFileRange, ssize_t, fileCopyRangeOp,
+         ( const char * pathIn, struct fuse_file_info * fiIn, off_t offIn,
+           const char * pathOut, struct fuse_file_info * fiOut, off_t offOut, size_t len, int flags ),
+         ( pathIn, fiIn, offIn, pathOut, fiOut, offOut, len, flags ) )
+#endif
+METERED( kOpLseek, off_t, lseekFileOp,
+         ( const char * path, off_t off, int whence, struct fuse_file_info * fi ), ( path, off, whence, fi ) )
+
 const struct fuse_operations templatefsOperations = {
     .init            = initFsOp,
-    .getattr         = getFileAttrOp,
-    .access          = fileAccessOp,
-    .readlink        = readSymlinkOp,
-    .opendir         = openDirOp,
-    .readdir         = readDirOp,
-    .releasedir      = releaseDirOp,
-    .mknod           = mkNodOp,
-    .mkdir           = createDirOp,
-    .symlink         = createSymlinkOp,
-    .unlink          = fileUnlinkOp,
-    .rmdir           = removeDirOp,
-    .rename          = renameFsObjOp,
-    .link            = linkFileOp,
-    .chmod           = chmodFileOp,
-    .chown           = chownFileOp,
-    .truncate        = truncateFileOp,
+    .destroy         = destroyFsOp,
+    .getattr         = getFileAttrOpMetered,
+    .access          = fileAccessOpMetered,
+    .readlink        = readSymlinkOpMetered,
+    .opendir         = openDirOpMetered,
+    .readdir         = readDirOpMetered,
+    .releasedir      = releaseDirOpMetered,
+    .mknod           = mkNodOpMetered,
+    .mkdir           = createDirOpMetered,
+    .symlink         = createSymlinkOpMetered,
+    .unlink          = fileUnlinkOpMetered,
+    .rmdir           = removeDirOpMetered,
+    .rename          = renameFsObjOpMetered,
+    .link            = linkFileOpMetered,
+    .chmod           = chmodFileOpMetered,
+    .chown           = chownFileOpMetered,
+    .truncate        = truncateFileOpMetered,
 #ifdef HAVE_UTIMENSAT
-    .utimens         = utimensOp,
+    .utimens         = utimensOpMetered,
 #endif
-    .create          = createFileOp,
-    .open            = openFileOp,
-    .read            = readFileOp,
-//  .read_buf        = readFileBufOp,
-    .write           = writeFileOp,
-//  .write_buf       = writeFileBufOp,
-    .statfs          = getFsStatsOp,
-    .flush           = flushFileOp,
-    .release         = releaseFileOp,
-    .fsync           = fsyncFileOp,
+    .create          = createFileOpMetered,
+    .open            = openFileOpMetered,
+    .read            = readFileOpMetered,
+    .read_buf        = readFileBufOpMetered,
+    .write           = writeFileOpMetered,
+    .write_buf       = writeFileBufOpMetered,
+    .statfs          = getFsStatsOpMetered,
+    .flush           = flushFileOpMetered,
+    .release         = releaseFileOpMetered,
+    .fsync           = fsyncFileOpMetered,
 #ifdef HAVE_POSIX_FALLOCATE
-    .fallocate       = fallocateOp,
+    .fallocate       = fallocateOpMetered,
 #endif
 #ifdef HAVE_SETXATTR
-    .setxattr        = setXAttrOp,
-    .getxattr        = getXAttrOp,
-    .listxattr       = listXAttrOp,
-    .removexattr     = removeXAttrOp,
+    .setxattr        = setXAttrOpMetered,
+    .getxattr        = getXAttrOpMetered,
+    .listxattr       = listXAttrOpMetered,
+    .removexattr     = removeXAttrOpMetered,
 #endif
 #ifdef HAVE_LIBULOCKMGR
-    .lock            = lockFileOp,
+    .lock            = lockFileOpMetered,
 #endif
-    .flock           = flockFileOp,
+    .flock           = flockFileOpMetered,
 #ifdef HAVE_COPY_FILE_RANGE
-    .copy_file_range = fileCopyRangeOp,
+    .copy_file_range = fileCopyRangeOpMetered,
 #endif
-    .lseek           = lseekFileOp,
+    .lseek           = lseekFileOpMetered,
 };
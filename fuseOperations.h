@@ -5,8 +5,107 @@
 #ifndef TEMPLATEFS_FUSEOPERATIONS_H
 #define TEMPLATEFS_FUSEOPERATIONS_H
 
+#include <stdbool.h>
+
+#include "configStore.h"
+#include "dirListing.h"
+#include "renderCache.h"
+#include "renderStream.h"
+
+typedef struct {
+    char * path;
+    DIR  * dir;
+    int    fd;
+} tFSTree;
+
+typedef struct {
+    tFSTree       mountpoint;    ///< absolute path to the mount point
+    tFSTree       templates;     ///< absolute path to the top of the template hierarchy
+    tConfigStore  config;        ///< long-lived connection to libelektra
+} tPrivateData;
+
+typedef struct {
+    const char *  path;          ///< absolute path to the file
+    int           fd;            ///< file descriptor. -1 if fd not open/valid */
+    bool          isTemplate;    ///< true if there's a template file to process, else pass request through
+    bool          isExecutable;  ///< true if the templatee file is _executable_
+    int           backingID;     ///< registered for kernel passthrough (see lowlevelOperations.c), zero if not
+
+    tRendered *   contents;      ///< the (shared) result of processing the template file
+    tRenderStream * stream;      ///< the output as it's produced, if it's streamed instead (see renderStream.c)
+} tFHFile;
+
+typedef struct {
+    tDirListing *    listing;       ///< the merged entries (see dirListing.c)
+    char *           path;          ///< of the directory, relative to the mount
+    int              mountFD;       ///< O_PATH fd of it underneath the mount. -1 if there's nothing there
+    int              templateFD;    ///< O_PATH fd of it in the template hierarchy. -1 if there's nothing there
+} tFHDir;
+
+typedef struct {
+    /* * * UNION MUST BE FIRST * * */
+    /* tFHHandle. tFHFile, and tFHDir are cast back and
+     * forth, based on the value of the type field */
+    union {
+        tFHFile file;
+        tFHDir  directory;
+    };
+
+    /* how the union should be accessed */
+    enum {
+        notInitialized = 0,  ///< hasn't been set yet
+        isFile,              ///< use the 'file' field of the union
+        isDirectory          ///< use the 'directory' field of the union
+    } type;                  ///< indicates which field of the union to use
+
+} tFileHandle;
+
+/**
+ * @brief substitute -errno if result == -1
+ *
+ * In a nutshell, most linux filesystem functions invariably return -1 on error,
+ * and return the actual error that occurred as a positive integer in 'errno'.
+ * libfuse adopts the (much saner) convention of returning -errno rather than -1
+ * when an error is being reported.
+ *
+ * This convention crops up throughout operation functions. So define it
+ * as a common inline function.
+ *
+ * @param result the result of a 'standard' filesystem function.
+ * @return if result == -1, then return -errno, otherwise just pass back result unmodified.
+ */
+static inline int fixupResult( int result )
+{
+    if ( result == -1 )
+    {
+        result = -errno;
+    }
+    return result;
+}
+
 extern const struct fuse_operations templatefsOperations;
 
-void * initPrivateData( const char * mountPath, const char * templatePath );
+void *         initPrivateData( const char * mountPath, const char * templatePath );
+tPrivateData * getPrivateData( void );
+void           setPrivateData( tPrivateData * privateData );
+void           startBackground( tPrivateData * privateData );
+void           wantSplice( struct fuse_conn_info * conn );
+void           wantReadDirPlus( struct fuse_conn_info * conn );
+void           stopBackground( tPrivateData * privateData );
+
+tFHFile *      getFileHandle( struct fuse_file_info * fi );
+void           setFileHandle( struct fuse_file_info * fi, tFHFile * fileHandle );
+tFHDir *       getDirHandle( struct fuse_file_info * fi );
+void           setDirHandle( struct fuse_file_info * fi, tFHDir * dirHandle );
+void           releaseHandle( struct fuse_file_info * fi );
+
+bool           hasTemplate( const char * path );
+bool           isExecutable( const char * path );
+void           templateAttributes( const char * path, const tFHFile * fh, struct stat * stbuf );
+int            renderTemplate( tFHFile * fh, bool * cacheHit );
+off_t          seekRendered( const tRendered * contents, off_t off, int whence );
+bool           isServedFromTemplates( const char * dirPath, const tDirEntry * entry );
+int            statsAttributes( const char * path, struct stat * stbuf );
+int            openStats( tFHFile * fh, struct fuse_file_info * fi );
 
 #endif //TEMPLATEFS_FUSEOPERATIONS_H
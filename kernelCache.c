@@ -0,0 +1,180 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* When the kernel is allowed to cache attributes, directory entries and
+ * file contents ('-o kernelcache'), anything that changes behind its back
+ * has to be pushed out explicitly. The kernel must not be notified from
+ * within the handler of a related request, or it can deadlock, so paths
+ * are queued here and invalidated by a dedicated thread, using whichever
+ * notification the mounted fuse API provides. */
+
+#include "common.h"
+#include "templatefs.h"
+#include "kernelCache.h"
+#include "logStuff.h"
+
+#include <pthread.h>
+
+/**
+ * @brief a path waiting to be invalidated
+ */
+typedef struct sInvalidation {
+    struct sInvalidation * next;
+    char *                 path;
+} tInvalidation;
+
+typedef struct {
+    pthread_mutex_t   lock;
+    pthread_cond_t    pending;   ///< signalled when the queue becomes non-empty, or on stop
+    tInvalidation *   head;
+    tInvalidation *   tail;
+    tInvalidateFunction invalidate; ///< NULL unless kernel caching is enabled
+    void *            context;
+    bool              running;
+    pthread_t         thread;
+} tInvalidator;
+
+static tInvalidator invalidator = {
+    .lock    = PTHREAD_MUTEX_INITIALIZER,
+    .pending = PTHREAD_COND_INITIALIZER
+};
+
+// ------------------------------------------------------------------------------
+
+static void * invalidatorThread( void * arg )
+{
+    (void)arg;
+
+    pthread_mutex_lock( &invalidator.lock );
+
+    while ( invalidator.running ) {
+        tInvalidation * next = invalidator.head;
+        if ( next == NULL ) {
+            pthread_cond_wait( &invalidator.pending, &invalidator.lock );
+        } else {
+            invalidator.head = next->next;
+            if ( invalidator.head == NULL ) {
+                invalidator.tail = NULL;
+            }
+
+            /* don't hold the lock while talking to the kernel */
+            pthread_mutex_unlock( &invalidator.lock );
+
+            int err = invalidator.invalidate( next->path, invalidator.context );
+            /* -ENOENT just means the kernel doesn't know about it (yet) */
+            if ( err != 0 && err != -ENOENT ) {
+                logError( "failed to invalidate \'%s\' (%d)", next->path, err );
+            } else {
+                logDebug( "invalidated \'%s\'", next->path );
+            }
+            free( next->path );
+            free( next );
+
+            pthread_mutex_lock( &invalidator.lock );
+        }
+    }
+
+    pthread_mutex_unlock( &invalidator.lock );
+
+    return NULL;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief start the thread that pushes invalidations out to the kernel
+ * @param invalidate  notifies the mounted fuse instance
+ * @param context     passed to 'invalidate'
+ * @return zero if successful, negative errno if not
+ */
+int startKernelCache( tInvalidateFunction invalidate, void * context )
+{
+    int result = 0;
+
+    pthread_mutex_lock( &invalidator.lock );
+
+    invalidator.invalidate = invalidate;
+    invalidator.context    = context;
+    invalidator.running    = true;
+    result = -pthread_create( &invalidator.thread, NULL, invalidatorThread, NULL );
+    if ( result != 0 ) {
+        logError( "unable to start the invalidation thread (%d)", result );
+        invalidator.invalidate = NULL;
+        invalidator.running    = false;
+    }
+
+    pthread_mutex_unlock( &invalidator.lock );
+
+    return result;
+}
+
+/**
+ * @brief stop the invalidation thread, discarding anything still queued
+ */
+void stopKernelCache( void )
+{
+    pthread_mutex_lock( &invalidator.lock );
+    bool wasRunning = invalidator.running;
+    invalidator.running = false;
+    pthread_cond_signal( &invalidator.pending );
+    pthread_mutex_unlock( &invalidator.lock );
+
+    if ( wasRunning ) {
+        pthread_join( invalidator.thread, NULL );
+    }
+
+    pthread_mutex_lock( &invalidator.lock );
+    while ( invalidator.head != NULL ) {
+        tInvalidation * next = invalidator.head;
+        invalidator.head = next->next;
+        free( next->path );
+        free( next );
+    }
+    invalidator.tail       = NULL;
+    invalidator.invalidate = NULL;
+    pthread_mutex_unlock( &invalidator.lock );
+}
+
+bool isKernelCacheEnabled( void )
+{
+    return globals.template.kernelCache;
+}
+
+/**
+ * @brief queue a path to have the kernel's cached attributes and contents dropped.
+ * Does nothing unless kernel caching is enabled.
+ * @param path  path relative to the mount, e.g. '/hosts'
+ */
+void invalidateKernelCache( const char * path )
+{
+    pthread_mutex_lock( &invalidator.lock );
+
+    if ( invalidator.running ) {
+        /* coalesce with an invalidation that's already queued */
+        tInvalidation * queued = invalidator.head;
+        while ( queued != NULL && strcmp( queued->path, path ) != 0 ) {
+            queued = queued->next;
+        }
+
+        if ( queued == NULL ) {
+            tInvalidation * inval = calloc( 1, sizeof( tInvalidation ) );
+            if ( inval != NULL ) {
+                inval->path = strdup( path );
+                if ( inval->path == NULL ) {
+                    free( inval );
+                } else {
+                    if ( invalidator.tail != NULL ) {
+                        invalidator.tail->next = inval;
+                    } else {
+                        invalidator.head = inval;
+                    }
+                    invalidator.tail = inval;
+                    pthread_cond_signal( &invalidator.pending );
+                }
+            }
+        }
+    }
+
+    pthread_mutex_unlock( &invalidator.lock );
+}
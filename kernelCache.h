@@ -0,0 +1,23 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_KERNELCACHE_H
+#define TEMPLATEFS_KERNELCACHE_H
+
+#include <stdbool.h>
+
+#define kDefaultKernelCacheTimeout  10.0
+
+/**
+ * @brief tells the kernel to drop what it has cached for a path
+ * @return zero if successful, negative errno if not
+ */
+typedef int (* tInvalidateFunction)( const char * path, void * context );
+
+int  startKernelCache( tInvalidateFunction invalidate, void * context );
+void stopKernelCache( void );
+bool isKernelCacheEnabled( void );
+void invalidateKernelCache( const char * path );
+
+#endif //TEMPLATEFS_KERNELCACHE_H
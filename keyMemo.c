@@ -0,0 +1,160 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* A hash table from (parent, tag name) to the Key that the tag resolved
+ * to, or NULL if there's no such key. 'parent' is whatever identifies what
+ * the name is relative to: a Key in the same KeySet, or a sentinel for the
+ * root or absolute names. The full name the tag stands for is kept too,
+ * as a render depends on it whether or not there's such a key.
+ *
+ * Each config view has its own, so the keys it points to are only ever
+ * those of the view's KeySet, which doesn't change for as long as the view
+ * exists. It's kept as long as the view is, across every render that uses it. */
+
+#include "common.h"
+#include "keyMemo.h"
+
+#include <stdint.h>
+
+typedef struct sMemoEntry {
+    struct sMemoEntry * next;
+    uint64_t            hash;
+    const void *        parent;
+    Key *               key;        ///< NULL if the name didn't resolve
+    const char *        fullName;   ///< the name it resolved to, or would have. Follows 'name'
+    char                name[];
+} tMemoEntry;
+
+struct sKeyMemo {
+    tMemoEntry ** buckets;
+    size_t        bucketCount;      ///< always a power of two
+    size_t        count;
+};
+
+#define kInitialMemoBuckets  256
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief double the number of buckets, to keep the chains short
+ */
+static void growMemo( tKeyMemo * memo )
+{
+    size_t        bucketCount = memo->bucketCount * 2;
+    tMemoEntry ** buckets     = calloc( bucketCount, sizeof( tMemoEntry * ) );
+
+    if ( buckets != NULL ) {
+        for ( size_t i = 0; i < memo->bucketCount; ++i ) {
+            tMemoEntry * entry = memo->buckets[ i ];
+            while ( entry != NULL ) {
+                tMemoEntry * next = entry->next;
+                size_t       slot = entry->hash & ( bucketCount - 1 );
+                entry->next     = buckets[ slot ];
+                buckets[ slot ] = entry;
+                entry = next;
+            }
+        }
+        free( memo->buckets );
+        memo->buckets     = buckets;
+        memo->bucketCount = bucketCount;
+    }
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @return a new, empty memo, or NULL if there isn't enough memory
+ */
+tKeyMemo * newKeyMemo( void )
+{
+    tKeyMemo * result = calloc( 1, sizeof( tKeyMemo ) );
+
+    if ( result != NULL ) {
+        result->buckets = calloc( kInitialMemoBuckets, sizeof( tMemoEntry * ) );
+        if ( result->buckets == NULL ) {
+            free( result );
+            result = NULL;
+        } else {
+            result->bucketCount = kInitialMemoBuckets;
+        }
+    }
+    return result;
+}
+
+void freeKeyMemo( tKeyMemo * memo )
+{
+    if ( memo != NULL ) {
+        for ( size_t i = 0; i < memo->bucketCount; ++i ) {
+            tMemoEntry * entry = memo->buckets[ i ];
+            while ( entry != NULL ) {
+                tMemoEntry * next = entry->next;
+                free( entry );
+                entry = next;
+            }
+        }
+        free( memo->buckets );
+        free( memo );
+    }
+}
+
+/**
+ * @brief look up what a tag resolved to before
+ * @param memo    may be NULL, in which case nothing is remembered
+ * @param parent  what 'name' is relative to. NULL if it can't be remembered
+ * @param name    the name used in the tag
+ * @param key     receives the key it resolved to, which may be NULL
+ * @param fullName  receives the full name it resolved to, even if there's no such key
+ * @return true if it has been resolved before
+ */
+bool recallKey( tKeyMemo * memo, const void * parent, const char * name, Key ** key, const char ** fullName )
+{
+    bool result = false;
+
+    if ( memo != NULL && parent != NULL ) {
+        uint64_t     hash  = hashStringSeeded( parent, name );
+        tMemoEntry * entry = memo->buckets[ hash & ( memo->bucketCount - 1 ) ];
+
+        while ( entry != NULL && !result ) {
+            if ( entry->hash == hash && entry->parent == parent && strcmp( entry->name, name ) == 0 ) {
+                *key      = entry->key;
+                *fullName = entry->fullName;
+                result    = true;
+            }
+            entry = entry->next;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief remember what a tag resolved to
+ * @param key       the key in the view's KeySet, or NULL if there isn't one
+ * @param fullName  the full name that was looked up
+ */
+void memoizeKey( tKeyMemo * memo, const void * parent, const char * name, Key * key, const char * fullName )
+{
+    if ( memo == NULL || parent == NULL || fullName == NULL || memo->count >= kKeyMemoMaxEntries ) {
+        return;
+    }
+
+    size_t       length     = strlen( name ) + 1;
+    size_t       fullLength = strlen( fullName ) + 1;
+    tMemoEntry * entry      = malloc( sizeof( tMemoEntry ) + length + fullLength );
+    if ( entry != NULL ) {
+        entry->hash   = hashStringSeeded( parent, name );
+        entry->parent = parent;
+        entry->key    = key;
+        memcpy( entry->name, name, length );
+        memcpy( &entry->name[ length ], fullName, fullLength );
+        entry->fullName = &entry->name[ length ];
+
+        if ( memo->count >= memo->bucketCount ) {
+            growMemo( memo );
+        }
+        size_t slot = entry->hash & ( memo->bucketCount - 1 );
+        entry->next           = memo->buckets[ slot ];
+        memo->buckets[ slot ] = entry;
+        ++memo->count;
+    }
+}
@@ -0,0 +1,26 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_KEYMEMO_H
+#define TEMPLATEFS_KEYMEMO_H
+
+#include <stdbool.h>
+
+#include <elektra.h>
+
+#define kKeyMemoMaxEntries  65536   // stop remembering past this many
+
+/**
+ * @brief remembers which key (and full name) each (parent, tag name) resolved
+ * to within one KeySet, so repeated tags don't have to search it again. Not thread-safe:
+ * it belongs to a config view, which only one render uses at a time
+ */
+typedef struct sKeyMemo tKeyMemo;
+
+tKeyMemo * newKeyMemo( void );
+void       freeKeyMemo( tKeyMemo * memo );
+bool       recallKey( tKeyMemo * memo, const void * parent, const char * name, Key ** key, const char ** fullName );
+void       memoizeKey( tKeyMemo * memo, const void * parent, const char * name, Key * key, const char * fullName );
+
+#endif //TEMPLATEFS_KEYMEMO_H
@@ -13,6 +13,12 @@
 #include <string.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "logStuff.h"
 
@@ -45,15 +51,51 @@ struct {
 
 eLogDestination gLogDestination;
 
+volatile unsigned int gLogThreshold = kLogMaxPriotity - 1;
+
+/*
+ * The asynchronous queue: a bounded ring of slots that any thread may
+ * claim one of (without taking a lock), and only the drain thread empties.
+ * Each slot's sequence number says whose turn it is: a producer may fill
+ * slot 'pos' when its sequence equals 'pos', and the consumer may empty
+ * it once it's 'pos + 1'. See Dmitry Vyukov's bounded MPMC queue.
+ */
+#define kAsyncLogSlots     1024         /* always a power of two */
+#define kLogMessageSize    1024         /* the same as the stack buffers below */
+#define kAsyncLogIdleMS    100          /* how long the drain thread sleeps, if it's not woken */
+
+typedef struct
+{
+    atomic_size_t   sequence;
+    unsigned char   priority;
+    unsigned char   destination;
+    char            msg[kLogMessageSize];
+} tLogSlot;
+
+static struct
+{
+    tLogSlot        slots[kAsyncLogSlots];
+    atomic_size_t   enqueuePos;
+    size_t          dequeuePos;         /* only touched by the drain thread */
+    atomic_bool     running;
+    atomic_uint     producers;          /* threads between checking 'running' and finishing their enqueue */
+    atomic_bool     idle;               /* the drain thread is (about to be) asleep */
+    atomic_ulong    dropped;
+    unsigned long   reported;           /* drops already reported */
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+} gAsyncLog =
+    {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .wake = PTHREAD_COND_INITIALIZER
+    };
+
 const char *    gMyName;
 const char *    gLogFilePath = NULL;
 FILE *          gLogFile;
 
 void *          gDLhandle = NULL;
-tBool           gFunctionTraceEnabled = off;
-int             gCallDepth = 1;
-
-static char * leader = "..........................................................................................";
 
 #ifdef __GNUC__
 #define DISABLE_FUNCTION_INSTRUMENTATION  __attribute__((no_instrument_function))
@@ -72,20 +114,19 @@ void _log( const char * inFile,
            unsigned int priority,
            const char *format, ... )    DISABLE_FUNCTION_INSTRUMENTATION;
 
+static void emitLog( unsigned int priority, const char *msg )  DISABLE_FUNCTION_INSTRUMENTATION;
+static bool enqueueLog( unsigned int priority, eLogDestination destination, const char *msg ) DISABLE_FUNCTION_INSTRUMENTATION;
+static bool dequeueLog( void )                                  DISABLE_FUNCTION_INSTRUMENTATION;
+static void reportDropped( void )                               DISABLE_FUNCTION_INSTRUMENTATION;
+static void * drainLog( void * arg )                            DISABLE_FUNCTION_INSTRUMENTATION;
+
 void _logToTheVoid( eLogPriority priority, const char *msg )   DISABLE_FUNCTION_INSTRUMENTATION;
 void _logToSyslog(  eLogPriority priority, const char *msg )   DISABLE_FUNCTION_INSTRUMENTATION;
 void _logToFile(    eLogPriority priority, const char *msg )   DISABLE_FUNCTION_INSTRUMENTATION;
 void _logToStderr(  eLogPriority priority, const char *msg )   DISABLE_FUNCTION_INSTRUMENTATION;
 
-void _profileHelper( void *leftAddr, const char *middle, void *rightAddr )  DISABLE_FUNCTION_INSTRUMENTATION;
-
 const char * addressToString( void * addr, char * scratch )    DISABLE_FUNCTION_INSTRUMENTATION;
 
-#ifdef __GNUC__
-void __cyg_profile_func_enter( void *this_fn, void *call_site )     DISABLE_FUNCTION_INSTRUMENTATION;
-void __cyg_profile_func_exit( void *this_fn, void *call_site )      DISABLE_FUNCTION_INSTRUMENTATION;
-#endif
-
 /* }}}}}}}} DO NOT INSTRUMENT THE INSTRUMENTATION! }}}}}}}} */
 
 
@@ -107,6 +148,207 @@ fpLogTo gLogOutputFP[kLogMaxDestination] =
         [kLogToStderr]  = &_logToStderr
     };
 
+/*
+ * queue a message for the drain thread
+ * returns false if the queue is full
+ */
+static bool enqueueLog( unsigned int priority, eLogDestination destination, const char *msg )
+{
+    tLogSlot * slot;
+    size_t     pos = atomic_load_explicit( &gAsyncLog.enqueuePos, memory_order_relaxed );
+
+    for (;;)
+    {
+        slot = &gAsyncLog.slots[ pos & (kAsyncLogSlots - 1) ];
+        size_t   sequence = atomic_load_explicit( &slot->sequence, memory_order_acquire );
+        intptr_t diff     = (intptr_t)sequence - (intptr_t)pos;
+
+        if ( diff == 0 )
+        {
+            /* our turn, if no-one else claims it first */
+            if ( atomic_compare_exchange_weak_explicit( &gAsyncLog.enqueuePos, &pos, pos + 1,
+                                                        memory_order_relaxed, memory_order_relaxed ) )
+            { break; }
+        }
+        else if ( diff < 0 )
+        {
+            /* the drain thread hasn't caught up yet */
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit( &gAsyncLog.enqueuePos, memory_order_relaxed );
+        }
+    }
+
+    slot->priority    = priority;
+    slot->destination = destination;
+    strncpy( slot->msg, msg, sizeof( slot->msg ) - 1 );
+    slot->msg[ sizeof( slot->msg ) - 1 ] = '\0';
+    atomic_store_explicit( &slot->sequence, pos + 1, memory_order_release );
+
+    if ( atomic_load_explicit( &gAsyncLog.idle, memory_order_acquire ) )
+    {
+        pthread_mutex_lock( &gAsyncLog.lock );
+        pthread_cond_signal( &gAsyncLog.wake );
+        pthread_mutex_unlock( &gAsyncLog.lock );
+    }
+    return true;
+}
+
+/*
+ * send on the oldest queued message. Only called by the drain thread (or once it's stopped)
+ * returns false if there was nothing queued
+ */
+static bool dequeueLog( void )
+{
+    size_t     pos  = gAsyncLog.dequeuePos;
+    tLogSlot * slot = &gAsyncLog.slots[ pos & (kAsyncLogSlots - 1) ];
+
+    if ( atomic_load_explicit( &slot->sequence, memory_order_acquire ) != pos + 1 )
+    { return false; }
+
+    ( gLogOutputFP[ slot->destination ] )( slot->priority, slot->msg );
+
+    /* hand the slot back, for the next lap */
+    atomic_store_explicit( &slot->sequence, pos + kAsyncLogSlots, memory_order_release );
+    gAsyncLog.dequeuePos = pos + 1;
+
+    return true;
+}
+
+/*
+ * say how many messages were dropped since it was last said
+ */
+static void reportDropped( void )
+{
+    unsigned long dropped = atomic_load( &gAsyncLog.dropped );
+
+    if ( dropped != gAsyncLog.reported )
+    {
+        char msg[128];
+        snprintf( msg, sizeof( msg ), "%s: %lu log messages dropped, the queue was full",
+                  gPriorityAsStr[ kLogWarning ], dropped - gAsyncLog.reported );
+        ( gLogOutputFP[ gLogSetting[ kLogWarning ].destination ] )( kLogWarning, msg );
+        gAsyncLog.reported = dropped;
+    }
+}
+
+static void * drainLog( void * UNUSED(arg) )
+{
+    while ( atomic_load( &gAsyncLog.running ) )
+    {
+        if ( dequeueLog() )
+        { continue; }
+
+        reportDropped();
+
+        /* nothing queued, so sleep until woken. Look again after saying so,
+         * in case a message arrived in between. Wake-ups can still be missed,
+         * hence the timeout */
+        atomic_store( &gAsyncLog.idle, true );
+        if ( !dequeueLog() )
+        {
+            struct timespec until;
+            clock_gettime( CLOCK_REALTIME, &until );
+            until.tv_nsec += kAsyncLogIdleMS * 1000000L;
+            if ( until.tv_nsec >= 1000000000L )
+            {
+                until.tv_sec  += 1;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_mutex_lock( &gAsyncLog.lock );
+            if ( atomic_load( &gAsyncLog.running ) )
+            {
+                pthread_cond_timedwait( &gAsyncLog.wake, &gAsyncLog.lock, &until );
+            }
+            pthread_mutex_unlock( &gAsyncLog.lock );
+        }
+        atomic_store( &gAsyncLog.idle, false );
+    }
+    return NULL;
+}
+
+/*
+ * send a formatted message on, or queue it to be
+ */
+static void emitLog( unsigned int priority, const char *msg )
+{
+    eLogDestination destination = gLogSetting[ priority ].destination;
+
+    if ( destination == kLogToTheVoid )
+    {
+        /* nothing to do */
+    }
+    else
+    {
+        /* announce ourselves before looking at 'running', so stopAsyncLogging()
+         * either sees us and waits, or we see that it has stopped */
+        atomic_fetch_add( &gAsyncLog.producers, 1 );
+        if ( atomic_load( &gAsyncLog.running ) )
+        {
+            if ( !enqueueLog( priority, destination, msg ) )
+            {
+                atomic_fetch_add( &gAsyncLog.dropped, 1 );
+            }
+        }
+        else
+        {
+            ( gLogOutputFP[ destination ] )( priority, msg );
+        }
+        atomic_fetch_sub( &gAsyncLog.producers, 1 );
+    }
+}
+
+void startAsyncLogging( void )
+{
+    if ( !atomic_load( &gAsyncLog.running ) )
+    {
+        for ( size_t i = 0; i < kAsyncLogSlots; ++i )
+        {
+            atomic_store( &gAsyncLog.slots[i].sequence, i );
+        }
+        atomic_store( &gAsyncLog.enqueuePos, 0 );
+        gAsyncLog.dequeuePos = 0;
+
+        atomic_store( &gAsyncLog.running, true );
+        int err = pthread_create( &gAsyncLog.thread, NULL, drainLog, NULL );
+        if ( err != 0 )
+        {
+            atomic_store( &gAsyncLog.running, false );
+            logError( "unable to start the log thread (%d: %s), logging synchronously", err, strerror( err ) );
+        }
+    }
+}
+
+void stopAsyncLogging( void )
+{
+    if ( atomic_exchange( &gAsyncLog.running, false ) )
+    {
+        pthread_mutex_lock( &gAsyncLog.lock );
+        pthread_cond_signal( &gAsyncLog.wake );
+        pthread_mutex_unlock( &gAsyncLog.lock );
+        pthread_join( gAsyncLog.thread, NULL );
+
+        /* a producer that saw 'running' before it was cleared may still be
+         * queueing. Once they're done, nothing more can be queued */
+        while ( atomic_load( &gAsyncLog.producers ) != 0 )
+        {
+            sched_yield();
+        }
+
+        /* whatever was queued before it stopped */
+        while ( dequeueLog() )
+        { /* keep going */ }
+        reportDropped();
+    }
+}
+
+unsigned long asyncLogDropped( void )
+{
+    return atomic_load( &gAsyncLog.dropped );
+}
+
 /*
  * the macros eventually expand to invoke this help function
  */
@@ -149,7 +391,7 @@ void _log( const char *inPath,
             snprintf( &msg[ prefixLen ], sizeof( msg ) - prefixLen, " @ %s:%d", inFile, atLine );
         }
 
-        ( gLogOutputFP[ gLogSetting[ priority ].destination ] )( priority, msg );
+        emitLog( priority, msg );
 
         va_end( vaptr );
     }
@@ -175,7 +417,7 @@ void _logEntry( unsigned int priority,
 
         prefixLen += vsnprintf( &msg[ prefixLen ], sizeof( msg ) - prefixLen, format, vaptr );
 
-        ( gLogOutputFP[ gLogSetting[ priority ].destination ] )( priority, msg );
+        emitLog( priority, msg );
 
         va_end( vaptr );
     }
@@ -186,6 +428,9 @@ void logTextBlock( eLogPriority priority, const char * textBlock, size_t textLen
     unsigned int counter;
     char line[4096];
 
+    if ( !logIsEnabled( priority ) )
+    { return; }
+
     const char * textEnd = &textBlock[textLen];
     if ( textLen == 0 )
     {
@@ -237,7 +482,7 @@ void logTextBlock( eLogPriority priority, const char * textBlock, size_t textLen
         if ( newline || *t == '\0' )
         {
             *dst = '\0';
-            ( gLogOutputFP[gLogSetting[priority].destination] )( priority, line );
+            emitLog( priority, line );
         }
     }
 }
@@ -267,8 +512,6 @@ void initLogStuff( const char * name )
     }
 
     gDLhandle = dlopen(NULL, RTLD_LAZY);
-
-    logFunctionTrace( off );
 }
 
 void setLogStuffDestination( eLogPriority logPrio, eLogDestination logDest, eLogMode logMode )
@@ -278,6 +521,15 @@ void setLogStuffDestination( eLogPriority logPrio, eLogDestination logDest, eLog
         gLogSetting[i].mode        = logMode;
         gLogSetting[i].destination = logDest;
     }
+
+    /* so the macros can skip formatting messages that won't go anywhere */
+    unsigned int threshold = 0;
+    for ( unsigned int i = 0; i < kLogMaxPriotity; ++i )
+    {
+        if ( gLogSetting[i].destination != kLogToTheVoid )
+        { threshold = i; }
+    }
+    gLogThreshold = threshold;
 }
 
 void setLogStuffFileDestination( const char * logFile )
@@ -346,57 +598,3 @@ const char * addressToString( void *addr, char *scratch)
     }
     return result;
 }
-
-#ifdef __GNUC__
-
-/* helper function for logging function entry and exit */
-void _profileHelper( void *leftAddr, const char *middle, void *rightAddr)
-{
-    // some scratch space, in case addressToString needs it. avoids needless malloc churn
-    char leftAddrAsStr[64];
-    char rightAddrAsStr[64];
-    char msg[256];
-
-
-    fpLogTo logDestFP = gLogOutputFP[gLogSetting[kLogFunctions].destination];
-
-    if ( gFunctionTraceEnabled && logDestFP != NULL )
-    {
-        addressToString( leftAddr,  leftAddrAsStr  );
-        addressToString( rightAddr, rightAddrAsStr );
-        snprintf( msg, sizeof(msg), "%.*s %s() %s %s()",
-                  gCallDepth, leader, leftAddrAsStr, middle, rightAddrAsStr );
-        (*logDestFP)( kLogFunctions, msg);
-    }
-}
-
-/*
-    if the -finstrument-functions option is used with gcc, it inserts calls
-    to these functions at the beginning and end of every compiled function.
-*/
-
-/* just landed in a function */
-void __cyg_profile_func_enter(void *this_fn, void *call_site)
-{
-    _profileHelper( call_site, "called", this_fn );
-    ++gCallDepth;
-}
-
-/* about to leave a function */
-void __cyg_profile_func_exit(void *this_fn, void *call_site)
-{
-    if (--gCallDepth < 1) gCallDepth = 1;
-    _profileHelper( this_fn, "returned to", call_site );
-}
-
-/*
-    If just left on, this generates so much logging that it's rarely useful.
-    Please use logFunctionTrace to turn on tracing only around the code
-    or situation you care about.
-*/
-void logFunctionTrace( tBool onOff )
-{
-    gFunctionTraceEnabled = onOff;
-}
-
-#endif
\ No newline at end of file
@@ -42,6 +42,22 @@ typedef enum {
 } eLogMode;
 
 
+/* messages less important than this are compiled out altogether, arguments and all */
+#ifndef kLogCompiledPriority
+#ifdef DEBUG
+#define kLogCompiledPriority  kLogFunctions
+#else
+#define kLogCompiledPriority  kLogInfo
+#endif
+#endif
+
+/* the least important priority that's logged anywhere. Maintained by setLogStuffDestination() */
+extern volatile unsigned int gLogThreshold;
+
+/* true if a message of this priority would go anywhere, so is worth formatting */
+#define logIsEnabled( priority ) \
+    ( (unsigned int)(priority) <= (unsigned int)kLogCompiledPriority && (unsigned int)(priority) <= gLogThreshold )
+
 /* set up the logging mechanisms. Call once, very early. */
 void    initLogStuff( const char *name );
 
@@ -50,8 +66,15 @@ void    stopLoggingStuff( void );
 
 void    setLogStuffDestination( eLogPriority priority, eLogDestination logDestination, eLogMode logMode );
 
-/* start/stop logging function entry & exit */
-void    logFunctionTrace( tBool onOff );
+/* queue messages for a background thread to send on, rather than sending them from the caller.
+ * Call after any fork(), e.g. fuse_daemonize(). Messages are dropped (and counted) if the queue is full */
+void    startAsyncLogging( void );
+
+/* send on whatever is still queued, and go back to sending messages from the caller */
+void    stopAsyncLogging( void );
+
+/* how many messages have been dropped because the queue was full */
+unsigned long asyncLogDropped( void );
 
 /* output a block of textBlock as a series of log lines, each with a line number prefixed */
 void logTextBlock( eLogPriority priority, const char * textBlock, size_t textLen );
@@ -73,7 +96,7 @@ __attribute__((__format__ (__printf__, 6, 7)))
 __attribute__((no_instrument_function));
 
 #define log( priority, ... ) \
-    do { _log( __FILE__, __LINE__, __func__, errno, priority, __VA_ARGS__ ); } while (0)
+    do { if ( logIsEnabled( priority ) ) { _log( __FILE__, __LINE__, __func__, errno, priority, __VA_ARGS__ ); } } while (0)
 
 #define logEmergency(...)  log( kLogEmergency, __VA_ARGS__ )
 #define logAlert(...)      log( kLogAlert,     __VA_ARGS__ )
@@ -85,8 +108,8 @@ __attribute__((no_instrument_function));
 
 #ifdef DEBUG
 #define logDebug(...)      log( kLogDebug, __VA_ARGS__ )
-#define logEntry(fmt, ...) do { _logEntry( kLogDebug, "%s(" fmt ")", __func__, ##__VA_ARGS__ ); } while (0)
-#define logCheckpoint()    do { _log( __FILE__, __LINE__, __func__, 0, kLogDebug, "reached" ); } while (0)
+#define logEntry(fmt, ...) do { if ( logIsEnabled( kLogDebug ) ) { _logEntry( kLogDebug, "%s(" fmt ")", __func__, ##__VA_ARGS__ ); } } while (0)
+#define logCheckpoint()    do { if ( logIsEnabled( kLogDebug ) ) { _log( __FILE__, __LINE__, __func__, 0, kLogDebug, "reached" ); } } while (0)
 #else
 #define logDebug(...)      do {} while (0)
 #define logEntry(...)      do {} while (0)
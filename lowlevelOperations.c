@@ -0,0 +1,1572 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* The same filesystem as fuseOperations.c, through the low-level fuse API
+ * ('-o lowlevel'). The high-level API builds the full path of every request,
+ * which the handlers then walk all over again with openat()/fstatat()
+ * against the roots. Here the kernel is handed inodes instead, each holding
+ * O_PATH fds for its object underneath the mount and in the template
+ * hierarchy, so a lookup only ever resolves one name, relative to its parent.
+ *
+ * Inodes are kept in a hash table keyed by parent and name, so the path of
+ * one can still be built from its parents, for locating its template
+ * settings, render cache entries and so on. An inode lives for as long as
+ * the kernel remembers it, or one of its children is alive.
+ *
+ * Rendering a template doesn't tie up a fuse thread: it's handed to the
+ * render pool, which sends the reply to open() once it's finished.
+ *
+ * With '-o passthrough', on kernels that support it, files without a
+ * template are registered with the kernel as the backing file of the open,
+ * and it does their reads, writes and mmaps itself. So are templates whose
+ * output is held in a sealed memfd (see renderCache.c).
+ *
+ * The stats directory and file (see metrics.c) don't exist underneath either
+ * root, so they're virtual inodes of their own, which the kernel is never
+ * allowed to make us free. Every handler is timed as its high-level
+ * counterpart is, up until it replies. */
+
+#include "common.h"
+#include "templatefs.h"
+#include "logStuff.h"
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/file.h>   /* flock(2) */
+#include <sys/statvfs.h>
+
+#include <fuse3/fuse_lowlevel.h>
+
+#include "fuseOperations.h"
+#include "lowlevelOperations.h"
+#include "kernelCache.h"
+#include "metrics.h"
+#include "renderPool.h"
+#include "templateIndex.h"
+
+#define kInodeBuckets  1024
+
+/* cleared if the kernel (or our privileges) turn out not to allow passthrough.
+ * Set by init, and read (and cleared) by every thread opening files */
+static atomic_bool passthroughEnabled = false;
+
+/**
+ * @brief something the kernel has looked up
+ */
+typedef struct sInode {
+    struct sInode * next;          ///< next in the same hash bucket
+    struct sInode * parent;        ///< holds a reference. NULL for the root
+    char *          name;          ///< name within the parent
+    dev_t           dev;           ///< identity of what was looked up, to notice it being replaced
+    ino_t           ino;
+    int             mountFD;       ///< O_PATH fd underneath the mount. -1 if there's nothing there
+    int             templateFD;    ///< O_PATH fd in the template hierarchy. -1 if there's nothing there
+    bool            isTemplate;    ///< true if it's served from the template hierarchy
+    bool            hashed;        ///< false once it's been unlinked, renamed over or replaced
+    uint64_t        nlookup;       ///< lookups the kernel hasn't forgotten yet
+    unsigned int    refs;          ///< children, plus one while nlookup is non-zero
+} tInode;
+
+/**
+ * @brief an open() of a template, waiting for its render
+ */
+typedef struct {
+    fuse_req_t             req;
+    struct fuse_file_info  fi;          ///< the caller's is only valid until open() returns
+    bool                   cacheHit;
+    uint64_t               start;       ///< when the open() arrived, for its timer
+} tOpenJob;
+
+static struct {
+    pthread_mutex_t  lock;
+    tInode           root;
+    tInode *         buckets[ kInodeBuckets ];
+} inodes = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .root = { .mountFD = -1, .templateFD = -1 }
+};
+
+/* the stats directory and the file in it, at kStatsDir and kStatsPath */
+static tInode statsDir = {
+    .parent     = &inodes.root,
+    .name       = (char *)( kStatsDir + 1 ),
+    .mountFD    = -1,
+    .templateFD = -1
+};
+static tInode statsFile = {
+    .parent     = &statsDir,
+    .name       = (char *)"stats",
+    .mountFD    = -1,
+    .templateFD = -1
+};
+
+/* the error the handler on this thread replied with, for its timer (see METERED_REPLY) */
+static __thread int repliedError;
+
+#define kReplyDeferred  (-1)    // the render pool replies instead, and notes the time itself
+
+// ------------------------------------------------------------------------------
+
+static inline tInode * getInode( fuse_ino_t ino )
+{
+    return ( ino == FUSE_ROOT_ID ) ? &inodes.root : (tInode *)(uintptr_t)ino;
+}
+
+static inline fuse_ino_t inodeNumber( const tInode * inode )
+{
+    return ( inode == &inodes.root ) ? FUSE_ROOT_ID : (fuse_ino_t)(uintptr_t)inode;
+}
+
+static inline bool isVirtual( const tInode * inode )
+{
+    return ( inode == &statsDir || inode == &statsFile );
+}
+
+/**
+ * @brief reply with an error, remembering it for the handler's timer
+ */
+static inline void replyError( fuse_req_t req, int err )
+{
+    repliedError = err;
+    fuse_reply_err( req, err );
+}
+
+/**
+ * @brief define 'name'Metered(), which calls the handler 'name', then notes how
+ * long it took to reply as 'op' (see METERED in metrics.h)
+ * @param params  the parameter list, with its parentheses
+ * @param args    the parameter names, with their parentheses
+ */
+#define METERED_REPLY( op, name, params, args )                 \
+    static void name##Metered params                            \
+    {                                                           \
+        uint64_t start = metricsClock();                        \
+        repliedError = 0;                                       \
+        name args;                                              \
+        if ( repliedError != kReplyDeferred ) {                 \
+            noteOperation( op, start, -repliedError );          \
+        }                                                       \
+    }
+
+/**
+ * @return the fd of the object the inode is served from
+ */
+static inline int servedFD( const tInode * inode )
+{
+    return inode->isTemplate ? inode->templateFD : inode->mountFD;
+}
+
+/**
+ * @brief how long the kernel may cache entries and attributes
+ */
+static inline double cacheTimeout( void )
+{
+    return isKernelCacheEnabled() ? globals.template.cacheTimeout : 0.0;
+}
+
+/**
+ * @brief an fd as a path, for the calls that can't be made on an O_PATH fd directly
+ */
+static inline void procPath( int fd, char * buf, size_t size )
+{
+    snprintf( buf, size, "/proc/self/fd/%d", fd );
+}
+
+static unsigned int hashEntry( const tInode * parent, const char * name )
+{
+    return (unsigned int)( hashStringSeeded( parent, name ) % kInodeBuckets );
+}
+
+/**
+ * @brief find the current inode for a name. Caller must hold the lock
+ */
+static tInode * findChild( const tInode * parent, const char * name )
+{
+    tInode * result = inodes.buckets[ hashEntry( parent, name ) ];
+
+    while ( result != NULL && ( result->parent != parent || strcmp( result->name, name ) != 0 ) ) {
+        result = result->next;
+    }
+    return result;
+}
+
+static void hashInode( tInode * inode )
+{
+    unsigned int bucket = hashEntry( inode->parent, inode->name );
+
+    inode->next    = inodes.buckets[ bucket ];
+    inode->hashed  = true;
+    inodes.buckets[ bucket ] = inode;
+}
+
+static void unhashInode( tInode * inode )
+{
+    if ( inode != NULL && inode->hashed ) {
+        tInode ** link = &inodes.buckets[ hashEntry( inode->parent, inode->name ) ];
+        while ( *link != inode ) {
+            link = &(*link)->next;
+        }
+        *link = inode->next;
+        inode->next   = NULL;
+        inode->hashed = false;
+    }
+}
+
+/**
+ * @brief drop a reference, freeing the inode (and maybe its parents) with the last one.
+ * Caller must hold the lock
+ */
+static void unrefInode( tInode * inode )
+{
+    while ( inode != NULL && inode != &inodes.root && !isVirtual( inode ) && --inode->refs == 0 ) {
+        tInode * parent = inode->parent;
+
+        unhashInode( inode );
+        if ( inode->mountFD != -1 ) {
+            close( inode->mountFD );
+        }
+        if ( inode->templateFD != -1 ) {
+            close( inode->templateFD );
+        }
+        free( inode->name );
+        free( inode );
+
+        inode = parent;
+    }
+}
+
+/**
+ * @brief the kernel has forgotten some lookups. Caller must hold the lock
+ */
+static void forgetInode( tInode * inode, uint64_t nlookup )
+{
+    if ( inode != &inodes.root && !isVirtual( inode ) ) {
+        if ( nlookup >= inode->nlookup ) {
+            inode->nlookup = 0;
+            unrefInode( inode );
+        } else {
+            inode->nlookup -= nlookup;
+        }
+    }
+}
+
+/**
+ * @brief build the path of an inode, relative to the mount. Caller must hold the lock
+ * @return zero if successful, -ENAMETOOLONG if it doesn't fit
+ */
+static int buildPath( const tInode * inode, const char * name, char * path, size_t size )
+{
+    int    result = 0;
+    size_t pos    = size - 1;
+
+    path[ pos ] = '\0';
+    if ( name != NULL ) {
+        size_t len = strlen( name );
+        if ( len + 1 > pos ) {
+            result = -ENAMETOOLONG;
+        } else {
+            pos -= len;
+            memcpy( &path[ pos ], name, len );
+            path[ --pos ] = '/';
+        }
+    }
+    for ( ; result == 0 && inode->parent != NULL; inode = inode->parent ) {
+        size_t len = strlen( inode->name );
+        if ( len + 1 > pos ) {
+            result = -ENAMETOOLONG;
+        } else {
+            pos -= len;
+            memcpy( &path[ pos ], inode->name, len );
+            path[ --pos ] = '/';
+        }
+    }
+
+    if ( result == 0 ) {
+        if ( path[ pos ] == '\0' ) {
+            /* the root */
+            path[ --pos ] = '/';
+        }
+        memmove( path, &path[ pos ], size - pos );
+    }
+    return result;
+}
+
+/**
+ * @brief the path of an inode (or of a name within it), relative to the mount
+ */
+static int inodePath( const tInode * inode, const char * name, char * path, size_t size )
+{
+    pthread_mutex_lock( &inodes.lock );
+    int result = buildPath( inode, name, path, size );
+    pthread_mutex_unlock( &inodes.lock );
+
+    return result;
+}
+
+/**
+ * @brief the attributes of an inode, as fuseOperations.c would report them
+ * @param fh  its open handle, or NULL
+ */
+static int inodeAttributes( tInode * inode, const tFHFile * fh, struct stat * st )
+{
+    int result;
+
+    if ( isVirtual( inode ) ) {
+        return statsAttributes( ( inode == &statsDir ) ? kStatsDir : kStatsPath, st );
+    }
+
+    if ( fh != NULL ) {
+        result = fixupResult( fstat( fh->fd, st ) );
+    } else {
+        result = fixupResult( fstatat( servedFD( inode ), "", st, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW ) );
+    }
+
+    if ( result == 0 && inode->isTemplate ) {
+        char path[ PATH_MAX ];
+        result = inodePath( inode, NULL, path, sizeof( path ) );
+        if ( result == 0 ) {
+            templateAttributes( path, fh, st );
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief look up a name in a directory, adding a reference to the inode the kernel is given
+ * @return zero if successful, negative errno if not
+ */
+static int lookupEntry( tInode * parent, const char * name, struct fuse_entry_param * e )
+{
+    int         result;
+    char        path[ PATH_MAX ];
+    struct stat st;
+    int         mountFD    = -1;
+    int         templateFD = -1;
+    bool        isTemplate = false;
+
+    memset( e, 0, sizeof( struct fuse_entry_param ) );
+    e->attr_timeout  = cacheTimeout();
+    e->entry_timeout = cacheTimeout();
+
+    if ( ( parent == &inodes.root && strcmp( name, statsDir.name ) == 0 ) || isVirtual( parent ) ) {
+        /* nothing underneath either root, and never freed, so no reference is needed */
+        tInode * inode = ( parent == &inodes.root ) ? &statsDir : NULL;
+        if ( parent == &statsDir && strcmp( name, statsFile.name ) == 0 ) {
+            inode = &statsFile;
+        }
+        if ( inode == NULL ) {
+            return -ENOENT;
+        }
+        /* the stats change all the time, so the kernel mustn't hang on to them */
+        e->attr_timeout = 0.0;
+        e->ino          = inodeNumber( inode );
+        return inodeAttributes( inode, NULL, &e->attr );
+    }
+
+    result = inodePath( parent, name, path, sizeof( path ) );
+    if ( result == 0 ) {
+        if ( parent->mountFD != -1 ) {
+            mountFD = openat( parent->mountFD, name, O_PATH | O_NOFOLLOW );
+        }
+        if ( parent->templateFD != -1 ) {
+            templateFD = openat( parent->templateFD, name, O_PATH | O_NOFOLLOW );
+            isTemplate = ( templateFD != -1 && hasTemplate( path ) );
+            if ( templateFD != -1 && !isTemplate && mountFD == -1 && recheckTemplateIndex( path ) ) {
+                /* the watcher hasn't caught up with the template being added yet */
+                isTemplate = hasTemplate( path );
+            }
+        }
+        errno = 0;
+
+        result = fixupResult( fstatat( isTemplate ? templateFD : mountFD,
+                                       "",
+                                       &st,
+                                       AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW ) );
+        if ( result == 0 && isTemplate ) {
+            templateAttributes( path, NULL, &st );
+        }
+    }
+
+    if ( result != 0 ) {
+        if ( mountFD != -1 ) {
+            close( mountFD );
+        }
+        if ( templateFD != -1 ) {
+            close( templateFD );
+        }
+        return ( result == -EBADF ) ? -ENOENT : result;
+    }
+
+    pthread_mutex_lock( &inodes.lock );
+
+    tInode * inode = findChild( parent, name );
+    if ( inode != NULL
+      && inode->dev == st.st_dev
+      && inode->ino == st.st_ino
+      && inode->isTemplate == isTemplate
+      && ( inode->mountFD != -1 ) == ( mountFD != -1 )
+      && ( inode->templateFD != -1 ) == ( templateFD != -1 ) ) {
+        /* the same thing as before */
+        if ( inode->nlookup++ == 0 ) {
+            ++inode->refs;
+        }
+    } else {
+        /* new, or replaced since it was last looked up */
+        unhashInode( inode );
+
+        inode = calloc( 1, sizeof( tInode ) );
+        if ( inode != NULL ) {
+            inode->name = strdup( name );
+            if ( inode->name == NULL ) {
+                free( inode );
+                inode = NULL;
+            }
+        }
+        if ( inode == NULL ) {
+            result = -ENOMEM;
+        } else {
+            inode->parent     = parent;
+            inode->dev        = st.st_dev;
+            inode->ino        = st.st_ino;
+            inode->mountFD    = mountFD;
+            inode->templateFD = templateFD;
+            inode->isTemplate = isTemplate;
+            inode->nlookup    = 1;
+            inode->refs       = 1;
+            ++parent->refs;
+            hashInode( inode );
+
+            /* the inode owns them now */
+            mountFD    = -1;
+            templateFD = -1;
+        }
+    }
+
+    pthread_mutex_unlock( &inodes.lock );
+
+    if ( mountFD != -1 ) {
+        close( mountFD );
+    }
+    if ( templateFD != -1 ) {
+        close( templateFD );
+    }
+
+    if ( result == 0 ) {
+        e->ino  = inodeNumber( inode );
+        e->attr = st;
+    }
+    return result;
+}
+
+/**
+ * @brief reply to a request that created something
+ */
+static void replyCreated( fuse_req_t req, tInode * parent, const char * name, int result )
+{
+    struct fuse_entry_param e;
+
+    if ( result == 0 ) {
+        result = lookupEntry( parent, name, &e );
+    }
+    if ( result == 0 ) {
+        fuse_reply_entry( req, &e );
+    } else {
+        replyError( req, -result );
+    }
+}
+
+/**
+ * @brief something underneath a parent was removed, so stop finding its inode
+ */
+static void forgetEntry( tInode * parent, const char * name )
+{
+    pthread_mutex_lock( &inodes.lock );
+    unhashInode( findChild( parent, name ) );
+    pthread_mutex_unlock( &inodes.lock );
+}
+
+/**
+ * @brief move an inode to its new name after a rename. Caller must hold the lock
+ */
+static void moveInode( tInode * inode, tInode * newParent, const char * newName )
+{
+    char * name = strdup( newName );
+
+    unhashInode( inode );
+    if ( name == NULL ) {
+        /* can't rename it, so it'll just have to be looked up again */
+        return;
+    }
+    free( inode->name );
+    inode->name = name;
+    if ( inode->parent != newParent ) {
+        ++newParent->refs;
+        unrefInode( inode->parent );
+        inode->parent = newParent;
+    }
+    hashInode( inode );
+}
+
+/**
+ * @brief hand a file's I/O over to the kernel, if we can
+ */
+static void passThrough( fuse_req_t req, tFHFile * fh, struct fuse_file_info * fi )
+{
+#ifdef FUSE_CAP_PASSTHROUGH
+    int fd = fh->fd;
+    if ( fh->isTemplate ) {
+        fd = ( fh->contents != NULL ) ? fh->contents->fd : -1;
+    }
+
+    if ( fd != -1 && atomic_load( &passthroughEnabled ) ) {
+        int backingID = fuse_passthrough_open( req, fd );
+        if ( backingID > 0 ) {
+            fh->backingID  = backingID;
+            fi->backing_id = backingID;
+        } else {
+            /* most likely we don't have CAP_SYS_ADMIN. Don't keep trying */
+            if ( atomic_exchange( &passthroughEnabled, false ) ) {
+                logWarning( "kernel passthrough unavailable (%d), falling back", backingID );
+            }
+        }
+    }
+#else
+    (void)req; (void)fh; (void)fi;
+#endif
+}
+
+/**
+ * @brief close an open file, and free its handle
+ * @param req  the request being handled, or NULL if it's already been replied to.
+ *             Without one, a backing file stays registered until the unmount
+ */
+static void closeFile( fuse_req_t req, struct fuse_file_info * fi )
+{
+    tFHFile * fh = getFileHandle( fi );
+    if ( fh != NULL ) {
+#ifdef FUSE_CAP_PASSTHROUGH
+        if ( fh->backingID > 0 && req != NULL ) {
+            fuse_passthrough_close( req, fh->backingID );
+        }
+#else
+        (void)req;
+#endif
+        if ( fh->fd != -1 ) {
+            close( fh->fd );
+        }
+        releaseRendered( fh->contents );
+        releaseRenderStream( fh->stream );
+        free( (char *)fh->path );
+        releaseHandle( fi );
+    }
+}
+
+/**
+ * @brief renders a template being opened, on a pool thread
+ */
+static int renderOpen( void * context )
+{
+    tOpenJob * job = context;
+
+    return renderTemplate( getFileHandle( &job->fi ), &job->cacheHit );
+}
+
+/**
+ * @brief replies to the open() of a template once it's rendered
+ */
+static void renderOpened( int result, void * context )
+{
+    tOpenJob * job = context;
+
+    if ( result == 0 ) {
+        /* the kernel's copy is only still good if the template,
+         * and the configuration it was rendered with, are unchanged */
+        job->fi.keep_cache = isKernelCacheEnabled() && job->cacheHit;
+        /* the length of a stream isn't known until it's finished */
+        job->fi.direct_io  = ( getFileHandle( &job->fi )->stream != NULL );
+        passThrough( job->req, getFileHandle( &job->fi ), &job->fi );
+        if ( fuse_reply_open( job->req, &job->fi ) == -ENOENT ) {
+            /* interrupted, so there won't be a release() */
+            closeFile( NULL, &job->fi );
+        }
+    } else {
+        closeFile( job->req, &job->fi );
+        fuse_reply_err( job->req, -result );
+    }
+    noteOperation( kOpOpen, job->start, result );
+    free( job );
+}
+
+// ------------------------------------------------------------------------------
+
+static void initOp( void * userdata, struct fuse_conn_info * conn )
+{
+    logEntry( "%p,%p", userdata, conn );
+
+    wantSplice( conn );
+    wantReadDirPlus( conn );
+
+#ifdef FUSE_CAP_PASSTHROUGH
+    if ( globals.template.passthrough ) {
+        if ( conn->capable & FUSE_CAP_PASSTHROUGH ) {
+            conn->want |= FUSE_CAP_PASSTHROUGH;
+            atomic_store( &passthroughEnabled, true );
+        } else {
+            logWarning( "the kernel doesn't support passthrough, so all I/O goes through us" );
+        }
+    }
+#else
+    if ( globals.template.passthrough ) {
+        logWarning( "built without passthrough support, so all I/O goes through us" );
+    }
+#endif
+
+    tPrivateData * privateData = userdata;
+    if ( privateData != NULL ) {
+        setPrivateData( privateData );
+
+        inodes.root.mountFD    = openat( privateData->mountpoint.fd, ".", O_PATH );
+        inodes.root.templateFD = openat( privateData->templates.fd, ".", O_PATH );
+        if ( inodes.root.mountFD == -1 ) {
+            logError( "unable to open \'%s\' (%d: %s)", privateData->mountpoint.path, errno, strerror( errno ) );
+        }
+        errno = 0;
+    }
+    startBackground( privateData );
+}
+
+static void destroyOp( void * userdata )
+{
+    logEntry( "%p", userdata );
+
+    stopBackground( userdata );
+
+    if ( inodes.root.mountFD != -1 ) {
+        close( inodes.root.mountFD );
+        inodes.root.mountFD = -1;
+    }
+    if ( inodes.root.templateFD != -1 ) {
+        close( inodes.root.templateFD );
+        inodes.root.templateFD = -1;
+    }
+}
+
+static void lookupOp( fuse_req_t req, fuse_ino_t parent, const char * name )
+{
+    struct fuse_entry_param e;
+
+    logEntry( "%lu,\'%s\'", parent, name );
+
+    int result = lookupEntry( getInode( parent ), name, &e );
+    if ( result == 0 ) {
+        fuse_reply_entry( req, &e );
+    } else if ( result == -ENOENT && isKernelCacheEnabled() ) {
+        /* a negative entry, which the kernel may cache too */
+        e.ino = 0;
+        fuse_reply_entry( req, &e );
+    } else {
+        replyError( req, -result );
+    }
+}
+
+static void forgetOp( fuse_req_t req, fuse_ino_t ino, uint64_t nlookup )
+{
+    logEntry( "%lu,%lu", ino, nlookup );
+
+    pthread_mutex_lock( &inodes.lock );
+    forgetInode( getInode( ino ), nlookup );
+    pthread_mutex_unlock( &inodes.lock );
+
+    fuse_reply_none( req );
+}
+
+static void forgetMultiOp( fuse_req_t req, size_t count, struct fuse_forget_data * forgets )
+{
+    logEntry( "%lu,%p", count, forgets );
+
+    pthread_mutex_lock( &inodes.lock );
+    for ( size_t i = 0; i < count; ++i ) {
+        forgetInode( getInode( forgets[ i ].ino ), forgets[ i ].nlookup );
+    }
+    pthread_mutex_unlock( &inodes.lock );
+
+    fuse_reply_none( req );
+}
+
+static void getAttrOp( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi )
+{
+    struct stat st;
+
+    logEntry( "%lu,%p", ino, fi );
+
+    int result = inodeAttributes( getInode( ino ), getFileHandle( fi ), &st );
+    if ( result == 0 ) {
+        fuse_reply_attr( req, &st, cacheTimeout() );
+    } else {
+        replyError( req, -result );
+    }
+}
+
+static void setAttrOp( fuse_req_t req, fuse_ino_t ino, struct stat * attr, int toSet, struct fuse_file_info * fi )
+{
+    int       result = 0;
+    tInode *  inode  = getInode( ino );
+    tFHFile * fh     = getFileHandle( fi );
+    char      proc[ 64 ];
+
+    logEntry( "%lu,%p,%d,%p", ino, attr, toSet, fi );
+
+    /* like fuseOperations.c, changes are made to the file underneath the mount */
+    if ( fh != NULL && fh->isTemplate ) {
+        fh = NULL;
+    }
+    if ( inode->mountFD == -1 ) {
+        result = -ENOENT;
+    }
+    procPath( inode->mountFD, proc, sizeof( proc ) );
+
+    if ( result == 0 && ( toSet & FUSE_SET_ATTR_MODE ) ) {
+        result = fixupResult( ( fh != NULL ) ? fchmod( fh->fd, attr->st_mode )
+                                             : chmod( proc, attr->st_mode ) );
+    }
+    if ( result == 0 && ( toSet & ( FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID ) ) ) {
+        uid_t uid = ( toSet & FUSE_SET_ATTR_UID ) ? attr->st_uid : (uid_t)-1;
+        gid_t gid = ( toSet & FUSE_SET_ATTR_GID ) ? attr->st_gid : (gid_t)-1;
+
+        result = fixupResult( fchownat( inode->mountFD, "", uid, gid, AT_EMPTY_PATH | AT_SYMLINK_NOFOLLOW ) );
+    }
+    if ( result == 0 && ( toSet & FUSE_SET_ATTR_SIZE ) ) {
+        if ( inode->isTemplate ) {
+            /* a template file is treated as 'read-only', and truncating isn't allowed */
+            result = -EPERM;
+        } else {
+            result = fixupResult( ( fh != NULL ) ? ftruncate( fh->fd, attr->st_size )
+                                                 : truncate( proc, attr->st_size ) );
+        }
+    }
+    if ( result == 0 && ( toSet & ( FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME ) ) ) {
+        struct timespec ts[ 2 ] = {
+            { .tv_nsec = UTIME_OMIT },
+            { .tv_nsec = UTIME_OMIT }
+        };
+
+        if ( toSet & FUSE_SET_ATTR_ATIME_NOW ) {
+            ts[ 0 ].tv_nsec = UTIME_NOW;
+        } else if ( toSet & FUSE_SET_ATTR_ATIME ) {
+            ts[ 0 ] = attr->st_atim;
+        }
+        if ( toSet & FUSE_SET_ATTR_MTIME_NOW ) {
+            ts[ 1 ].tv_nsec = UTIME_NOW;
+        } else if ( toSet & FUSE_SET_ATTR_MTIME ) {
+            ts[ 1 ] = attr->st_mtim;
+        }
+        result = fixupResult( ( fh != NULL ) ? futimens( fh->fd, ts )
+                                             : utimensat( AT_FDCWD, proc, ts, 0 ) );
+    }
+
+    if ( result == 0 ) {
+        struct stat st;
+        result = inodeAttributes( inode, getFileHandle( fi ), &st );
+        if ( result == 0 ) {
+            fuse_reply_attr( req, &st, cacheTimeout() );
+        }
+    }
+    if ( result != 0 ) {
+        replyError( req, -result );
+    }
+}
+
+static void readSymlinkOp( fuse_req_t req, fuse_ino_t ino )
+{
+    char    buf[ PATH_MAX + 1 ];
+    ssize_t len;
+
+    logEntry( "%lu", ino );
+
+    len = readlinkat( servedFD( getInode( ino ) ), "", buf, sizeof( buf ) - 1 );
+    if ( len == -1 ) {
+        replyError( req, errno );
+    } else {
+        buf[ len ] = '\0';
+        fuse_reply_readlink( req, buf );
+    }
+}
+
+static void mkNodOp( fuse_req_t req, fuse_ino_t parent, const char * name, mode_t mode, dev_t rdev )
+{
+    logEntry( "%lu,\'%s\',%d,%d", parent, name, mode, rdev );
+
+    tInode * dir = getInode( parent );
+    int      result;
+
+    if ( S_ISFIFO( mode ) ) {
+        result = fixupResult( mkfifoat( dir->mountFD, name, mode ) );
+    } else {
+        result = fixupResult( mknodat( dir->mountFD, name, mode, rdev ) );
+    }
+    replyCreated( req, dir, name, result );
+}
+
+static void createDirOp( fuse_req_t req, fuse_ino_t parent, const char * name, mode_t mode )
+{
+    logEntry( "%lu,\'%s\',%d", parent, name, mode );
+
+    tInode * dir = getInode( parent );
+    replyCreated( req, dir, name, fixupResult( mkdirat( dir->mountFD, name, mode ) ) );
+}
+
+static void createSymlinkOp( fuse_req_t req, const char * link, fuse_ino_t parent, const char * name )
+{
+    logEntry( "\'%s\',%lu,\'%s\'", link, parent, name );
+
+    tInode * dir = getInode( parent );
+    replyCreated( req, dir, name, fixupResult( symlinkat( link, dir->mountFD, name ) ) );
+}
+
+static void linkFileOp( fuse_req_t req, fuse_ino_t ino, fuse_ino_t newParent, const char * newName )
+{
+    char proc[ 64 ];
+
+    logEntry( "%lu,%lu,\'%s\'", ino, newParent, newName );
+
+    /* AT_EMPTY_PATH would need CAP_DAC_READ_SEARCH, so go through /proc */
+    tInode * dir   = getInode( newParent );
+    tInode * inode = getInode( ino );
+    procPath( inode->mountFD, proc, sizeof( proc ) );
+    replyCreated( req, dir, newName,
+                  fixupResult( linkat( AT_FDCWD, proc, dir->mountFD, newName, AT_SYMLINK_FOLLOW ) ) );
+}
+
+static void fileUnlinkOp( fuse_req_t req, fuse_ino_t parent, const char * name )
+{
+    logEntry( "%lu,\'%s\'", parent, name );
+
+    tInode * dir    = getInode( parent );
+    int      result = fixupResult( unlinkat( dir->mountFD, name, 0 ) );
+    if ( result == 0 ) {
+        forgetEntry( dir, name );
+    }
+    replyError( req, -result );
+}
+
+static void removeDirOp( fuse_req_t req, fuse_ino_t parent, const char * name )
+{
+    logEntry( "%lu,\'%s\'", parent, name );
+
+    tInode * dir    = getInode( parent );
+    int      result = fixupResult( unlinkat( dir->mountFD, name, AT_REMOVEDIR ) );
+    if ( result == 0 ) {
+        forgetEntry( dir, name );
+    }
+    replyError( req, -result );
+}
+
+static void renameFsObjOp( fuse_req_t req,
+                           fuse_ino_t parent, const char * name,
+                           fuse_ino_t newParent, const char * newName,
+                           unsigned int flags )
+{
+    logEntry( "%lu,\'%s\',%lu,\'%s\',%u", parent, name, newParent, newName, flags );
+
+    tInode * from   = getInode( parent );
+    tInode * to     = getInode( newParent );
+    int      result = fixupResult( renameat2( from->mountFD, name, to->mountFD, newName, flags ) );
+
+    if ( result == 0 ) {
+        pthread_mutex_lock( &inodes.lock );
+
+        tInode * moved    = findChild( from, name );
+        tInode * replaced = findChild( to, newName );
+        if ( flags & RENAME_EXCHANGE ) {
+            /* unhash both first, so neither is found under the other's name */
+            unhashInode( moved );
+            unhashInode( replaced );
+            if ( replaced != NULL ) {
+                moveInode( replaced, from, name );
+            }
+        } else {
+            unhashInode( replaced );
+        }
+        if ( moved != NULL ) {
+            moveInode( moved, to, newName );
+        }
+
+        pthread_mutex_unlock( &inodes.lock );
+    }
+    replyError( req, -result );
+}
+
+static void createFileOp( fuse_req_t req,
+                          fuse_ino_t parent,
+                          const char * name,
+                          mode_t mode,
+                          struct fuse_file_info * fi )
+{
+    struct fuse_entry_param e;
+    char                    path[ PATH_MAX ];
+
+    logEntry( "%lu,\'%s\',%u,%p", parent, name, mode, fi );
+
+    /* files are always created under the mount point, never in the template hierarchy */
+    tInode * dir    = getInode( parent );
+    int      result = inodePath( dir, name, path, sizeof( path ) );
+    tFHFile * fh    = NULL;
+
+    if ( result == 0 ) {
+        fh = (tFHFile *) calloc( 1, sizeof( tFileHandle ) );
+        if ( fh == NULL ) {
+            result = -ENOMEM;
+        } else {
+            fh->path = strdup( path );
+            fh->fd   = fixupResult( openat( dir->mountFD, name, ( fi->flags | O_CREAT ) & ~O_NOFOLLOW, mode ) );
+            setFileHandle( fi, fh );
+            if ( fh->fd < 0 ) {
+                result = fh->fd;
+                fh->fd = -1;
+            }
+        }
+    }
+    if ( result == 0 ) {
+        result = lookupEntry( dir, name, &e );
+    }
+
+    if ( result == 0 ) {
+        fi->keep_cache = isKernelCacheEnabled();
+        passThrough( req, fh, fi );
+        if ( fuse_reply_create( req, &e, fi ) == -ENOENT ) {
+            closeFile( NULL, fi );
+        }
+    } else {
+        closeFile( req, fi );
+        replyError( req, -result );
+    }
+}
+
+static void openFileOp( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi )
+{
+    char     path[ PATH_MAX ];
+    char     proc[ 64 ];
+    tInode * inode = getInode( ino );
+
+    logEntry( "%lu,%p", ino, fi );
+
+    int result = inodePath( inode, NULL, path, sizeof( path ) );
+
+    tFHFile * fh = NULL;
+    if ( result == 0 ) {
+        fh = (tFHFile *) calloc( 1, sizeof( tFileHandle ) );
+        if ( fh == NULL ) {
+            result = -ENOMEM;
+        }
+    }
+    if ( result == 0 && inode == &statsFile ) {
+        fh->path = strdup( path );
+        setFileHandle( fi, fh );
+        result = openStats( fh, fi );
+    } else if ( result == 0 ) {
+        fh->path         = strdup( path );
+        fh->isTemplate   = inode->isTemplate;
+        fh->isExecutable = inode->isTemplate && isExecutable( path );
+        setFileHandle( fi, fh );
+
+        /* reopen the O_PATH fd for real */
+        procPath( servedFD( inode ), proc, sizeof( proc ) );
+        fh->fd = fixupResult( open( proc, fi->flags & ~O_NOFOLLOW ) );
+        if ( fh->fd < 0 ) {
+            result = fh->fd;
+            fh->fd = -1;
+        }
+    }
+
+    if ( result != 0 ) {
+        closeFile( req, fi );
+        replyError( req, -result );
+    } else if ( inode == &statsFile ) {
+        /* already 'rendered', by openStats() */
+        if ( fuse_reply_open( req, fi ) == -ENOENT ) {
+            closeFile( NULL, fi );
+        }
+    } else if ( !fh->isTemplate ) {
+        logDebug( "regular file" );
+        fi->keep_cache = isKernelCacheEnabled();
+        passThrough( req, fh, fi );
+        if ( fuse_reply_open( req, fi ) == -ENOENT ) {
+            closeFile( NULL, fi );
+        }
+    } else {
+        logDebug( "have%s template", fh->isExecutable ? " executable" : "" );
+
+        /* reply from the render pool once it's rendered, rather than tying up this thread */
+        tOpenJob * job = calloc( 1, sizeof( tOpenJob ) );
+        if ( job == NULL ) {
+            closeFile( req, fi );
+            replyError( req, ENOMEM );
+        } else {
+            job->req   = req;
+            job->fi    = *fi;
+            job->start = metricsClock();
+
+            result = submitRender( fh->isExecutable ? kLaneExecutable : kLaneTemplate,
+                                   renderOpen, job,
+                                   renderOpened, job );
+            if ( result != 0 ) {
+                free( job );
+                closeFile( req, fi );
+                replyError( req, -result );
+            } else {
+                /* renderOpened() notes it, once it's replied */
+                repliedError = kReplyDeferred;
+            }
+        }
+    }
+}
+
+static void readFileOp( fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info * fi )
+{
+    logEntry( "%lu,%lu,%ld,%p", ino, size, offset, fi );
+
+    tFHFile * fh = getFileHandle( fi );
+    if ( fh == NULL ) {
+        replyError( req, ENFILE );
+    } else if ( fh->stream != NULL ) {
+        char * buf = malloc( size );
+        if ( buf == NULL ) {
+            replyError( req, ENOMEM );
+        } else {
+            /* waits for the output to reach offset + size, or end */
+            ssize_t got = readRenderStream( fh->stream, buf, size, offset );
+            if ( got < 0 ) {
+                replyError( req, -got );
+            } else {
+                fuse_reply_buf( req, buf, got );
+            }
+            free( buf );
+        }
+    } else if ( fh->isTemplate ) {
+        tRendered * contents = fh->contents;
+        if ( contents == NULL || (size_t)offset >= contents->length ) {
+            fuse_reply_buf( req, NULL, 0 );
+        } else {
+            /* if trying to read more data than we have, trim the size */
+            if ( offset + size > contents->length ) {
+                size = contents->length - offset;
+            }
+            if ( contents->fd != -1 ) {
+                /* served straight from the sealed memfd */
+                struct fuse_bufvec buf = FUSE_BUFVEC_INIT( size );
+
+                buf.buf[ 0 ].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+                buf.buf[ 0 ].fd    = contents->fd;
+                buf.buf[ 0 ].pos   = offset;
+
+                fuse_reply_data( req, &buf, FUSE_BUF_SPLICE_MOVE );
+            } else {
+                fuse_reply_buf( req, &contents->data[ offset ], size );
+            }
+        }
+    } else {
+        /* let libfuse move the data straight from the file, splicing if it can */
+        struct fuse_bufvec buf = FUSE_BUFVEC_INIT( size );
+
+        buf.buf[ 0 ].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        buf.buf[ 0 ].fd    = fh->fd;
+        buf.buf[ 0 ].pos   = offset;
+
+        fuse_reply_data( req, &buf, FUSE_BUF_SPLICE_MOVE );
+    }
+}
+
+static void writeFileBufOp( fuse_req_t req,
+                            fuse_ino_t ino,
+                            struct fuse_bufvec * buf,
+                            off_t offset,
+                            struct fuse_file_info * fi )
+{
+    logEntry( "%lu,%p,%ld,%p", ino, buf, offset, fi );
+
+    tFHFile * fh = getFileHandle( fi );
+    if ( fh == NULL ) {
+        replyError( req, ENFILE );
+    } else if ( fh->isTemplate ) {
+        /* fail if attempting to write to a template file - they are read-only */
+        replyError( req, EPERM );
+    } else {
+        struct fuse_bufvec dst = FUSE_BUFVEC_INIT( fuse_buf_size( buf ) );
+
+        dst.buf[ 0 ].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        dst.buf[ 0 ].fd    = fh->fd;
+        dst.buf[ 0 ].pos   = offset;
+
+        ssize_t result = fuse_buf_copy( &dst, buf, FUSE_BUF_SPLICE_NONBLOCK );
+        if ( result < 0 ) {
+            replyError( req, (int)-result );
+        } else {
+            fuse_reply_write( req, (size_t)result );
+        }
+    }
+}
+
+#ifdef HAVE_COPY_FILE_RANGE
+static void copyFileRangeOp( fuse_req_t req,
+                             fuse_ino_t inoIn, off_t offIn, struct fuse_file_info * fiIn,
+                             fuse_ino_t inoOut, off_t offOut, struct fuse_file_info * fiOut,
+                             size_t len, int flags )
+{
+    logEntry( "%lu,%ld,%p,%lu,%ld,%p,%lu,%d", inoIn, offIn, fiIn, inoOut, offOut, fiOut, len, flags );
+
+    tFHFile * fhIn  = getFileHandle( fiIn );
+    tFHFile * fhOut = getFileHandle( fiOut );
+    if ( fhIn == NULL || fhOut == NULL ) {
+        replyError( req, ENFILE );
+    } else if ( fhOut->isTemplate ) {
+        replyError( req, EPERM );
+    } else if ( fhIn->isTemplate ) {
+        /* the fd is the template itself, not what it renders to */
+        replyError( req, EOPNOTSUPP );
+    } else {
+        ssize_t result = copy_file_range( fhIn->fd, &offIn, fhOut->fd, &offOut, len, flags );
+        if ( result == -1 ) {
+            replyError( req, errno );
+        } else {
+            fuse_reply_write( req, (size_t)result );
+        }
+    }
+}
+#endif
+
+static void flushFileOp( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi )
+{
+    int result = 0;
+
+    logEntry( "%lu,%p", ino, fi );
+
+    tFHFile * fh = getFileHandle( fi );
+    if ( fh == NULL ) {
+        result = -ENFILE;
+    } else if ( !fh->isTemplate ) {
+        /* see flushFileOp() in fuseOperations.c: this *must not* actually close the file */
+        result = fixupResult( close( dup( fh->fd ) ) );
+    }
+    replyError( req, -result );
+}
+
+static void releaseFileOp( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi )
+{
+    logEntry( "%lu,%p", ino, fi );
+
+    closeFile( req, fi );
+    replyError( req, 0 );
+}
+
+static void fsyncFileOp( fuse_req_t req, fuse_ino_t ino, int isdatasync, struct fuse_file_info * fi )
+{
+    int result = -ENFILE;
+
+    logEntry( "%lu,%d,%p", ino, isdatasync, fi );
+    (void)isdatasync;
+
+    tFHFile * fh = getFileHandle( fi );
+    if ( fh != NULL ) {
+#ifdef HAVE_FDATASYNC
+        if ( isdatasync ) {
+            result = fixupResult( fdatasync( fh->fd ) );
+        } else
+#endif
+        {
+            result = fixupResult( fsync( fh->fd ) );
+        }
+    }
+    replyError( req, -result );
+}
+
+static void openDirOp( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi )
+{
+    int    result = 0;
+    char   path[ PATH_MAX ];
+
+    logEntry( "%lu,%p", ino, fi );
+
+    tInode * inode = getInode( ino );
+    tFHDir * dh    = (tFHDir *) calloc( 1, sizeof( tFileHandle ) );
+    if ( dh == NULL ) {
+        result = -ENOMEM;
+    } else {
+        /* the inode's fds are used instead of the handle's own (see fuseOperations.c) */
+        dh->mountFD    = -1;
+        dh->templateFD = -1;
+
+        result = inodePath( inode, NULL, path, sizeof( path ) );
+        if ( result == 0 && inode->mountFD == -1 && inode->templateFD == -1 && inode != &statsDir ) {
+            /* only the stats directory may be empty (see fuseOperations.c) */
+            result = -ENOENT;
+        }
+        if ( result == 0 ) {
+            dh->path = strdup( path );
+            if ( dh->path == NULL ) {
+                result = -ENOMEM;
+            }
+        }
+        if ( result == 0 ) {
+            /* merged with the same directory in the template hierarchy (see dirListing.c) */
+            dh->listing = acquireDirListing( path, inode->mountFD, inode->templateFD );
+            if ( dh->listing == NULL ) {
+                result = -EIO;
+            }
+        }
+    }
+
+    if ( result == 0 ) {
+        setDirHandle( fi, dh );
+        if ( fuse_reply_open( req, fi ) == -ENOENT ) {
+            releaseDirListing( dh->listing );
+            free( dh->path );
+            releaseHandle( fi );
+        }
+    } else {
+        if ( dh != NULL ) {
+            free( dh->path );
+        }
+        free( dh );
+        replyError( req, -result );
+    }
+}
+
+/**
+ * @brief reply with as many entries of the directory as fit, starting at 'offset'.
+ * The offset of an entry is one more than its index in the listing
+ * @param plus  true for readdirplus, which looks each entry up, as lookup would
+ */
+static void replyDirEntries( fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info * fi, bool plus )
+{
+    tInode * inode = getInode( ino );
+    tFHDir * dh    = getDirHandle( fi );
+    if ( dh == NULL ) {
+        replyError( req, ENOTDIR );
+        return;
+    }
+
+    char * buf = malloc( size );
+    if ( buf == NULL ) {
+        replyError( req, ENOMEM );
+        return;
+    }
+
+    if ( offset == 0 ) {
+        /* (re)starting, so pick up any change since it was opened */
+        tDirListing * listing = acquireDirListing( dh->path, inode->mountFD, inode->templateFD );
+        if ( listing != NULL ) {
+            releaseDirListing( dh->listing );
+            dh->listing = listing;
+        }
+    }
+
+    size_t used = 0;
+    for ( size_t i = offset; i < dh->listing->count; ++i ) {
+        const tDirEntry * entry = &dh->listing->entries[ i ];
+        bool              fromTemplates = isServedFromTemplates( dh->path, entry );
+        size_t            entsize;
+
+        if ( !fromTemplates && !entry->inMount ) {
+            /* only in the template hierarchy, but not a template (e.g. unreadable) */
+            continue;
+        }
+
+        if ( plus ) {
+            struct fuse_entry_param e;
+            bool                    dots = ( strcmp( entry->name, "." ) == 0 || strcmp( entry->name, ".." ) == 0 );
+
+            if ( dots ) {
+                /* the kernel doesn't look these up, so they mustn't count as lookups */
+                memset( &e, 0, sizeof( e ) );
+                e.attr.st_ino  = fromTemplates ? entry->templateIno : entry->mountIno;
+                e.attr.st_mode = ( fromTemplates ? entry->templateType : entry->mountType ) << 12;
+            } else if ( lookupEntry( inode, entry->name, &e ) != 0 ) {
+                /* gone since it was listed */
+                continue;
+            }
+
+            entsize = fuse_add_direntry_plus( req, &buf[ used ], size - used, entry->name, &e, i + 1 );
+            if ( entsize > size - used && !dots ) {
+                /* it wasn't sent, so the kernel won't forget it */
+                pthread_mutex_lock( &inodes.lock );
+                forgetInode( getInode( e.ino ), 1 );
+                pthread_mutex_unlock( &inodes.lock );
+            }
+        } else {
+            struct stat st;
+
+            memset( &st, 0, sizeof( st ) );
+            st.st_ino  = fromTemplates ? entry->templateIno : entry->mountIno;
+            st.st_mode = ( fromTemplates ? entry->templateType : entry->mountType ) << 12;
+
+            entsize = fuse_add_direntry( req, &buf[ used ], size - used, entry->name, &st, i + 1 );
+        }
+
+        if ( entsize > size - used ) {
+            /* doesn't fit, so it's the first entry of the next call */
+            break;
+        }
+        used += entsize;
+    }
+
+    fuse_reply_buf( req, buf, used );
+    free( buf );
+}
+
+static void readDirOp( fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info * fi )
+{
+    logEntry( "%lu,%lu,%ld,%p", ino, size, offset, fi );
+
+    replyDirEntries( req, ino, size, offset, fi, false );
+}
+
+static void readDirPlusOp( fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info * fi )
+{
+    logEntry( "%lu,%lu,%ld,%p", ino, size, offset, fi );
+
+    replyDirEntries( req, ino, size, offset, fi, true );
+}
+
+static void releaseDirOp( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi )
+{
+    logEntry( "%lu,%p", ino, fi );
+
+    tFHDir * dh = getDirHandle( fi );
+    if ( dh != NULL ) {
+        releaseDirListing( dh->listing );
+        free( dh->path );
+    }
+    releaseHandle( fi );
+    replyError( req, 0 );
+}
+
+static void getFsStatsOp( fuse_req_t req, fuse_ino_t ino )
+{
+    struct statvfs st;
+
+    logEntry( "%lu", ino );
+
+    tInode * inode = getInode( ino );
+    int      fd    = ( inode->mountFD != -1 ) ? inode->mountFD : inodes.root.mountFD;
+    if ( fstatvfs( fd, &st ) == -1 ) {
+        replyError( req, errno );
+    } else {
+        fuse_reply_statfs( req, &st );
+    }
+}
+
+static void fileAccessOp( fuse_req_t req, fuse_ino_t ino, int mask )
+{
+    char proc[ 64 ];
+
+    logEntry( "%lu,%d", ino, mask );
+
+    tInode * inode = getInode( ino );
+    if ( isVirtual( inode ) ) {
+        /* the stats are read-only */
+        replyError( req, ( mask & W_OK ) ? EACCES : 0 );
+    } else {
+        procPath( servedFD( inode ), proc, sizeof( proc ) );
+        replyError( req, -fixupResult( access( proc, mask ) ) );
+    }
+}
+
+static void flockFileOp( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi, int op )
+{
+    int result = -ENFILE;
+
+    logEntry( "%lu,%p,%d", ino, fi, op );
+
+    tFHFile * fh = getFileHandle( fi );
+    if ( fh != NULL ) {
+        result = fixupResult( flock( fh->fd, op ) );
+    }
+    replyError( req, -result );
+}
+
+static void lseekFileOp( fuse_req_t req, fuse_ino_t ino, off_t off, int whence, struct fuse_file_info * fi )
+{
+    off_t result = -ENFILE;
+
+    logEntry( "%lu,%ld,%d,%p", ino, off, whence, fi );
+
+    tFHFile * fh = getFileHandle( fi );
+    if ( fh != NULL ) {
+        if ( fh->isTemplate ) {
+            result = seekRendered( fh->contents, off, whence );
+        } else {
+            result = lseek( fh->fd, off, whence );
+            if ( result == -1 ) {
+                result = -errno;
+            }
+        }
+    }
+
+    if ( result < 0 ) {
+        replyError( req, (int)-result );
+    } else {
+        fuse_reply_lseek( req, result );
+    }
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief kernel cache invalidation for the low-level API (see kernelCache.c)
+ * @param path     path relative to the mount, e.g. '/hosts'
+ * @param session  the fuse session that's mounted
+ * @return zero if successful, -ENOENT if the kernel hasn't looked it up
+ */
+int invalidateInodePath( const char * path, void * session )
+{
+    int        result = 0;
+    char       name[ NAME_MAX + 1 ];
+    fuse_ino_t ino    = FUSE_ROOT_ID;
+    fuse_ino_t parent = FUSE_ROOT_ID;
+
+    name[ 0 ] = '\0';
+
+    pthread_mutex_lock( &inodes.lock );
+
+    tInode * inode = &inodes.root;
+    for ( const char * p = path; result == 0 && *p != '\0'; ) {
+        while ( *p == '/' ) {
+            ++p;
+        }
+        size_t len = strcspn( p, "/" );
+        if ( len == 0 ) {
+            break;
+        }
+        if ( len > NAME_MAX ) {
+            result = -ENAMETOOLONG;
+        } else {
+            memcpy( name, p, len );
+            name[ len ] = '\0';
+
+            tInode * child = findChild( inode, name );
+            if ( child == NULL ) {
+                result = -ENOENT;
+            } else {
+                parent = inodeNumber( inode );
+                ino    = inodeNumber( child );
+                inode  = child;
+            }
+        }
+        p += len;
+    }
+
+    pthread_mutex_unlock( &inodes.lock );
+
+    if ( result == 0 ) {
+        result = fuse_lowlevel_notify_inval_inode( session, ino, 0, 0 );
+        if ( ino != FUSE_ROOT_ID ) {
+            int err = fuse_lowlevel_notify_inval_entry( session, parent, name, strlen( name ) );
+            if ( result == 0 ) {
+                result = err;
+            }
+        }
+    }
+
+    return result;
+}
+
+/* each operation, timed for the stats (see metrics.c) */
+METERED_REPLY( kOpLookup, lookupOp, ( fuse_req_t req, fuse_ino_t parent, const char * name ), ( req, parent, name ) )
+METERED_REPLY( kOpGetattr, getAttrOp, ( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi ), ( req, ino, fi ) )
+METERED_REPLY( kOpSetattr, setAttrOp,
+               ( fuse_req_t req, fuse_ino_t ino, struct stat * attr, int toSet, struct fuse_file_info * fi ),
+               ( req, ino, attr, toSet, fi ) )
+METERED_REPLY( kOpReadlink, readSymlinkOp, ( fuse_req_t req, fuse_ino_t ino ), ( req, ino ) )
+METERED_REPLY( kOpMknod, mkNodOp,
+               ( fuse_req_t req, fuse_ino_t parent, const char * name, mode_t mode, dev_t rdev ),
+               ( req, parent, name, mode, rdev ) )
+METERED_REPLY( kOpMkdir, createDirOp,
+               ( fuse_req_t req, fuse_ino_t parent, const char * name, mode_t mode ), ( req, parent, name, mode ) )
+METERED_REPLY( kOpUnlink, fileUnlinkOp, ( fuse_req_t req, fuse_ino_t parent, const char * name ), ( req, parent, name ) )
+METERED_REPLY( kOpRmdir, removeDirOp, ( fuse_req_t req, fuse_ino_t parent, const char * name ), ( req, parent, name ) )
+METERED_REPLY( kOpSymlink, createSymlinkOp,
+               ( fuse_req_t req, const char * link, fuse_ino_t parent, const char * name ), ( req, link, parent, name ) )
+METERED_REPLY( kOpRename, renameFsObjOp,
+               ( fuse_req_t req, fuse_ino_t parent, const char * name,
+                 fuse_ino_t newParent, const char * newName, unsigned int flags ),
+               ( req, parent, name, newParent, newName, flags ) )
+METERED_REPLY( kOpLink, linkFileOp,
+               ( fuse_req_t req, fuse_ino_t ino, fuse_ino_t newParent, const char * newName ),
+               ( req, ino, newParent, newName ) )
+METERED_REPLY( kOpOpen, openFileOp, ( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi ), ( req, ino, fi ) )
+METERED_REPLY( kOpRead, readFileOp,
+               ( fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info * fi ),
+               ( req, ino, size, offset, fi ) )
+METERED_REPLY( kOpWriteBuf, writeFileBufOp,
+               ( fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec * buf, off_t offset, struct fuse_file_info * fi ),
+               ( req, ino, buf, offset, fi ) )
+METERED_REPLY( kOpFlush, flushFileOp, ( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi ), ( req, ino, fi ) )
+METERED_REPLY( kOpRelease, releaseFileOp, ( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi ), ( req, ino, fi ) )
+METERED_REPLY( kOpFsync, fsyncFileOp,
+               ( fuse_req_t req, fuse_ino_t ino, int isdatasync, struct fuse_file_info * fi ), ( req, ino, isdatasync, fi ) )
+METERED_REPLY( kOpOpendir, openDirOp, ( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi ), ( req, ino, fi ) )
+METERED_REPLY( kOpReaddir, readDirOp,
+               ( fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info * fi ),
+               ( req, ino, size, offset, fi ) )
+METERED_REPLY( kOpReaddir, readDirPlusOp,
+               ( fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info * fi ),
+               ( req, ino, size, offset, fi ) )
+METERED_REPLY( kOpReleasedir, releaseDirOp, ( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi ), ( req, ino, fi ) )
+METERED_REPLY( kOpStatfs, getFsStatsOp, ( fuse_req_t req, fuse_ino_t ino ), ( req, ino ) )
+METERED_REPLY( kOpAccess, fileAccessOp, ( fuse_req_t req, fuse_ino_t ino, int mask ), ( req, ino, mask ) )
+METERED_REPLY( kOpCreate, createFileOp,
+               ( fuse_req_t req, fuse_ino_t parent, const char * name, mode_t mode, struct fuse_file_info * fi ),
+               ( req, parent, name, mode, fi ) )
+METERED_REPLY( kOpFlock, flockFileOp, ( fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi, int op ), ( req, ino, fi, op ) )
+#ifdef HAVE_COPY_FILE_RANGE
+METERED_REPLY( kOpCopyFileRange, copyFileRangeOp,
+               ( fuse_req_t req,
+                 fuse_ino_t inoIn, off_t offIn, struct fuse_file_info * fiIn,
+                 fuse_ino_t inoOut, off_t offOut, struct fuse_file_info * fiOut,
+                 size_t len, int flags ),
+               ( req, inoIn, offIn, fiIn, inoOut, offOut, fiOut, len, flags ) )
+#endif
+METERED_REPLY( kOpLseek, lseekFileOp,
+               ( fuse_req_t req, fuse_ino_t ino, off_t off, int whence, struct fuse_file_info * fi ),
+               ( req, ino, off, whence, fi ) )
+
+const struct fuse_lowlevel_ops templatefsLowlevelOperations = {
+    .init            = initOp,
+    .destroy         = destroyOp,
+    .lookup          = lookupOpMetered,
+    .forget          = forgetOp,
+    .forget_multi    = forgetMultiOp,
+    .getattr         = getAttrOpMetered,
+    .setattr         = setAttrOpMetered,
+    .readlink        = readSymlinkOpMetered,
+    .mknod           = mkNodOpMetered,
+    .mkdir           = createDirOpMetered,
+    .unlink          = fileUnlinkOpMetered,
+    .rmdir           = removeDirOpMetered,
+    .symlink         = createSymlinkOpMetered,
+    .rename          = renameFsObjOpMetered,
+    .link            = linkFileOpMetered,
+    .open            = openFileOpMetered,
+    .read            = readFileOpMetered,
+    .write_buf       = writeFileBufOpMetered,
+    .flush           = flushFileOpMetered,
+    .release         = releaseFileOpMetered,
+    .fsync           = fsyncFileOpMetered,
+    .opendir         = openDirOpMetered,
+    .readdir         = readDirOpMetered,
+    .readdirplus     = readDirPlusOpMetered,
+    .releasedir      = releaseDirOpMetered,
+    .statfs          = getFsStatsOpMetered,
+    .access          = fileAccessOpMetered,
+    .create          = createFileOpMetered,
+    .flock           = flockFileOpMetered,
+#ifdef HAVE_COPY_FILE_RANGE
+    .copy_file_range = copyFileRangeOpMetered,
+#endif
+    .lseek           = lseekFileOpMetered,
+};
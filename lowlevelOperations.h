@@ -0,0 +1,14 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_LOWLEVELOPERATIONS_H
+#define TEMPLATEFS_LOWLEVELOPERATIONS_H
+
+#include "templatefs.h"
+
+extern const struct fuse_lowlevel_ops templatefsLowlevelOperations;
+
+int invalidateInodePath( const char * path, void * session );
+
+#endif //TEMPLATEFS_LOWLEVELOPERATIONS_H
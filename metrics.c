@@ -0,0 +1,442 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* What the daemon has been doing, read from kStatsPath at the root of
+ * the mount in the Prometheus text format, e.g. for node_exporter's
+ * textfile collector, or anything else that scrapes it.
+ *
+ * Each thread counts into a shard of its own, so counting needs no lock
+ * and no shared cache line: only the thread that owns a shard ever writes
+ * to it. Reading the stats sums every shard. When a thread exits its shard
+ * is kept, counts and all, and handed to the next new thread, so nothing
+ * is lost and threads coming and going don't keep adding shards.
+ *
+ * Latencies are counted into buckets that double in width, from 1µs.
+ *
+ * Renders are also totalled by template. That does take a lock, but
+ * renders are rare and slow compared to taking it. */
+
+#include "common.h"
+#include "metrics.h"
+#include "logStuff.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define kTemplateBuckets  256   // always a power of two
+
+typedef struct {
+    atomic_uint_fast64_t  count;
+    atomic_uint_fast64_t  sumNS;
+    atomic_uint_fast64_t  buckets[ kLatencyBuckets + 1 ];   ///< the last is for anything slower
+} tHistogram;
+
+typedef struct sMetricsShard {
+    struct sMetricsShard * next;
+    bool                   inUse;       ///< by a thread that hasn't exited yet
+    tHistogram             operations[ kMaxOperation ];
+    atomic_uint_fast64_t   errors[ kMaxOperation ];
+    tHistogram             timers[ kMaxTimer ];
+    atomic_uint_fast64_t   counters[ kMaxCounter ];
+} tMetricsShard;
+
+/**
+ * @brief the renders of one template
+ */
+typedef struct sTemplateMetrics {
+    struct sTemplateMetrics * next;     ///< next in the same hash bucket
+    uint64_t                  renders;
+    uint64_t                  failures;
+    uint64_t                  ns;
+    uint64_t                  bytes;
+    char                      path[];
+} tTemplateMetrics;
+
+static struct {
+    pthread_mutex_t     lock;           ///< of the list of shards, and the templates
+    pthread_once_t      once;
+    pthread_key_t       key;            ///< so a shard is handed on when its thread exits
+    tMetricsShard *     shards;
+    tTemplateMetrics *  templates[ kTemplateBuckets ];
+    size_t              templateCount;
+} metrics = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT
+};
+
+static __thread tMetricsShard * threadShard = NULL;
+
+static const char * operationNames[ kMaxOperation ] = {
+    [kOpGetattr]       = "getattr",
+    [kOpAccess]        = "access",
+    [kOpReadlink]      = "readlink",
+    [kOpOpendir]       = "opendir",
+    [kOpReaddir]       = "readdir",
+    [kOpReleasedir]    = "releasedir",
+    [kOpMknod]         = "mknod",
+    [kOpMkdir]         = "mkdir",
+    [kOpSymlink]       = "symlink",
+    [kOpUnlink]        = "unlink",
+    [kOpRmdir]         = "rmdir",
+    [kOpRename]        = "rename",
+    [kOpLink]          = "link",
+    [kOpChmod]         = "chmod",
+    [kOpChown]         = "chown",
+    [kOpTruncate]      = "truncate",
+    [kOpUtimens]       = "utimens",
+    [kOpCreate]        = "create",
+    [kOpOpen]          = "open",
+    [kOpRead]          = "read",
+    [kOpReadBuf]       = "read_buf",
+    [kOpWrite]         = "write",
+    [kOpWriteBuf]      = "write_buf",
+    [kOpStatfs]        = "statfs",
+    [kOpFlush]         = "flush",
+    [kOpRelease]       = "release",
+    [kOpFsync]         = "fsync",
+    [kOpFallocate]     = "fallocate",
+    [kOpSetxattr]      = "setxattr",
+    [kOpGetxattr]      = "getxattr",
+    [kOpListxattr]     = "listxattr",
+    [kOpRemovexattr]   = "removexattr",
+    [kOpLock]          = "lock",
+    [kOpFlock]         = "flock",
+    [kOpCopyFileRange] = "copy_file_range",
+    [kOpLseek]         = "lseek",
+    [kOpLookup]        = "lookup",
+    [kOpSetattr]       = "setattr"
+};
+
+static const struct {
+    const char * name;
+    const char * help;
+} timerNames[ kMaxTimer ] = {
+    [kTimerRender]     = { "templatefs_render_duration_seconds",      "Time taken to render a template against the configuration" },
+    [kTimerExecute]    = { "templatefs_execute_duration_seconds",     "Time taken to run an executable template" },
+    [kTimerConfigLoad] = { "templatefs_config_load_duration_seconds", "Time taken to refresh the configuration from Elektra" }
+};
+
+static const struct {
+    const char * name;
+    const char * help;
+} counterNames[ kMaxCounter ] = {
+    [kCountRenderedBytes]        = { "templatefs_rendered_bytes_total",       "Output rendered from templates" },
+    [kCountExecutedBytes]        = { "templatefs_executed_bytes_total",       "Output produced by executable templates" },
+    [kCountExecTimeouts]         = { "templatefs_execute_timeouts_total",     "Runs of executable templates that were killed for taking too long" },
+    [kCountRenderCacheHits]      = { "templatefs_render_cache_hits_total",    "Renderings served from the render cache" },
+    [kCountRenderCacheMisses]    = { "templatefs_render_cache_misses_total",  "Renderings not found in the render cache" },
+    [kCountRenderCacheEvictions] = { "templatefs_render_cache_evictions_total", "Renderings evicted from the render cache to make room" },
+    [kCountOutputCacheHits]      = { "templatefs_output_cache_hits_total",    "Executable template output reused from the output cache" },
+    [kCountOutputCacheMisses]    = { "templatefs_output_cache_misses_total",  "Executable template output not found in the output cache" }
+};
+
+// ------------------------------------------------------------------------------
+
+/* only ever written by the shard's own thread, so no need for an atomic add */
+static inline void bump( atomic_uint_fast64_t * value, uint64_t amount )
+{
+    atomic_store_explicit( value, atomic_load_explicit( value, memory_order_relaxed ) + amount, memory_order_relaxed );
+}
+
+static inline uint64_t peek( const atomic_uint_fast64_t * value )
+{
+    return atomic_load_explicit( (atomic_uint_fast64_t *)value, memory_order_relaxed );
+}
+
+/**
+ * @brief the thread that owned this shard has exited
+ */
+static void releaseShard( void * shard )
+{
+    pthread_mutex_lock( &metrics.lock );
+    ((tMetricsShard *)shard)->inUse = false;
+    pthread_mutex_unlock( &metrics.lock );
+}
+
+static void createKey( void )
+{
+    pthread_key_create( &metrics.key, releaseShard );
+}
+
+/**
+ * @return the calling thread's shard, or NULL if it hasn't got one and there's no memory for one
+ */
+static tMetricsShard * getShard( void )
+{
+    tMetricsShard * result = threadShard;
+
+    if ( result == NULL ) {
+        pthread_once( &metrics.once, createKey );
+        pthread_mutex_lock( &metrics.lock );
+
+        result = metrics.shards;
+        while ( result != NULL && result->inUse ) {
+            result = result->next;
+        }
+        if ( result == NULL ) {
+            result = calloc( 1, sizeof( tMetricsShard ) );
+            if ( result != NULL ) {
+                result->next   = metrics.shards;
+                metrics.shards = result;
+            }
+        }
+        if ( result != NULL ) {
+            result->inUse = true;
+            pthread_setspecific( metrics.key, result );
+        }
+
+        pthread_mutex_unlock( &metrics.lock );
+        threadShard = result;
+    }
+    return result;
+}
+
+static void noteLatency( tHistogram * histogram, uint64_t start )
+{
+    uint64_t ns = metricsClock() - start;
+    uint64_t us = ( ns + 999 ) / 1000;
+
+    /* the first bucket whose upper bound, 2^i µs, it doesn't exceed */
+    unsigned int bucket = ( us <= 1 ) ? 0 : 64 - __builtin_clzll( us - 1 );
+    if ( bucket > kLatencyBuckets ) {
+        bucket = kLatencyBuckets;
+    }
+
+    bump( &histogram->count, 1 );
+    bump( &histogram->sumNS, ns );
+    bump( &histogram->buckets[ bucket ], 1 );
+}
+
+/**
+ * @brief write a label value, escaped as the text format requires
+ */
+static void writeLabel( FILE * out, const char * value )
+{
+    for ( const char * c = value; *c != '\0'; ++c ) {
+        switch ( *c ) {
+        case '\\': fputs( "\\\\", out ); break;
+        case '\"': fputs( "\\\"", out ); break;
+        case '\n': fputs( "\\n", out );  break;
+        default:   fputc( *c, out );     break;
+        }
+    }
+}
+
+/**
+ * @brief write one histogram, summed over every shard. Caller must hold the lock
+ * @param label  e.g. 'op="open"', or NULL if it has no labels
+ */
+static void writeHistogram( FILE * out, const char * name, const char * label, size_t offset )
+{
+    uint64_t count      = 0;
+    uint64_t sumNS      = 0;
+    uint64_t buckets[ kLatencyBuckets + 1 ] = { 0 };
+
+    for ( const tMetricsShard * shard = metrics.shards; shard != NULL; shard = shard->next ) {
+        const tHistogram * histogram = (const tHistogram *)( (const char *)shard + offset );
+        count += peek( &histogram->count );
+        sumNS += peek( &histogram->sumNS );
+        for ( unsigned int i = 0; i <= kLatencyBuckets; ++i ) {
+            buckets[ i ] += peek( &histogram->buckets[ i ] );
+        }
+    }
+
+    const char * separator = ( label != NULL ) ? "," : "";
+    if ( label == NULL ) {
+        label = "";
+    }
+
+    uint64_t cumulative = 0;
+    for ( unsigned int i = 0; i < kLatencyBuckets; ++i ) {
+        cumulative += buckets[ i ];
+        fprintf( out, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, label, separator, 1e-6 * (double)( 1UL << i ), cumulative );
+    }
+    fprintf( out, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, label, separator, count );
+    if ( *label != '\0' ) {
+        fprintf( out, "%s_sum{%s} %.9f\n", name, label, (double)sumNS / 1e9 );
+        fprintf( out, "%s_count{%s} %lu\n", name, label, count );
+    } else {
+        fprintf( out, "%s_sum %.9f\n", name, (double)sumNS / 1e9 );
+        fprintf( out, "%s_count %lu\n", name, count );
+    }
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief note that an operation has finished
+ * @param start   from metricsClock(), when it started
+ * @param result  what it returned. Negative is an error
+ */
+void noteOperation( eOperation op, uint64_t start, long result )
+{
+    tMetricsShard * shard = getShard();
+
+    if ( shard != NULL ) {
+        noteLatency( &shard->operations[ op ], start );
+        if ( result < 0 ) {
+            bump( &shard->errors[ op ], 1 );
+        }
+    }
+}
+
+/**
+ * @param start  from metricsClock(), when whatever's being timed started
+ */
+void noteTimer( eTimer timer, uint64_t start )
+{
+    tMetricsShard * shard = getShard();
+
+    if ( shard != NULL ) {
+        noteLatency( &shard->timers[ timer ], start );
+    }
+}
+
+void countMetric( eCounter counter, uint64_t amount )
+{
+    tMetricsShard * shard = getShard();
+
+    if ( shard != NULL ) {
+        bump( &shard->counters[ counter ], amount );
+    }
+}
+
+/**
+ * @brief add a render (or run) of one template to its totals
+ * @param path    path of the template, relative to the mount
+ * @param start   from metricsClock(), when the render started
+ * @param bytes   how much it produced
+ * @param result  zero if it succeeded, negative errno if not
+ */
+void noteTemplateRender( const char * path, uint64_t start, size_t bytes, int result )
+{
+    uint64_t ns     = metricsClock() - start;
+    size_t   bucket = hashString( path ) & ( kTemplateBuckets - 1 );
+
+    pthread_mutex_lock( &metrics.lock );
+
+    tTemplateMetrics * entry = metrics.templates[ bucket ];
+    while ( entry != NULL && strcmp( entry->path, path ) != 0 ) {
+        entry = entry->next;
+    }
+    if ( entry == NULL && metrics.templateCount < kMaxTemplateMetrics ) {
+        size_t length = strlen( path ) + 1;
+        entry = calloc( 1, sizeof( tTemplateMetrics ) + length );
+        if ( entry != NULL ) {
+            memcpy( entry->path, path, length );
+            entry->next = metrics.templates[ bucket ];
+            metrics.templates[ bucket ] = entry;
+            ++metrics.templateCount;
+        }
+    }
+    if ( entry != NULL ) {
+        ++entry->renders;
+        if ( result != 0 ) {
+            ++entry->failures;
+        }
+        entry->ns    += ns;
+        entry->bytes += bytes;
+    }
+
+    pthread_mutex_unlock( &metrics.lock );
+}
+
+/**
+ * @brief write out everything counted so far, in the Prometheus text format
+ * @param text    receives the text, allocated with malloc()
+ * @param length  receives its length
+ * @return zero if successful, negative errno if not
+ */
+int formatMetrics( char ** text, size_t * length )
+{
+    int    result = 0;
+    FILE * out    = open_memstream( text, length );
+
+    if ( out == NULL ) {
+        result = -errno;
+        errno = 0;
+        return result;
+    }
+
+    pthread_mutex_lock( &metrics.lock );
+
+    fputs( "# HELP templatefs_operation_duration_seconds Time taken by each filesystem operation\n"
+           "# TYPE templatefs_operation_duration_seconds histogram\n", out );
+    for ( unsigned int op = 0; op < kMaxOperation; ++op ) {
+        char label[64];
+        snprintf( label, sizeof( label ), "op=\"%s\"", operationNames[ op ] );
+        writeHistogram( out, "templatefs_operation_duration_seconds", label,
+                        offsetof( tMetricsShard, operations ) + op * sizeof( tHistogram ) );
+    }
+
+    fputs( "# HELP templatefs_operation_errors_total Filesystem operations that returned an error\n"
+           "# TYPE templatefs_operation_errors_total counter\n", out );
+    for ( unsigned int op = 0; op < kMaxOperation; ++op ) {
+        uint64_t errors = 0;
+        for ( const tMetricsShard * shard = metrics.shards; shard != NULL; shard = shard->next ) {
+            errors += peek( &shard->errors[ op ] );
+        }
+        fprintf( out, "templatefs_operation_errors_total{op=\"%s\"} %lu\n", operationNames[ op ], errors );
+    }
+
+    for ( unsigned int timer = 0; timer < kMaxTimer; ++timer ) {
+        fprintf( out, "# HELP %s %s\n# TYPE %s histogram\n",
+                 timerNames[ timer ].name, timerNames[ timer ].help, timerNames[ timer ].name );
+        writeHistogram( out, timerNames[ timer ].name, NULL,
+                        offsetof( tMetricsShard, timers ) + timer * sizeof( tHistogram ) );
+    }
+
+    for ( unsigned int counter = 0; counter < kMaxCounter; ++counter ) {
+        uint64_t total = 0;
+        for ( const tMetricsShard * shard = metrics.shards; shard != NULL; shard = shard->next ) {
+            total += peek( &shard->counters[ counter ] );
+        }
+        fprintf( out, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n",
+                 counterNames[ counter ].name, counterNames[ counter ].help,
+                 counterNames[ counter ].name, counterNames[ counter ].name, total );
+    }
+
+    static const struct {
+        const char * name;
+        const char * help;
+        size_t       offset;
+        bool         seconds;
+    } perTemplate[] = {
+        { "templatefs_template_renders_total",         "Renders (or runs) of each template",       offsetof( tTemplateMetrics, renders ),  false },
+        { "templatefs_template_render_failures_total", "Renders (or runs) of each template that failed", offsetof( tTemplateMetrics, failures ), false },
+        { "templatefs_template_render_seconds_total",  "Time spent rendering (or running) each template", offsetof( tTemplateMetrics, ns ), true },
+        { "templatefs_template_rendered_bytes_total",  "Output produced by each template",         offsetof( tTemplateMetrics, bytes ),    false }
+    };
+    for ( size_t i = 0; i < sizeof( perTemplate ) / sizeof( perTemplate[0] ); ++i ) {
+        fprintf( out, "# HELP %s %s\n# TYPE %s counter\n", perTemplate[ i ].name, perTemplate[ i ].help, perTemplate[ i ].name );
+        for ( size_t bucket = 0; bucket < kTemplateBuckets; ++bucket ) {
+            for ( const tTemplateMetrics * entry = metrics.templates[ bucket ]; entry != NULL; entry = entry->next ) {
+                uint64_t value = *(const uint64_t *)( (const char *)entry + perTemplate[ i ].offset );
+
+                fprintf( out, "%s{template=\"", perTemplate[ i ].name );
+                writeLabel( out, entry->path );
+                if ( perTemplate[ i ].seconds ) {
+                    fprintf( out, "\"} %.9f\n", (double)value / 1e9 );
+                } else {
+                    fprintf( out, "\"} %lu\n", value );
+                }
+            }
+        }
+    }
+
+    pthread_mutex_unlock( &metrics.lock );
+
+    if ( ferror( out ) ) {
+        result = -ENOMEM;
+    }
+    if ( fclose( out ) != 0 && result == 0 ) {
+        result = -ENOMEM;
+    }
+    if ( result != 0 ) {
+        free( *text );
+        *text = NULL;
+    }
+    return result;
+}
@@ -0,0 +1,128 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_METRICS_H
+#define TEMPLATEFS_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define kStatsDir             "/.templatefs"
+#define kStatsPath            "/.templatefs/stats"
+
+#define kLatencyBuckets       24      // upper bounds from 1µs, doubling to ~8.4s. Anything slower only counts for +Inf
+#define kMaxTemplateMetrics   1024    // templates tracked individually. Any more only count towards the totals
+
+/**
+ * @brief each filesystem operation, as named in the stats
+ */
+typedef enum {
+    kOpGetattr,
+    kOpAccess,
+    kOpReadlink,
+    kOpOpendir,
+    kOpReaddir,
+    kOpReleasedir,
+    kOpMknod,
+    kOpMkdir,
+    kOpSymlink,
+    kOpUnlink,
+    kOpRmdir,
+    kOpRename,
+    kOpLink,
+    kOpChmod,
+    kOpChown,
+    kOpTruncate,
+    kOpUtimens,
+    kOpCreate,
+    kOpOpen,
+    kOpRead,
+    kOpReadBuf,
+    kOpWrite,
+    kOpWriteBuf,
+    kOpStatfs,
+    kOpFlush,
+    kOpRelease,
+    kOpFsync,
+    kOpFallocate,
+    kOpSetxattr,
+    kOpGetxattr,
+    kOpListxattr,
+    kOpRemovexattr,
+    kOpLock,
+    kOpFlock,
+    kOpCopyFileRange,
+    kOpLseek,
+    kOpLookup,              ///< only in lowlevel mode, where paths are looked up a name at a time
+    kOpSetattr,             ///< lowlevel mode's chmod, chown, truncate and utimens, all in one
+    kMaxOperation
+} eOperation;
+
+/**
+ * @brief everything else that's timed
+ */
+typedef enum {
+    kTimerRender,           ///< rendering a template against the configuration
+    kTimerExecute,          ///< running an executable template
+    kTimerConfigLoad,       ///< refreshing the configuration from Elektra
+    kMaxTimer
+} eTimer;
+
+typedef enum {
+    kCountRenderedBytes,
+    kCountExecutedBytes,
+    kCountExecTimeouts,
+    kCountRenderCacheHits,
+    kCountRenderCacheMisses,
+    kCountRenderCacheEvictions,
+    kCountOutputCacheHits,
+    kCountOutputCacheMisses,
+    kMaxCounter
+} eCounter;
+
+/**
+ * @return a timestamp to pass to noteOperation() or noteTimer(), in ns
+ */
+static inline uint64_t metricsClock( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static inline bool isStatsDir( const char * path )
+{
+    return ( strcmp( path, kStatsDir ) == 0 );
+}
+
+static inline bool isStatsFile( const char * path )
+{
+    return ( strcmp( path, kStatsPath ) == 0 );
+}
+
+/**
+ * @brief define 'name'Metered(), which calls 'name' and notes how long it took as 'op'
+ * @param params  the parameter list, with its parentheses
+ * @param args    the parameter names, with their parentheses
+ */
+#define METERED( op, type, name, params, args )      \
+    static type name##Metered params                 \
+    {                                                \
+        uint64_t start  = metricsClock();            \
+        type     result = name args;                 \
+        noteOperation( op, start, result );          \
+        return result;                               \
+    }
+
+void noteOperation( eOperation op, uint64_t start, long result );
+void noteTimer( eTimer timer, uint64_t start );
+void countMetric( eCounter counter, uint64_t amount );
+void noteTemplateRender( const char * path, uint64_t start, size_t bytes, int result );
+
+int  formatMetrics( char ** text, size_t * length );
+
+#endif //TEMPLATEFS_METRICS_H
@@ -0,0 +1,400 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* Executable templates are normally run on every open. One whose settings
+ * give it a 'ttl' has its output reused until the ttl expires, or until the
+ * template, any of its declared 'inputs', or the value of any of its
+ * declared libelektra 'keys' changes, whichever comes first.
+ *
+ * Separately, with '-o servestale', the last good output of each one is
+ * kept regardless of its ttl, to fall back on if a later run times out.
+ *
+ * There are only ever a handful of executable templates, so the entries are
+ * kept in simple lists. */
+
+#include "common.h"
+#include "outputCache.h"
+#include "logStuff.h"
+
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * @brief enough of a file's status to tell whether it has changed
+ */
+typedef struct {
+    int              err;       ///< errno from stat'ing it, zero if it exists
+    dev_t            dev;
+    ino_t            ino;
+    struct timespec  mtime;
+    off_t            size;
+} tInputStamp;
+
+/**
+ * @brief the cached output of one executable template
+ */
+struct sOutputEntry {
+    struct sOutputEntry * next;
+    char *                path;         ///< path of the template, relative to the mount
+    tRendered *           output;       ///< holds a reference
+    dev_t                 dev;          ///< identity of the template when it was run
+    ino_t                 ino;
+    struct timespec       mtime;
+    struct timespec       expires;      ///< when the ttl runs out (CLOCK_MONOTONIC)
+    unsigned long         generation;   ///< configuration generation that 'keysHash' was checked against
+    uint64_t              keysHash;     ///< hash of the values of the declared keys
+    size_t                inputCount;
+    tInputStamp           inputs[];     ///< one for each declared input, in order
+};
+
+/**
+ * @brief the last good output of one executable template
+ */
+typedef struct sLastGood {
+    struct sLastGood * next;
+    char *             path;
+    tRendered *        output;      ///< holds a reference
+} tLastGood;
+
+static pthread_mutex_t outputLock  = PTHREAD_MUTEX_INITIALIZER;
+static tOutputEntry *  outputCache = NULL;
+static tLastGood *     lastGood    = NULL;
+
+// ------------------------------------------------------------------------------
+
+static inline bool sameTimespec( const struct timespec * a, const struct timespec * b )
+{
+    return ( a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec );
+}
+
+static size_t countList( char * const list[] )
+{
+    size_t count = 0;
+    while ( list[ count ] != NULL ) {
+        ++count;
+    }
+    return count;
+}
+
+/**
+ * @brief stat a declared input. Inputs underneath the mount are looked up
+ * in the directory it hides, as going through the mount would come back to us
+ */
+static void stampInput( const char * input, const tInputRoot * root, tInputStamp * stamp )
+{
+    struct stat st;
+    size_t      len = strlen( root->mountPath );
+    int         err;
+
+    if ( strncmp( input, root->mountPath, len ) == 0 && input[ len ] == '/' ) {
+        err = fstatat( root->mountFD, &input[ len + 1 ], &st, 0 );
+    } else if ( strcmp( input, root->mountPath ) == 0 ) {
+        err = fstat( root->mountFD, &st );
+    } else {
+        err = stat( input, &st );
+    }
+
+    memset( stamp, 0, sizeof( tInputStamp ) );
+    if ( err != 0 ) {
+        stamp->err = errno;
+        errno = 0;
+    } else {
+        stamp->dev   = st.st_dev;
+        stamp->ino   = st.st_ino;
+        stamp->mtime = st.st_mtim;
+        stamp->size  = st.st_size;
+    }
+}
+
+static bool sameStamp( const tInputStamp * a, const tInputStamp * b )
+{
+    return ( a->err == b->err
+          && a->dev == b->dev
+          && a->ino == b->ino
+          && a->size == b->size
+          && sameTimespec( &a->mtime, &b->mtime ) );
+}
+
+/**
+ * @brief is a cached output still good? Caller must hold the lock
+ */
+static bool isValid( tOutputEntry * entry,
+                     const struct stat * st,
+                     const tTemplateSettings * settings,
+                     tConfigSnapshot * config,
+                     const tInputRoot * root )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    if ( entry->dev != st->st_dev || entry->ino != st->st_ino || !sameTimespec( &entry->mtime, &st->st_mtim ) ) {
+        return false;
+    }
+    if ( now.tv_sec > entry->expires.tv_sec
+      || ( now.tv_sec == entry->expires.tv_sec && now.tv_nsec >= entry->expires.tv_nsec ) ) {
+        return false;
+    }
+
+    if ( entry->inputCount != countList( settings->inputs ) ) {
+        return false;
+    }
+    for ( size_t i = 0; i < entry->inputCount; ++i ) {
+        tInputStamp stamp;
+        stampInput( settings->inputs[ i ], root, &stamp );
+        if ( !sameStamp( &stamp, &entry->inputs[ i ] ) ) {
+            return false;
+        }
+    }
+
+    if ( settings->keys[0] != NULL ) {
+        if ( config == NULL ) {
+            return false;
+        }
+        /* only worth re-hashing if the configuration has changed at all */
+        if ( config->generation != entry->generation ) {
+            if ( hashConfigValues( config, settings->keys ) != entry->keysHash ) {
+                return false;
+            }
+            entry->generation = config->generation;
+        }
+    }
+
+    return true;
+}
+
+static void freeEntry( tOutputEntry * entry )
+{
+    releaseRendered( entry->output );
+    free( entry->path );
+    free( entry );
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief look for reusable output from an executable template
+ * @param path      path of the template, relative to the mount
+ * @param st        the current status of the template file
+ * @param settings  the template's settings
+ * @param config    the current configuration, or NULL if there is none
+ * @param root      where to find inputs underneath the mount
+ * @return a new reference to the output, or NULL if there's nothing reusable
+ */
+tRendered * lookupOutput( const char * path,
+                          const struct stat * st,
+                          const tTemplateSettings * settings,
+                          tConfigSnapshot * config,
+                          const tInputRoot * root )
+{
+    tRendered * result = NULL;
+
+    if ( settings->ttl == 0 ) {
+        return NULL;
+    }
+
+    pthread_mutex_lock( &outputLock );
+
+    tOutputEntry ** link = &outputCache;
+    while ( *link != NULL && strcmp( (*link)->path, path ) != 0 ) {
+        link = &(*link)->next;
+    }
+
+    tOutputEntry * entry = *link;
+    if ( entry != NULL ) {
+        if ( isValid( entry, st, settings, config, root ) ) {
+            result = retainRendered( entry->output );
+        } else {
+            logDebug( "cached output of \'%s\' is stale", path );
+            *link = entry->next;
+            freeEntry( entry );
+        }
+    }
+
+    pthread_mutex_unlock( &outputLock );
+
+    return result;
+}
+
+/**
+ * @brief record the state of an executable template's dependencies before it's run,
+ * so a change while it's running isn't mistaken for what it saw
+ * @param path      path of the template, relative to the mount
+ * @param st        the status of the template file about to be run
+ * @param settings  the template's settings
+ * @param config    the configuration it will run with, or NULL if there is none
+ * @param root      where to find inputs underneath the mount
+ * @return an entry to pass to storeOutput(), or NULL if its output isn't to be cached
+ */
+tOutputEntry * prepareOutput( const char * path,
+                              const struct stat * st,
+                              const tTemplateSettings * settings,
+                              tConfigSnapshot * config,
+                              const tInputRoot * root )
+{
+    if ( settings->ttl == 0 || ( settings->keys[0] != NULL && config == NULL ) ) {
+        return NULL;
+    }
+
+    size_t         inputCount = countList( settings->inputs );
+    tOutputEntry * entry      = calloc( 1, sizeof( tOutputEntry ) + inputCount * sizeof( tInputStamp ) );
+    if ( entry == NULL ) {
+        return NULL;
+    }
+
+    entry->path = strdup( path );
+    if ( entry->path == NULL ) {
+        free( entry );
+        return NULL;
+    }
+    entry->dev    = st->st_dev;
+    entry->ino    = st->st_ino;
+    entry->mtime  = st->st_mtim;
+
+    /* the ttl runs from when it was started */
+    clock_gettime( CLOCK_MONOTONIC, &entry->expires );
+    entry->expires.tv_sec += settings->ttl;
+
+    entry->inputCount = inputCount;
+    for ( size_t i = 0; i < inputCount; ++i ) {
+        stampInput( settings->inputs[ i ], root, &entry->inputs[ i ] );
+    }
+    if ( settings->keys[0] != NULL ) {
+        entry->generation = config->generation;
+        entry->keysHash   = hashConfigValues( config, settings->keys );
+    }
+
+    return entry;
+}
+
+/**
+ * @brief remember the output of an executable template
+ * @param entry   from prepareOutput(), before it was run. May be NULL
+ * @param output  the output, or NULL if it failed. The cache takes its own reference
+ */
+void storeOutput( tOutputEntry * entry, tRendered * output )
+{
+    if ( entry == NULL ) {
+        return;
+    }
+    if ( output == NULL ) {
+        freeEntry( entry );
+        return;
+    }
+
+    entry->output = retainRendered( output );
+    const char * path = entry->path;
+
+    pthread_mutex_lock( &outputLock );
+
+    /* replace any previous output */
+    tOutputEntry ** link = &outputCache;
+    while ( *link != NULL && strcmp( (*link)->path, path ) != 0 ) {
+        link = &(*link)->next;
+    }
+    if ( *link != NULL ) {
+        tOutputEntry * previous = *link;
+        *link = previous->next;
+        freeEntry( previous );
+    }
+    entry->next = outputCache;
+    outputCache = entry;
+
+    pthread_mutex_unlock( &outputLock );
+}
+
+/**
+ * @brief discard the cached output of an executable template
+ */
+void forgetOutput( const char * path )
+{
+    pthread_mutex_lock( &outputLock );
+
+    tOutputEntry ** link = &outputCache;
+    while ( *link != NULL && strcmp( (*link)->path, path ) != 0 ) {
+        link = &(*link)->next;
+    }
+    if ( *link != NULL ) {
+        tOutputEntry * entry = *link;
+        *link = entry->next;
+        freeEntry( entry );
+    }
+
+    pthread_mutex_unlock( &outputLock );
+}
+
+static tLastGood ** findLastGood( const char * path )
+{
+    tLastGood ** link = &lastGood;
+    while ( *link != NULL && strcmp( (*link)->path, path ) != 0 ) {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+/**
+ * @brief remember an executable template's output, to serve if a later run times out
+ * @param output  the output. The cache takes its own reference
+ */
+void storeLastGood( const char * path, tRendered * output )
+{
+    pthread_mutex_lock( &outputLock );
+
+    tLastGood ** link = findLastGood( path );
+    if ( *link != NULL ) {
+        releaseRendered( (*link)->output );
+        (*link)->output = retainRendered( output );
+    } else {
+        tLastGood * entry = calloc( 1, sizeof( tLastGood ) );
+        if ( entry != NULL ) {
+            entry->path = strdup( path );
+            if ( entry->path == NULL ) {
+                free( entry );
+            } else {
+                entry->output = retainRendered( output );
+                entry->next   = lastGood;
+                lastGood      = entry;
+            }
+        }
+    }
+
+    pthread_mutex_unlock( &outputLock );
+}
+
+/**
+ * @return a new reference to the last good output of an executable template, or NULL
+ */
+tRendered * lookupLastGood( const char * path )
+{
+    tRendered * result = NULL;
+
+    pthread_mutex_lock( &outputLock );
+
+    tLastGood ** link = findLastGood( path );
+    if ( *link != NULL ) {
+        result = retainRendered( (*link)->output );
+    }
+
+    pthread_mutex_unlock( &outputLock );
+
+    return result;
+}
+
+/**
+ * @brief discard the last good output of an executable template, e.g. because it was deleted
+ */
+void forgetLastGood( const char * path )
+{
+    pthread_mutex_lock( &outputLock );
+
+    tLastGood ** link = findLastGood( path );
+    if ( *link != NULL ) {
+        tLastGood * entry = *link;
+        *link = entry->next;
+        releaseRendered( entry->output );
+        free( entry->path );
+        free( entry );
+    }
+
+    pthread_mutex_unlock( &outputLock );
+}
@@ -0,0 +1,40 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_OUTPUTCACHE_H
+#define TEMPLATEFS_OUTPUTCACHE_H
+
+#include "configStore.h"
+#include "renderCache.h"
+#include "templateSettings.h"
+
+/**
+ * @brief where to find the files an executable's output declares it depends on
+ */
+typedef struct {
+    const char * mountPath;   ///< absolute path of the mount
+    int          mountFD;     ///< descriptor of the directory underneath the mount
+} tInputRoot;
+
+typedef struct sOutputEntry tOutputEntry;
+
+tRendered * lookupOutput( const char * path,
+                          const struct stat * st,
+                          const tTemplateSettings * settings,
+                          tConfigSnapshot * config,
+                          const tInputRoot * root );
+
+tOutputEntry * prepareOutput( const char * path,
+                              const struct stat * st,
+                              const tTemplateSettings * settings,
+                              tConfigSnapshot * config,
+                              const tInputRoot * root );
+void        storeOutput( tOutputEntry * entry, tRendered * output );
+void        forgetOutput( const char * path );
+
+void        storeLastGood( const char * path, tRendered * output );
+tRendered * lookupLastGood( const char * path );
+void        forgetLastGood( const char * path );
+
+#endif //TEMPLATEFS_OUTPUTCACHE_H
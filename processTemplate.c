@@ -7,9 +7,16 @@
 
 #include "common.h"
 #include "templatefs.h"
+#include "arena.h"
+#include "arrayIndex.h"
+#include "compiledTemplate.h"
+#include "configStore.h"
+#include "dependencies.h"
+#include "keyMemo.h"
 #include "processTemplate.h"
 #include "logStuff.h"
 
+#include <pthread.h>
 #include <sys/mman.h>
 
 #include <mustach/mustach-wrap.h>
@@ -40,17 +47,80 @@ typedef struct sSection {
     int                 depth;
     bool                isArray;
     elektraCursor       cursor;
+    const tArrayElements * elements;    // the array's elements, if it was indexed
+    size_t              element;        // index of the next of them
 } tSection;
 
 typedef struct {
-    KDB *       kdb;
-    KeySet *    keySet;
-    Key *       parent;
+    KeySet *    keySet;     ///< private to this render, see checkoutConfigView()
+    Key *       root;       ///< relative names at the top level are below this key
+    tArena *    arena;      ///< sections and formatted values, released in elektraStop()
+    tKeyMemo *  memo;       ///< tags already resolved against 'keySet'. May be NULL
+    const tArrayIndex * arrays;  ///< the elements of each array in 'keySet'. May be NULL
+    tDependencyRecorder * recorder;   ///< the keys read so far. NULL if they're not wanted
+    tDependencies *     dependencies; ///< what 'recorder' recorded, once the render stops
 
     tSection *  stack;
+    tSection *  spare;      ///< popped sections, to be reused by the next push
 
 } tMustachContext;
 
+/* the most text a binary value can be formatted as */
+#define kMaxNumberText  24
+
+/* Note: keys in the KeySet must not be keyDup()'d, as that shares (and
+ * updates the reference counts of) their internals with the copy. Make a
+ * new key with the same name instead, then look it up if it's needed. */
+static inline Key * copySelection( const Key * key )
+{
+    return ( key != NULL ) ? keyNew( keyName( key ), KEY_END ) : NULL;
+}
+
+/* A key that's in the KeySet can be shared rather than copied, as long as
+ * it's never modified: the KeySet outlives the render, and keyDel() is a
+ * no-op for it. Only free-standing keys need a copy of their own. */
+static inline Key * shareSelection( Key * key )
+{
+    return ( key != NULL && keyGetRef( key ) > 0 ) ? key : copySelection( key );
+}
+
+/* what names are relative to in the key memo, when it's not a Key */
+static const char kRootParent     = 'r';    ///< appended to the root
+static const char kAbsoluteParent = 'a';    ///< not relative to anything
+
+static pthread_once_t arenaOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t  arenaKey;
+
+static void dropArena( void * arena )
+{
+    freeArena( arena );
+    free( arena );
+}
+
+static void makeArenaKey( void )
+{
+    pthread_key_create( &arenaKey, dropArena );
+}
+
+/**
+ * @brief the calling thread's render arena. Kept from one render to the
+ * next, so its chunks are rarely allocated
+ * @return the arena, or NULL if there isn't enough memory
+ */
+static tArena * threadArena( void )
+{
+    pthread_once( &arenaOnce, makeArenaKey );
+
+    tArena * result = pthread_getspecific( arenaKey );
+    if ( result == NULL ) {
+        result = calloc( 1, sizeof( tArena ) );
+        if ( result != NULL ) {
+            pthread_setspecific( arenaKey, result );
+        }
+    }
+    return result;
+}
+
 /* The 'stack' is important to preserve the outer array state when arrays are nested */
 /**
  * @brief
@@ -63,24 +133,33 @@ int sectionPush( tMustachContext * context, int objiter )
     logEntry( "%p,%d", context, objiter );
     int result = 0;
 
-    tSection * section = calloc( 1, sizeof(tSection) );
     if ( context != NULL ) {
+        /* reuse a popped section if there is one, rather than allocate */
+        tSection * section = context->spare;
+        if ( section != NULL ) {
+            context->spare = section->next;
+        } else {
+            section = arenaAlloc( context->arena, sizeof( tSection ) );
+        }
         if ( section == NULL ) {
             result = -ENOMEM;
         } else {
+            memset( section, 0, sizeof( tSection ) );
             section->depth = objiter;
 
             /* if there is another level below this one in the
              * stack, copy its contents up to the new one. */
             tSection * topOfStack = context->stack;
             if ( topOfStack != NULL ) {
-                section->arraySelection = keyDup( topOfStack->arraySelection, KEY_CP_ALL );
-                section->selection      = keyDup( topOfStack->selection, KEY_CP_ALL );
+                section->arraySelection = shareSelection( topOfStack->arraySelection );
+                section->selection      = shareSelection( topOfStack->selection );
                 section->isArray        = topOfStack->isArray;
                 section->cursor         = topOfStack->cursor;
+                section->elements       = topOfStack->elements;
+                section->element        = topOfStack->element;
             } else {
                 /* first entry in the stack, so initialize some fields */
-                section->selection = keyNew( "system:/config", KEY_END );
+                section->selection = copySelection( context->root );
                 section->isArray   = false;
             }
 
@@ -113,8 +192,10 @@ int sectionPop( tMustachContext * context )
             if ( section->arraySelection ) {
                 keyDel( section->arraySelection );
             }
-            /* release the section itself */
-            free( section );
+            /* keep the section itself for the next push. Its memory
+             * belongs to the arena */
+            section->next  = context->spare;
+            context->spare = section;
         }
     }
 
@@ -155,8 +236,18 @@ void elektraStop( void * closure, int status )
     logEntry( "%d", status );
 
     if ( closure != NULL ) {
+        tMustachContext * context = (tMustachContext *) closure;
+
         /* dispose of the entry at the top of the stack */
-        sectionPop( (tMustachContext * )closure );
+        sectionPop( context );
+
+        /* copy out what the render read, before the arena it's in is reset */
+        context->dependencies = finishDependencies( context->recorder );
+        context->recorder     = NULL;
+
+        /* which leaves nothing in the arena that's still needed */
+        context->spare = NULL;
+        resetArena( context->arena );
     }
 }
 
@@ -197,7 +288,18 @@ int selectNextArrayKey( tSection * section, KeySet * keySet )
 {
     int result = 0;
 
-    if ( section != NULL && section->isArray ) {
+    if ( section != NULL && section->isArray && section->elements != NULL ) {
+        /* indexed, so it's just the next one */
+        if ( section->element < section->elements->count ) {
+            section->cursor = section->elements->elements[ section->element++ ];
+
+            keyDel( section->selection );
+            section->selection = ksAtCursor( keySet, section->cursor );
+            result = 1;
+
+            logDebug( "next key in array is \'%s\'", keyName( section->selection ) );
+        }
+    } else if ( section != NULL && section->isArray ) {
         Key * key = NULL;
         do {
             ++section->cursor;
@@ -218,6 +320,8 @@ int selectNextArrayKey( tSection * section, KeySet * keySet )
         } while ( result == 0 );
 
         if ( result == 1 && key != NULL ) {
+            /* Note: keyDel() is a no-op for keys that are in the KeySet */
+            keyDel( section->selection );
             section->selection = key;
 
             logDebug( "next key in array is \'%s\'", keyName( key ) );
@@ -228,7 +332,85 @@ int selectNextArrayKey( tSection * section, KeySet * keySet )
 }
 
 /**
- * @brief update all the key-related fields in the section.
+ * @brief swap the key we built for the one in the KeySet, or NULL if there isn't one
+ */
+static void lookupSelection( tMustachContext * context, tSection * section )
+{
+    Key * lookup = section->selection;
+
+    if ( lookup != NULL ) {
+        section->selection = ksLookup( context->keySet, lookup, KDB_O_NONE );
+        if ( section->selection != lookup ) {
+            keyDel( lookup );
+        }
+    }
+}
+
+/**
+ * @brief what a name in a tag is relative to, as far as the key memo is concerned
+ * @param parent  the section the name is appended to the selection of, or NULL for the root
+ * @return the parent's identity, or NULL if what it resolves to can't be remembered
+ */
+static const void * memoParent( tSection * parent )
+{
+    const void * result = &kRootParent;
+
+    if ( parent != NULL ) {
+        /* only a key in the KeySet lives, and means the same thing, from one render to the next */
+        result = ( parent->selection != NULL && keyGetRef( parent->selection ) > 0 ) ? parent->selection : NULL;
+    }
+    return result;
+}
+
+/**
+ * @brief record that the render read (or tried to read) the key 'name',
+ * unless it's an element of an array that has already been recorded
+ */
+static void noteDependency( tMustachContext * context, const char * name, bool prefix )
+{
+    if ( context->recorder == NULL || name == NULL ) {
+        return;
+    }
+
+    bool covered = false;
+    for ( tSection * section = context->stack; section != NULL && !covered; section = section->next ) {
+        if ( section->isArray && section->arraySelection != NULL ) {
+            const char * array  = keyName( section->arraySelection );
+            size_t       length = strlen( array );
+            covered = ( strncmp( name, array, length ) == 0 && name[ length ] == '/' );
+        }
+    }
+    if ( !covered ) {
+        recordDependency( context->recorder, name, prefix );
+    }
+}
+
+/**
+ * @brief look the selection we built up in the KeySet, and remember what it resolved to
+ * @param relative  what 'name' was relative to, see memoParent()
+ * @param name      the name in the tag
+ */
+static void resolveSelection( tMustachContext * context, tSection * section, const void * relative, const char * name )
+{
+    /* the built key is freed if it's not in the KeySet, so keep its name */
+    const char * fullName = NULL;
+    if ( section->selection != NULL ) {
+        size_t length = strlen( keyName( section->selection ) ) + 1;
+        char * copy   = arenaAlloc( context->arena, length );
+        if ( copy != NULL ) {
+            memcpy( copy, keyName( section->selection ), length );
+            fullName = copy;
+        }
+    }
+
+    lookupSelection( context, section );
+    memoizeKey( context->memo, relative, name, section->selection, fullName );
+    noteDependency( context, fullName, false );
+}
+
+/**
+ * @brief update all the key-related fields in the section, once its
+ * selection has been looked up in the KeySet (see lookupSelection()).
  * Also selects the first child key if the key represents an array.
  * @param context
  * @param section
@@ -238,12 +420,17 @@ int updateSelection( tMustachContext * context, tSection * section )
 {
     int result = 0;
 
-    logDebug( "selecting %s", keyName( section->selection ) );
     if ( context != NULL ) {
-        section->selection = ksLookup( context->keySet,
-                                       section->selection,
-                                       KDB_O_NONE );
+        /* forget any array this section was previously moving through */
+        if ( section->arraySelection != NULL ) {
+            keyDel( section->arraySelection );
+            section->arraySelection = NULL;
+        }
+        section->isArray  = false;
+        section->elements = NULL;
+
         if ( section->selection != NULL ) {
+            logDebug( "selecting %s", keyName( section->selection ) );
             result = 1;
 
             const Key * metaArray = keyGetMeta( section->selection, "array" );
@@ -251,9 +438,14 @@ int updateSelection( tMustachContext * context, tSection * section )
             if (section->isArray) {
                 /* remember the base key of the array. section->selection
                  * will move through the direct children of this key */
-                section->arraySelection = keyDup( section->selection, KEY_CP_ALL );
+                section->arraySelection = shareSelection( section->selection );
+                /* any change to its elements changes what's rendered */
+                noteDependency( context, keyName( section->arraySelection ), true );
+                section->elements = findArrayElements( context->arrays, section->arraySelection );
+                section->element  = 0;
                 /* Select the first item - find the electraCursor value or the base key */
-                section->cursor = ksSearch( context->keySet, section->arraySelection );
+                section->cursor = ( section->elements != NULL ) ? 0
+                                : ksSearch( context->keySet, section->arraySelection );
                 if ( section->cursor < 0 ) {
                     logError( "failed to locate the selection");
                     section->cursor = 0;
@@ -285,7 +477,22 @@ int elektraSel( void * closure, const char * name )
 
     int result = 0;
 
-    if ( closure != NULL ) {
+    if ( closure != NULL && name == NULL ) {
+        /* NULL selects the current item */
+        tMustachContext * context = (tMustachContext *) closure;
+        tSection        * section = context->stack;
+
+        if ( section != NULL && section->selection != NULL ) {
+            Key * found = ksLookup( context->keySet, section->selection, KDB_O_NONE );
+            if ( found != NULL ) {
+                if ( found != section->selection ) {
+                    keyDel( section->selection );
+                    section->selection = found;
+                }
+                result = 1;
+            }
+        }
+    } else if ( closure != NULL ) {
         tMustachContext * context = (tMustachContext *) closure;
         tSection        * section = context->stack;
 
@@ -304,30 +511,50 @@ int elektraSel( void * closure, const char * name )
         if ( append ) {
             /* refresh the selected key with the parent's selection
              * This is important when appending to array index keys */
-            tSection * parent = section->next;
-
-            /* if there's another level above on the stack, append to that */
-            if ( parent != NULL ) {
-                /* recover any resources used by the current selection key */
-                if ( section->selection != NULL ) {
-                    keyDel( section->selection );
-                }
-                section->selection = keyDup( parent->selection, KEY_CP_ALL );
-            }
-
-            result = (int) keyAddBaseName( section->selection, name );
-            if ( result >= 0 ) {
+            tSection *   parent   = section->next;
+            const void * relative = memoParent( parent );
+            Key *        found;
+            const char * fullName;
+
+            /* recover any resources used by the current selection key */
+            keyDel( section->selection );
+
+            if ( recallKey( context->memo, relative, name, &found, &fullName ) ) {
+                /* resolved by an earlier tag, so there's no need to search the KeySet */
+                section->selection = found;
+                noteDependency( context, fullName, false );
                 result = updateSelection( context, section );
             } else {
-                logError( "keyAddBaseName %s to %s failed",
-                          name, keyName(section->selection) );
-                result = 0;
+                /* if there's another level above on the stack, append to that,
+                 * otherwise append to the root. Either way, to a copy: the
+                 * keys in the KeySet itself must never be modified */
+                section->selection = copySelection( ( parent != NULL ) ? parent->selection
+                                                                       : context->root );
+                if ( section->selection == NULL ) {
+                    result = -1;
+                } else {
+                    result = (int) keyAddBaseName( section->selection, name );
+                }
+                if ( result >= 0 ) {
+                    resolveSelection( context, section, relative, name );
+                    result = updateSelection( context, section );
+                } else {
+                    logDebug( "can't append \'%s\' to the current selection", name );
+                    result = 0;
+                }
             }
         } else {
-            if ( section->selection != NULL ) {
-                keyDel( section->selection );
+            Key *        found;
+            const char * fullName;
+
+            keyDel( section->selection );
+            if ( recallKey( context->memo, &kAbsoluteParent, name, &found, &fullName ) ) {
+                section->selection = found;
+                noteDependency( context, fullName, false );
+            } else {
+                section->selection = keyNew( name, KEY_END );
+                resolveSelection( context, section, &kAbsoluteParent, name );
             }
-            section->selection = keyNew( name, KEY_END );
             result = updateSelection( context, section );
         }
     }
@@ -414,26 +641,28 @@ int elektraGet( void * closure, struct mustach_sbuf * sbuf, int type )
             if ( type == 0 ) {
                 /* return the value of the type */
                 ssize_t len = keyGetValueSize( section->selection );
-                if ( keyIsBinary( section->selection ) ) {
+                if ( len < 0 ) {
+                    /* no key to get the value of */
+                    result = 0;
+                } else if ( keyIsBinary( section->selection ) ) {
                     union {
                         short  integerValue;
                         long   longValue;
                     } binaryValue;
+                    char * text = arenaAlloc( context->arena, kMaxNumberText );
 
                     keyGetBinary( section->selection,
                                   &binaryValue,
                                   sizeof(binaryValue) );
-                    switch (len) {
+                    if ( text == NULL ) {
+                        result = -ENOMEM;
+                    } else switch (len) {
                     case sizeof(short):
-                        result = asprintf( (char **) &sbuf->value,
-                                           "%d",
-                                           binaryValue.integerValue );
+                        result = snprintf( text, kMaxNumberText, "%d", binaryValue.integerValue );
                         break;
 
                     case sizeof(long):
-                        result = asprintf( (char **) &sbuf->value,
-                                           "%ld",
-                                            binaryValue.longValue );
+                        result = snprintf( text, kMaxNumberText, "%ld", binaryValue.longValue );
                         break;
 
                     default:
@@ -442,30 +671,27 @@ int elektraGet( void * closure, struct mustach_sbuf * sbuf, int type )
                         break;
                     }
                     if ( result >= 0 ) {
+                        /* the arena's, so there's nothing for mustach to free */
+                        sbuf->value  = text;
                         sbuf->length = result;
                         result = 1;
                     }
                 } else {
-                    sbuf->length = len;
-                    sbuf->value  = malloc( len );
-                    if ( sbuf->value != NULL ) {
-                        result = (int) keyGetString( section->selection,
-                                                     (char *) sbuf->value,
-                                                     sbuf->length );
-                    }
+                    /* borrowed straight from the key, which outlives the render.
+                     * Note: the value size includes the NUL terminator, the length doesn't */
+                    sbuf->value  = keyString( section->selection );
+                    sbuf->length = ( len > 0 ) ? len - 1 : 0;
+                    result = 1;
                 }
                 logDebug( "type value: \'%s\', result: %d", sbuf->value, result );
-                if ( result > 0 ) result = 1;
             } else {
-                /* return the name of the type */
-                sbuf->length = keyGetNameSize( section->selection );
-                sbuf->value  = malloc( sbuf->length );
-                if ( sbuf->value != NULL ) {
-                    result = (int) keyGetName( section->selection,
-                                               (char *)sbuf->value,
-                                               sbuf->length );
-                    logDebug( "type name: \'%s\', result: %d", sbuf->value, result );
-                    if (result > 0) result = 1;
+                /* return the name of the type, borrowed from the key */
+                ssize_t len = keyGetNameSize( section->selection );
+                if ( len > 0 ) {
+                    sbuf->value  = keyName( section->selection );
+                    sbuf->length = len - 1;
+                    logDebug( "type name: \'%s\'", sbuf->value );
+                    result = 1;
                 }
             }
         }
@@ -538,53 +764,127 @@ struct mustach_wrap_itf elektraMustachItf = {
     .leave   = elektraLeave
 };
 
-void cleanupElektra( tMustachContext * context )
+/**
+ * @brief passes what a render writes on to a tOutputSink, as a mustach_write_cb_t
+ */
+typedef struct {
+    tOutputSink  sink;
+    void *       context;
+    int          status;    ///< the sink's error, once it has failed
+} tSinkWriter;
+
+static int writeToSink( void * closure, const char * buffer, size_t size )
 {
-    if (context != NULL ){
-        if ( context->keySet != NULL ) {
-            ksDel( context->keySet );
-        }
-        if ( context->kdb != NULL ) {
-            kdbClose( context->kdb, NULL );
-        }
-    }
+    tSinkWriter * writer = closure;
+
+    writer->status = writer->sink( writer->context, (const byte *) buffer, size );
+    return ( writer->status == 0 ) ? MUSTACH_OK : MUSTACH_ERROR_SYSTEM;
 }
 
 /**
- * @brief prep libelektra for retrieval
- * @param context
- * @return zero if everything worked, negative if an error occurred
+ * @brief render a template, either into a buffer, or through 'writer' (see processTemplate())
  */
-int initElektra( tMustachContext * context )
+static int expandTemplate( int fd,
+                           tConfigSnapshot * config,
+                           byte ** buffer,
+                           size_t * size,
+                           tSinkWriter * writer,
+                           tDependencies ** dependencies )
 {
-    int result = -EINVAL;
-
-    if ( context != NULL ) {
-        char * keyName = strdup( "system:/config" );
+    int result = -ENOMEM;
 
-        context->parent = keyNew(keyName, KEY_END);
-        context->kdb    = kdbOpen( NULL, context->parent );
-        logDebug( "kdb = %p for \'%s\'", context->kdb, keyName );
+    if ( config == NULL ) {
+        logError( "no configuration available to render with" );
+        return -EFAULT;
+    }
 
-        if ( context->kdb == NULL ) {
-            logError( "unable to open libelektra" );
-            result = -EFAULT;
+    tMustachContext * context = calloc( 1, sizeof( tMustachContext ));
+    if ( context != NULL ) {
+        struct stat st;
+        context->arena = threadArena();
+        result = fstat( fd, &st );
+        if ( context->arena == NULL ) {
+            result = -ENOMEM;
+        } else if ( result == -1 ) {
+            result = -errno;
         } else {
-            context->keySet = ksNew( 0, KS_END );
-            if ( context->keySet == NULL ) {
-                logError( "failed to create a KeySet" );
-                result = -EADDRNOTAVAIL;
+            tConfigView * view = checkoutConfigView( config );
+            if ( view == NULL ) {
+                result = -ENOMEM;
             } else {
-                /* It's necessary to preload the keySet.
-                 * No idea why, but errors occur if we don't. */
-                kdbGet( context->kdb, context->keySet, context->parent );
-                result = 0;
-            }
-        }
+                context->keySet = view->keySet;
+                context->memo   = view->memo;
+                context->arrays = view->arrays;
+                context->root   = keyNew( "system:/config", KEY_END );
+                if ( dependencies != NULL ) {
+                    context->recorder = newDependencyRecorder( context->arena );
+                }
 
-        if ( result < 0 ) {
-            cleanupElektra( context );
+                tCompiledTemplate * compiled = acquireCompiledTemplate( fd, &st );
+                if ( compiled != NULL && compiled->compiled ) {
+                    /* already parsed, so just walk the ops */
+                    if ( writer != NULL ) {
+                        result = writeCompiledTemplate( compiled,
+                                                        &elektraMustachItf,
+                                                        (void *) context,
+                                                        writeToSink,
+                                                        writer );
+                    } else {
+                        result = renderCompiledTemplate( compiled,
+                                                         &elektraMustachItf,
+                                                         (void *) context,
+                                                         buffer,
+                                                         size );
+                    }
+                } else {
+                    /* efficient way to feed the template file into mustache */
+                    void * template = mmap( NULL,
+                                            st.st_size,
+                                            PROT_READ,
+                                            MAP_PRIVATE,
+                                            fd,
+                                            0 );
+
+                    if ( template == MAP_FAILED ) {
+                        result = -errno;
+                    } else if ( writer != NULL ) {
+                        result = mustach_wrap_write( template,
+                                                     st.st_size,
+                                                     &elektraMustachItf,
+                                                     (void *) context,
+                                                     Mustach_With_AllExtensions,
+                                                     writeToSink,
+                                                     writer );
+
+                        munmap( template, st.st_size );
+                    } else {
+                        /* now parse the template to generate the content to cache */
+                        result = mustach_wrap_mem( template,
+                                                   st.st_size,
+                                                   &elektraMustachItf,
+                                                   (void *) context,
+                                                   Mustach_With_AllExtensions,
+                                                   (char **) buffer,
+                                                   size );
+
+                        munmap( template, st.st_size );
+                    }
+                }
+                releaseCompiledTemplate( compiled );
+
+                if ( dependencies != NULL ) {
+                    /* stop hands the recorder's findings over, whether or not it succeeded */
+                    *dependencies = context->dependencies;
+                    if ( result != 0 ) {
+                        freeDependencies( *dependencies );
+                        *dependencies = NULL;
+                    }
+                }
+                keyDel( context->root );
+                checkinConfigView( config, view );
+            }
         }
+        free( context );
     }
     return result;
 }
@@ -604,45 +904,45 @@ int initElektra( tMustachContext * context )
  *
  * Returns 0 in case of success, -1 with errno set in case of system error
  * a other negative value in case of error.
+ *
+ * If 'dependencies' isn't NULL, it receives the keys the render read (see
+ * dependencies.c), or NULL if they couldn't be recorded.
+ *
+ * Nothing here loads the configuration: 'config' may come from a config store,
+ * or from newConfigSnapshot() of a KeySet built in memory (see bench/renderBench.c).
  */
 
-int processTemplate( int fd, byte ** buffer, size_t * size )
+int processTemplate( int fd,
+                     tConfigSnapshot * config,
+                     byte ** buffer,
+                     size_t * size,
+                     tDependencies ** dependencies )
 {
-    int result = -ENOMEM;
+    return expandTemplate( fd, config, buffer, size, NULL, dependencies );
+}
 
-    tMustachContext * context = calloc( 1, sizeof( tMustachContext ));
-    if ( context != NULL ) {
-        struct stat st;
-        result = fstat( fd, &st );
-        if ( result == -1 ) {
-            result = -errno;
-        } else {
-            /* efficient way to feed the template file into mustache */
-            void * template = mmap( NULL,
-                                    st.st_size,
-                                    PROT_READ,
-                                    MAP_PRIVATE,
-                                    fd,
-                                    0 );
-
-            if ( template != NULL ) {
-                if ( initElektra( context ) == 0 ) {
-
-                    /* now parse the template to generate the content to cache */
-                    result = mustach_wrap_mem( template,
-                                               st.st_size,
-                                               &elektraMustachItf,
-                                               (void *) context,
-                                               Mustach_With_AllExtensions,
-                                               (char **) buffer,
-                                               size );
-
-                    cleanupElektra( context );
-                }
-                munmap( template, st.st_size );
-            }
-        }
-        free( context );
+/**
+ * @brief process the template file, handing the output to 'sink' as it's produced
+ *
+ * The same as processTemplate(), except that the output never accumulates
+ * here, so a reader can start on it before the render has finished (see
+ * renderStream.c). mustach_wrap_write() is used, or the compiled template's
+ * equivalent.
+ *
+ * @return zero if successful, the sink's negative errno if it failed, or
+ * another negative value in case of error, as for processTemplate()
+ */
+int streamTemplate( int fd,
+                    tConfigSnapshot * config,
+                    tOutputSink sink,
+                    void * context,
+                    tDependencies ** dependencies )
+{
+    tSinkWriter writer = { sink, context, 0 };
+
+    int result = expandTemplate( fd, config, NULL, NULL, &writer, dependencies );
+    if ( writer.status != 0 ) {
+        result = writer.status;
     }
     return result;
 }
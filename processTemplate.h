@@ -5,6 +5,18 @@
 #ifndef TEMPLATEFS_PROCESSTEMPLATE_H
 #define TEMPLATEFS_PROCESSTEMPLATE_H
 
-int processTemplate( int fd, byte ** buffer, size_t * size );
+#include "configStore.h"
+#include "dependencies.h"
+
+int processTemplate( int fd,
+                     tConfigSnapshot * config,
+                     byte ** buffer,
+                     size_t * size,
+                     tDependencies ** dependencies );
+int streamTemplate( int fd,
+                    tConfigSnapshot * config,
+                    tOutputSink sink,
+                    void * context,
+                    tDependencies ** dependencies );
 
 #endif //TEMPLATEFS_PROCESSTEMPLATE_H
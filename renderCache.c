@@ -0,0 +1,632 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* A process-wide cache of rendered templates, so repeated opens of the same
+ * template share one buffer instead of each re-rendering it. Entries are
+ * keyed on the template's path, and are only valid while the template's
+ * inode and mtime, and the configuration generation, match those recorded
+ * when it was rendered. Total memory is bounded by a budget, with the least
+ * recently used entries evicted first.
+ *
+ * When the configuration changes, an entry that records which keys it was
+ * rendered from, none of which changed, is carried forward to the new
+ * generation rather than discarded (see reviseRendered()).
+ *
+ * Concurrent renders of the same path, against the same configuration
+ * generation, are also deduplicated here. The first thread to ask becomes
+ * the 'leader' and renders it, any others that arrive while it's still in
+ * flight wait for, and then share, the leader's result.
+ *
+ * The output of a render is moved into a sealed memfd when it's wrapped, if
+ * it's big enough to be worth it. Then it can be shared with the kernel
+ * rather than copied, and nothing can change it behind a reader's back. */
+
+#include "common.h"
+#include "templatefs.h"
+#include "renderCache.h"
+#include "renderMeta.h"
+#include "metrics.h"
+#include "logStuff.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+/**
+ * @brief a render in progress, that other threads may be waiting on
+ */
+struct sInFlight {
+    struct sInFlight * next;
+    char *             path;
+    unsigned long      generation;  ///< of the configuration it's rendered against
+    pthread_cond_t     finished;    ///< signalled when 'done' becomes true
+    bool               done;
+    int                status;      ///< the leader's result
+    tRendered *        rendered;    ///< the leader's output, one reference held for the waiters
+    unsigned int       users;       ///< the leader, plus the number of waiters
+};
+
+typedef struct {
+    pthread_mutex_t  lock;
+    tInFlight *      inFlight;       ///< renders in progress
+    tRendered **     buckets;
+    size_t           bucketCount;    ///< always a power of two
+    size_t           entryCount;
+    size_t           budget;         ///< upper limit on 'used', in bytes
+    size_t           used;           ///< bytes accounted to cached entries
+    tRendered *      lruHead;        ///< most recently used
+    tRendered *      lruTail;        ///< least recently used
+} tRenderCache;
+
+static tRenderCache renderCache = {
+    .lock   = PTHREAD_MUTEX_INITIALIZER,
+    .budget = kDefaultRenderCacheBudget
+};
+
+// ------------------------------------------------------------------------------
+
+static inline size_t entryCost( const tRendered * rendered )
+{
+    return sizeof( tRendered ) + rendered->length + strlen( rendered->path ) + 1
+         + dependenciesSize( rendered->dependencies );
+}
+
+static inline bool sameTimespec( const struct timespec * a, const struct timespec * b )
+{
+    return ( a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec );
+}
+
+static void lruUnlink( tRendered * rendered )
+{
+    if ( rendered->lruPrev != NULL ) {
+        rendered->lruPrev->lruNext = rendered->lruNext;
+    } else {
+        renderCache.lruHead = rendered->lruNext;
+    }
+    if ( rendered->lruNext != NULL ) {
+        rendered->lruNext->lruPrev = rendered->lruPrev;
+    } else {
+        renderCache.lruTail = rendered->lruPrev;
+    }
+    rendered->lruPrev = NULL;
+    rendered->lruNext = NULL;
+}
+
+static void lruPushHead( tRendered * rendered )
+{
+    rendered->lruPrev = NULL;
+    rendered->lruNext = renderCache.lruHead;
+    if ( renderCache.lruHead != NULL ) {
+        renderCache.lruHead->lruPrev = rendered;
+    } else {
+        renderCache.lruTail = rendered;
+    }
+    renderCache.lruHead = rendered;
+}
+
+/**
+ * @brief unlink an entry from the cache and drop the cache's reference to it.
+ * Open handles which still hold a reference keep the buffer alive.
+ * Caller must hold the lock.
+ */
+static void removeEntry( tRendered * rendered )
+{
+    tRendered ** link = &renderCache.buckets[ hashString( rendered->path ) & ( renderCache.bucketCount - 1 ) ];
+    while ( *link != NULL && *link != rendered ) {
+        link = &(*link)->hashNext;
+    }
+    if ( *link == rendered ) {
+        *link = rendered->hashNext;
+        rendered->hashNext = NULL;
+    }
+    lruUnlink( rendered );
+
+    renderCache.used -= entryCost( rendered );
+    --renderCache.entryCount;
+
+    releaseRendered( rendered );
+}
+
+/**
+ * @brief double the number of buckets, rehashing the existing entries.
+ * Caller must hold the lock.
+ */
+static void growBuckets( void )
+{
+    size_t newCount = ( renderCache.bucketCount == 0 ) ? 64 : renderCache.bucketCount * 2;
+    tRendered ** newBuckets = calloc( newCount, sizeof( tRendered * ) );
+
+    if ( newBuckets != NULL ) {
+        for ( size_t i = 0; i < renderCache.bucketCount; ++i ) {
+            tRendered * rendered = renderCache.buckets[ i ];
+            while ( rendered != NULL ) {
+                tRendered * next = rendered->hashNext;
+                size_t      idx  = hashString( rendered->path ) & ( newCount - 1 );
+
+                rendered->hashNext = newBuckets[ idx ];
+                newBuckets[ idx ]  = rendered;
+                rendered = next;
+            }
+        }
+        free( renderCache.buckets );
+        renderCache.buckets     = newBuckets;
+        renderCache.bucketCount = newCount;
+    }
+}
+
+static tRendered * findEntry( const char * path )
+{
+    tRendered * rendered = NULL;
+
+    if ( renderCache.bucketCount > 0 ) {
+        rendered = renderCache.buckets[ hashString( path ) & ( renderCache.bucketCount - 1 ) ];
+        while ( rendered != NULL && strcmp( rendered->path, path ) != 0 ) {
+            rendered = rendered->hashNext;
+        }
+    }
+    return rendered;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief set the memory budget for the cache. Zero disables caching.
+ * @param budget  upper limit, in bytes, on the memory used by cached entries
+ */
+void initRenderCache( size_t budget )
+{
+    pthread_mutex_lock( &renderCache.lock );
+
+    renderCache.budget = budget;
+    while ( renderCache.used > renderCache.budget && renderCache.lruTail != NULL ) {
+        removeEntry( renderCache.lruTail );
+    }
+
+    pthread_mutex_unlock( &renderCache.lock );
+
+    logInfo( "render cache budget is %lu bytes", budget );
+}
+
+/**
+ * @return the memory budget for the cache, in bytes
+ */
+size_t renderCacheBudget( void )
+{
+    pthread_mutex_lock( &renderCache.lock );
+    size_t result = renderCache.budget;
+    pthread_mutex_unlock( &renderCache.lock );
+
+    return result;
+}
+
+/**
+ * @brief move a rendering into a sealed memfd, and map it back in its place.
+ * If that can't be done, it just stays on the heap
+ */
+static void sealRendered( tRendered * rendered )
+{
+    int fd = memfd_create( "templatefs", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+    if ( fd == -1 ) {
+        logDebug( "unable to create a memfd (%d: %s)", errno, strerror( errno ) );
+        errno = 0;
+        return;
+    }
+
+    size_t written = 0;
+    while ( written < rendered->length ) {
+        ssize_t count = write( fd, &rendered->data[ written ], rendered->length - written );
+        if ( count <= 0 ) {
+            if ( count == -1 && errno == EINTR ) {
+                continue;
+            }
+            break;
+        }
+        written += count;
+    }
+
+    void * map = MAP_FAILED;
+    if ( written == rendered->length
+      && fcntl( fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL ) == 0 ) {
+        map = mmap( NULL, rendered->length, PROT_READ, MAP_SHARED, fd, 0 );
+    }
+
+    if ( map == MAP_FAILED ) {
+        logDebug( "unable to seal rendered output (%d: %s)", errno, strerror( errno ) );
+        errno = 0;
+        close( fd );
+    } else {
+        free( rendered->data );
+        rendered->data = map;
+        rendered->fd   = fd;
+    }
+}
+
+/**
+ * @brief wrap a freshly rendered buffer, so it can be shared.
+ * @param data    rendered output allocated with malloc(). Ownership passes to the result.
+ * @param length  length of the rendered output
+ * @return the new (uncached) rendered object with one reference, or NULL if out of memory
+ */
+tRendered * newRendered( byte * data, size_t length )
+{
+    tRendered * rendered = calloc( 1, sizeof( tRendered ) );
+    if ( rendered != NULL ) {
+        rendered->data   = data;
+        rendered->length = length;
+        rendered->fd     = -1;
+        atomic_init( &rendered->refCount, 1 );
+
+        if ( length >= kMinSealedLength ) {
+            sealRendered( rendered );
+        }
+    }
+    return rendered;
+}
+
+tRendered * retainRendered( tRendered * rendered )
+{
+    if ( rendered != NULL ) {
+        atomic_fetch_add( &rendered->refCount, 1 );
+    }
+    return rendered;
+}
+
+void releaseRendered( tRendered * rendered )
+{
+    if ( rendered != NULL && atomic_fetch_sub( &rendered->refCount, 1 ) == 1 ) {
+        if ( rendered->fd != -1 ) {
+            munmap( rendered->data, rendered->length );
+            close( rendered->fd );
+        } else {
+            free( rendered->data );
+        }
+        freeDependencies( rendered->dependencies );
+        free( rendered->path );
+        free( rendered );
+    }
+}
+
+/**
+ * @brief look for a valid rendering of the template at 'path'
+ *
+ * An entry that's stale (the template was replaced or modified, or the
+ * configuration has changed since it was rendered) is discarded.
+ *
+ * @param path        path of the template, relative to the mount
+ * @param st          the current status of the template file
+ * @param generation  the current configuration generation
+ * @return a new reference to the cached rendering, or NULL on a miss
+ */
+tRendered * lookupRendered( const char * path, const struct stat * st, unsigned long generation )
+{
+    tRendered * result = NULL;
+
+    pthread_mutex_lock( &renderCache.lock );
+
+    tRendered * rendered = findEntry( path );
+    if ( rendered != NULL ) {
+        if ( rendered->dev == st->st_dev
+          && rendered->ino == st->st_ino
+          && sameTimespec( &rendered->mtime, &st->st_mtim )
+          && rendered->generation == generation ) {
+            lruUnlink( rendered );
+            lruPushHead( rendered );
+            result = retainRendered( rendered );
+        } else {
+            logDebug( "discarding stale rendering of \'%s\'", path );
+            removeEntry( rendered );
+        }
+    }
+
+    pthread_mutex_unlock( &renderCache.lock );
+
+    return result;
+}
+
+/**
+ * @brief add a rendering to the cache, replacing any earlier one for the same path.
+ *
+ * The cache takes its own reference, so the caller's reference is unaffected.
+ * Renderings that would never fit in the budget are silently not cached.
+ *
+ * @param path        path of the template, relative to the mount
+ * @param st          the status of the template file at the time it was rendered
+ * @param generation  the configuration generation the template was rendered against
+ * @param rendered    the output of rendering the template
+ */
+void insertRendered( const char * path,
+                     const struct stat * st,
+                     unsigned long generation,
+                     tRendered * rendered )
+{
+    if ( rendered == NULL || rendered->path != NULL ) {
+        /* nothing to do, or it's already been cached */
+        return;
+    }
+
+    rendered->path = strdup( path );
+    if ( rendered->path == NULL ) {
+        return;
+    }
+    rendered->dev        = st->st_dev;
+    rendered->ino        = st->st_ino;
+    rendered->mtime      = st->st_mtim;
+    rendered->generation = generation;
+
+    size_t cost = entryCost( rendered );
+
+    pthread_mutex_lock( &renderCache.lock );
+
+    if ( cost <= renderCache.budget ) {
+        tRendered * existing = findEntry( path );
+        if ( existing != NULL ) {
+            removeEntry( existing );
+        }
+
+        /* make room by evicting the least recently used entries */
+        while ( renderCache.used + cost > renderCache.budget && renderCache.lruTail != NULL ) {
+            logDebug( "evicting \'%s\'", renderCache.lruTail->path );
+            removeEntry( renderCache.lruTail );
+            countMetric( kCountRenderCacheEvictions, 1 );
+        }
+
+        if ( renderCache.entryCount >= renderCache.bucketCount ) {
+            growBuckets();
+        }
+
+        if ( renderCache.bucketCount > 0 ) {
+            size_t idx = hashString( path ) & ( renderCache.bucketCount - 1 );
+            rendered->hashNext = renderCache.buckets[ idx ];
+            renderCache.buckets[ idx ] = retainRendered( rendered );
+            lruPushHead( rendered );
+
+            renderCache.used += cost;
+            ++renderCache.entryCount;
+        }
+    }
+
+    pthread_mutex_unlock( &renderCache.lock );
+}
+
+/**
+ * @brief call 'callback' with the path of every cached entry.
+ * The cache is locked for the duration, so the callback must not call back into it.
+ */
+void forEachRenderedPath( void (* callback)( const char * path ) )
+{
+    pthread_mutex_lock( &renderCache.lock );
+
+    for ( tRendered * rendered = renderCache.lruHead; rendered != NULL; rendered = rendered->lruNext ) {
+        callback( rendered->path );
+    }
+
+    pthread_mutex_unlock( &renderCache.lock );
+}
+
+/**
+ * @brief call 'callback' with every cached entry, most recently used first.
+ * The cache is locked for the duration, so the callback must not call back into it.
+ */
+void forEachRendered( void (* callback)( const tRendered * rendered, void * context ), void * context )
+{
+    pthread_mutex_lock( &renderCache.lock );
+
+    for ( tRendered * rendered = renderCache.lruHead; rendered != NULL; rendered = rendered->lruNext ) {
+        callback( rendered, context );
+    }
+
+    pthread_mutex_unlock( &renderCache.lock );
+}
+
+/**
+ * @brief the configuration has changed from generation 'from' to 'to'.
+ *
+ * Entries rendered against 'from' that read none of the keys that changed
+ * are still good, so they're carried forward to 'to'. The rest are
+ * discarded, including those that don't know what they read. Entries for
+ * other generations were rendered against another store, so are left alone.
+ *
+ * @param changes  the names of the keys that changed, or NULL if that isn't known
+ * @param stale    called with the path of each entry discarded. May be NULL.
+ *                 The cache is locked, so it must not call back into it
+ */
+void reviseRendered( unsigned long from,
+                     unsigned long to,
+                     const tConfigChanges * changes,
+                     void (* stale)( const char * path ) )
+{
+    unsigned int carried = 0;
+    unsigned int dropped = 0;
+
+    pthread_mutex_lock( &renderCache.lock );
+
+    tRendered * rendered = renderCache.lruHead;
+    while ( rendered != NULL ) {
+        tRendered * next = rendered->lruNext;
+
+        if ( rendered->generation == from ) {
+            if ( dependsOnChanges( rendered->dependencies, changes ) ) {
+                if ( stale != NULL ) {
+                    stale( rendered->path );
+                }
+                removeEntry( rendered );
+                ++dropped;
+            } else {
+                rendered->generation = to;
+                reviseRenderedMeta( rendered->path, from, to );
+                ++carried;
+            }
+        }
+        rendered = next;
+    }
+
+    pthread_mutex_unlock( &renderCache.lock );
+
+    logDebug( "generation %lu to %lu: %u renderings carried forward, %u discarded",
+              from, to, carried, dropped );
+}
+
+// ------------------------------------------------------------------------------
+
+static void releaseInFlight( tInFlight * flight )
+{
+    /* caller must hold the lock */
+    if ( --flight->users == 0 ) {
+        releaseRendered( flight->rendered );
+        pthread_cond_destroy( &flight->finished );
+        free( flight->path );
+        free( flight );
+    }
+}
+
+/**
+ * @brief the render of 'path' in progress against 'generation', if any. Caller must hold the lock
+ */
+static tInFlight * findInFlight( const char * path, unsigned long generation )
+{
+    tInFlight * result = renderCache.inFlight;
+
+    while ( result != NULL && ( result->generation != generation || strcmp( result->path, path ) != 0 ) ) {
+        result = result->next;
+    }
+    return result;
+}
+
+/**
+ * @brief start tracking a render, so others may join it. Caller must hold the lock
+ * @return the flight, or NULL if there isn't the memory for one
+ */
+static tInFlight * newInFlight( const char * path, unsigned long generation )
+{
+    tInFlight * result = calloc( 1, sizeof( tInFlight ) );
+
+    if ( result != NULL ) {
+        result->path = strdup( path );
+        if ( result->path == NULL ) {
+            free( result );
+            result = NULL;
+        } else {
+            pthread_cond_init( &result->finished, NULL );
+            result->generation = generation;
+            result->users      = 1;
+            result->next       = renderCache.inFlight;
+            renderCache.inFlight = result;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief join the render of 'path' already in progress, or become the one doing it
+ *
+ * Only a render against the same generation of the configuration is joined,
+ * so a waiter never gets output rendered against one older than its own.
+ *
+ * If true is returned, the caller is the leader: it must render 'path' and
+ * then call finishRender() with the flight, whether or not the render
+ * succeeded. The flight is NULL if there wasn't the memory to track it, in
+ * which case the render just isn't shared.
+ *
+ * If false is returned, another thread was already rendering 'path', and
+ * this one has waited for it to finish. Its result is returned in 'status'
+ * and, if it succeeded, a new reference to its output in 'rendered'.
+ *
+ * @param path        path of the template, relative to the mount
+ * @param generation  of the configuration it's to be rendered against
+ * @param flight      receives the leader's handle on the render, if this thread is the leader
+ * @param rendered    receives the leader's output, if this thread isn't the leader
+ * @param status      receives the leader's result, if this thread isn't the leader
+ * @return true if the caller must do the render, false if it has been done for it
+ */
+bool joinRender( const char * path,
+                 unsigned long generation,
+                 tInFlight ** flight,
+                 tRendered ** rendered,
+                 int * status )
+{
+    bool result = true;
+
+    pthread_mutex_lock( &renderCache.lock );
+
+    tInFlight * joined = findInFlight( path, generation );
+
+    *flight = NULL;
+    if ( joined != NULL ) {
+        logDebug( "waiting for the render of \'%s\' in progress", path );
+
+        ++joined->users;
+        while ( !joined->done ) {
+            pthread_cond_wait( &joined->finished, &renderCache.lock );
+        }
+        *rendered = retainRendered( joined->rendered );
+        *status   = joined->status;
+        releaseInFlight( joined );
+
+        result = false;
+    } else {
+        /* if we failed to allocate, just render without deduplication */
+        *flight = newInFlight( path, generation );
+    }
+
+    pthread_mutex_unlock( &renderCache.lock );
+
+    return result;
+}
+
+/**
+ * @brief become the leader of the render of 'path', unless it's already in progress
+ *
+ * Like joinRender(), except that it never waits. For renders done on a
+ * render pool thread, which mustn't wait on a leader whose own render may
+ * still be queued behind it.
+ *
+ * @return true if the caller must do the render (and then call finishRender()),
+ * false if it's already being done, and there's nothing for the caller to do
+ */
+bool tryJoinRender( const char * path, unsigned long generation, tInFlight ** flight )
+{
+    bool result = false;
+
+    pthread_mutex_lock( &renderCache.lock );
+
+    *flight = NULL;
+    if ( findInFlight( path, generation ) == NULL ) {
+        *flight = newInFlight( path, generation );
+        result  = true;
+    }
+
+    pthread_mutex_unlock( &renderCache.lock );
+
+    return result;
+}
+
+/**
+ * @brief publish the leader's result to any threads waiting on it
+ * @param flight    the leader's handle from joinRender(). Nothing is done if it's NULL
+ * @param rendered  the output of the render, or NULL if it failed
+ * @param status    the result of the render
+ */
+void finishRender( tInFlight * flight, tRendered * rendered, int status )
+{
+    if ( flight == NULL ) {
+        return;
+    }
+
+    pthread_mutex_lock( &renderCache.lock );
+
+    /* no longer joinable. Any later arrivals start afresh */
+    tInFlight ** link = &renderCache.inFlight;
+    while ( *link != flight ) {
+        link = &(*link)->next;
+    }
+    *link = flight->next;
+
+    flight->rendered = retainRendered( rendered );
+    flight->status   = status;
+    flight->done     = true;
+    pthread_cond_broadcast( &flight->finished );
+
+    releaseInFlight( flight );
+
+    pthread_mutex_unlock( &renderCache.lock );
+}
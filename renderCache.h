@@ -0,0 +1,82 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_RENDERCACHE_H
+#define TEMPLATEFS_RENDERCACHE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dependencies.h"
+
+/**
+ * @brief the immutable output of rendering a template.
+ *
+ * Shared between every open handle on the same template (and the cache
+ * itself), so it must never be modified once it has been published.
+ * Use retainRendered() and releaseRendered() to manage its lifetime.
+ *
+ * Anything bigger than a page is moved into a sealed memfd, so it can be
+ * served with fd-based bufvecs (or passed through to the kernel), and its
+ * pages belong to the kernel rather than our heap.
+ */
+typedef struct sRendered {
+    byte *                data;      ///< the rendered output. Mapped read-only from 'fd' if it has one
+    size_t                length;    ///< length of the rendered output
+    int                   fd;        ///< sealed memfd holding the output, -1 if it's only on the heap
+    tDependencies *       dependencies; ///< the keys it was rendered from, NULL if unknown. Owned by the rendering
+    uint64_t              configHash;   ///< hashConfigContent() of the configuration it was rendered against, zero if unknown
+    struct timespec       configChangedAt; ///< when that configuration last changed, see tConfigSnapshot
+
+    /* everything below is owned by the render cache */
+    atomic_uint           refCount;  ///< one for each open handle, plus one if cached
+    char *                path;      ///< path of the template, relative to the mount
+    dev_t                 dev;       ///< device of the template file when rendered
+    ino_t                 ino;       ///< inode of the template file when rendered
+    struct timespec       mtime;     ///< modification time of the template when rendered
+    unsigned long         generation;///< configuration generation it was rendered against
+
+    struct sRendered *    hashNext;  ///< next entry in the same hash bucket
+    struct sRendered *    lruPrev;   ///< more recently used neighbour
+    struct sRendered *    lruNext;   ///< less recently used neighbour
+} tRendered;
+
+#define kDefaultRenderCacheBudget  (16 * 1024 * 1024)
+#define kMinSealedLength           4096    // smaller outputs aren't worth an fd each
+
+void        initRenderCache( size_t budget );
+size_t      renderCacheBudget( void );
+
+tRendered * newRendered( byte * data, size_t length );
+tRendered * retainRendered( tRendered * rendered );
+void        releaseRendered( tRendered * rendered );
+
+tRendered * lookupRendered( const char * path, const struct stat * st, unsigned long generation );
+void        insertRendered( const char * path,
+                            const struct stat * st,
+                            unsigned long generation,
+                            tRendered * rendered );
+
+void        forEachRenderedPath( void (* callback)( const char * path ) );
+void        forEachRendered( void (* callback)( const tRendered * rendered, void * context ), void * context );
+void        reviseRendered( unsigned long from,
+                            unsigned long to,
+                            const tConfigChanges * changes,
+                            void (* stale)( const char * path ) );
+
+/**
+ * @brief a render in progress, which others may join (see joinRender())
+ */
+typedef struct sInFlight tInFlight;
+
+bool        joinRender( const char * path,
+                        unsigned long generation,
+                        tInFlight ** flight,
+                        tRendered ** rendered,
+                        int * status );
+bool        tryJoinRender( const char * path, unsigned long generation, tInFlight ** flight );
+void        finishRender( tInFlight * flight, tRendered * rendered, int status );
+
+#endif //TEMPLATEFS_RENDERCACHE_H
@@ -0,0 +1,209 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* The length of each template's most recent rendering, so getattr can
+ * report it without having to render. Unlike the render cache, this
+ * doesn't hold the output itself, so an entry is tiny and is never
+ * evicted. It's only removed when its template is deleted. Entries are
+ * only valid while the template's inode and mtime, and the configuration
+ * generation, match what they were when it was rendered, or the rendering
+ * has been found not to depend on anything that changed since (see
+ * reviseRendered()). */
+
+#include "common.h"
+#include "renderMeta.h"
+#include "logStuff.h"
+
+#include <pthread.h>
+
+/**
+ * @brief the length of one template's rendered output, and what it was rendered from
+ */
+typedef struct sRenderedMeta {
+    struct sRenderedMeta * next;        ///< next entry in the same hash bucket
+    dev_t                  dev;         ///< device of the template file when rendered
+    ino_t                  ino;         ///< inode of the template file when rendered
+    struct timespec        mtime;       ///< modification time of the template when rendered
+    unsigned long          generation;  ///< configuration generation it was rendered against
+    size_t                 length;      ///< length of the rendered output
+    char                   path[];      ///< path of the template, relative to the mount
+} tRenderedMeta;
+
+typedef struct {
+    pthread_rwlock_t   lock;
+    tRenderedMeta **   buckets;
+    size_t             bucketCount;     ///< always a power of two
+    size_t             entryCount;
+} tMetaCache;
+
+static tMetaCache metaCache = {
+    .lock = PTHREAD_RWLOCK_INITIALIZER
+};
+
+// ------------------------------------------------------------------------------
+
+static inline bool sameTimespec( const struct timespec * a, const struct timespec * b )
+{
+    return ( a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec );
+}
+
+/**
+ * @brief double the number of buckets, rehashing the existing entries.
+ * Caller must hold the write lock.
+ */
+static void growBuckets( void )
+{
+    size_t           newCount   = ( metaCache.bucketCount == 0 ) ? 64 : metaCache.bucketCount * 2;
+    tRenderedMeta ** newBuckets = calloc( newCount, sizeof( tRenderedMeta * ) );
+
+    if ( newBuckets != NULL ) {
+        for ( size_t i = 0; i < metaCache.bucketCount; ++i ) {
+            tRenderedMeta * meta = metaCache.buckets[ i ];
+            while ( meta != NULL ) {
+                tRenderedMeta * next = meta->next;
+                size_t          idx  = hashString( meta->path ) & ( newCount - 1 );
+
+                meta->next = newBuckets[ idx ];
+                newBuckets[ idx ] = meta;
+                meta = next;
+            }
+        }
+        free( metaCache.buckets );
+        metaCache.buckets     = newBuckets;
+        metaCache.bucketCount = newCount;
+    }
+}
+
+static tRenderedMeta ** findLink( const char * path )
+{
+    tRenderedMeta ** link = NULL;
+
+    if ( metaCache.bucketCount > 0 ) {
+        link = &metaCache.buckets[ hashString( path ) & ( metaCache.bucketCount - 1 ) ];
+        while ( *link != NULL && strcmp( (*link)->path, path ) != 0 ) {
+            link = &(*link)->next;
+        }
+    }
+    return link;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief remember the length of a template's rendered output
+ * @param path        path of the template, relative to the mount
+ * @param st          the status of the template file it was rendered from
+ * @param generation  the configuration generation it was rendered against
+ * @param length      length of the rendered output
+ */
+void recordRenderedMeta( const char * path,
+                         const struct stat * st,
+                         unsigned long generation,
+                         size_t length )
+{
+    pthread_rwlock_wrlock( &metaCache.lock );
+
+    tRenderedMeta ** link = findLink( path );
+    tRenderedMeta *  meta = ( link != NULL ) ? *link : NULL;
+
+    if ( meta == NULL ) {
+        if ( metaCache.entryCount >= metaCache.bucketCount ) {
+            growBuckets();
+        }
+
+        size_t len = strlen( path );
+        meta = calloc( 1, sizeof( tRenderedMeta ) + len + 1 );
+        if ( meta != NULL && metaCache.bucketCount > 0 ) {
+            memcpy( meta->path, path, len + 1 );
+
+            size_t idx = hashString( path ) & ( metaCache.bucketCount - 1 );
+            meta->next = metaCache.buckets[ idx ];
+            metaCache.buckets[ idx ] = meta;
+            ++metaCache.entryCount;
+        } else {
+            free( meta );
+            meta = NULL;
+        }
+    }
+
+    if ( meta != NULL ) {
+        meta->dev        = st->st_dev;
+        meta->ino        = st->st_ino;
+        meta->mtime      = st->st_mtim;
+        meta->generation = generation;
+        meta->length     = length;
+    }
+
+    pthread_rwlock_unlock( &metaCache.lock );
+}
+
+/**
+ * @brief look up the length of a template's rendered output, if it's still valid
+ * @param path        path of the template, relative to the mount
+ * @param st          the current status of the template file
+ * @param generation  the current configuration generation
+ * @param length      receives the length of the rendered output
+ * @return true if 'length' was set
+ */
+bool lookupRenderedMeta( const char * path,
+                         const struct stat * st,
+                         unsigned long generation,
+                         size_t * length )
+{
+    bool result = false;
+
+    pthread_rwlock_rdlock( &metaCache.lock );
+
+    tRenderedMeta ** link = findLink( path );
+    if ( link != NULL && *link != NULL ) {
+        tRenderedMeta * meta = *link;
+        if ( meta->dev == st->st_dev
+          && meta->ino == st->st_ino
+          && sameTimespec( &meta->mtime, &st->st_mtim )
+          && meta->generation == generation ) {
+            *length = meta->length;
+            result  = true;
+        }
+    }
+
+    pthread_rwlock_unlock( &metaCache.lock );
+
+    return result;
+}
+
+/**
+ * @brief discard what's known about a template, e.g. because it was deleted
+ */
+void forgetRenderedMeta( const char * path )
+{
+    pthread_rwlock_wrlock( &metaCache.lock );
+
+    tRenderedMeta ** link = findLink( path );
+    if ( link != NULL && *link != NULL ) {
+        tRenderedMeta * meta = *link;
+        *link = meta->next;
+        free( meta );
+        --metaCache.entryCount;
+    }
+
+    pthread_rwlock_unlock( &metaCache.lock );
+}
+
+/**
+ * @brief a template's rendering doesn't depend on anything that changed
+ * between two configuration generations, so its length is still good
+ * @param from  the generation it was rendered against
+ * @param to    the generation it's now known to be the same as
+ */
+void reviseRenderedMeta( const char * path, unsigned long from, unsigned long to )
+{
+    pthread_rwlock_wrlock( &metaCache.lock );
+
+    tRenderedMeta ** link = findLink( path );
+    if ( link != NULL && *link != NULL && (*link)->generation == from ) {
+        (*link)->generation = to;
+    }
+
+    pthread_rwlock_unlock( &metaCache.lock );
+}
@@ -0,0 +1,21 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_RENDERMETA_H
+#define TEMPLATEFS_RENDERMETA_H
+
+#include <stdbool.h>
+
+void recordRenderedMeta( const char * path,
+                         const struct stat * st,
+                         unsigned long generation,
+                         size_t length );
+bool lookupRenderedMeta( const char * path,
+                         const struct stat * st,
+                         unsigned long generation,
+                         size_t * length );
+void forgetRenderedMeta( const char * path );
+void reviseRenderedMeta( const char * path, unsigned long from, unsigned long to );
+
+#endif //TEMPLATEFS_RENDERMETA_H
@@ -0,0 +1,333 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* A fixed-size pool of threads that renders run on, rather than on
+ * whichever fuse thread happened to receive the open(), so the number of
+ * renders in progress is bounded no matter how many opens arrive at once.
+ *
+ * Work is queued in lanes. Idle threads always take from the template
+ * lane first, and at most all but one of the threads will run executables
+ * and warm-up renders (which are only taken when there's nothing else to
+ * do) between them, so neither slow scripts nor a warm-up can hold up
+ * plain templates.
+ *
+ * runRender() waits for its render to finish, which is what the
+ * high-level fuse API needs. submitRender() doesn't, and calls back when
+ * it's done instead, so a reply can be sent from the pool thread.
+ *
+ * Until the pool is started, and after it's stopped, renders run on the
+ * calling thread. So do renders started with runRender() from a pool
+ * thread, as waiting for another pool thread from one could leave them all
+ * waiting. submitRender() doesn't wait, so it always queues. */
+
+#include "common.h"
+#include "renderPool.h"
+#include "logStuff.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/**
+ * @brief one queued render
+ */
+typedef struct sRenderJob {
+    struct sRenderJob * next;
+    tRenderFunction     render;
+    void *              context;
+    tRenderDone         done;
+    void *              doneContext;
+} tRenderJob;
+
+/**
+ * @brief a render waiting in runRender()
+ */
+typedef struct {
+    pthread_mutex_t  lock;
+    pthread_cond_t   finished;
+    bool             done;
+    int              result;
+} tRenderWait;
+
+typedef struct {
+    tRenderJob *  head;
+    tRenderJob *  tail;
+    unsigned int  busy;     ///< jobs from this lane currently running
+    unsigned int  limit;    ///< most jobs from this lane that may run at once
+} tRenderQueue;
+
+static struct {
+    pthread_mutex_t  lock;
+    pthread_cond_t   work;          ///< signalled when a job is queued, or a lane has room
+    bool             running;
+    bool             stopping;
+    unsigned int     threadCount;
+    pthread_t *      threads;
+    tRenderQueue     lanes[ kLaneCount ];
+    unsigned int     otherBusy;     ///< jobs from lanes other than kLaneTemplate currently running
+    unsigned int     otherLimit;    ///< most of those that may run at once
+} renderPool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER
+};
+
+static __thread bool onPoolThread = false;
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief take the next job that's allowed to run. Caller must hold the lock
+ */
+static tRenderJob * takeJob( eRenderLane * lane )
+{
+    tRenderJob * result = NULL;
+
+    for ( int i = 0; i < kLaneCount && result == NULL; ++i ) {
+        tRenderQueue * queue = &renderPool.lanes[ i ];
+        if ( queue->head != NULL && queue->busy < queue->limit
+          && ( i == kLaneTemplate || renderPool.otherBusy < renderPool.otherLimit ) ) {
+            result      = queue->head;
+            queue->head = result->next;
+            if ( queue->head == NULL ) {
+                queue->tail = NULL;
+            }
+            ++queue->busy;
+            if ( i != kLaneTemplate ) {
+                ++renderPool.otherBusy;
+            }
+            *lane = i;
+        }
+    }
+    return result;
+}
+
+static bool isQueueEmpty( void )
+{
+    bool result = true;
+
+    for ( int i = 0; i < kLaneCount; ++i ) {
+        if ( renderPool.lanes[ i ].head != NULL ) {
+            result = false;
+        }
+    }
+    return result;
+}
+
+static void * renderThread( void * arg )
+{
+    (void)arg;
+
+    onPoolThread = true;
+    pthread_mutex_lock( &renderPool.lock );
+
+    /* finish whatever's queued before stopping */
+    while ( !renderPool.stopping || !isQueueEmpty() ) {
+        eRenderLane  lane;
+        tRenderJob * job = takeJob( &lane );
+
+        if ( job == NULL ) {
+            pthread_cond_wait( &renderPool.work, &renderPool.lock );
+        } else {
+            pthread_mutex_unlock( &renderPool.lock );
+
+            int result = job->render( job->context );
+            if ( job->done != NULL ) {
+                job->done( result, job->doneContext );
+            }
+            free( job );
+
+            pthread_mutex_lock( &renderPool.lock );
+            --renderPool.lanes[ lane ].busy;
+            if ( lane != kLaneTemplate ) {
+                --renderPool.otherBusy;
+            }
+            /* another job from this lane may have been held back by its limit */
+            pthread_cond_broadcast( &renderPool.work );
+        }
+    }
+
+    pthread_mutex_unlock( &renderPool.lock );
+
+    return NULL;
+}
+
+static void renderFinished( int result, void * context )
+{
+    tRenderWait * wait = context;
+
+    pthread_mutex_lock( &wait->lock );
+    wait->result = result;
+    wait->done   = true;
+    pthread_cond_signal( &wait->finished );
+    pthread_mutex_unlock( &wait->lock );
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief start the render threads. Must be called after fuse_daemonize()
+ * @param threads  how many renders may run at once
+ * @return zero if successful, negative errno if not
+ */
+int startRenderPool( unsigned int threads )
+{
+    int result = 0;
+
+    if ( threads == 0 ) {
+        threads = 1;
+    }
+
+    pthread_mutex_lock( &renderPool.lock );
+
+    renderPool.threads = calloc( threads, sizeof( pthread_t ) );
+    if ( renderPool.threads == NULL ) {
+        result = -ENOMEM;
+    } else {
+        renderPool.stopping = false;
+        renderPool.lanes[ kLaneTemplate ].limit   = threads;
+        /* keep one thread for templates, unless there's only one */
+        renderPool.lanes[ kLaneExecutable ].limit = ( threads > 1 ) ? threads - 1 : 1;
+        renderPool.lanes[ kLaneWarmup ].limit     = renderPool.lanes[ kLaneExecutable ].limit;
+        /* ...and not just from each of the other lanes, but from all of them together */
+        renderPool.otherLimit                     = renderPool.lanes[ kLaneExecutable ].limit;
+
+        while ( renderPool.threadCount < threads ) {
+            int err = pthread_create( &renderPool.threads[ renderPool.threadCount ], NULL, renderThread, NULL );
+            if ( err != 0 ) {
+                logError( "unable to start render thread (%d)", err );
+                break;
+            }
+            ++renderPool.threadCount;
+        }
+
+        if ( renderPool.threadCount == 0 ) {
+            free( renderPool.threads );
+            renderPool.threads = NULL;
+            result = -EAGAIN;
+        } else {
+            for ( int i = kLaneExecutable; i < kLaneCount; ++i ) {
+                if ( renderPool.lanes[ i ].limit > renderPool.threadCount ) {
+                    renderPool.lanes[ i ].limit = renderPool.threadCount;
+                }
+            }
+            /* fewer threads may have started than were asked for */
+            if ( renderPool.otherLimit >= renderPool.threadCount ) {
+                renderPool.otherLimit = ( renderPool.threadCount > 1 ) ? renderPool.threadCount - 1 : 1;
+            }
+            renderPool.running = true;
+            logInfo( "started %u render threads", renderPool.threadCount );
+        }
+    }
+
+    pthread_mutex_unlock( &renderPool.lock );
+
+    return result;
+}
+
+/**
+ * @brief finish the queued renders, and stop the render threads
+ */
+void stopRenderPool( void )
+{
+    pthread_mutex_lock( &renderPool.lock );
+    bool running = renderPool.running;
+    renderPool.running  = false;
+    renderPool.stopping = true;
+    pthread_cond_broadcast( &renderPool.work );
+    pthread_mutex_unlock( &renderPool.lock );
+
+    if ( running ) {
+        for ( unsigned int i = 0; i < renderPool.threadCount; ++i ) {
+            pthread_join( renderPool.threads[ i ], NULL );
+        }
+        free( renderPool.threads );
+        renderPool.threads     = NULL;
+        renderPool.threadCount = 0;
+    }
+}
+
+/**
+ * @brief queue a render, and return without waiting for it
+ * @param lane         which queue it waits in
+ * @param render       does the work, on a pool thread
+ * @param context      passed to 'render'
+ * @param done         called with the result once it's finished. May be NULL
+ * @param doneContext  passed to 'done'
+ * @return zero if it was queued (or, without a pool, has already run), negative errno if not
+ */
+int submitRender( eRenderLane lane,
+                  tRenderFunction render,
+                  void * context,
+                  tRenderDone done,
+                  void * doneContext )
+{
+    int          result = 0;
+    tRenderJob * job    = calloc( 1, sizeof( tRenderJob ) );
+
+    if ( job == NULL ) {
+        return -ENOMEM;
+    }
+    job->render      = render;
+    job->context     = context;
+    job->done        = done;
+    job->doneContext = doneContext;
+
+    pthread_mutex_lock( &renderPool.lock );
+
+    if ( renderPool.running ) {
+        tRenderQueue * queue = &renderPool.lanes[ lane ];
+        if ( queue->tail == NULL ) {
+            queue->head = job;
+        } else {
+            queue->tail->next = job;
+        }
+        queue->tail = job;
+        job = NULL;
+        pthread_cond_signal( &renderPool.work );
+    }
+
+    pthread_mutex_unlock( &renderPool.lock );
+
+    if ( job != NULL ) {
+        /* no pool to hand it to */
+        int rendered = render( context );
+        if ( done != NULL ) {
+            done( rendered, doneContext );
+        }
+        free( job );
+    }
+
+    return result;
+}
+
+/**
+ * @brief queue a render, and wait for it to finish
+ * @return the result of 'render'
+ */
+int runRender( eRenderLane lane, tRenderFunction render, void * context )
+{
+    int         result;
+    tRenderWait wait = {
+        .lock     = PTHREAD_MUTEX_INITIALIZER,
+        .finished = PTHREAD_COND_INITIALIZER
+    };
+
+    if ( onPoolThread ) {
+        /* we're already on it */
+        result = render( context );
+    } else {
+        result = submitRender( lane, render, context, renderFinished, &wait );
+        if ( result == 0 ) {
+            pthread_mutex_lock( &wait.lock );
+            while ( !wait.done ) {
+                pthread_cond_wait( &wait.finished, &wait.lock );
+            }
+            result = wait.result;
+            pthread_mutex_unlock( &wait.lock );
+        }
+    }
+    pthread_mutex_destroy( &wait.lock );
+    pthread_cond_destroy( &wait.finished );
+
+    return result;
+}
@@ -0,0 +1,40 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_RENDERPOOL_H
+#define TEMPLATEFS_RENDERPOOL_H
+
+#define kDefaultRenderThreads  4
+
+/**
+ * @brief the queues renders wait in. Lower lanes are served first
+ */
+typedef enum {
+    kLaneTemplate = 0,      ///< rendering a template against the configuration
+    kLaneExecutable,        ///< running an executable template
+    kLaneWarmup,            ///< rendering a template ahead of use (see warmup.c)
+    kLaneCount
+} eRenderLane;
+
+/**
+ * @brief does the work of a render, on a pool thread
+ * @return zero if successful, negative errno if not
+ */
+typedef int  (* tRenderFunction)( void * context );
+
+/**
+ * @brief called on the pool thread once a render submitted with submitRender() has finished
+ */
+typedef void (* tRenderDone)( int result, void * context );
+
+int  startRenderPool( unsigned int threads );
+void stopRenderPool( void );
+int  submitRender( eRenderLane lane,
+                   tRenderFunction render,
+                   void * context,
+                   tRenderDone done,
+                   void * doneContext );
+int  runRender( eRenderLane lane, tRenderFunction render, void * context );
+
+#endif //TEMPLATEFS_RENDERPOOL_H
@@ -0,0 +1,308 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* With '-o snapshot=FILE', the render cache is saved to FILE when the
+ * filesystem is unmounted, and read back when it's next mounted, so a
+ * restart can serve what was rendered before straight away rather than
+ * rendering everything again.
+ *
+ * Configuration generations only mean anything within one run, so each
+ * rendering is saved with a hash of the content of the configuration it
+ * was rendered against instead (see hashConfigContent()), along with the
+ * identity of its template file. What's read back isn't put in the render
+ * cache directly. It's held aside until the template is next needed, and
+ * only used then if the template file and the configuration's content
+ * are still the same. Otherwise it's discarded, and rendered as usual.
+ * Each is also saved with when its configuration last changed, so a
+ * configuration that's the same after the restart keeps that as the
+ * mtime of what's rendered from it (see rememberConfigChange()).
+ *
+ * The file is only a cache: if it's missing, damaged or out of date,
+ * nothing is lost but the head start. */
+
+#include "common.h"
+#include "templatefs.h"
+#include "configStore.h"
+#include "renderSnapshot.h"
+#include "logStuff.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define kRestoredBuckets  256   // always a power of two
+
+/**
+ * @brief how each rendering is laid out in the file. Followed by the
+ * path (without a terminator), then the rendered output
+ */
+typedef struct {
+    uint32_t  pathLength;
+    uint32_t  reserved;
+    uint64_t  dev;
+    uint64_t  ino;
+    int64_t   mtimeSec;
+    int64_t   mtimeNsec;
+    uint64_t  configHash;
+    int64_t   configChangedSec;
+    int64_t   configChangedNsec;
+    uint64_t  length;
+} tSnapshotRecord;
+
+/**
+ * @brief a rendering read back from the file, waiting to be claimed
+ */
+typedef struct sRestored {
+    struct sRestored * next;        ///< next in the same hash bucket
+    tSnapshotRecord    record;
+    byte *             data;        ///< allocated with malloc()
+    char               path[];
+} tRestored;
+
+static struct {
+    pthread_mutex_t  lock;
+    tRestored *      buckets[ kRestoredBuckets ];
+    size_t           count;
+} restored = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/**
+ * @brief the state of a save in progress
+ */
+typedef struct {
+    FILE *    file;
+    bool      failed;
+    unsigned  saved;
+} tSaving;
+
+// ------------------------------------------------------------------------------
+
+static void saveRendered( const tRendered * rendered, void * context )
+{
+    tSaving * saving = context;
+
+    if ( saving->failed || rendered->configHash == 0 ) {
+        /* wasn't rendered with a hash, so couldn't be checked when read back */
+        return;
+    }
+
+    tSnapshotRecord record = {
+        .pathLength        = strlen( rendered->path ),
+        .dev               = rendered->dev,
+        .ino               = rendered->ino,
+        .mtimeSec          = rendered->mtime.tv_sec,
+        .mtimeNsec         = rendered->mtime.tv_nsec,
+        .configHash        = rendered->configHash,
+        .configChangedSec  = rendered->configChangedAt.tv_sec,
+        .configChangedNsec = rendered->configChangedAt.tv_nsec,
+        .length            = rendered->length
+    };
+
+    if ( fwrite( &record, sizeof( record ), 1, saving->file ) != 1
+      || fwrite( rendered->path, 1, record.pathLength, saving->file ) != record.pathLength
+      || fwrite( rendered->data, 1, rendered->length, saving->file ) != rendered->length ) {
+        saving->failed = true;
+    } else {
+        ++saving->saved;
+    }
+}
+
+/**
+ * @brief forget whatever was restored. Caller must hold the lock
+ */
+static void clearRestored( void )
+{
+    for ( size_t i = 0; i < kRestoredBuckets; ++i ) {
+        while ( restored.buckets[ i ] != NULL ) {
+            tRestored * entry = restored.buckets[ i ];
+            restored.buckets[ i ] = entry->next;
+            free( entry->data );
+            free( entry );
+        }
+    }
+    restored.count = 0;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief save every cached rendering. Written to a temporary file first,
+ * and renamed over 'file', so a crash part way through leaves the old one
+ * @return zero if successful, negative errno if not
+ */
+int saveRenderSnapshot( const char * file )
+{
+    int     result = 0;
+    char    temporary[ PATH_MAX ];
+    tSaving saving = { NULL, false, 0 };
+
+    if ( snprintf( temporary, sizeof( temporary ), "%s.part", file ) >= (int)sizeof( temporary ) ) {
+        return -ENAMETOOLONG;
+    }
+
+    int fd = open( temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600 );
+    if ( fd == -1 || ( saving.file = fdopen( fd, "wb" ) ) == NULL ) {
+        result = -errno;
+        if ( fd != -1 ) {
+            close( fd );
+        }
+    } else {
+        if ( fwrite( kSnapshotMagic, 1, sizeof( kSnapshotMagic ) - 1, saving.file ) != sizeof( kSnapshotMagic ) - 1 ) {
+            saving.failed = true;
+        }
+        forEachRendered( saveRendered, &saving );
+
+        if ( saving.failed || fflush( saving.file ) != 0 || fsync( fileno( saving.file ) ) != 0 ) {
+            result = ( errno != 0 ) ? -errno : -EIO;
+        }
+        if ( fclose( saving.file ) != 0 && result == 0 ) {
+            result = -errno;
+        }
+        if ( result == 0 && rename( temporary, file ) != 0 ) {
+            result = -errno;
+        }
+    }
+
+    if ( result != 0 ) {
+        logError( "unable to save the render snapshot to \'%s\' (%d: %s)", file, -result, strerror( -result ) );
+        unlink( temporary );
+    } else {
+        logInfo( "saved %u renderings to \'%s\'", saving.saved, file );
+    }
+    errno = 0;
+
+    return result;
+}
+
+/**
+ * @brief read back the renderings saved by saveRenderSnapshot(), to be claimed as they're needed
+ * @param budget  the most output to read back, in bytes
+ * @return zero if successful (including when there's no file yet), negative errno if not
+ */
+int loadRenderSnapshot( const char * file, size_t budget )
+{
+    int    result = 0;
+    size_t loaded = 0;
+    char   magic[ sizeof( kSnapshotMagic ) - 1 ];
+
+    FILE * in = fopen( file, "rbe" );
+    if ( in == NULL ) {
+        result = ( errno == ENOENT ) ? 0 : -errno;
+        errno = 0;
+        return result;
+    }
+
+    if ( fread( magic, 1, sizeof( magic ), in ) != sizeof( magic ) || memcmp( magic, kSnapshotMagic, sizeof( magic ) ) != 0 ) {
+        logWarning( "\'%s\' isn't a render snapshot, ignoring it", file );
+        result = -EINVAL;
+    }
+
+    pthread_mutex_lock( &restored.lock );
+
+    tSnapshotRecord record;
+    while ( result == 0 && fread( &record, sizeof( record ), 1, in ) == 1 ) {
+        if ( record.pathLength == 0 || record.pathLength >= PATH_MAX || record.length > budget - loaded ) {
+            /* damaged, or more than we have room for */
+            break;
+        }
+
+        tRestored * entry = malloc( sizeof( tRestored ) + record.pathLength + 1 );
+        byte *      data  = malloc( record.length > 0 ? record.length : 1 );
+        if ( entry == NULL || data == NULL ) {
+            free( entry );
+            free( data );
+            result = -ENOMEM;
+        } else if ( fread( entry->path, 1, record.pathLength, in ) != record.pathLength
+                 || fread( data, 1, record.length, in ) != record.length ) {
+            /* truncated */
+            free( entry );
+            free( data );
+            break;
+        } else {
+            entry->path[ record.pathLength ] = '\0';
+            entry->record = record;
+            entry->data   = data;
+
+            /* so a configuration that hasn't changed since keeps its mtime */
+            struct timespec changedAt = { .tv_sec = record.configChangedSec, .tv_nsec = record.configChangedNsec };
+            rememberConfigChange( record.configHash, &changedAt );
+
+            size_t bucket = hashString( entry->path ) & ( kRestoredBuckets - 1 );
+            entry->next = restored.buckets[ bucket ];
+            restored.buckets[ bucket ] = entry;
+            ++restored.count;
+            loaded += record.length;
+        }
+    }
+    size_t count = restored.count;
+
+    pthread_mutex_unlock( &restored.lock );
+
+    fclose( in );
+    logInfo( "restored %lu renderings (%lu bytes) from \'%s\'", count, loaded, file );
+
+    return result;
+}
+
+/**
+ * @brief take a rendering read back from the snapshot, if it's still valid.
+ * Either way, it's no longer held aside
+ * @param path        path of the template, relative to the mount
+ * @param st          the current status of the template file
+ * @param configHash  hashConfigContent() of the configuration it would be rendered against
+ * @return a new (uncached) rendering with one reference, or NULL if there isn't a valid one
+ */
+tRendered * claimRestored( const char * path, const struct stat * st, uint64_t configHash )
+{
+    tRendered * result = NULL;
+    tRestored * entry  = NULL;
+
+    pthread_mutex_lock( &restored.lock );
+
+    if ( restored.count > 0 ) {
+        tRestored ** link = &restored.buckets[ hashString( path ) & ( kRestoredBuckets - 1 ) ];
+        while ( *link != NULL && strcmp( (*link)->path, path ) != 0 ) {
+            link = &(*link)->next;
+        }
+        entry = *link;
+        if ( entry != NULL ) {
+            *link = entry->next;
+            --restored.count;
+        }
+    }
+
+    pthread_mutex_unlock( &restored.lock );
+
+    if ( entry != NULL ) {
+        if ( entry->record.dev == st->st_dev
+          && entry->record.ino == st->st_ino
+          && entry->record.mtimeSec == st->st_mtim.tv_sec
+          && entry->record.mtimeNsec == st->st_mtim.tv_nsec
+          && entry->record.configHash == configHash ) {
+            result = newRendered( entry->data, entry->record.length );
+            if ( result != NULL ) {
+                entry->data        = NULL;
+                result->configHash = configHash;
+                result->configChangedAt.tv_sec  = entry->record.configChangedSec;
+                result->configChangedAt.tv_nsec = entry->record.configChangedNsec;
+            }
+        } else {
+            logDebug( "restored rendering of \'%s\' is stale", path );
+        }
+        free( entry->data );
+        free( entry );
+    }
+
+    return result;
+}
+
+/**
+ * @brief forget whatever hasn't been claimed
+ */
+void discardRestored( void )
+{
+    pthread_mutex_lock( &restored.lock );
+    clearRestored();
+    pthread_mutex_unlock( &restored.lock );
+}
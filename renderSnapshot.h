@@ -0,0 +1,20 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_RENDERSNAPSHOT_H
+#define TEMPLATEFS_RENDERSNAPSHOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "renderCache.h"
+
+#define kSnapshotMagic  "TFSSNAP2"
+
+int         saveRenderSnapshot( const char * file );
+int         loadRenderSnapshot( const char * file, size_t budget );
+tRendered * claimRestored( const char * path, const struct stat * st, uint64_t configHash );
+void        discardRestored( void );
+
+#endif //TEMPLATEFS_RENDERSNAPSHOT_H
@@ -0,0 +1,259 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* A template whose settings say 'stream = yes' has its output served while
+ * it's still being produced, rather than once it's complete, so readers of
+ * a large output can overlap with producing it. It's produced either by
+ * running an executable template (see streamExecutable()), or by rendering
+ * one through mustach_wrap_write() or a compiled template (see streamTemplate()).
+ *
+ * The output accumulates in the stream. A read that asks for more than
+ * has been produced so far waits until there's enough, or until the
+ * output is complete. Once it is, it's wrapped with newRendered() like any
+ * other output (and so may move into a sealed memfd), and reads are served
+ * from that.
+ *
+ * Opens of a template that's already streaming join the stream in
+ * progress, rather than starting another run or render. There are only ever a
+ * handful of these in progress, so they're kept in a simple list. */
+
+#include "common.h"
+#include "renderStream.h"
+#include "logStuff.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+struct sRenderStream {
+    struct sRenderStream * next;        ///< next stream in progress
+    char *                 path;        ///< path of the template, relative to the mount
+    atomic_uint            refCount;    ///< one for each open handle, plus one for the producer
+
+    pthread_mutex_t        lock;
+    pthread_cond_t         grown;       ///< broadcast whenever more output arrives, or it finishes
+    byte *                 data;        ///< the output so far. NULL once it has finished
+    size_t                 length;      ///< amount of output so far
+    size_t                 allocated;   ///< size of 'data'
+    bool                   finished;
+    int                    status;      ///< zero if it finished successfully, negative errno if not
+    tRendered *            output;      ///< the complete output, once it has finished successfully
+};
+
+static pthread_mutex_t  streamLock = PTHREAD_MUTEX_INITIALIZER;
+static tRenderStream *  streams    = NULL;    ///< the streams still in progress
+
+// ------------------------------------------------------------------------------
+
+static tRenderStream * newRenderStream( const char * path )
+{
+    tRenderStream * result = calloc( 1, sizeof( tRenderStream ) );
+
+    if ( result != NULL ) {
+        result->path = strdup( path );
+        if ( result->path == NULL ) {
+            free( result );
+            result = NULL;
+        } else {
+            /* one for the caller, and one for the producer */
+            atomic_init( &result->refCount, 2 );
+            pthread_mutex_init( &result->lock, NULL );
+            pthread_cond_init( &result->grown, NULL );
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief stop offering a stream to later opens
+ */
+static void unlistStream( tRenderStream * stream )
+{
+    pthread_mutex_lock( &streamLock );
+
+    tRenderStream ** link = &streams;
+    while ( *link != NULL && *link != stream ) {
+        link = &(*link)->next;
+    }
+    if ( *link != NULL ) {
+        *link = stream->next;
+    }
+
+    pthread_mutex_unlock( &streamLock );
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief join the stream in progress for a template, or start a new one
+ * @param path    path of the template, relative to the mount
+ * @param leader  set true if a new stream was started, in which case the
+ * caller must produce its output, and call finishRenderStream() when it's done
+ * @return a reference to the stream, or NULL if there isn't enough memory
+ */
+tRenderStream * joinRenderStream( const char * path, bool * leader )
+{
+    pthread_mutex_lock( &streamLock );
+
+    tRenderStream * result = streams;
+    while ( result != NULL && strcmp( result->path, path ) != 0 ) {
+        result = result->next;
+    }
+
+    if ( result != NULL ) {
+        *leader = false;
+        retainRenderStream( result );
+    } else {
+        *leader = true;
+        result  = newRenderStream( path );
+        if ( result != NULL ) {
+            result->next = streams;
+            streams      = result;
+        }
+    }
+
+    pthread_mutex_unlock( &streamLock );
+
+    return result;
+}
+
+tRenderStream * retainRenderStream( tRenderStream * stream )
+{
+    if ( stream != NULL ) {
+        atomic_fetch_add( &stream->refCount, 1 );
+    }
+    return stream;
+}
+
+void releaseRenderStream( tRenderStream * stream )
+{
+    if ( stream != NULL && atomic_fetch_sub( &stream->refCount, 1 ) == 1 ) {
+        releaseRendered( stream->output );
+        free( stream->data );
+        free( stream->path );
+        pthread_cond_destroy( &stream->grown );
+        pthread_mutex_destroy( &stream->lock );
+        free( stream );
+    }
+}
+
+/**
+ * @brief add more output to a stream, and wake anyone waiting for it. A tOutputSink
+ * @return zero if successful, -ENOMEM if not
+ */
+int appendRenderStream( void * context, const byte * data, size_t length )
+{
+    int             result = 0;
+    tRenderStream * stream = context;
+
+    pthread_mutex_lock( &stream->lock );
+
+    if ( stream->allocated - stream->length < length ) {
+        size_t newSize = ( stream->allocated == 0 ) ? 65536 : stream->allocated * 2;
+        while ( newSize - stream->length < length ) {
+            newSize *= 2;
+        }
+        byte * grown = realloc( stream->data, newSize );
+        if ( grown == NULL ) {
+            result = -ENOMEM;
+        } else {
+            stream->data      = grown;
+            stream->allocated = newSize;
+        }
+    }
+    if ( result == 0 ) {
+        memcpy( &stream->data[ stream->length ], data, length );
+        stream->length += length;
+        pthread_cond_broadcast( &stream->grown );
+    }
+
+    pthread_mutex_unlock( &stream->lock );
+
+    return result;
+}
+
+/**
+ * @brief mark a stream complete, and wake everyone waiting on it
+ * @param status  zero if all the output was produced, negative errno if not
+ */
+void finishRenderStream( tRenderStream * stream, int status )
+{
+    unlistStream( stream );
+
+    pthread_mutex_lock( &stream->lock );
+
+    if ( status == 0 ) {
+        stream->output = newRendered( stream->data, stream->length );
+        if ( stream->output == NULL ) {
+            status = -ENOMEM;
+            free( stream->data );
+        }
+    } else {
+        free( stream->data );
+    }
+    stream->data     = NULL;
+    stream->status   = status;
+    stream->finished = true;
+    pthread_cond_broadcast( &stream->grown );
+
+    pthread_mutex_unlock( &stream->lock );
+
+    logDebug( "finished streaming \'%s\' (%d)", stream->path, status );
+}
+
+/**
+ * @brief read from a stream, waiting until enough of it has been produced
+ * @return the number of bytes read, which is only short at the end of the
+ * output, or negative errno if producing it failed
+ */
+ssize_t readRenderStream( tRenderStream * stream, char * buf, size_t size, off_t offset )
+{
+    ssize_t result = 0;
+
+    pthread_mutex_lock( &stream->lock );
+
+    while ( !stream->finished && stream->length < (size_t)offset + size ) {
+        pthread_cond_wait( &stream->grown, &stream->lock );
+    }
+
+    if ( stream->finished && stream->status != 0 ) {
+        result = stream->status;
+    } else {
+        const byte * data = ( stream->output != NULL ) ? stream->output->data : stream->data;
+        if ( (size_t)offset < stream->length ) {
+            result = stream->length - offset;
+            if ( (size_t)result > size ) {
+                result = size;
+            }
+            memcpy( buf, &data[ offset ], result );
+        }
+    }
+
+    pthread_mutex_unlock( &stream->lock );
+
+    return result;
+}
+
+/**
+ * @return how much output has been produced so far
+ */
+size_t renderStreamLength( tRenderStream * stream )
+{
+    pthread_mutex_lock( &stream->lock );
+    size_t result = stream->length;
+    pthread_mutex_unlock( &stream->lock );
+
+    return result;
+}
+
+/**
+ * @return a new reference to the complete output, or NULL if it hasn't finished, or failed
+ */
+tRendered * renderStreamOutput( tRenderStream * stream )
+{
+    pthread_mutex_lock( &stream->lock );
+    tRendered * result = retainRendered( stream->output );
+    pthread_mutex_unlock( &stream->lock );
+
+    return result;
+}
@@ -0,0 +1,30 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_RENDERSTREAM_H
+#define TEMPLATEFS_RENDERSTREAM_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "renderCache.h"
+
+/**
+ * @brief output that's still being produced, shared by everyone
+ * reading it and whatever is producing it
+ */
+typedef struct sRenderStream tRenderStream;
+
+tRenderStream * joinRenderStream( const char * path, bool * leader );
+tRenderStream * retainRenderStream( tRenderStream * stream );
+void            releaseRenderStream( tRenderStream * stream );
+
+int             appendRenderStream( void * stream, const byte * data, size_t length );
+void            finishRenderStream( tRenderStream * stream, int status );
+
+ssize_t         readRenderStream( tRenderStream * stream, char * buf, size_t size, off_t offset );
+size_t          renderStreamLength( tRenderStream * stream );
+tRendered *     renderStreamOutput( tRenderStream * stream );
+
+#endif //TEMPLATEFS_RENDERSTREAM_H
@@ -0,0 +1,392 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* An in-memory index of every path in the template hierarchy, so the
+ * question 'is there a template for this path, and is it executable?'
+ * can be answered without a syscall. Built when mounted, and kept up to
+ * date by the watcher. Until it's ready (or if the watcher couldn't be
+ * started, so it can't be kept up to date) callers fall back to asking
+ * the filesystem.
+ *
+ * The watcher debounces its events, so for a moment after a template is
+ * created or removed the index can still say otherwise. Callers that find
+ * what's on disk disagrees with it (e.g. ENOENT opening a template) can
+ * have the entry re-probed straight away, with recheckTemplateIndex(). */
+
+#include "common.h"
+#include "templateIndex.h"
+#include "templateSettings.h"
+#include "logStuff.h"
+
+#include <limits.h>
+#include <pthread.h>
+
+/**
+ * @brief one path in the template hierarchy
+ */
+typedef struct sIndexEntry {
+    struct sIndexEntry * next;      ///< next entry in the same hash bucket
+    unsigned int         flags;     ///< kTemplate* bits
+    char                 path[];    ///< relative to the root of the hierarchy, e.g. '/hosts'
+} tIndexEntry;
+
+typedef struct {
+    pthread_rwlock_t  lock;
+    bool              ready;
+    int               rootFD;
+    tIndexEntry **    buckets;
+    size_t            bucketCount;  ///< always a power of two
+    size_t            entryCount;
+} tTemplateIndex;
+
+static tTemplateIndex templateIndex = {
+    .lock   = PTHREAD_RWLOCK_INITIALIZER,
+    .rootFD = -1
+};
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief double the number of buckets, rehashing the existing entries.
+ * Caller must hold the write lock.
+ */
+static void growBuckets( void )
+{
+    size_t         newCount   = ( templateIndex.bucketCount == 0 ) ? 256 : templateIndex.bucketCount * 2;
+    tIndexEntry ** newBuckets = calloc( newCount, sizeof( tIndexEntry * ) );
+
+    if ( newBuckets != NULL ) {
+        for ( size_t i = 0; i < templateIndex.bucketCount; ++i ) {
+            tIndexEntry * entry = templateIndex.buckets[ i ];
+            while ( entry != NULL ) {
+                tIndexEntry * next = entry->next;
+                size_t        idx  = hashString( entry->path ) & ( newCount - 1 );
+
+                entry->next = newBuckets[ idx ];
+                newBuckets[ idx ] = entry;
+                entry = next;
+            }
+        }
+        free( templateIndex.buckets );
+        templateIndex.buckets     = newBuckets;
+        templateIndex.bucketCount = newCount;
+    }
+}
+
+static tIndexEntry ** findLink( const char * path )
+{
+    tIndexEntry ** link = NULL;
+
+    if ( templateIndex.bucketCount > 0 ) {
+        link = &templateIndex.buckets[ hashString( path ) & ( templateIndex.bucketCount - 1 ) ];
+        while ( *link != NULL && strcmp( (*link)->path, path ) != 0 ) {
+            link = &(*link)->next;
+        }
+    }
+    return link;
+}
+
+/**
+ * @brief add, update or remove the entry for 'path'. Zero flags removes it.
+ * Caller must hold the write lock.
+ */
+static void setEntry( const char * path, unsigned int flags )
+{
+    tIndexEntry ** link = findLink( path );
+
+    if ( link != NULL && *link != NULL ) {
+        if ( flags != 0 ) {
+            (*link)->flags = flags;
+        } else {
+            tIndexEntry * entry = *link;
+            *link = entry->next;
+            free( entry );
+            --templateIndex.entryCount;
+        }
+    } else if ( flags != 0 ) {
+        if ( templateIndex.entryCount >= templateIndex.bucketCount ) {
+            growBuckets();
+        }
+
+        size_t        len   = strlen( path );
+        tIndexEntry * entry = malloc( sizeof( tIndexEntry ) + len + 1 );
+        if ( entry == NULL ) {
+            logError( "out of memory indexing \'%s\'", path );
+        } else {
+            memcpy( entry->path, path, len + 1 );
+            entry->flags = flags;
+
+            size_t idx = hashString( path ) & ( templateIndex.bucketCount - 1 );
+            entry->next = templateIndex.buckets[ idx ];
+            templateIndex.buckets[ idx ] = entry;
+            ++templateIndex.entryCount;
+        }
+    }
+}
+
+/**
+ * @brief remove every entry below the directory 'path'.
+ * Caller must hold the write lock.
+ */
+static void removeBelow( const char * path )
+{
+    size_t len = strlen( path );
+
+    for ( size_t i = 0; i < templateIndex.bucketCount; ++i ) {
+        tIndexEntry ** link = &templateIndex.buckets[ i ];
+        while ( *link != NULL ) {
+            tIndexEntry * entry = *link;
+            if ( strncmp( entry->path, path, len ) == 0 && entry->path[ len ] == '/' ) {
+                *link = entry->next;
+                free( entry );
+                --templateIndex.entryCount;
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+}
+
+static void removeAll( void )
+{
+    for ( size_t i = 0; i < templateIndex.bucketCount; ++i ) {
+        tIndexEntry * entry = templateIndex.buckets[ i ];
+        while ( entry != NULL ) {
+            tIndexEntry * next = entry->next;
+            free( entry );
+            entry = next;
+        }
+        templateIndex.buckets[ i ] = NULL;
+    }
+    templateIndex.entryCount = 0;
+}
+
+/**
+ * @brief ask the filesystem what 'path' is, the same way hasTemplate() used to.
+ * Settings files aren't templates, so aren't indexed themselves.
+ */
+static unsigned int probeFlags( const char * path )
+{
+    unsigned int flags = 0;
+    struct stat  st;
+
+    if ( !isSettingsPath( path )
+      && faccessat( templateIndex.rootFD, &path[1], R_OK, AT_SYMLINK_NOFOLLOW ) == 0 ) {
+        flags |= kTemplatePresent;
+        if ( faccessat( templateIndex.rootFD, &path[1], X_OK, AT_SYMLINK_NOFOLLOW ) == 0 ) {
+            flags |= kTemplateExecutable;
+        }
+        if ( fstatat( templateIndex.rootFD, &path[1], &st, AT_SYMLINK_NOFOLLOW ) == 0
+          && S_ISDIR( st.st_mode ) ) {
+            flags |= kTemplateIsDir;
+        } else {
+            char settings[ PATH_MAX ];
+            snprintf( settings, sizeof( settings ), "%s%s", &path[1], kSettingsSuffix );
+            if ( faccessat( templateIndex.rootFD, settings, R_OK, 0 ) == 0 ) {
+                flags |= kTemplateHasSettings;
+            }
+        }
+    }
+    errno = 0;
+
+    return flags;
+}
+
+/**
+ * @brief index a directory and everything below it. '' is the root.
+ * Caller must hold the write lock.
+ */
+static void indexTree( const char * dir )
+{
+    int fd = ( dir[0] == '\0' ) ? dup( templateIndex.rootFD )
+                                : openat( templateIndex.rootFD, &dir[1], O_RDONLY | O_DIRECTORY | O_NOFOLLOW );
+    DIR * dp = ( fd < 0 ) ? NULL : fdopendir( fd );
+    if ( dp == NULL ) {
+        if ( fd >= 0 ) {
+            close( fd );
+        }
+        return;
+    }
+
+    struct dirent * entry;
+    while ( ( entry = readdir( dp ) ) != NULL ) {
+        if ( strcmp( entry->d_name, "." ) == 0 || strcmp( entry->d_name, ".." ) == 0 ) {
+            continue;
+        }
+
+        char path[ PATH_MAX ];
+        snprintf( path, sizeof( path ), "%s/%s", dir, entry->d_name );
+
+        unsigned int flags = probeFlags( path );
+        setEntry( path, flags );
+        if ( flags & kTemplateIsDir ) {
+            indexTree( path );
+        }
+    }
+    closedir( dp );
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief index the template hierarchy, and start answering lookups from memory.
+ * The watcher should already be running, so no changes are missed.
+ * @param templatesFD  descriptor of the root of the template hierarchy
+ * @return zero if successful, negative errno if not
+ */
+int buildTemplateIndex( int templatesFD )
+{
+    int result = 0;
+
+    pthread_rwlock_wrlock( &templateIndex.lock );
+
+    templateIndex.rootFD = templatesFD;
+    removeAll();
+    growBuckets();
+    if ( templateIndex.buckets == NULL ) {
+        result = -ENOMEM;
+    } else {
+        indexTree( "" );
+        templateIndex.ready = true;
+        logInfo( "indexed %lu template paths", templateIndex.entryCount );
+    }
+
+    pthread_rwlock_unlock( &templateIndex.lock );
+
+    return result;
+}
+
+void releaseTemplateIndex( void )
+{
+    pthread_rwlock_wrlock( &templateIndex.lock );
+
+    templateIndex.ready = false;
+    removeAll();
+    free( templateIndex.buckets );
+    templateIndex.buckets     = NULL;
+    templateIndex.bucketCount = 0;
+
+    pthread_rwlock_unlock( &templateIndex.lock );
+}
+
+/**
+ * @brief true if lookupTemplateIndex() can be relied on
+ */
+bool isTemplateIndexReady( void )
+{
+    pthread_rwlock_rdlock( &templateIndex.lock );
+    bool result = templateIndex.ready;
+    pthread_rwlock_unlock( &templateIndex.lock );
+
+    return result;
+}
+
+/**
+ * @brief what's known about 'path' in the template hierarchy
+ * @param path  relative to the mount, e.g. '/hosts'
+ * @return the kTemplate* bits, or zero if there's no such template
+ */
+unsigned int lookupTemplateIndex( const char * path )
+{
+    unsigned int result = 0;
+
+    pthread_rwlock_rdlock( &templateIndex.lock );
+
+    tIndexEntry ** link = findLink( path );
+    if ( link != NULL && *link != NULL ) {
+        result = (*link)->flags;
+    }
+
+    pthread_rwlock_unlock( &templateIndex.lock );
+
+    return result;
+}
+
+/**
+ * @brief ask the filesystem about 'path' again, rather than waiting for the watcher to
+ * @param path  relative to the mount, e.g. '/hosts'
+ * @return true if what the index said about it was out of date
+ */
+bool recheckTemplateIndex( const char * path )
+{
+    bool result = false;
+
+    pthread_rwlock_wrlock( &templateIndex.lock );
+
+    if ( templateIndex.ready ) {
+        tIndexEntry ** link  = findLink( path );
+        unsigned int   was   = ( link != NULL && *link != NULL ) ? (*link)->flags : 0;
+        unsigned int   flags = probeFlags( path );
+
+        if ( flags != was ) {
+            logDebug( "index of '%s' was stale", path );
+            setEntry( path, flags );
+            result = true;
+        }
+    }
+
+    pthread_rwlock_unlock( &templateIndex.lock );
+
+    return result;
+}
+
+/**
+ * @brief call 'callback' for every path in the index.
+ * The index is locked for the duration, so the callback should be quick.
+ */
+void forEachTemplate( void (* callback)( const char * path, unsigned int flags, void * context ),
+                      void * context )
+{
+    pthread_rwlock_rdlock( &templateIndex.lock );
+
+    for ( size_t i = 0; i < templateIndex.bucketCount; ++i ) {
+        for ( tIndexEntry * entry = templateIndex.buckets[ i ]; entry != NULL; entry = entry->next ) {
+            callback( entry->path, entry->flags, context );
+        }
+    }
+
+    pthread_rwlock_unlock( &templateIndex.lock );
+}
+
+/**
+ * @brief watch consumer that keeps the index in step with the template hierarchy
+ */
+void updateTemplateIndex( const tWatchEvent * events, size_t count, void * context )
+{
+    (void)context;
+
+    pthread_rwlock_wrlock( &templateIndex.lock );
+
+    if ( templateIndex.ready ) {
+        for ( size_t i = 0; i < count; ++i ) {
+            const tWatchEvent * event = &events[ i ];
+
+            if ( event->tree != kTreeTemplates ) {
+                continue;
+            }
+
+            if ( event->kinds & kChangeOverflow ) {
+                logInfo( "re-indexing templates" );
+                removeAll();
+                indexTree( "" );
+            } else if ( isSettingsPath( event->path ) ) {
+                /* update the template the settings file belongs to */
+                char   path[ PATH_MAX ];
+                size_t len = strlen( event->path ) - ( sizeof( kSettingsSuffix ) - 1 );
+
+                snprintf( path, sizeof( path ), "%.*s", (int)len, event->path );
+                setEntry( path, probeFlags( path ) );
+            } else {
+                /* the events are coalesced, so check what's there now */
+                unsigned int flags = probeFlags( event->path );
+                if ( event->isDir && !( flags & kTemplateIsDir ) ) {
+                    removeBelow( event->path );
+                }
+                setEntry( event->path, flags );
+            }
+        }
+    }
+
+    pthread_rwlock_unlock( &templateIndex.lock );
+}
@@ -0,0 +1,27 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_TEMPLATEINDEX_H
+#define TEMPLATEFS_TEMPLATEINDEX_H
+
+#include <stdbool.h>
+
+#include "watcher.h"
+
+/* what's known about a path in the template hierarchy */
+#define kTemplatePresent     0x01   ///< exists, and is readable
+#define kTemplateExecutable  0x02   ///< is executable
+#define kTemplateIsDir       0x04   ///< is a directory
+#define kTemplateHasSettings 0x08   ///< has a settings file, see templateSettings.c
+
+int          buildTemplateIndex( int templatesFD );
+void         releaseTemplateIndex( void );
+bool         isTemplateIndexReady( void );
+unsigned int lookupTemplateIndex( const char * path );
+bool         recheckTemplateIndex( const char * path );
+void         forEachTemplate( void (* callback)( const char * path, unsigned int flags, void * context ),
+                              void * context );
+void         updateTemplateIndex( const tWatchEvent * events, size_t count, void * context );
+
+#endif //TEMPLATEFS_TEMPLATEINDEX_H
@@ -0,0 +1,342 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* A template can have a settings file alongside it, named after it with
+ * kSettingsSuffix appended, e.g. 'hosts.templatefs' next to 'hosts'.
+ * It holds 'name = value' lines. Blank lines and lines starting with '#'
+ * are ignored. Settings files are never treated as templates themselves.
+ *
+ *     worker  = yes                  run as a long-lived worker (executables only)
+ *     workers = 4                    size of its worker pool
+ *     ttl     = 300                  reuse its output for up to this many seconds
+ *     inputs  = /etc/hostname ...    ...unless one of these files changes
+ *     keys    = system:/config/... ...or one of these libelektra keys does
+ *     roots   = system:/config/ntp   only load these parts of the configuration to render it
+ *     timeout   = 2000               kill it if it runs for more than this many ms
+ *     maxoutput = 1M                 kill it if it writes more than this to stdout
+ *     stream  = yes                  serve its output while it's still being produced
+ *
+ * 'inputs', 'keys' and 'roots' take whitespace-separated lists, and may be repeated.
+ *
+ * Parsed settings are cached, and re-read when the file changes. */
+
+#include "common.h"
+#include "templatefs.h"
+#include "templateSettings.h"
+#include "logStuff.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+
+/**
+ * @brief the parsed settings of one template
+ */
+typedef struct sSettingsEntry {
+    struct sSettingsEntry * next;
+    dev_t                   dev;        ///< identity of the settings file they were parsed from
+    ino_t                   ino;
+    struct timespec         mtime;
+    tTemplateSettings *     settings;
+    char                    path[];     ///< path of the template, relative to the mount
+} tSettingsEntry;
+
+static pthread_mutex_t  settingsLock = PTHREAD_MUTEX_INITIALIZER;
+static tSettingsEntry * settingsCache = NULL;
+
+// ------------------------------------------------------------------------------
+
+/* used when a template has no settings file. Never freed */
+static char *            noList[] = { NULL };
+static tTemplateSettings defaults = {
+    .workers = kDefaultWorkers,
+    .inputs  = noList,
+    .keys    = noList,
+    .roots   = noList
+};
+
+static void freeList( char ** list )
+{
+    if ( list != NULL && list != noList ) {
+        for ( char ** item = list; *item != NULL; ++item ) {
+            free( *item );
+        }
+        free( list );
+    }
+}
+
+/**
+ * @brief append each whitespace-separated word in 'value' to a NULL-terminated list
+ */
+static char ** appendWords( char ** list, char * value )
+{
+    size_t count = 0;
+    while ( list[ count ] != NULL ) {
+        ++count;
+    }
+
+    char * state;
+    for ( char * word = strtok_r( value, " \t", &state ); word != NULL; word = strtok_r( NULL, " \t", &state ) ) {
+        char ** grown = malloc( ( count + 2 ) * sizeof( char * ) );
+        if ( grown == NULL ) {
+            break;
+        }
+        memcpy( grown, list, count * sizeof( char * ) );
+        grown[ count ] = strdup( word );
+        if ( grown[ count ] == NULL ) {
+            free( grown );
+            break;
+        }
+        grown[ ++count ] = NULL;
+
+        if ( list != noList ) {
+            free( list );
+        }
+        list = grown;
+    }
+    return list;
+}
+
+static bool parseBool( const char * value )
+{
+    return ( strcasecmp( value, "yes" ) == 0
+          || strcasecmp( value, "true" ) == 0
+          || strcasecmp( value, "on" ) == 0
+          || strcmp( value, "1" ) == 0 );
+}
+
+/**
+ * @brief apply one 'name = value' line
+ */
+static void parseSetting( const char * file, unsigned int line, char * name, char * value, tTemplateSettings * settings )
+{
+    if ( strcmp( name, "worker" ) == 0 ) {
+        settings->worker = parseBool( value );
+    } else if ( strcmp( name, "workers" ) == 0 ) {
+        char *        end;
+        unsigned long count = strtoul( value, &end, 10 );
+        if ( *end != '\0' || count == 0 ) {
+            logError( "%s:%u: invalid number of workers \'%s\'", file, line, value );
+        } else {
+            settings->workers = count;
+        }
+    } else if ( strcmp( name, "stream" ) == 0 ) {
+        settings->stream = parseBool( value );
+    } else if ( strcmp( name, "ttl" ) == 0 ) {
+        char *        end;
+        unsigned long ttl = strtoul( value, &end, 10 );
+        if ( *end != '\0' ) {
+            logError( "%s:%u: invalid ttl \'%s\'", file, line, value );
+        } else {
+            settings->ttl = ttl;
+        }
+    } else if ( strcmp( name, "timeout" ) == 0 ) {
+        char *        end;
+        unsigned long timeout = strtoul( value, &end, 10 );
+        if ( *end != '\0' ) {
+            logError( "%s:%u: invalid timeout \'%s\'", file, line, value );
+        } else {
+            settings->timeout = timeout;
+        }
+    } else if ( strcmp( name, "maxoutput" ) == 0 ) {
+        if ( parseByteSize( value, &settings->maxOutput ) != 0 ) {
+            logError( "%s:%u: invalid maxoutput \'%s\'", file, line, value );
+        }
+    } else if ( strcmp( name, "inputs" ) == 0 ) {
+        settings->inputs = appendWords( settings->inputs, value );
+    } else if ( strcmp( name, "keys" ) == 0 ) {
+        settings->keys = appendWords( settings->keys, value );
+    } else if ( strcmp( name, "roots" ) == 0 ) {
+        settings->roots = appendWords( settings->roots, value );
+    } else {
+        logWarning( "%s:%u: unknown setting \'%s\'", file, line, name );
+    }
+}
+
+static char * trim( char * str )
+{
+    while ( isspace( (unsigned char)*str ) ) {
+        ++str;
+    }
+    char * end = str + strlen( str );
+    while ( end > str && isspace( (unsigned char)end[-1] ) ) {
+        --end;
+    }
+    *end = '\0';
+    return str;
+}
+
+static void parseSettings( FILE * fp, const char * file, tTemplateSettings * settings )
+{
+    char         text[ 1024 ];
+    unsigned int line = 0;
+
+    while ( fgets( text, sizeof( text ), fp ) != NULL ) {
+        ++line;
+
+        char * name = trim( text );
+        if ( *name == '\0' || *name == '#' ) {
+            continue;
+        }
+
+        char * value = strchr( name, '=' );
+        if ( value == NULL ) {
+            logError( "%s:%u: expected \'name = value\'", file, line );
+        } else {
+            *value++ = '\0';
+            parseSetting( file, line, trim( name ), trim( value ), settings );
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief true if 'path' names a settings file, rather than a template
+ */
+bool isSettingsPath( const char * path )
+{
+    size_t len    = strlen( path );
+    size_t suffix = sizeof( kSettingsSuffix ) - 1;
+
+    return ( len > suffix && strcmp( &path[ len - suffix ], kSettingsSuffix ) == 0 );
+}
+
+/**
+ * @brief the settings a template has if it has no settings file
+ */
+const tTemplateSettings * defaultTemplateSettings( void )
+{
+    return &defaults;
+}
+
+/**
+ * @brief get the settings for a template, or the defaults if it has no settings file
+ * @param templatesFD  descriptor of the root of the template hierarchy
+ * @param path         path of the template, relative to the mount
+ * @return the settings. Release with releaseTemplateSettings()
+ */
+const tTemplateSettings * acquireTemplateSettings( int templatesFD, const char * path )
+{
+    tTemplateSettings * result = &defaults;
+    char                file[ PATH_MAX ];
+    struct stat         st;
+
+    snprintf( file, sizeof( file ), "%s%s", &path[1], kSettingsSuffix );
+
+    if ( fstatat( templatesFD, file, &st, 0 ) != 0 ) {
+        errno = 0;
+        return result;
+    }
+
+    pthread_mutex_lock( &settingsLock );
+
+    tSettingsEntry ** link = &settingsCache;
+    while ( *link != NULL && strcmp( (*link)->path, path ) != 0 ) {
+        link = &(*link)->next;
+    }
+
+    tSettingsEntry * entry = *link;
+    if ( entry != NULL
+      && entry->dev == st.st_dev
+      && entry->ino == st.st_ino
+      && entry->mtime.tv_sec == st.st_mtim.tv_sec
+      && entry->mtime.tv_nsec == st.st_mtim.tv_nsec ) {
+        result = entry->settings;
+    } else {
+        int    fd = openat( templatesFD, file, O_RDONLY );
+        FILE * fp = ( fd < 0 ) ? NULL : fdopen( fd, "r" );
+        tTemplateSettings * settings = calloc( 1, sizeof( tTemplateSettings ) );
+
+        if ( fp == NULL || settings == NULL ) {
+            logError( "unable to read \'%s\'", file );
+            if ( fp != NULL ) {
+                fclose( fp );
+            } else if ( fd >= 0 ) {
+                close( fd );
+            }
+            free( settings );
+        } else {
+            *settings = defaults;
+            atomic_init( &settings->refCount, 1 );   /* the cache's reference */
+            parseSettings( fp, file, settings );
+            fclose( fp );
+
+            if ( entry == NULL ) {
+                entry = calloc( 1, sizeof( tSettingsEntry ) + strlen( path ) + 1 );
+                if ( entry != NULL ) {
+                    strcpy( entry->path, path );
+                    entry->next   = settingsCache;
+                    settingsCache = entry;
+                }
+            }
+            if ( entry == NULL ) {
+                /* can't cache it, so the caller gets the only reference */
+                result = settings;
+            } else {
+                releaseTemplateSettings( entry->settings );
+                entry->dev      = st.st_dev;
+                entry->ino      = st.st_ino;
+                entry->mtime    = st.st_mtim;
+                entry->settings = settings;
+                result          = settings;
+            }
+        }
+    }
+
+    if ( result != &defaults && entry != NULL && entry->settings == result ) {
+        atomic_fetch_add( &result->refCount, 1 );
+    }
+
+    pthread_mutex_unlock( &settingsLock );
+
+    return result;
+}
+
+/**
+ * @brief take another reference to settings, e.g. for a run that outlives the open that started it
+ */
+const tTemplateSettings * retainTemplateSettings( const tTemplateSettings * settings )
+{
+    tTemplateSettings * mutable = (tTemplateSettings *)settings;
+
+    if ( mutable != NULL && mutable != &defaults ) {
+        atomic_fetch_add( &mutable->refCount, 1 );
+    }
+    return settings;
+}
+
+void releaseTemplateSettings( const tTemplateSettings * settings )
+{
+    tTemplateSettings * mutable = (tTemplateSettings *)settings;
+
+    if ( mutable != NULL && mutable != &defaults
+      && atomic_fetch_sub( &mutable->refCount, 1 ) == 1 ) {
+        freeList( mutable->inputs );
+        freeList( mutable->keys );
+        freeList( mutable->roots );
+        free( mutable );
+    }
+}
+
+/**
+ * @brief discard the cached settings for a template
+ */
+void forgetTemplateSettings( const char * path )
+{
+    pthread_mutex_lock( &settingsLock );
+
+    tSettingsEntry ** link = &settingsCache;
+    while ( *link != NULL && strcmp( (*link)->path, path ) != 0 ) {
+        link = &(*link)->next;
+    }
+    if ( *link != NULL ) {
+        tSettingsEntry * entry = *link;
+        *link = entry->next;
+        releaseTemplateSettings( entry->settings );
+        free( entry );
+    }
+
+    pthread_mutex_unlock( &settingsLock );
+}
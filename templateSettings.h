@@ -0,0 +1,39 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_TEMPLATESETTINGS_H
+#define TEMPLATEFS_TEMPLATESETTINGS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/* a template's settings live in a file alongside it, with this appended to its name */
+#define kSettingsSuffix   ".templatefs"
+
+#define kDefaultWorkers   2
+
+/**
+ * @brief per-template settings, read from its settings file. Immutable once published.
+ */
+typedef struct {
+    atomic_uint   refCount;
+    bool          worker;     ///< run as a long-lived worker, see coprocess.c
+    unsigned int  workers;    ///< maximum number of workers for this template
+    bool          stream;     ///< serve the output as it's produced, see renderStream.c
+    unsigned long ttl;        ///< seconds an executable's output may be reused. Zero never
+    unsigned long timeout;    ///< ms an executable may run for. Zero for the mount's default
+    size_t        maxOutput;  ///< most output accepted from an executable. Zero for the mount's default
+    char **       inputs;     ///< NULL-terminated list of files the output depends on
+    char **       keys;       ///< NULL-terminated list of libelektra keys the output depends on
+    char **       roots;      ///< NULL-terminated list of the only parts of the configuration it uses. Empty for all of it
+} tTemplateSettings;
+
+bool                      isSettingsPath( const char * path );
+const tTemplateSettings * defaultTemplateSettings( void );
+const tTemplateSettings * acquireTemplateSettings( int templatesFD, const char * path );
+const tTemplateSettings * retainTemplateSettings( const tTemplateSettings * settings );
+void                      releaseTemplateSettings( const tTemplateSettings * settings );
+void                      forgetTemplateSettings( const char * path );
+
+#endif //TEMPLATEFS_TEMPLATESETTINGS_H
@@ -42,11 +42,16 @@
 #include <fuse3/fuse_common.h>
 #include <fuse3/fuse_opt.h>
 
-#ifdef INSTRUMENT_FUNCTIONS
-#include <dlfcn.h>
-#endif
+#include <signal.h>
 
 #include "fuseOperations.h"
+#include "lowlevelOperations.h"
+#include "configStore.h"
+#include "execEngine.h"
+#include "renderCache.h"
+#include "renderPool.h"
+#include "kernelCache.h"
+#include "traceStuff.h"
 
 #define VERSION "0.2"
 
@@ -58,69 +63,188 @@ tGlobals globals;
 const struct fuse_opt tmplCmdLineOptions[] =
 {
     { "templates=%s", offsetof( tTemplateOptions, templates ), 0 },
+    { "cachesize=%s", offsetof( tTemplateOptions, cacheSize ), 0 },
+    { "configcheck=%lu", offsetof( tTemplateOptions, configCheck ), 0 },
+    { "kernelcache", offsetof( tTemplateOptions, kernelCache ), 1 },
+    { "cachetimeout=%lf", offsetof( tTemplateOptions, cacheTimeout ), 0 },
+    { "warmup", offsetof( tTemplateOptions, warmup ), 1 },
+    { "snapshot=%s", offsetof( tTemplateOptions, snapshot ), 0 },
+    { "exectimeout=%lu", offsetof( tTemplateOptions, execTimeout ), 0 },
+    { "maxoutput=%s", offsetof( tTemplateOptions, execMaxOutput ), 0 },
+    { "execcgroup=%s", offsetof( tTemplateOptions, execCgroup ), 0 },
+    { "execcpu=%u", offsetof( tTemplateOptions, execCPU ), 0 },
+    { "execmemory=%s", offsetof( tTemplateOptions, execMemory ), 0 },
+    { "servestale", offsetof( tTemplateOptions, serveStale ), 1 },
+    { "renderthreads=%u", offsetof( tTemplateOptions, renderThreads ), 0 },
+    { "lowlevel", offsetof( tTemplateOptions, lowlevel ), 1 },
+    { "passthrough", offsetof( tTemplateOptions, passthrough ), 1 },
+    { "loglevel=%u", offsetof( tTemplateOptions, logLevel ), 0 },
+    { "logasync", offsetof( tTemplateOptions, logAsync ), 1 },
+    { "trace=%s", offsetof( tTemplateOptions, trace ), 0 },
     FUSE_OPT_END
 };
 
+const char tmplOptionsHelp[] =
+    "templatefs options:\n"
+    "    -o templates=DIR       root of the template hierarchy (required)\n"
+    "    -o cachesize=BYTES     memory budget for rendered templates, with an\n"
+    "                           optional K, M or G suffix. 0 disables caching\n"
+    "                           (default: 16M)\n"
+    "    -o configcheck=MS      minimum time between checks for configuration\n"
+    "                           changes (default: 1000). SIGUSR1 forces a check\n"
+    "    -o kernelcache         let the kernel cache attributes, directory entries\n"
+    "                           and file contents, invalidating them on changes\n"
+    "    -o cachetimeout=SECS   how long the kernel may cache attributes and\n"
+    "                           entries with kernelcache (default: 10)\n"
+    "    -o warmup              render templates in the background when mounted,\n"
+    "                           and whenever templates or configuration change\n"
+    "    -o snapshot=FILE       save rendered templates to FILE when unmounted, and\n"
+    "                           serve them from it when next mounted, if they're\n"
+    "                           still up to date. Also keeps their mtimes across\n"
+    "                           restarts, if the configuration hasn't changed\n"
+    "    -o exectimeout=MS      kill an executable template that runs for longer\n"
+    "                           than this. 0 waits indefinitely (default: 10000)\n"
+    "    -o maxoutput=BYTES     kill an executable template that writes more than\n"
+    "                           this, with an optional K, M or G suffix (default: 16M)\n"
+    "    -o execcgroup=DIR      run executable templates in child cgroups of this\n"
+    "                           delegated cgroup v2 directory\n"
+    "    -o execcpu=PERCENT     CPU limit for each run of an executable template,\n"
+    "                           as a percentage of one CPU. Needs execcgroup\n"
+    "    -o execmemory=BYTES    memory limit for each run of an executable template.\n"
+    "                           Needs execcgroup\n"
+    "    -o servestale          if an executable template times out, serve its last\n"
+    "                           good output instead of failing\n"
+    "    -o renderthreads=N     how many renders may run at once. One is kept for\n"
+    "                           templates that aren't executable (default: 4)\n"
+    "    -o lowlevel            use the low-level fuse API, which looks up one path\n"
+    "                           component at a time rather than whole paths\n"
+    "    -o passthrough         let the kernel read and write files that have no\n"
+    "                           template itself, bypassing templatefs (Linux 6.9\n"
+    "                           or later, else ignored). Implies lowlevel\n"
+    "    -o loglevel=N          least important messages to log, from 0 (emergency)\n"
+    "                           to 7 (debug). Anything less is never formatted\n"
+    "                           (default: 7)\n"
+    "    -o logasync            log from a background thread, so the fuse threads\n"
+    "                           don't wait on syslog. Messages are dropped (and\n"
+    "                           counted) rather than waited for if it falls behind\n"
+    "    -o trace=FILE          record every function entry and exit to FILE, for\n"
+    "                           --trace-json. Needs an INSTRUMENT_FUNCTIONS build\n"
+    "\n"
+    "'templatefs --trace-json FILE' writes a trace recorded with -o trace=FILE to\n"
+    "stdout, as Chrome trace JSON (which Perfetto reads too).\n"
+    "\n"
+    "A template's settings file can override exectimeout and maxoutput for it.\n";
+
 int processTmplOpts( void * data, const char * arg, int key, struct fuse_args * outargs )
 {
     (void)data; (void)arg; (void)key; (void)outargs;
     return 1;
 }
 
-// ------------------------------------------------------------------------------
+/**
+ * @brief parse a size in bytes, with an optional K, M or G suffix
+ * @param str     the string to parse
+ * @param result  where to store the size
+ * @return zero if successful, -EINVAL if the string isn't a valid size
+ */
+int parseByteSize( const char * str, size_t * result )
+{
+    char *        end;
+    unsigned long value;
 
-#ifdef INSTRUMENT_FUNCTIONS
-unsigned int depth = 0;
-void *symbols = NULL;
+    errno = 0;
+    value = strtoul( str, &end, 10 );
+    if ( errno != 0 || end == str ) {
+        return -EINVAL;
+    }
 
-const char leader[] = "...............................";
+    switch ( *end )
+    {
+    case 'G': case 'g': value *= 1024; /* fall through */
+    case 'M': case 'm': value *= 1024; /* fall through */
+    case 'K': case 'k': value *= 1024; ++end; break;
+    default: break;
+    }
 
-__attribute__((no_instrument_function))
-void __cyg_profile_func_enter( void * func, void * caller )
+    if ( *end != '\0' ) {
+        return -EINVAL;
+    }
+    *result = value;
+    return 0;
+}
+
+/**
+ * @brief apply the templatefs-specific options that configure subsystems
+ * @return zero if successful, non-zero if an option was invalid
+ */
+int applyTmplOpts( void )
 {
-    Dl_info info;
-    int result = 0;
+    int    result = 0;
+    size_t cacheBudget = kDefaultRenderCacheBudget;
+    size_t maxOutput   = kDefaultExecMaxOutput;
+    size_t memoryMax   = 0;
 
-    if (symbols != NULL)
-    {
-        result = dladdr( func, &info );
-    }
-    if ( result != 0 && info.dli_sname != NULL )
-    {
-        syslog( LOG_DEBUG, "%.*s{ %s", 2 * depth, leader, info.dli_sname );
+    if ( globals.template.logLevel > kLogDebug ) {
+        logCritical( "fatal: invalid loglevel %u", globals.template.logLevel );
+        result = 1;
+    } else if ( globals.template.cacheSize != NULL
+      && parseByteSize( globals.template.cacheSize, &cacheBudget ) != 0 ) {
+        logCritical( "fatal: invalid cachesize \'%s\'", globals.template.cacheSize );
+        result = 1;
+    } else if ( globals.template.execMaxOutput != NULL
+             && parseByteSize( globals.template.execMaxOutput, &maxOutput ) != 0 ) {
+        logCritical( "fatal: invalid maxoutput \'%s\'", globals.template.execMaxOutput );
+        result = 1;
+    } else if ( globals.template.execMemory != NULL
+             && parseByteSize( globals.template.execMemory, &memoryMax ) != 0 ) {
+        logCritical( "fatal: invalid execmemory \'%s\'", globals.template.execMemory );
+        result = 1;
+    } else if ( configureExecEngine( globals.template.execTimeout,
+                                     maxOutput,
+                                     globals.template.execCgroup,
+                                     globals.template.execCPU,
+                                     memoryMax ) != 0 ) {
+        result = 1;
     } else {
-        syslog( LOG_DEBUG, "%.*s{ %p", 2 * depth, leader, func );
+        /* less important messages go nowhere, so aren't formatted */
+        setLogStuffDestination( kLogFunctions, kLogToTheVoid, kLogNothing );
+        setLogStuffDestination( globals.template.logLevel, kLogToSyslog, kLogNormal );
+
+        initRenderCache( cacheBudget );
     }
 
-    ++depth;
+    return result;
 }
 
-__attribute__((no_instrument_function))
-void __cyg_profile_func_exit( void * func, void * caller )
+/**
+ * @brief SIGUSR1 asks us to check for configuration changes right away
+ */
+static void configChangedHandler( int UNUSED( signum ) )
 {
-    Dl_info info;
-    int result = 0;
+    requestConfigRefresh();
+}
 
-    --depth;
+static void catchConfigChanged( void )
+{
+    struct sigaction sa;
 
-    info.dli_sname = NULL;
-    if ( symbols != NULL)
-    {
-        result = dladdr( func, &info );
-    }
-    if ( result != 0 && info.dli_sname != NULL )
-    {
-        syslog( LOG_DEBUG, "%.*s  %s }", 2 * depth, leader, info.dli_sname );
-    }
-    else
-    {
-        syslog( LOG_DEBUG, "%.*s  %p }", 2 * depth, leader, func );
-    }
+    memset( &sa, 0, sizeof( sa ) );
+    sa.sa_handler = configChangedHandler;
+    sigemptyset( &sa.sa_mask );
+    sa.sa_flags = SA_RESTART;
+    sigaction( SIGUSR1, &sa, NULL );
 }
-#endif
 
 // ------------------------------------------------------------------------------
 
+/**
+ * @brief kernel cache invalidation for the high-level API
+ */
+static int invalidatePath( const char * path, void * context )
+{
+    return fuse_invalidate_path( (struct fuse *)context, path );
+}
+
 int lightFuse( struct fuse_args * args )
 {
     int result;
@@ -164,8 +288,16 @@ int lightFuse( struct fuse_args * args )
                 logCritical( "error: fuse_set_signal_handlers failed" );
                 result = 6;
             }
+            else if ( globals.template.kernelCache && startKernelCache( invalidatePath, fuse ) != 0 )
+            {
+                logCritical( "error: unable to start kernel cache invalidation" );
+                result = 6;
+                fuse_remove_signal_handlers( se );
+            }
             else
             {
+                catchConfigChanged();
+
                 if ( globals.options.singlethread )
                 {
                     result = fuse_loop( fuse );
@@ -183,6 +315,7 @@ int lightFuse( struct fuse_args * args )
                     logCritical( "error: fuse_loop failed" );
                     result = 7;
                 }
+                stopKernelCache();
                 fuse_remove_signal_handlers( se );
             }
         }
@@ -193,6 +326,80 @@ int lightFuse( struct fuse_args * args )
     return result;
 }
 
+/**
+ * @brief the same as lightFuse(), but through the low-level API (see lowlevelOperations.c)
+ */
+int lightFuseLowlevel( struct fuse_args * args )
+{
+    int result;
+    struct fuse_session * se;
+
+    se = fuse_session_new( args,
+                           &templatefsLowlevelOperations,
+                           sizeof( templatefsLowlevelOperations ),
+                           initPrivateData( globals.options.mountpoint,
+                                            globals.template.templates ) );
+
+    if ( se == NULL )
+    {
+        logCritical( "error: fuse_session_new failed" );
+        return 3;
+    }
+
+    if ( fuse_session_mount( se, globals.options.mountpoint ) != 0 )
+    {
+        logCritical( "error: fuse_session_mount failed" );
+        result = 4;
+    }
+    else
+    {
+        if ( fuse_daemonize( globals.options.foreground ) != 0 )
+        {
+            logCritical( "error: fuse_daemonize failed" );
+            result = 5;
+        }
+        else if ( fuse_set_signal_handlers( se ) != 0 )
+        {
+            logCritical( "error: fuse_set_signal_handlers failed" );
+            result = 6;
+        }
+        else if ( globals.template.kernelCache && startKernelCache( invalidateInodePath, se ) != 0 )
+        {
+            logCritical( "error: unable to start kernel cache invalidation" );
+            result = 6;
+            fuse_remove_signal_handlers( se );
+        }
+        else
+        {
+            catchConfigChanged();
+
+            if ( globals.options.singlethread )
+            {
+                result = fuse_session_loop( se );
+            }
+            else
+            {
+                struct fuse_loop_config loop_config;
+
+                loop_config.clone_fd         = globals.options.clone_fd;
+                loop_config.max_idle_threads = globals.options.max_idle_threads;
+                result = fuse_session_loop_mt( se, &loop_config );
+            }
+            if ( result != 0 )
+            {
+                logCritical( "error: fuse_session_loop failed" );
+                result = 7;
+            }
+            stopKernelCache();
+            fuse_remove_signal_handlers( se );
+        }
+        fuse_session_unmount( se );
+    }
+    fuse_session_destroy( se );
+
+    return result;
+}
+
 /**
  * @brief main entry point
  * @param argc  count of command line arguments
@@ -218,17 +425,14 @@ int main( int argc, char * argv[], char * const envp[] )
         logDebug( "%d: %s", i, envp[i] );
     }
 
-#ifdef INSTRUMENT_FUNCTIONS
-    symbols = dlopen(NULL, RTLD_NOW );
-    if ( symbols == NULL)
-    {
-        logError( "unable to load symbols (%s)", dlerror() );
-    }
-    else
-    {
-        logDebug( "symbols loaded at %p", symbols );
+    if ( argc == 3 && strcmp( argv[1], "--trace-json" ) == 0 ) {
+        /* not mounting anything, just converting a trace */
+        int err = traceToJSON( argv[2], stdout );
+        if ( err != 0 ) {
+            fprintf( stderr, "%s: unable to convert '%s' (%d: %s)\n", globals.myName, argv[2], -err, strerror( -err ) );
+        }
+        return ( err == 0 ) ? 0 : 1;
     }
-#endif
 
     if ( fuse_version() < FUSE_USE_VERSION ) {
         logCritical( "fatal: libfuse is too old" );
@@ -258,9 +462,9 @@ int main( int argc, char * argv[], char * const envp[] )
             if ( args.argv[ 0 ][ 0 ] != '\0' ) {
                 printf( "usage: %s [options] <mountpoint>\n\n", globals.myName );
             }
+            printf( "%s\n", tmplOptionsHelp );
             printf( "FUSE options:\n" );
 
-            /* ToDo: also output templatefs-specific options */
             fuse_lib_help( &args );
 
             result = 0;
@@ -270,6 +474,11 @@ int main( int argc, char * argv[], char * const envp[] )
         } else {
             /* not --version or --help, so check for templatefs-specific options */
             memset( &globals.template, 0, sizeof( tTemplateOptions ) );
+            globals.template.configCheck = kDefaultConfigCheckInterval;
+            globals.template.cacheTimeout = kDefaultKernelCacheTimeout;
+            globals.template.execTimeout = kDefaultExecTimeout;
+            globals.template.renderThreads = kDefaultRenderThreads;
+            globals.template.logLevel = kLogDebug;
 
             if ( fuse_opt_parse( &args,
                                  &globals.template,
@@ -280,6 +489,10 @@ int main( int argc, char * argv[], char * const envp[] )
             } else if ( globals.template.templates == NULL ) {
                 logCritical( "fatal: no template directory specified" );
                 result = 2;
+            } else if ( applyTmplOpts() != 0 ) {
+                result = 8;
+            } else if ( globals.template.lowlevel || globals.template.passthrough ) {
+                result = lightFuseLowlevel( &args );
             } else {
                 result = lightFuse( &args );
             }
@@ -11,13 +11,31 @@
 #undef HAVE_UTIMENSAT
 #undef HAVE_FDATASYNC
 #undef HAVE_POSIX_FALLOCATE
-#undef HAVE_COPY_FILE_RANGE
+#define HAVE_COPY_FILE_RANGE
 
 #define FUSE_USE_VERSION 39
 #include <fuse3/fuse_lowlevel.h>
 
 typedef struct {
     char * templates;
+    char * cacheSize;   // memory budget for the render cache, e.g. '64M'. '0' disables it
+    unsigned long configCheck; // minimum ms between checks for configuration changes
+    int    kernelCache;  // non-zero to let the kernel cache attributes, entries and contents
+    double cacheTimeout; // seconds the kernel may cache attributes and entries, if kernelCache
+    int    warmup;       // non-zero to render templates in the background, ahead of use
+    char * snapshot;     // file the render cache is saved to when unmounted, and restored from when mounted
+    unsigned long execTimeout; // ms an executable template may run before it's killed. 0 waits forever
+    char * execMaxOutput;   // most output accepted from an executable template, e.g. '16M'
+    char * execCgroup;      // delegated cgroup v2 directory to run executable templates in
+    unsigned int execCPU;   // CPU limit for each run, as a percentage of one CPU, with execCgroup
+    char * execMemory;      // memory limit for each run, e.g. '256M', with execCgroup
+    int    serveStale;      // non-zero to serve an executable's last good output if it times out
+    unsigned int renderThreads; // size of the render pool
+    int    lowlevel;        // non-zero to mount through the low-level fuse API
+    int    passthrough;     // non-zero to let the kernel do I/O on non-template files itself. Implies lowlevel
+    unsigned int logLevel;  // least important priority sent to syslog, kLogEmergency to kLogDebug
+    int    logAsync;        // non-zero to send log messages on from a background thread
+    char * trace;           // file to record function entries and exits to, in INSTRUMENT_FUNCTIONS builds
 } tTemplateOptions;
 
 typedef struct {
@@ -30,4 +48,6 @@ typedef struct {
 
 extern tGlobals globals;
 
+int parseByteSize( const char * str, size_t * result );
+
 #endif // TEMPLATEFS_H
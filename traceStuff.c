@@ -0,0 +1,508 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* Function tracing, for builds with INSTRUMENT_FUNCTIONS (which compiles
+ * with -finstrument-functions, so every function entry and exit calls the
+ * hooks below).
+ *
+ * With '-o trace=FILE', each hook appends a timestamp and the function's
+ * address to a buffer of the calling thread's own, so nothing is shared
+ * or locked along the way. Only when a buffer is full is it written out,
+ * as one chunk, to FILE. Nothing is resolved to a name while tracing:
+ * traceToJSON() does that afterwards, in the same executable, and turns
+ * the records into Chrome trace JSON, which Perfetto reads too, e.g.
+ *
+ *     templatefs -o trace=/tmp/trace ... /etc
+ *     templatefs --trace-json /tmp/trace > trace.json
+ *
+ * Library code (libfuse, Elektra, mustach) isn't instrumented, so time
+ * spent in it shows up in whichever of our functions called it. dladdr()
+ * only knows exported symbols, so static functions are named by their
+ * address, which 'addr2line -f -e templatefs' can resolve. */
+
+#include "common.h"
+#include "traceStuff.h"
+#include "logStuff.h"
+
+#define NO_TRACE  __attribute__((no_instrument_function))
+
+#ifdef INSTRUMENT_FUNCTIONS
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#define kTraceExit     ( 1ULL << 63 )   // set in 'when' if it's an exit
+#define kSymbolSlots   4096             // always a power of two
+
+typedef struct {
+    uint64_t  when;         ///< ns since tracing started, with kTraceExit if leaving the function
+    uint64_t  function;     ///< address of the function entered or left
+} tTraceRecord;
+
+/**
+ * @brief the start of the file. It's followed by any number of chunks
+ */
+typedef struct {
+    char      magic[ sizeof( kTraceMagic ) - 1 ];
+    uint64_t  reference;    ///< where startTracing() was, so the load address can be found again
+    uint32_t  pid;
+    uint32_t  reserved;
+} tTraceHeader;
+
+/**
+ * @brief one thread's buffer, as written out. Followed by 'count' records
+ */
+typedef struct {
+    uint32_t  tid;
+    uint32_t  count;
+} tTraceChunk;
+
+typedef struct sTraceBuffer {
+    struct sTraceBuffer * next;
+    bool                  inUse;    ///< by a thread that hasn't exited yet
+    uint32_t              tid;
+    atomic_uint           count;
+    tTraceRecord          records[ kTraceRecords ];
+} tTraceBuffer;
+
+static struct {
+    atomic_bool      enabled;
+    pthread_mutex_t  lock;          ///< of everything below
+    pthread_once_t   once;
+    pthread_key_t    key;           ///< so a buffer is written out (and reused) when its thread exits
+    int              fd;
+    uint64_t         start;         ///< CLOCK_MONOTONIC, in ns
+    tTraceBuffer *   buffers;
+    atomic_ulong     dropped;
+} tracing = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+    .fd   = -1
+};
+
+static __thread tTraceBuffer * threadBuffer = NULL;
+
+void __cyg_profile_func_enter( void * function, void * caller ) NO_TRACE;
+void __cyg_profile_func_exit( void * function, void * caller ) NO_TRACE;
+
+// ------------------------------------------------------------------------------
+
+NO_TRACE
+static uint64_t monotonicNS( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief write out what's in a buffer, and empty it. Caller must hold the lock
+ */
+NO_TRACE
+static void writeBuffer( tTraceBuffer * buffer )
+{
+    tTraceChunk chunk = {
+        .tid   = buffer->tid,
+        .count = atomic_load_explicit( &buffer->count, memory_order_acquire )
+    };
+
+    if ( chunk.count > 0 ) {
+        size_t length = chunk.count * sizeof( tTraceRecord );
+        if ( tracing.fd == -1
+          || write( tracing.fd, &chunk, sizeof( chunk ) ) != sizeof( chunk )
+          || write( tracing.fd, buffer->records, length ) != (ssize_t)length ) {
+            atomic_fetch_add( &tracing.dropped, chunk.count );
+        }
+        atomic_store_explicit( &buffer->count, 0, memory_order_release );
+    }
+}
+
+/**
+ * @brief the thread that was using this buffer has exited
+ */
+NO_TRACE
+static void releaseBuffer( void * buffer )
+{
+    pthread_mutex_lock( &tracing.lock );
+    writeBuffer( buffer );
+    ((tTraceBuffer *)buffer)->inUse = false;
+    pthread_mutex_unlock( &tracing.lock );
+}
+
+NO_TRACE
+static void createKey( void )
+{
+    pthread_key_create( &tracing.key, releaseBuffer );
+}
+
+/**
+ * @brief a buffer for the calling thread, reusing one from a thread that's exited if there is one
+ */
+NO_TRACE
+static tTraceBuffer * acquireBuffer( void )
+{
+    pthread_mutex_lock( &tracing.lock );
+
+    tTraceBuffer * result = tracing.buffers;
+    while ( result != NULL && result->inUse ) {
+        result = result->next;
+    }
+    if ( result == NULL ) {
+        result = malloc( sizeof( tTraceBuffer ) );
+        if ( result != NULL ) {
+            atomic_init( &result->count, 0 );
+            result->next    = tracing.buffers;
+            tracing.buffers = result;
+        }
+    }
+    if ( result != NULL ) {
+        result->inUse = true;
+        result->tid   = syscall( SYS_gettid );
+        pthread_setspecific( tracing.key, result );
+    }
+
+    pthread_mutex_unlock( &tracing.lock );
+
+    return result;
+}
+
+NO_TRACE
+static inline void traceRecord( void * function, uint64_t exit )
+{
+    if ( !atomic_load_explicit( &tracing.enabled, memory_order_relaxed ) ) {
+        return;
+    }
+
+    tTraceBuffer * buffer = threadBuffer;
+    if ( buffer == NULL ) {
+        buffer = threadBuffer = acquireBuffer();
+        if ( buffer == NULL ) {
+            atomic_fetch_add( &tracing.dropped, 1 );
+            return;
+        }
+    }
+
+    unsigned int count = atomic_load_explicit( &buffer->count, memory_order_relaxed );
+    if ( count >= kTraceRecords ) {
+        pthread_mutex_lock( &tracing.lock );
+        writeBuffer( buffer );
+        pthread_mutex_unlock( &tracing.lock );
+        count = 0;
+    }
+
+    buffer->records[ count ].when     = ( monotonicNS() - tracing.start ) | exit;
+    buffer->records[ count ].function = (uintptr_t) function;
+    atomic_store_explicit( &buffer->count, count + 1, memory_order_release );
+}
+
+void __cyg_profile_func_enter( void * function, void * caller )
+{
+    (void)caller;
+    traceRecord( function, 0 );
+}
+
+void __cyg_profile_func_exit( void * function, void * caller )
+{
+    (void)caller;
+    traceRecord( function, kTraceExit );
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief start recording function entries and exits to 'file'. Replaces anything already in it
+ * @return zero if successful, negative errno if not
+ */
+NO_TRACE
+int startTracing( const char * file )
+{
+    int result = 0;
+
+    pthread_once( &tracing.once, createKey );
+    pthread_mutex_lock( &tracing.lock );
+
+    if ( tracing.fd != -1 ) {
+        result = -EBUSY;
+    } else {
+        tracing.fd = open( file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600 );
+        if ( tracing.fd == -1 ) {
+            result = -errno;
+        } else {
+            tTraceHeader header = {
+                .reference = (uintptr_t) &startTracing,
+                .pid       = getpid()
+            };
+            memcpy( header.magic, kTraceMagic, sizeof( header.magic ) );
+
+            if ( write( tracing.fd, &header, sizeof( header ) ) != sizeof( header ) ) {
+                result = ( errno != 0 ) ? -errno : -EIO;
+                close( tracing.fd );
+                tracing.fd = -1;
+            } else {
+                /* anything left from a previous trace is stale */
+                for ( tTraceBuffer * buffer = tracing.buffers; buffer != NULL; buffer = buffer->next ) {
+                    atomic_store( &buffer->count, 0 );
+                }
+                atomic_store( &tracing.dropped, 0 );
+                tracing.start = monotonicNS();
+                atomic_store( &tracing.enabled, true );
+            }
+        }
+    }
+
+    pthread_mutex_unlock( &tracing.lock );
+
+    if ( result != 0 ) {
+        logError( "unable to trace to \'%s\' (%d: %s)", file, -result, strerror( -result ) );
+    } else {
+        logInfo( "tracing to \'%s\'", file );
+    }
+    errno = 0;
+
+    return result;
+}
+
+/**
+ * @brief stop recording, and write out what every thread has buffered.
+ * Records made by other threads while this is stopping may be lost.
+ * The buffers are kept, as threads still running may be using them
+ */
+NO_TRACE
+void stopTracing( void )
+{
+    if ( atomic_exchange( &tracing.enabled, false ) ) {
+        pthread_mutex_lock( &tracing.lock );
+
+        for ( tTraceBuffer * buffer = tracing.buffers; buffer != NULL; buffer = buffer->next ) {
+            writeBuffer( buffer );
+        }
+        close( tracing.fd );
+        tracing.fd = -1;
+
+        pthread_mutex_unlock( &tracing.lock );
+
+        unsigned long dropped = traceDropped();
+        if ( dropped != 0 ) {
+            logWarning( "%lu trace records were lost", dropped );
+        }
+    }
+}
+
+/**
+ * @return how many records couldn't be buffered or written out
+ */
+NO_TRACE
+unsigned long traceDropped( void )
+{
+    return atomic_load( &tracing.dropped );
+}
+
+// ------------------------------------------------------------------------------
+
+typedef struct {
+    uint64_t      address;
+    const char *  name;     ///< NULL if it couldn't be resolved
+} tSymbol;
+
+typedef struct {
+    uint32_t  tid;
+    unsigned  depth;        ///< functions entered and not yet left
+    uint64_t  last;         ///< the latest timestamp seen
+} tThreadState;
+
+typedef struct {
+    FILE *          out;
+    uint32_t        pid;
+    uint64_t        slide;      ///< add to a recorded address to get one in this process
+    tSymbol *       symbols;    ///< kSymbolSlots of them
+    tThreadState *  threads;
+    size_t          threadCount;
+    bool            first;      ///< no event written yet
+} tConverting;
+
+/**
+ * @brief the symbol at a recorded address. dladdr() is slow, so remember what it said
+ */
+NO_TRACE
+static const char * symbolName( tConverting * converting, uint64_t address )
+{
+    const char * result = NULL;
+    size_t       slot   = fnvAddBytes( kFNVOffsetBasis, &address, sizeof( address ) ) & ( kSymbolSlots - 1 );
+    size_t       probes = 0;
+
+    while ( converting->symbols[ slot ].address != 0
+         && converting->symbols[ slot ].address != address
+         && ++probes < kSymbolSlots ) {
+        slot = ( slot + 1 ) & ( kSymbolSlots - 1 );
+    }
+
+    if ( converting->symbols[ slot ].address == address ) {
+        result = converting->symbols[ slot ].name;
+    } else {
+        Dl_info info;
+        if ( dladdr( (void *)(uintptr_t)( address + converting->slide ), &info ) != 0 ) {
+            result = info.dli_sname;
+        }
+        if ( converting->symbols[ slot ].address == 0 ) {
+            converting->symbols[ slot ].address = address;
+            converting->symbols[ slot ].name    = result;
+        }
+    }
+    return result;
+}
+
+NO_TRACE
+static tThreadState * threadState( tConverting * converting, uint32_t tid )
+{
+    for ( size_t i = 0; i < converting->threadCount; ++i ) {
+        if ( converting->threads[ i ].tid == tid ) {
+            return &converting->threads[ i ];
+        }
+    }
+
+    tThreadState * threads = realloc( converting->threads, ( converting->threadCount + 1 ) * sizeof( tThreadState ) );
+    if ( threads == NULL ) {
+        return NULL;
+    }
+    converting->threads = threads;
+
+    tThreadState * result = &threads[ converting->threadCount++ ];
+    result->tid   = tid;
+    result->depth = 0;
+    result->last  = 0;
+    return result;
+}
+
+NO_TRACE
+static void writeEvent( tConverting * converting, uint32_t tid, uint64_t address, char phase, uint64_t when )
+{
+    const char * name = symbolName( converting, address );
+
+    fprintf( converting->out, "%s{\"ph\":\"%c\",\"pid\":%u,\"tid\":%u,\"ts\":%lu.%03lu,\"name\":\"",
+             converting->first ? "" : ",\n", phase, converting->pid, tid,
+             (unsigned long)( when / 1000 ), (unsigned long)( when % 1000 ) );
+    if ( name != NULL ) {
+        /* C identifiers need no escaping */
+        fputs( name, converting->out );
+    } else {
+        fprintf( converting->out, "0x%lx", (unsigned long) address );
+    }
+    fputs( "\"}", converting->out );
+    converting->first = false;
+}
+
+/**
+ * @brief turn a trace written by this executable into Chrome trace
+ * event JSON. Exits without a matching entry (functions that were
+ * already running when tracing started) are skipped, and functions that
+ * hadn't returned when it stopped are closed at their thread's last event
+ * @return zero if successful, negative errno if not
+ */
+NO_TRACE
+int traceToJSON( const char * file, FILE * out )
+{
+    int          result = 0;
+    tTraceHeader header;
+    tTraceChunk  chunk;
+    tConverting  converting = { .out = out, .first = true };
+
+    FILE * in = fopen( file, "rbe" );
+    if ( in == NULL ) {
+        result = -errno;
+        errno = 0;
+        return result;
+    }
+
+    converting.symbols = calloc( kSymbolSlots, sizeof( tSymbol ) );
+    tTraceRecord * records = malloc( kTraceRecords * sizeof( tTraceRecord ) );
+
+    if ( converting.symbols == NULL || records == NULL ) {
+        result = -ENOMEM;
+    } else if ( fread( &header, sizeof( header ), 1, in ) != 1
+             || memcmp( header.magic, kTraceMagic, sizeof( header.magic ) ) != 0 ) {
+        result = -EINVAL;
+    } else {
+        converting.pid   = header.pid;
+        converting.slide = (uintptr_t) &startTracing - header.reference;
+
+        fputs( "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", out );
+
+        while ( result == 0 && fread( &chunk, sizeof( chunk ), 1, in ) == 1 ) {
+            tThreadState * thread = threadState( &converting, chunk.tid );
+            if ( thread == NULL ) {
+                result = -ENOMEM;
+            } else if ( chunk.count > kTraceRecords
+                     || fread( records, sizeof( tTraceRecord ), chunk.count, in ) != chunk.count ) {
+                /* truncated, or not one of ours. Keep what's been converted so far */
+                break;
+            } else {
+                for ( uint32_t i = 0; i < chunk.count; ++i ) {
+                    uint64_t when = records[ i ].when & ~kTraceExit;
+
+                    if ( ( records[ i ].when & kTraceExit ) == 0 ) {
+                        writeEvent( &converting, chunk.tid, records[ i ].function, 'B', when );
+                        ++thread->depth;
+                    } else if ( thread->depth > 0 ) {
+                        writeEvent( &converting, chunk.tid, records[ i ].function, 'E', when );
+                        --thread->depth;
+                    }
+                    thread->last = when;
+                }
+            }
+        }
+
+        for ( size_t i = 0; i < converting.threadCount; ++i ) {
+            tThreadState * thread = &converting.threads[ i ];
+            for ( ; thread->depth > 0; --thread->depth ) {
+                /* an 'E' needs no name. Address zero won't resolve to one */
+                writeEvent( &converting, thread->tid, 0, 'E', thread->last );
+            }
+        }
+
+        fputs( "\n]}\n", out );
+        if ( fflush( out ) != 0 ) {
+            result = -errno;
+        }
+    }
+
+    free( records );
+    free( converting.symbols );
+    free( converting.threads );
+    fclose( in );
+    errno = 0;
+
+    return result;
+}
+
+#else
+
+int startTracing( const char * file )
+{
+    (void)file;
+    logWarning( "tracing ignored, as this wasn't built with INSTRUMENT_FUNCTIONS" );
+    return -ENOTSUP;
+}
+
+void stopTracing( void )
+{
+}
+
+unsigned long traceDropped( void )
+{
+    return 0;
+}
+
+int traceToJSON( const char * file, FILE * out )
+{
+    (void)file; (void)out;
+    return -ENOTSUP;
+}
+
+#endif
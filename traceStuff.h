@@ -0,0 +1,19 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_TRACESTUFF_H
+#define TEMPLATEFS_TRACESTUFF_H
+
+#include <stdio.h>
+
+#define kTraceMagic    "TFSTRACE"
+#define kTraceRecords  65536    // records buffered by each thread before it writes them out
+
+int  startTracing( const char * file );
+void stopTracing( void );
+unsigned long traceDropped( void );
+
+int  traceToJSON( const char * file, FILE * out );
+
+#endif //TEMPLATEFS_TRACESTUFF_H
@@ -0,0 +1,211 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* With '-o warmup', every (non-executable) template is rendered in the
+ * background when mounted, and again whenever the templates or the
+ * configuration change, so the render and metadata caches are already
+ * filled before anyone asks. Requests that arrive while a pass is running
+ * are folded into a single follow-up pass.
+ *
+ * A pass hands every template to the render pool at once, in its warm-up
+ * lane, so they're rendered in parallel, but only by threads that have
+ * nothing more pressing to do (see renderPool.c). A template someone else
+ * is already rendering is skipped, rather than waited for: its leader's
+ * render may be queued behind the warm-up's, on the same threads. */
+
+#include "common.h"
+#include "warmup.h"
+#include "templateIndex.h"
+#include "renderPool.h"
+#include "logStuff.h"
+
+#include <pthread.h>
+
+typedef struct {
+    pthread_mutex_t   lock;
+    pthread_cond_t    wake;        ///< signalled when 'requested' or 'stopping' is set
+    pthread_cond_t    settled;     ///< signalled when 'pending' reaches zero
+    size_t            pending;     ///< renders of the current pass not finished yet
+    bool              requested;
+    bool              stopping;
+    bool              running;
+    pthread_t         thread;
+    tWarmFunction     warm;
+    void *            context;
+} tWarmer;
+
+static tWarmer warmer = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake    = PTHREAD_COND_INITIALIZER,
+    .settled = PTHREAD_COND_INITIALIZER
+};
+
+/**
+ * @brief the paths to be warmed, copied out of the index so it isn't locked while rendering
+ */
+typedef struct {
+    char **  paths;
+    size_t   count;
+    size_t   limit;
+} tWarmList;
+
+// ------------------------------------------------------------------------------
+
+static void collectTemplate( const char * path, unsigned int flags, void * context )
+{
+    tWarmList * list = context;
+
+    if ( ( flags & ( kTemplateIsDir | kTemplateExecutable ) ) == 0 ) {
+        if ( list->count >= list->limit ) {
+            size_t  limit = ( list->limit == 0 ) ? 64 : list->limit * 2;
+            char ** paths = realloc( list->paths, limit * sizeof( char * ) );
+            if ( paths == NULL ) {
+                return;
+            }
+            list->paths = paths;
+            list->limit = limit;
+        }
+        list->paths[ list->count ] = strdup( path );
+        if ( list->paths[ list->count ] != NULL ) {
+            ++list->count;
+        }
+    }
+}
+
+/**
+ * @brief render one template of a pass, on a render pool thread
+ */
+static int warmJob( void * context )
+{
+    pthread_mutex_lock( &warmer.lock );
+    bool stopping = warmer.stopping;
+    pthread_mutex_unlock( &warmer.lock );
+
+    if ( !stopping ) {
+        warmer.warm( context, warmer.context );
+    }
+    return 0;
+}
+
+/**
+ * @brief one template of a pass has been rendered
+ */
+static void warmDone( int result, void * context )
+{
+    (void)result;
+    free( context );
+
+    pthread_mutex_lock( &warmer.lock );
+    if ( --warmer.pending == 0 ) {
+        pthread_cond_signal( &warmer.settled );
+    }
+    pthread_mutex_unlock( &warmer.lock );
+}
+
+static void warmAll( void )
+{
+    tWarmList list = { NULL, 0, 0 };
+
+    forEachTemplate( collectTemplate, &list );
+    logDebug( "warming %lu templates", list.count );
+
+    for ( size_t i = 0; i < list.count; ++i ) {
+        pthread_mutex_lock( &warmer.lock );
+        ++warmer.pending;
+        pthread_mutex_unlock( &warmer.lock );
+
+        /* the path belongs to the job now. Without a pool, it's run right here */
+        if ( submitRender( kLaneWarmup, warmJob, list.paths[ i ], warmDone, list.paths[ i ] ) != 0 ) {
+            warmDone( -ENOMEM, list.paths[ i ] );
+        }
+    }
+    free( list.paths );
+
+    /* don't start another pass until this one has finished */
+    pthread_mutex_lock( &warmer.lock );
+    while ( warmer.pending > 0 ) {
+        pthread_cond_wait( &warmer.settled, &warmer.lock );
+    }
+    pthread_mutex_unlock( &warmer.lock );
+}
+
+static void * warmupThread( void * arg )
+{
+    (void)arg;
+
+    pthread_mutex_lock( &warmer.lock );
+    while ( !warmer.stopping ) {
+        if ( !warmer.requested ) {
+            pthread_cond_wait( &warmer.wake, &warmer.lock );
+        } else {
+            warmer.requested = false;
+            pthread_mutex_unlock( &warmer.lock );
+
+            warmAll();
+
+            pthread_mutex_lock( &warmer.lock );
+        }
+    }
+    pthread_mutex_unlock( &warmer.lock );
+
+    return NULL;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief start the warm-up thread, and ask it to warm everything
+ * @param warm     renders one template
+ * @param context  passed to 'warm'
+ * @return zero if successful, negative errno if not
+ */
+int startWarmup( tWarmFunction warm, void * context )
+{
+    int result;
+
+    pthread_mutex_lock( &warmer.lock );
+
+    warmer.warm      = warm;
+    warmer.context   = context;
+    warmer.requested = true;
+    warmer.stopping  = false;
+
+    result = -pthread_create( &warmer.thread, NULL, warmupThread, NULL );
+    if ( result != 0 ) {
+        logError( "unable to start the warm-up thread (%d)", result );
+    } else {
+        warmer.running = true;
+    }
+
+    pthread_mutex_unlock( &warmer.lock );
+
+    return result;
+}
+
+/**
+ * @brief ask for every template to be rendered again. Does nothing unless started.
+ */
+void requestWarmup( void )
+{
+    pthread_mutex_lock( &warmer.lock );
+    if ( warmer.running ) {
+        warmer.requested = true;
+        pthread_cond_signal( &warmer.wake );
+    }
+    pthread_mutex_unlock( &warmer.lock );
+}
+
+void stopWarmup( void )
+{
+    pthread_mutex_lock( &warmer.lock );
+    bool wasRunning = warmer.running;
+    warmer.stopping = true;
+    warmer.running  = false;
+    pthread_cond_signal( &warmer.wake );
+    pthread_mutex_unlock( &warmer.lock );
+
+    if ( wasRunning ) {
+        pthread_join( warmer.thread, NULL );
+    }
+}
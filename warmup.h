@@ -0,0 +1,17 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_WARMUP_H
+#define TEMPLATEFS_WARMUP_H
+
+/**
+ * @brief called on the warm-up thread, to render one template
+ */
+typedef void (* tWarmFunction)( const char * path, void * context );
+
+int  startWarmup( tWarmFunction warm, void * context );
+void requestWarmup( void );
+void stopWarmup( void );
+
+#endif //TEMPLATEFS_WARMUP_H
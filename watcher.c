@@ -0,0 +1,497 @@
+//
+// Created by paul on 10/14/26.
+//
+
+/* Watches the template hierarchy and the directory underneath the mount,
+ * recursively, and publishes what changed to registered consumers.
+ *
+ * inotify is used rather than fanotify, as fanotify's directory-entry
+ * events need CAP_SYS_ADMIN. inotify watches aren't recursive, so every
+ * directory gets its own watch, added as directories appear. The lower
+ * directory is hidden by our own mount, so watches are added through
+ * /proc/self/fd/ using the descriptors opened before mounting.
+ *
+ * Events are coalesced per path, and only published once the trees have
+ * been quiet for kWatchQuietPeriod, or kWatchMaxDelay after the first
+ * event of a batch, so a burst of changes becomes a single batch. */
+
+#include "common.h"
+#include "watcher.h"
+#include "logStuff.h"
+
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <time.h>
+
+#define kWatchMask  ( IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB \
+                    | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR )
+
+#define kPendingBuckets  256
+
+/**
+ * @brief one tree being watched
+ */
+typedef struct {
+    int        rootFD;      ///< the directory at the top of the tree
+    int        inotifyFD;
+    char **    dirs;        ///< indexed by watch descriptor: path of the directory, '' for the root
+    size_t     dirLimit;    ///< allocated length of 'dirs'
+} tWatchedTree;
+
+/**
+ * @brief a path with changes waiting to be published
+ */
+typedef struct sPending {
+    struct sPending * hashNext;
+    tWatchEvent       event;
+} tPending;
+
+typedef struct {
+    pthread_mutex_t   lock;              ///< protects the consumers
+    struct {
+        tWatchConsumer  consumer;
+        void *          context;
+    }                 consumers[ kMaxWatchConsumers ];
+    unsigned int      consumerCount;
+
+    bool              running;
+    pthread_t         thread;
+    int               stopFD;            ///< eventfd, written to stop the thread
+    tWatchedTree      trees[ kTreeCount ];
+
+    /* only touched by the watcher thread */
+    tPending *        pending[ kPendingBuckets ];
+    size_t            pendingCount;
+    struct timespec   firstEvent;        ///< of the batch in progress
+    struct timespec   lastEvent;
+} tWatcher;
+
+static tWatcher watcher = {
+    .lock   = PTHREAD_MUTEX_INITIALIZER,
+    .stopFD = -1,
+    .trees  = { { .rootFD = -1, .inotifyFD = -1 }, { .rootFD = -1, .inotifyFD = -1 } }
+};
+
+// ------------------------------------------------------------------------------
+
+static long msBetween( const struct timespec * from, const struct timespec * to )
+{
+    return ( to->tv_sec - from->tv_sec ) * 1000 + ( to->tv_nsec - from->tv_nsec ) / 1000000;
+}
+
+/**
+ * @brief record a change, merging it with any already pending for the same path
+ */
+static void addPending( eWatchTree tree, const char * path, unsigned int kinds, bool isDir )
+{
+    size_t     bucket  = ( hashString( path ) + tree ) & ( kPendingBuckets - 1 );
+    tPending * pending = watcher.pending[ bucket ];
+
+    while ( pending != NULL
+         && ( pending->event.tree != tree || strcmp( pending->event.path, path ) != 0 ) ) {
+        pending = pending->hashNext;
+    }
+
+    if ( pending == NULL ) {
+        pending = calloc( 1, sizeof( tPending ) );
+        if ( pending == NULL ) {
+            logError( "out of memory, dropping change to \'%s\'", path );
+            return;
+        }
+        pending->event.path = strdup( path );
+        if ( pending->event.path == NULL ) {
+            free( pending );
+            return;
+        }
+        pending->event.tree = tree;
+        pending->hashNext   = watcher.pending[ bucket ];
+        watcher.pending[ bucket ] = pending;
+
+        if ( watcher.pendingCount++ == 0 ) {
+            clock_gettime( CLOCK_MONOTONIC, &watcher.firstEvent );
+        }
+    }
+
+    pending->event.kinds |= kinds;
+    pending->event.isDir |= isDir;
+    clock_gettime( CLOCK_MONOTONIC, &watcher.lastEvent );
+}
+
+static void discardPending( void )
+{
+    for ( unsigned int i = 0; i < kPendingBuckets; ++i ) {
+        tPending * pending = watcher.pending[ i ];
+        while ( pending != NULL ) {
+            tPending * next = pending->hashNext;
+            free( (char *)pending->event.path );
+            free( pending );
+            pending = next;
+        }
+        watcher.pending[ i ] = NULL;
+    }
+    watcher.pendingCount = 0;
+}
+
+/**
+ * @brief hand the pending batch to every consumer, then discard it
+ */
+static void publishPending( void )
+{
+    tWatchEvent * events = calloc( watcher.pendingCount, sizeof( tWatchEvent ) );
+    size_t        count  = 0;
+
+    for ( unsigned int i = 0; i < kPendingBuckets; ++i ) {
+        for ( tPending * pending = watcher.pending[ i ]; pending != NULL; pending = pending->hashNext ) {
+            if ( events != NULL ) {
+                events[ count++ ] = pending->event;
+            }
+        }
+    }
+
+    if ( events == NULL ) {
+        logError( "out of memory, dropping %lu changes", watcher.pendingCount );
+    } else {
+        logDebug( "publishing %lu changes", count );
+
+        pthread_mutex_lock( &watcher.lock );
+        for ( unsigned int i = 0; i < watcher.consumerCount; ++i ) {
+            watcher.consumers[ i ].consumer( events, count, watcher.consumers[ i ].context );
+        }
+        pthread_mutex_unlock( &watcher.lock );
+
+        free( events );
+    }
+
+    discardPending();
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief watch one directory. Its path is relative to the tree's root, '' for the root itself
+ * @return the watch descriptor, or negative errno
+ */
+static int addDirWatch( tWatchedTree * tree, const char * dir )
+{
+    char procPath[ PATH_MAX ];
+    int  wd;
+
+    snprintf( procPath, sizeof( procPath ), "/proc/self/fd/%d%s", tree->rootFD, dir );
+
+    /* only the root is reached through the /proc magic link, so don't follow anything else */
+    wd = inotify_add_watch( tree->inotifyFD, procPath, kWatchMask | ( dir[0] != '\0' ? IN_DONT_FOLLOW : 0 ) );
+    if ( wd < 0 ) {
+        wd = -errno;
+    } else {
+        if ( (size_t)wd >= tree->dirLimit ) {
+            size_t   limit = ( wd + 1 ) * 2;
+            char ** dirs  = realloc( tree->dirs, limit * sizeof( char * ) );
+            if ( dirs == NULL ) {
+                inotify_rm_watch( tree->inotifyFD, wd );
+                return -ENOMEM;
+            }
+            memset( &dirs[ tree->dirLimit ], 0, ( limit - tree->dirLimit ) * sizeof( char * ) );
+            tree->dirs     = dirs;
+            tree->dirLimit = limit;
+        }
+        /* the same directory may be added twice, e.g. if created during a scan */
+        free( tree->dirs[ wd ] );
+        tree->dirs[ wd ] = strdup( dir );
+    }
+
+    return wd;
+}
+
+/**
+ * @brief watch a directory and everything below it
+ * @param created  if true, the directory is new, so report what's already in it as created
+ */
+static void addTreeWatches( eWatchTree which, const char * dir, bool created )
+{
+    tWatchedTree * tree = &watcher.trees[ which ];
+
+    int wd = addDirWatch( tree, dir );
+    if ( wd < 0 ) {
+        logError( "unable to watch \'%s\' (%d)", dir, wd );
+        return;
+    }
+
+    int fd = ( dir[0] == '\0' ) ? dup( tree->rootFD )
+                                : openat( tree->rootFD, &dir[1], O_RDONLY | O_DIRECTORY | O_NOFOLLOW );
+    DIR * dp = ( fd < 0 ) ? NULL : fdopendir( fd );
+    if ( dp == NULL ) {
+        if ( fd >= 0 ) {
+            close( fd );
+        }
+        return;
+    }
+
+    struct dirent * entry;
+    while ( ( entry = readdir( dp ) ) != NULL ) {
+        if ( strcmp( entry->d_name, "." ) == 0 || strcmp( entry->d_name, ".." ) == 0 ) {
+            continue;
+        }
+
+        char path[ PATH_MAX ];
+        snprintf( path, sizeof( path ), "%s/%s", dir, entry->d_name );
+
+        bool isDir = ( entry->d_type == DT_DIR );
+        if ( entry->d_type == DT_UNKNOWN ) {
+            struct stat st;
+            isDir = ( fstatat( dirfd( dp ), entry->d_name, &st, AT_SYMLINK_NOFOLLOW ) == 0
+                      && S_ISDIR( st.st_mode ) );
+        }
+
+        if ( created ) {
+            addPending( which, path, kChangeCreated, isDir );
+        }
+        if ( isDir ) {
+            addTreeWatches( which, path, created );
+        }
+    }
+    closedir( dp );
+}
+
+/**
+ * @brief stop watching a directory that moved away, and everything below it
+ */
+static void removeTreeWatches( eWatchTree which, const char * dir )
+{
+    tWatchedTree * tree = &watcher.trees[ which ];
+    size_t         len  = strlen( dir );
+
+    for ( size_t wd = 0; wd < tree->dirLimit; ++wd ) {
+        const char * watched = tree->dirs[ wd ];
+        if ( watched != NULL
+          && strncmp( watched, dir, len ) == 0
+          && ( watched[ len ] == '\0' || watched[ len ] == '/' ) ) {
+            /* the IN_IGNORED that follows will find nothing to free */
+            inotify_rm_watch( tree->inotifyFD, (int)wd );
+            free( tree->dirs[ wd ] );
+            tree->dirs[ wd ] = NULL;
+        }
+    }
+}
+
+/**
+ * @brief read and record everything available from one tree's inotify descriptor
+ */
+static void readEvents( eWatchTree which )
+{
+    tWatchedTree * tree = &watcher.trees[ which ];
+    char           buffer[ 16 * 1024 ] __attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+    ssize_t        length;
+
+    while ( ( length = read( tree->inotifyFD, buffer, sizeof( buffer ) ) ) > 0 ) {
+        const struct inotify_event * event;
+
+        for ( char * ptr = buffer; ptr < buffer + length; ptr += sizeof( struct inotify_event ) + event->len ) {
+            event = (const struct inotify_event *)ptr;
+
+            if ( event->mask & IN_Q_OVERFLOW ) {
+                logWarning( "change events were lost" );
+                addPending( which, "/", kChangeOverflow, true );
+                continue;
+            }
+
+            if ( event->wd < 0 || (size_t)event->wd >= tree->dirLimit || tree->dirs[ event->wd ] == NULL ) {
+                continue;
+            }
+
+            if ( event->mask & IN_IGNORED ) {
+                free( tree->dirs[ event->wd ] );
+                tree->dirs[ event->wd ] = NULL;
+                continue;
+            }
+
+            char path[ PATH_MAX ];
+            if ( event->len > 0 ) {
+                snprintf( path, sizeof( path ), "%s/%s", tree->dirs[ event->wd ], event->name );
+            } else {
+                snprintf( path, sizeof( path ), "%s", tree->dirs[ event->wd ][0] != '\0' ? tree->dirs[ event->wd ] : "/" );
+            }
+
+            unsigned int kinds = 0;
+            if ( event->mask & ( IN_MODIFY | IN_CLOSE_WRITE ) ) {
+                kinds |= kChangeContent;
+            }
+            if ( event->mask & IN_ATTRIB ) {
+                kinds |= kChangeAttrib;
+            }
+            if ( event->mask & ( IN_CREATE | IN_MOVED_TO ) ) {
+                kinds |= kChangeCreated;
+            }
+            if ( event->mask & ( IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF ) ) {
+                kinds |= kChangeDeleted;
+            }
+
+            bool isDir = ( event->mask & IN_ISDIR ) != 0 || ( event->len == 0 );
+            addPending( which, path, kinds, isDir );
+
+            if ( event->mask & IN_ISDIR ) {
+                if ( event->mask & IN_MOVED_FROM ) {
+                    removeTreeWatches( which, path );
+                } else if ( event->mask & ( IN_CREATE | IN_MOVED_TO ) ) {
+                    addTreeWatches( which, path, true );
+                }
+            }
+        }
+    }
+}
+
+static void * watcherThread( void * arg )
+{
+    (void)arg;
+
+    struct pollfd fds[ kTreeCount + 1 ];
+
+    fds[ 0 ].fd     = watcher.stopFD;
+    fds[ 0 ].events = POLLIN;
+    for ( unsigned int i = 0; i < kTreeCount; ++i ) {
+        fds[ i + 1 ].fd     = watcher.trees[ i ].inotifyFD;
+        fds[ i + 1 ].events = POLLIN;
+    }
+
+    for (;;) {
+        int timeout = -1;
+
+        if ( watcher.pendingCount > 0 ) {
+            struct timespec now;
+            clock_gettime( CLOCK_MONOTONIC, &now );
+
+            long quiet = kWatchQuietPeriod - msBetween( &watcher.lastEvent, &now );
+            long limit = kWatchMaxDelay - msBetween( &watcher.firstEvent, &now );
+            timeout = (int)( quiet < limit ? quiet : limit );
+
+            if ( timeout <= 0 ) {
+                publishPending();
+                timeout = -1;
+            }
+        }
+
+        int ready = poll( fds, kTreeCount + 1, timeout );
+        if ( ready < 0 && errno != EINTR ) {
+            logError( "poll failed, no longer watching for changes" );
+            break;
+        }
+        if ( ready > 0 ) {
+            if ( fds[ 0 ].revents != 0 ) {
+                break;
+            }
+            for ( unsigned int i = 0; i < kTreeCount; ++i ) {
+                if ( fds[ i + 1 ].revents & POLLIN ) {
+                    readEvents( (eWatchTree)i );
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// ------------------------------------------------------------------------------
+
+/**
+ * @brief register a function to be called with each batch of changes.
+ * Must be called before startWatcher().
+ * @return zero if successful, -ENOSPC if there are too many consumers already
+ */
+int addWatchConsumer( tWatchConsumer consumer, void * context )
+{
+    int result = 0;
+
+    pthread_mutex_lock( &watcher.lock );
+    if ( watcher.consumerCount >= kMaxWatchConsumers ) {
+        result = -ENOSPC;
+    } else {
+        watcher.consumers[ watcher.consumerCount ].consumer = consumer;
+        watcher.consumers[ watcher.consumerCount ].context  = context;
+        ++watcher.consumerCount;
+    }
+    pthread_mutex_unlock( &watcher.lock );
+
+    return result;
+}
+
+/**
+ * @brief start watching both trees, recursively, on a thread of its own
+ * @param templatesFD   descriptor of the root of the template hierarchy
+ * @param mountpointFD  descriptor of the directory underneath the mount
+ * @return zero if successful, negative errno if not
+ */
+int startWatcher( int templatesFD, int mountpointFD )
+{
+    int result = 0;
+
+    watcher.trees[ kTreeTemplates ].rootFD  = templatesFD;
+    watcher.trees[ kTreeMountpoint ].rootFD = mountpointFD;
+
+    watcher.stopFD = eventfd( 0, EFD_CLOEXEC );
+    if ( watcher.stopFD < 0 ) {
+        result = -errno;
+    }
+
+    for ( unsigned int i = 0; result == 0 && i < kTreeCount; ++i ) {
+        watcher.trees[ i ].inotifyFD = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+        if ( watcher.trees[ i ].inotifyFD < 0 ) {
+            result = -errno;
+        } else {
+            addTreeWatches( (eWatchTree)i, "", false );
+        }
+    }
+
+    if ( result == 0 ) {
+        result = -pthread_create( &watcher.thread, NULL, watcherThread, NULL );
+    }
+
+    if ( result == 0 ) {
+        watcher.running = true;
+        logInfo( "watching for changes" );
+    } else {
+        logError( "unable to watch for changes (%d)", result );
+        stopWatcher();
+    }
+
+    return result;
+}
+
+/**
+ * @brief stop the watcher thread, and release everything it was using
+ */
+void stopWatcher( void )
+{
+    if ( watcher.running ) {
+        uint64_t one = 1;
+        if ( write( watcher.stopFD, &one, sizeof( one ) ) != sizeof( one ) ) {
+            logError( "unable to signal the watcher to stop" );
+        }
+        pthread_join( watcher.thread, NULL );
+        watcher.running = false;
+    }
+
+    for ( unsigned int i = 0; i < kTreeCount; ++i ) {
+        tWatchedTree * tree = &watcher.trees[ i ];
+
+        if ( tree->inotifyFD >= 0 ) {
+            close( tree->inotifyFD );
+            tree->inotifyFD = -1;
+        }
+        for ( size_t wd = 0; wd < tree->dirLimit; ++wd ) {
+            free( tree->dirs[ wd ] );
+        }
+        free( tree->dirs );
+        tree->dirs     = NULL;
+        tree->dirLimit = 0;
+    }
+
+    if ( watcher.stopFD >= 0 ) {
+        close( watcher.stopFD );
+        watcher.stopFD = -1;
+    }
+
+    /* drop anything that didn't get published */
+    discardPending();
+}
@@ -0,0 +1,47 @@
+//
+// Created by paul on 10/14/26.
+//
+
+#ifndef TEMPLATEFS_WATCHER_H
+#define TEMPLATEFS_WATCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    kTreeTemplates = 0,     ///< the template hierarchy
+    kTreeMountpoint,        ///< the directory underneath the mount
+    kTreeCount
+} eWatchTree;
+
+/* kinds of change, combined when several are coalesced for the same path */
+#define kChangeContent   0x01   ///< written to
+#define kChangeAttrib    0x02   ///< metadata (mode, owner, timestamps) changed
+#define kChangeCreated   0x04   ///< created, or moved into place
+#define kChangeDeleted   0x08   ///< deleted, or moved away
+#define kChangeOverflow  0x10   ///< events were lost, so anything in the tree may have changed
+
+/**
+ * @brief one path that changed, possibly more than once, during a batch
+ */
+typedef struct {
+    eWatchTree      tree;
+    const char *    path;       ///< relative to the root of the tree, e.g. '/hosts'. Only valid during the callback
+    unsigned int    kinds;      ///< the kChange* bits for every change seen
+    bool            isDir;
+} tWatchEvent;
+
+/**
+ * @brief called on the watcher's thread with each coalesced batch of changes
+ */
+typedef void (* tWatchConsumer)( const tWatchEvent * events, size_t count, void * context );
+
+#define kWatchQuietPeriod    100    ///< ms without events before a batch is published
+#define kWatchMaxDelay       1000   ///< ms after its first event that a batch is published regardless
+#define kMaxWatchConsumers   8
+
+int  addWatchConsumer( tWatchConsumer consumer, void * context );
+int  startWatcher( int templatesFD, int mountpointFD );
+void stopWatcher( void );
+
+#endif //TEMPLATEFS_WATCHER_H